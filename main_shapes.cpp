@@ -13,12 +13,25 @@
 using namespace glib;
 
 #include "scene.h"
+#include "scene_gen.h"
 #include "render.h"
 #include "render_gl.h"
 #include "render_optix.h"
 #include "object_list.h"
 #include "lightset.h"
 #include "image.h"
+#include "character.h"
+#include "crowd.h"
+#include "deform.h"
+#include "displace.h"
+#include "heightfield.h"
+#include "loft.h"
+#include "module.h"
+#include "motioncycles.h"
+#include "navigation.h"
+#include "scatter.h"
+#include "blob_cache.h"
+#include "shapes.h"
 
 #ifdef BUILD_CUDA
 	#include "common_cuda.h"
@@ -81,6 +94,13 @@ public:
 	Vec3I			m_S1, m_S2;
 
 	std::string			m_SceneFile;
+	std::string			m_GenSpec;			// synthetic scene spec, see SceneGen::ParseSpec
+	SceneGen			m_Gen;
+	std::string			m_BenchSort;		// instance count for sort+pack benchmark
+	std::string			m_BenchCrowd;		// agent count for crowd neighbor benchmark
+	std::string			m_BenchNav;			// query count for path query benchmark
+	std::string			m_SelfTest;			// self test name, or 'all'
+	std::string			m_CacheDir;			// disk cache of generated results
 
 	Scene					mScene;
 	RenderMgr			mRenderMgr;
@@ -114,6 +134,51 @@ void Sample::on_arg(int i, std::string arg, std::string val)
 	if (i==1 && val.empty()) {
 		m_SceneFile = arg;
 	}
+	if (arg.compare("-gen")==0) {
+		m_GenSpec = val;
+	}
+	if (arg.compare("-bench")==0) {
+		m_BenchSort = val;
+	}
+	if (arg.compare("-benchcrowd")==0) {
+		m_BenchCrowd = val;
+	}
+	if (arg.compare("-benchnav")==0) {
+		m_BenchNav = val;
+	}
+	if (arg.compare("-cache")==0) {
+		m_CacheDir = val;
+	}
+	if (arg.compare("-selftest")==0) {
+		m_SelfTest = val.empty() ? "all" : val;
+	}
+}
+
+// Self tests of behaviors, see selftest.h
+// - returns number of failed checks
+static int RunSelfTests ( std::string name )
+{
+	int bad = 0;
+	bool all = (name.compare("all")==0);
+	if ( all || name.compare("scene_gen")==0 )	bad += SceneGen::SelfTest ();
+	if ( all || name.compare("blob_cache")==0 )	bad += BlobCache::SelfTest ();
+	if ( all || name.compare("displace")==0 )	bad += Displace::SelfTest ();
+	if ( all || name.compare("loft")==0 )		bad += Loft::SelfTest ();
+	if ( all || name.compare("deform")==0 )		bad += Deform::SelfTest ();
+	if ( all || name.compare("motioncycles")==0 )	bad += MotionCycles::SelfTest ();
+	if ( all || name.compare("pose_search")==0 )	bad += PoseDB::SelfTest ();
+	if ( all || name.compare("character")==0 )	bad += Character::SelfTest ();
+	if ( all || name.compare("crowd")==0 )		bad += Crowd::SelfTest ();
+	if ( all || name.compare("crowd_grid")==0 )	bad += CrowdGrid::SelfTest ();
+	if ( all || name.compare("pose_cache")==0 )	bad += PoseCache::SelfTest ();
+	if ( all || name.compare("variant_cache")==0 )	bad += Module::SelfTest ();
+	if ( all || name.compare("navigation")==0 )	bad += Navigation::SelfTest ();
+	if ( all || name.compare("scatter")==0 )		bad += Scatter::SelfTest ();
+	if ( all || name.compare("wang_tiles")==0 )	bad += WangTiles::SelfTest ();
+	if ( all || name.compare("heightfield")==0 )	bad += Heightfield::SelfTest ();
+	if ( all || name.compare("shapes")==0 )		bad += Shapes::SelfTest ();
+	if ( all || name.compare("trs_xform")==0 )	bad += RenderBase::SelfTest ();
+	return bad;
 }
 
 bool Sample::init ()
@@ -150,11 +215,35 @@ bool Sample::init ()
 	mouse_plane = 3;			// height
 
 
+	// Disk cache of generated results
+	BlobCache::SetDir ( m_CacheDir.empty() ? std::string(ASSET_PATH) + "/cache" : m_CacheDir );
+
+	// Self tests, no scene needed
+	if (!m_SelfTest.empty()) {
+		int bad = RunSelfTests ( m_SelfTest );
+		dbgprintf ( "Selftest: %d failures\n", bad );
+		exit ( bad > 0 ? 1 : 0 );
+	}
+
+	// Synthetic stress scene
+	if (!m_GenSpec.empty()) {
+		if ( !m_Gen.ParseSpec ( m_GenSpec ) ) exit(-1);
+		m_Gen.Generate ();
+		m_SceneFile = "scene_stress_" + iToStr(m_Gen.getParams().seed) + ".txt";
+		if ( !m_Gen.Save ( m_SceneFile ) ) exit(-1);			// saved for reuse, scene is built in-memory below
+	}
+
 	// Usage - no scene file
 	if (m_SceneFile.empty()) {
     dbgprintf("\nNO SCENE FILE FOUND\n\n");
     dbgprintf ("Usage: shapes {scene_file}\n\n");
-    dbgprintf ("{scene_file}   Scene file to render, txt or gltf.\n\n");
+    dbgprintf ("{scene_file}   Scene file to render, txt or gltf.\n");
+    dbgprintf ("-gen {spec}    Generate a stress scene, e.g. -gen seed=1,inst=1000000,obj=1000,mtl=10000,depth=4,fanout=8,pnts=0\n");
+    dbgprintf ("-bench {num}   Benchmark shape sort & pack of {num} instances, matrix vs. TRS mode\n");
+    dbgprintf ("-benchcrowd {num}  Benchmark crowd neighbor grid with {num} agents, vs. brute force\n");
+    dbgprintf ("-benchnav {num}    Benchmark {num} path queries on a 256x256 obstacle grid\n");
+    dbgprintf ("-cache {dir}   Directory of cached displace, pose & variant results. default: {data path}/cache\n");
+    dbgprintf ("-selftest {name}   Run self tests of behaviors, 'all' or one name, e.g. -selftest crowd\n\n");
     dbgprintf ("Data Path: %s  <-- searching for scenes here\n", ASSET_PATH );
     dbgprintf ("Shader Path: %s\n", SHADER_PATH );
     dbgprintf ("\n");		  
@@ -202,7 +291,10 @@ bool Sample::init ()
 
 	// Load Scene 			
   std::string filepath;
-  if (getFileLocation(m_SceneFile, filepath)) {
+  if (!m_GenSpec.empty()) {
+    dbgprintf("\nBUILDING SCENE: %s\n", m_SceneFile.c_str());
+    mScene.LoadGen ( &m_Gen, w, h );	// generated scene
+  } else if (getFileLocation(m_SceneFile, filepath)) {
     dbgprintf("\nLOADING SCENE: %s\n", filepath.c_str());
 	  mScene.Load ( m_SceneFile, w, h);	// load scene file	
   } else {
@@ -239,6 +331,13 @@ bool Sample::init ()
 	dbgprintf("\nGENERATING SCENE.\n");
 	mScene.Generate ( w, h );				// create scene outputs & RIDs
 
+	if (!m_BenchSort.empty())
+		RenderBase::BenchmarkSortPack ( strToI(m_BenchSort), 64 );
+	if (!m_BenchCrowd.empty())
+		Crowd::BenchmarkNeighbors ( strToI(m_BenchCrowd) );
+	if (!m_BenchNav.empty())
+		Navigation::BenchmarkPaths ( strToI(m_BenchNav) );
+
 	// Get list of temporal (keyframed) objects
 	mScene.getTimeObjects( mTimeObjects );
 
@@ -665,6 +764,10 @@ void Sample::keyboard(int keycode, AppEnum action, int mods, int x, int y)
 	case '3':	mRenderMgr.SetOption (OPT_SKETCH_STATE, TOGGLE);	break;		// draw states
 	case '4':	mRenderMgr.SetOption (OPT_SKETCH_WIRE, TOGGLE);		break;		// draw wireframe
 	case '5':	mRenderMgr.SetOption (OPT_SKETCH_PICK, TOGGLE);		break;		// draw picking buffer
+	case '6':																			// TRS instancing (GL only)
+		mRenderMgr.SetOption (OPT_TRS_XFORM, TOGGLE, REND_GL);
+		mRenderMgr.TriggerSceneUpdate();
+		break;
 
 	case 'm': m_stats = !m_stats; break;					// show stats
 	case 'i':	m_show_info = !m_show_info; break;	// show info
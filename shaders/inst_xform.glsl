@@ -0,0 +1,36 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+// GLSL vertex shaders - instance transform
+// - included after the instance attributes (instPos, instRot, instScale, instPivot, instMatIDS, instXformIn)
+// - trsMode 0: per-instance matrix (instXformIn)
+// - trsMode 1: composed from instance pos/rot/scale/pivot and the parent transform
+//   of its shape group (parentXforms, index in instMatIDS.w, 16-bit. see TRS_MAX_PARENTS)
+uniform int				trsMode;
+uniform samplerBuffer	parentXforms;
+
+mat4 getInstXform ()
+{
+	if ( trsMode == 0 ) return instXformIn;
+	vec4 r = instRot;
+	vec3 s = instScale;
+	mat3 m = mat3 ( 1.0 - 2.0*(r.y*r.y + r.z*r.z),	2.0*(r.x*r.y + r.z*r.w),		2.0*(r.x*r.z - r.y*r.w),
+					2.0*(r.x*r.y - r.z*r.w),		1.0 - 2.0*(r.x*r.x + r.z*r.z),	2.0*(r.y*r.z + r.x*r.w),
+					2.0*(r.x*r.z + r.y*r.w),		2.0*(r.y*r.z - r.x*r.w),		1.0 - 2.0*(r.x*r.x + r.y*r.y) );
+	m[0] *= s.x; m[1] *= s.y; m[2] *= s.z;
+	mat4 trs = mat4 ( vec4(m[0], 0), vec4(m[1], 0), vec4(m[2], 0), vec4(m * instPivot + instPos, 1) );
+	int p = int(instMatIDS.w) * 4;
+	mat4 parent = mat4 ( texelFetch(parentXforms, p), texelFetch(parentXforms, p+1), texelFetch(parentXforms, p+2), texelFetch(parentXforms, p+3) );
+	return parent * trs;
+}
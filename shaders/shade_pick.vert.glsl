@@ -30,7 +30,9 @@ layout(location = 8) in uint instClr;
 layout(location = 9) in vec4 instMatIDS;
 layout(location = 10) in vec4 instTexSub;
 layout(location = 11) in vec4 instIDS;
-layout(location = 12) in mat4 instXform;
+layout(location = 12) in mat4 instXformIn;
+
+#include "inst_xform.glsl"
 
 // shader parameters
 uniform vec3	param0;
@@ -55,29 +57,11 @@ flat out vec4 vids;
 flat out ivec4 vtexids;
 flat out vec4 vtexsub;
 
-mat4 getShapeMatrix ( vec3 pos, vec4 r, vec3 s, vec3 piv, out mat4 m )
-{
-    // quaternion rotation matrix
-	m[0][0] = 1.0f - 2.0f * r.y * r.y - 2.0f * r.z * r.z;	m[1][0] = 2.0f * r.x * r.y + 2.0f * r.z * r.w;			m[2][0] = 2.0f * r.x * r.z - 2.0f * r.y * r.w;	m[3][0] = 0;
-	m[0][1] = 2.0f * r.x * r.y - 2.0f * r.z * r.w;			m[1][1] = 1.0f - 2.0f * r.x * r.x - 2.0f * r.z * r.z;	m[2][1] = 2.0f * r.z * r.y + 2.0f * r.x * r.w;	m[3][1] = 0;
-	m[0][2] = 2.0f * r.x * r.z + 2.0f * r.y * r.w;			m[1][2] = 2.0f * r.z * r.y - 2.0f * r.x * r.w;			m[2][2] = 1.0f - 2.0f * r.x * r.x - 2.0f * r.y * r.y;	m[3][2] = 0;
-	m[0][3] = 0; m[1][3] = 0; m[2][3] = 0; m[3][3] = 1;
-	
-	// composite matrix: M' = Tpos R S Tpiv
-	return mat4( s.x * m[0][0],	s.x * m[1][0],	s.x * m[2][0],		0,
-				 s.y * m[0][1],	s.y * m[1][1],	s.y * m[2][1],		0,
-				 s.z * m[0][2],	s.z * m[1][2],	s.z * m[2][2],		0,
-				pos.x + (piv.x * s.x * m[0][0]) + (piv.y * s.y * m[0][1]) + (piv.z * s.z * m[0][2]),
-				pos.y + (piv.x * s.x * m[1][0]) + (piv.y * s.y * m[1][1]) + (piv.z * s.z * m[1][2]),
-				pos.z + (piv.x * s.x * m[2][0]) + (piv.y * s.y * m[2][1]) + (piv.z * s.z * m[2][2]), 1);
-}
-
 void main() 
 {
 	int inst = gl_InstanceID;		
 	
-	mat4 rotMtx;
-	vworldpos =  objMatrix * getShapeMatrix( instPos, instRot, instScale, instPivot, rotMtx ) * vec4(inPos, 1);	
+	vworldpos = getInstXform () * vec4(inPos, 1);			// same instance transform as the beauty pass
 	
     vids = instIDS;		// picking IDs
 	
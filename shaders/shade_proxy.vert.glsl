@@ -31,7 +31,10 @@ layout(location = 8) in uint instClr;
 layout(location = 9) in vec4 instMatIDS;
 layout(location = 10) in vec4 instTexSub;
 layout(location = 11) in vec4 instIDS;
-layout(location = 12) in mat4 instXform;
+layout(location = 12) in mat4 instXformIn;
+
+#include "inst_xform.glsl"
+mat4 instXform;
 
 // shader parameters
 uniform vec3	param0;
@@ -77,6 +80,7 @@ mat4 getInvTranspose ( vec3 pos, vec4 r, vec3 s, vec3 piv)
 
 void main() 
 {
+	instXform = getInstXform ();
 	int inst = gl_InstanceID;		
 
 	vworldpos = instXform * vec4(inPos, 1);	
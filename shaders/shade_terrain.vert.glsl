@@ -30,7 +30,10 @@ layout(location = 7) in vec3 instPivot;
 layout(location = 8) in uint instClr;
 layout(location = 9) in vec4 instMatIDS;
 layout(location = 10) in vec4 instTexSub;
-layout(location = 12) in mat4 instXform;
+layout(location = 12) in mat4 instXformIn;
+
+#include "inst_xform.glsl"
+mat4 instXform;
 
 // shader parameters
 uniform vec4	param0;
@@ -100,12 +103,13 @@ mat4 getInvTranspose ( vec3 pos, vec4 r, vec3 s, vec3 piv)
 
 void main() 
 {
+	instXform = getInstXform ();
 	int inst = gl_InstanceID;		
 
 	vtexcoord = vec3 ( inTexCoord, gl_InstanceID );	
 	vtexsub = instTexSub;
 	vmatids = ivec4 ( instMatIDS );
-	vclr = CLR2VEC(inClr) * CLR2VEC ( instClr );
+	vclr = CLR2VEC(inClr);				// instClr holds geomorph params, see below
 
 	int m = vmatids.x;					// material
 	int t = int(mat[m].texids.x);		// color texture
@@ -117,10 +121,29 @@ void main()
 	vec2 dtc = 1.0f / textureSize(ht, 0);
 
 	float h0 = texture(ht, tc).x;
+
+	// CDLOD geomorph
+	// - instClr x = morph start as a fraction of end (1/255), z = log2 grid quads (1/16)
+	//   y,w = morph end in node sizes, 8.8 fixed point (y low byte)
+	// - vertices morph toward the next coarser grid with distance, so nodes match coarser neighbors
+	vec3 lpos = inPos;
+	float mend = float( ((instClr >> 8u) & 255u) | ((instClr >> 16u) & 0xFF00u) ) / 256.0;
+	if ( mend > 0 ) {
+		float nsize = length ( instXform[0].xyz );
+		mend *= nsize;
+		float mstart = float( instClr & 255u ) / 255.0 * mend;
+		float grid = exp2 ( float( (instClr >> 16u) & 255u ) / 16.0 );
+		float dist = length ( (instXform * vec4(inPos.x, inPos.y + h0, inPos.z, 1)).xyz - camPos );
+		float morph = clamp ( (dist - mstart) / max(mend - mstart, 0.0001), 0.0, 1.0 );
+		lpos.xz -= fract ( inPos.xz * grid * 0.5 ) * 2.0 / grid * morph;
+		vtexcoord.xy = lpos.xz;
+		tc = vtexsub.xy + vtexsub.zw * vtexcoord.xy;
+		h0 = texture(ht, tc).x;
+	}
 	float hx = 0.5 * (texture( ht, tc + vec2(dtc.x,0) ).x - texture(ht, tc + vec2(-dtc.x,0) ).x );
 	float hy = 0.5 * (texture( ht, tc + vec2(0,dtc.y) ).x - texture(ht, tc + vec2(0,-dtc.y) ).x );
 
-	vworldpos = instXform * vec4(inPos.x, inPos.y + h0, inPos.z, 1);
+	vworldpos = instXform * vec4(lpos.x, lpos.y + h0, lpos.z, 1);
 	vviewpos = viewMatrix * vworldpos;	
 	vnormal = normalize ( vec3(-hx, 1, -hy) / instScale );	
 
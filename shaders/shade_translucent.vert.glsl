@@ -29,7 +29,10 @@ layout(location = 7) in vec3 instPivot;
 layout(location = 8) in uint instClr;
 layout(location = 9) in vec4 instMatIDS;
 layout(location = 10) in vec4 instTexSub;
-layout(location = 12) in mat4 instXform;
+layout(location = 12) in mat4 instXformIn;
+
+#include "inst_xform.glsl"
+mat4 instXform;
 
 // shader parameters
 uniform vec3	param0;
@@ -102,6 +105,7 @@ mat4 getInvTranspose(mat4 a)
 
 void main() 
 {
+	instXform = getInstXform ();
 	int inst = gl_InstanceID;
 
 	vworldpos = instXform * vec4(inPos, 1);	
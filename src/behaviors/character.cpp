@@ -23,11 +23,16 @@
 #include "parts.h"
 #include "muscles.h"
 #include "scene.h"
+#include "navigation.h"
+#include "crowd.h"
+#include "parallel.h"
+#include "selftest.h"
 
 #include "gxlib.h"
 using namespace glib;
 
 #include <stack>
+#include <math.h>
 #include <vector>
 
 #define BVH_START		0
@@ -54,7 +59,8 @@ Character::Character () : Object()
 
 	m_PathID = -1;
 	m_PathU = 0;
-	m_PathStatus = 0;
+	m_PathStatus = PATH_FOLLOW;
+	m_PathNext = 0;
 	mTargetDir.Set(0,0,0);
 	mTargetDist = 0;
 	
@@ -66,6 +72,11 @@ Character::Character () : Object()
 	m_PrimaryMotion = -1;
 	m_SecondaryMotion = -1;
 	m_bBones = true;
+	m_DeferJoints = false;
+	m_Crowd = 0x0;
+	m_CrowdNdx = -1;
+	m_Dir.Set(0,0,1);
+	for (int s=0; s < JNTS_MAX; s++) { m_EvalPending[s] = false; m_EvalSource[s] = 0; }
 	
 	m_Target = Vec3F(0,0,0);	
 	m_Style = "home";
@@ -76,6 +87,7 @@ bool Character::RunCommand(std::string cmd, vecStrs args)
 	if (cmd.compare("skeleton") == 0)	{ LoadBVH(args[0]);			return true; }
 	if (cmd.compare("boneinfo") == 0)	{ LoadBoneInfo(args[0]);	return true; }
 	if (cmd.compare("home") == 0)		{ SetHomePos ( strToVec3(args[0], ';') );	return true; }
+	if (cmd.compare("goal") == 0)		{ PlanPath ( strToVec3(args[0], ';') );		return true; }
 
 	if (cmd.compare("finish") == 0) {
 		SetScene ( gScene );
@@ -97,6 +109,7 @@ void Character::Define (int x, int y)
 	AddInput ("bones",  'Ashp' );
 	AddInput ("muscles", 'Ashp');
 	AddInput ("motions", 'mcyc');		// library of motion cycles
+	AddInput ("nav",	'navg');		// navigation for planned paths
 
 	//-- future stuff
 	// AddInput ("path", 
@@ -215,50 +228,51 @@ void Character::BindBones ()
 
 		m_BoneBinds.push_back ( bi );
 	}	
+
+	PackBoneBinds ();
+}
+
+// Bind info used per frame, as flat arrays
+void Character::PackBoneBinds ()
+{
+	m_BoneRel.resize ( m_BoneBinds.size() );
+	m_BoneJoint.resize ( m_BoneBinds.size() );
+	for (int n=0; n < m_BoneBinds.size(); n++) {
+		m_BoneRel[n] = m_BoneBinds[n].localrel[0];
+		m_BoneJoint[n] = m_BoneBinds[n].bind[0];
+	}
 }
 
 void Character::EvaluateBones ()
 {
 	if ( m_BoneBinds.size() == 0 ) return;		// nothing bound
 	
-	Shapes* bones = getInputShapes ( "bones" );
-	Shape* s; 
-	Quaternion jorient;
-	int jbound;
-	Dualquat b, bsum, beval, j, jinv;
+	EvaluateBones ( getInputShapes ( "bones" ) );
+}
 
-	// Full equation: B(t) = B0 J0inv J(t)				// bone at time t = the bone in base pose, in the space of joint in base pose, transformed to space of joint at current time
+void Character::EvaluateBones ( Shapes* bones )
+{
+	JointSet& joints = m_Joints[JNTS_A];
 
-	// For each bone, apply the local relative bone orientation to the *current* joint orientation
-	for (int n=0; n < m_BoneBinds.size(); n++ ) {
-		s = bones->getShape(n);
+	// Full equation: B(t) = B0 J0inv J(t)				// bone at time t = the bone in base pose, in the space of joint in base pose, transformed to space of joint at current time
 
-		jbound = m_BoneBinds[n].bind[0];
-		jorient = m_Joints[JNTS_A][ jbound ].Morient;
-		j = Dualquat ( jorient, m_Joints[JNTS_A][ jbound ].pos );				// dual-quaternion for *current* joint orientation
-		bsum = m_BoneBinds[n].localrel[0] * j;
-		//bsum.normalize();
+	// dual-quaternion for *current* joint orientation, once per joint
+	m_JointDQ.resize ( joints.size() );
+	for (int k=0; k < joints.size(); k++)
+		m_JointDQ[k] = Dualquat ( joints[k].Morient, joints[k].pos );
 
-		/*bsum.zero();
-		for (int i=0; i < 1; i++) {
-			jbound = m_BindInfo[n].bind[i];
-			jorient = m_Joints[JNTS_A][ jbound ].Morient;
-			j = dualquat ( jorient, m_Joints[JNTS_A][ jbound ].pos );				// dual-quaternion for joint orientation			
-			beval = m_BindInfo[n].localrel[i] * j;		
-			beval.normalize();
-			bsum = bsum + (beval * m_BindInfo[n].wgts[i]);	
-		}*/		
-
-		s->pos =		bsum.getTranslate();
-		s->rot =		bsum.getRotate();
-		m_BoneBinds[n].pos = s->pos;
-
-		if (n==0) {
-			Vec3F t = j.getTranslate();
-			dbgprintf ( "%d %f,%f,%f\n", n, t.x, t.y, t.z );
+	// For each bone, apply the local relative bone orientation to the *current* joint orientation
+	ParallelFor ( (int) m_BoneRel.size(), 256, [&](int start, int end, int chunk) {
+		Dualquat bsum;
+		Shape* s;
+		for (int n=start; n < end; n++ ) {
+			s = bones->getShape(n);
+			bsum = m_BoneRel[n] * m_JointDQ[ m_BoneJoint[n] ];
+			s->pos = bsum.getTranslate();
+			s->rot = bsum.getRotate();
+			m_BoneBinds[n].pos = s->pos;
 		}
-
-	}
+	} );
 
 	bones->MarkDirty();
 }
@@ -276,6 +290,8 @@ void Character::ResetBones()
 		s->rot = m_BoneBinds[n].orig.getRotate();
 	}
 	m_BoneBinds.clear();
+	m_BoneRel.clear();
+	m_BoneJoint.clear();
 }
 
 void Character::BindMuscles()
@@ -318,6 +334,21 @@ void Character::BindMuscles()
 		
 		m_MuscleBinds.push_back( bi );
 	}
+
+	PackMuscleBinds ();
+}
+
+void Character::PackMuscleBinds ()
+{
+	int nm = (int) m_MuscleBinds.size();
+	m_MuscleRel[0].resize ( nm );
+	m_MuscleRel[1].resize ( nm );
+	m_MuscleBone.resize ( nm );
+	for (int n=0; n < nm; n++) {
+		m_MuscleRel[0][n] = m_MuscleBinds[n].localrel[0];
+		m_MuscleRel[1][n] = m_MuscleBinds[n].localrel[1];
+		m_MuscleBone[n] = Vec3I ( m_MuscleBinds[n].b1.x, m_MuscleBinds[n].b2.x, 0 );
+	}
 }
 
 Quaternion Character::getMuscleRotation(Vec3F muscle_dir, Quaternion& bone_rotate, float angle)
@@ -329,7 +360,7 @@ Quaternion Character::getMuscleRotation(Vec3F muscle_dir, Quaternion& bone_rotat
 	c1.fromRotationFromTo(Vec3F(0, 1, 0), muscle_dir);			// rotate the shape Y-axis along the muscle direction
 	
 	// twist fix
-	p2 = c1.rotateVec(Vec3F(0, 1, 0)); p2.Normalize();	// muscle shape, Y-axis before twist fix ('norm' of muscle)
+	p2 = muscle_dir; p2.Normalize();					// muscle shape, Y-axis before twist fix ('norm' of muscle). c1 maps Y onto the muscle dir
 	p3 = c1.rotateVec(Vec3F(0, 0, 1)); p3.Normalize();	// muscle shape, Z-axis before twist fix 
 	p4 = Vec3F(0, 0, 1); p4 *= bone_rotate; 			// Z-axis of bone 
 	p4 -= p2 * (float) p2.Dot(p4); p4.Normalize();					// [optional step] project the bone Z-axis into the new muscle shape base plane (XZ)
@@ -340,9 +371,11 @@ Quaternion Character::getMuscleRotation(Vec3F muscle_dir, Quaternion& bone_rotat
 	mP[4] = p1 + p4;	// bone orientation, Z-axis (yellow)
 	*/
 	// see: https://stackoverflow.com/questions/5188561/signed-angle-between-two-3d-vectors-with-same-origin-within-the-same-plane
-	float twist = acos(p3.Dot(p4));							// angle between muscle Z-axis and bone Z-axis
-	float cross = p2.Dot(p3.Cross(p4));						// cross between them is compared to muscle norm for *signed* in-plane rotation. (note: p3 is destroyed here)
-	if (cross < 0) twist = -twist;
+	// signed angle between muscle Z-axis and bone Z-axis. both lie in the plane normal to p2, so
+	// atan2( p2.(p3 x p4), p3.p4 ) is the same angle as acos(p3.p4) signed by the cross, without clamping
+	float cosa = (float) p3.Dot(p4);
+	float sina = (float) p2.Dot(p3.Cross(p4));				// (note: p3 is destroyed here)
+	float twist = atan2(sina, cosa);
 	c2.fromAngleAxis ( twist + angle*DEGtoRAD, muscle_dir);
 	c2.normalize();
 
@@ -354,47 +387,53 @@ void Character::EvaluateMuscles ()
 	Muscles* muscles = (Muscles*)getInput("muscles");			if (muscles == 0x0) return;
 	Shapes* mush  = getInputShapes( "muscles");		if (mush == 0x0) return;
 	Shapes* bones = getInputShapes( "bones");
-	Shape *sb, *sh;
-	Muscle* m;
-	if (mush == 0x0) return;
-	BindInfo* bi;
-	Vec3F p1, p2, p3, p4;
-	Vec3F mdir;
-	Dualquat j;
-	Quaternion c;
-	float bulge, muscle_len;
+	if ( m_MuscleBinds.size() == 0 || bones == 0x0 ) return;
 
+	EvaluateMuscles ( muscles, mush, bones );
+}
+
+void Character::EvaluateMuscles ( Muscles* muscles, Shapes* mush, Shapes* bones )
+{
 	// Full equation: M(t) = M0 B0inv B(t)				// muscle pnt at time t = the muscle pnt in base pose, in the space of bone in base pose, transformed to space of bone at current time
 
 	Vec3F* sh_muscle = (Vec3F*) mush->getData (BMUSCLE);		// shape muscle data
 
-	for (int n = 0; n < m_MuscleBinds.size(); n++) {
-		sh = mush->getShape(n);		
-		bi = &m_MuscleBinds[n];							// bind info (static since bind time)
-		m = muscles->getMuscle(n);						// get muscle for dynamic params (e.g. size, curve, flat)
+	// dual-quaternion for *current* bone orientation, once per bone
+	m_BoneDQ.resize ( bones->getNumShapes() );
+	for (int b=0; b < bones->getNumShapes(); b++) {
+		Shape* sb = bones->getShape(b);
+		m_BoneDQ[b] = Dualquat(sb->rot, sb->pos);
+	}
 
-		sb = bones->getShape(bi->b2.x);					// get the bone #2 shape ID
-		j = Dualquat(sb->rot, sb->pos);					// dual-quaternion for *current* bone orientation
-		p2 = (bi->localrel[1] * j).getTranslate();		// map muscle point into bone space
+	ParallelFor ( (int) m_MuscleRel[0].size(), 128, [&](int start, int end, int chunk) {
+		Shape *sb, *sh;
+		Muscle* m;
+		Vec3F p1, p2, mdir;
+		float bulge, muscle_len;
 
-		sb = bones->getShape(bi->b1.x);					// get the bone #1 shape ID
-		j = Dualquat(sb->rot, sb->pos);					// dual-quaternion for *current* bone orientation
-		p1 = (bi->localrel[0] * j).getTranslate();		// map muscle point into bone space
+		for (int n = start; n < end; n++) {
+			sh = mush->getShape(n);		
+			m = muscles->getMuscle(n);						// get muscle for dynamic params (e.g. size, curve, flat)
+
+			p2 = (m_MuscleRel[1][n] * m_BoneDQ[ m_MuscleBone[n].y ]).getTranslate();		// map muscle point into bone #2 space
+			p1 = (m_MuscleRel[0][n] * m_BoneDQ[ m_MuscleBone[n].x ]).getTranslate();		// map muscle point into bone #1 space
+			sb = bones->getShape( m_MuscleBone[n].x );
 			
-		sh->pos = p1;
-		mdir = p2 - p1; 
-		muscle_len = mdir.Length();							// muscle current length
-		mdir.Normalize();									// muscle dir
-		bulge = m->rest_len / muscle_len;
-		bulge *= bulge;
-		if (bulge < 0.3) bulge = 0.3;
-		if (bulge > 2.0) bulge = 2.0;
+			sh->pos = p1;
+			mdir = p2 - p1; 
+			muscle_len = mdir.Length();							// muscle current length
+			mdir.Normalize();									// muscle dir
+			bulge = m->rest_len / muscle_len;
+			bulge *= bulge;
+			if (bulge < 0.3) bulge = 0.3;
+			if (bulge > 2.0) bulge = 2.0;
 			
-		// final shape orientation
-		sh->rot = getMuscleRotation(mdir, sb->rot, m->angle);		// shape orientation. c1 = align shape along muscle dir, c2 = twist fix. (right-to-left evaluation, first c1, then c2)
-		sh->scale = m->specs * muscle_len * Vec3F(bulge, 1.0, bulge);
-		sh_muscle[n] = Vec3F(m->angle, m->curve, 0.f);
-	}
+			// final shape orientation
+			sh->rot = getMuscleRotation(mdir, sb->rot, m->angle);		// shape orientation. c1 = align shape along muscle dir, c2 = twist fix. (right-to-left evaluation, first c1, then c2)
+			sh->scale = m->specs * muscle_len * Vec3F(bulge, 1.0, bulge);
+			sh_muscle[n] = Vec3F(m->angle, m->curve, 0.f);
+		}
+	} );
 
 	mush->MarkDirty();
 }
@@ -434,12 +473,202 @@ void Character::ResetMuscles()
 		sh_muscle[n] = Vec3F(m->angle, m->curve, 0.f);
 	}
 	m_MuscleBinds.clear();
+	m_MuscleRel[0].clear();
+	m_MuscleRel[1].clear();
+	m_MuscleBone.clear();
+}
+
+// Self test
+// - EvaluateBones & EvaluateMuscles match the per-bone, per-muscle path they replaced
+// - getMuscleRotation (muscle dir as Y-axis, atan2 twist) matches the acos twist
+//   and stays finite when the muscle & bone Z-axes coincide
+static Quaternion TestRot ( uint64_t seed, int i )
+{
+	Quaternion q;
+	q.fromAngleAxis ( hashRandF ( seed, i*4 ) * 6.0f, Vec3F( hashRandF(seed, i*4+1) - 0.5f, hashRandF(seed, i*4+2) - 0.5f, hashRandF(seed, i*4+3) - 0.5f ).Normalize() );
+	return q;
+}
+
+static Vec3F TestPos ( uint64_t seed, int i )
+{
+	return Vec3F ( hashRandF(seed, i*3), hashRandF(seed, i*3+1), hashRandF(seed, i*3+2) ) * 4.0f;
+}
+
+static bool TestSameRot ( Quaternion a, Quaternion b )
+{
+	return fabs ( a.X*b.X + a.Y*b.Y + a.Z*b.Z + a.W*b.W ) > 1 - 1e-4f;
+}
+
+static bool TestSamePos ( Vec3F a, Vec3F b )
+{
+	return fabs(a.x - b.x) < 1e-3f && fabs(a.y - b.y) < 1e-3f && fabs(a.z - b.z) < 1e-3f;
 }
 
+// muscle rotation as before, with the Y-axis from c1 and the acos twist
+static Quaternion MuscleRotationRef ( Vec3F muscle_dir, Quaternion& bone_rotate, float angle )
+{
+	Vec3F p2, p3, p4;
+	Quaternion c1, c2;
+	c1.fromRotationFromTo(Vec3F(0, 1, 0), muscle_dir);
+	p2 = c1.rotateVec(Vec3F(0, 1, 0)); p2.Normalize();
+	p3 = c1.rotateVec(Vec3F(0, 0, 1)); p3.Normalize();
+	p4 = Vec3F(0, 0, 1); p4 *= bone_rotate;
+	p4 -= p2 * (float) p2.Dot(p4); p4.Normalize();
+	float twist = acos(p3.Dot(p4));
+	float cross = p2.Dot(p3.Cross(p4));
+	if (cross < 0) twist = -twist;
+	c2.fromAngleAxis ( twist + angle*DEGtoRAD, muscle_dir);
+	c2.normalize();
+	return (c2 * c1);
+}
+
+int Character::SelfTest ()
+{
+	int bad = 0;
+	int nj = 24, nb = 700, nm = 300;			// more than one ParallelFor chunk of bones & muscles
+	Character ch;
+	BindInfo bi;
+	Shape* s;
+	int first;
+
+	// joints in the current pose
+	JointSet& joints = ch.m_Joints[JNTS_A];
+	joints.resize ( nj );
+	for (int k=0; k < nj; k++) {
+		joints[k].Morient = TestRot ( 31, k );
+		joints[k].pos = TestPos ( 32, k );
+	}
+
+	// bones bound to joints
+	Shapes bones;
+	s = bones.AddSpan ( nb, first );
+	for (int n=0; n < nb; n++, s++) {
+		s->Clear ();
+		bi.localrel[0] = Dualquat ( TestRot(33, n), TestPos(34, n) );
+		bi.localrel[0].normalize ();
+		bi.bind[0] = int( hashRandF(35, n) * nj ) % nj;
+		ch.m_BoneBinds.push_back ( bi );
+	}
+	ch.PackBoneBinds ();
+	ch.EvaluateBones ( &bones );
+
+	int pos_bad = 0, rot_bad = 0;
+	Dualquat j, bsum;
+	for (int n=0; n < nb; n++) {
+		Joint& jt = joints[ ch.m_BoneBinds[n].bind[0] ];
+		j = Dualquat ( jt.Morient, jt.pos );
+		bsum = ch.m_BoneBinds[n].localrel[0] * j;
+		s = bones.getShape(n);
+		if ( !TestSamePos ( s->pos, bsum.getTranslate() ) || !TestSamePos ( ch.m_BoneBinds[n].pos, s->pos ) ) pos_bad++;
+		if ( !TestSameRot ( s->rot, bsum.getRotate() ) ) rot_bad++;
+	}
+	bad += selfCheck ( pos_bad == 0, "character", "bone positions differ from per-bone path" );
+	bad += selfCheck ( rot_bad == 0, "character", "bone orientations differ from per-bone path" );
+
+	// muscles bound to pairs of bones
+	Muscles muscles;
+	Shapes mush;
+	mush.AddChannel ( BMUSCLE, "muscle", sizeof(Vec3F) );
+	s = mush.AddSpan ( nm, first );
+	for (int n=0; n < nm; n++, s++) {
+		s->Clear ();
+		bi.localrel[0] = Dualquat ( TestPos(36, n) ); bi.localrel[0].normalize ();
+		bi.localrel[1] = Dualquat ( TestPos(37, n) ); bi.localrel[1].normalize ();
+		bi.b1 = Vec3I ( int( hashRandF(38, n) * nb ) % nb, 0, 0 );
+		bi.b2 = Vec3I ( int( hashRandF(39, n) * nb ) % nb, 0, 0 );
+		ch.m_MuscleBinds.push_back ( bi );
+		muscles.AddMuscle ( TestPos(40, n), TestPos(41, n), bi.b1, bi.b2, Vec3F(0, 1, 0) );
+		muscles.getMuscle(n)->angle = hashRandF(42, n) * 90.0f - 45.0f;
+		muscles.getMuscle(n)->curve = hashRandF(43, n);
+	}
+	ch.PackMuscleBinds ();
+	ch.EvaluateMuscles ( &muscles, &mush, &bones );
+
+	Vec3F* sh_muscle = (Vec3F*) mush.getData (BMUSCLE);
+	Vec3F p1, p2, mdir;
+	Quaternion ref;
+	Shape* sb;
+	Muscle* m;
+	int scale_bad = 0, data_bad = 0;
+	pos_bad = 0; rot_bad = 0;
+	for (int n=0; n < nm; n++) {
+		m = muscles.getMuscle(n);
+		sb = bones.getShape( ch.m_MuscleBinds[n].b2.x );
+		p2 = (ch.m_MuscleBinds[n].localrel[1] * Dualquat(sb->rot, sb->pos)).getTranslate();
+		sb = bones.getShape( ch.m_MuscleBinds[n].b1.x );
+		p1 = (ch.m_MuscleBinds[n].localrel[0] * Dualquat(sb->rot, sb->pos)).getTranslate();
+		mdir = p2 - p1;
+		float muscle_len = mdir.Length();
+		mdir.Normalize();
+		float bulge = m->rest_len / muscle_len;
+		bulge *= bulge;
+		if (bulge < 0.3) bulge = 0.3;
+		if (bulge > 2.0) bulge = 2.0;
+		ref = MuscleRotationRef ( mdir, sb->rot, m->angle );
+
+		s = mush.getShape(n);
+		if ( !TestSamePos ( s->pos, p1 ) ) pos_bad++;
+		if ( !TestSamePos ( s->scale, m->specs * muscle_len * Vec3F(bulge, 1.0, bulge) ) ) scale_bad++;
+		if ( !isnan(ref.W) && !TestSameRot ( s->rot, ref ) ) rot_bad++;
+		if ( !TestSamePos ( sh_muscle[n], Vec3F(m->angle, m->curve, 0.f) ) ) data_bad++;
+	}
+	bad += selfCheck ( pos_bad == 0, "character", "muscle positions differ from per-muscle path" );
+	bad += selfCheck ( scale_bad == 0, "character", "muscle scales differ from per-muscle path" );
+	bad += selfCheck ( rot_bad == 0, "character", "muscle rotation differs from acos twist" );
+	bad += selfCheck ( data_bad == 0, "character", "muscle shape data not written" );
+
+	// twist angle turns the muscle about its own axis, so q(a) & q(0) are a/2 apart.
+	// bone Z-axis along the muscle Z-axis has cos at 1, where acos could go past its domain
+	int ang_bad = 0, nan_bad = 0;
+	Quaternion q0, qa, c1;
+	for (int n=0; n < 64; n++) {
+		mdir = Vec3F( hashRandF(44, n*3) - 0.5f, hashRandF(44, n*3+1) - 0.5f, hashRandF(44, n*3+2) - 0.5f ).Normalize();
+		Quaternion brot = TestRot ( 45, n );
+		q0 = ch.getMuscleRotation ( mdir, brot, 0 );
+		qa = ch.getMuscleRotation ( mdir, brot, 30 );
+		if ( fabs( fabs(q0.X*qa.X + q0.Y*qa.Y + q0.Z*qa.Z + q0.W*qa.W) - cos(15*DEGtoRAD) ) > 1e-3f ) ang_bad++;
+
+		c1.fromRotationFromTo ( Vec3F(0, 1, 0), mdir );
+		q0 = ch.getMuscleRotation ( mdir, c1, 0 );
+		if ( isnan(q0.X) || isnan(q0.Y) || isnan(q0.Z) || isnan(q0.W) ) nan_bad++;
+	}
+	bad += selfCheck ( ang_bad == 0, "character", "muscle angle is not a turn about the muscle axis" );
+	bad += selfCheck ( nan_bad == 0, "character", "muscle rotation not finite with aligned axes" );
+
+	return selfReport ( "character", bad );
+}
 
 
+
+Navigation* Character::getNav ()
+{
+	return dynamic_cast<Navigation*> ( getInput ( "nav" ) );
+}
+
+// Plan path to target
+// - queued on the navigation object, solved with all other requests during the crowd pass
+// - without navigation, the target is steered to directly
 void Character::PlanPath ( Vec3F target )
 {
+	Navigation* nav = getNav ();
+	if ( nav == 0x0 ) {
+		SetTarget ( target );
+		return;
+	}
+	m_Path.clear();
+	m_PathNext = 0;
+	m_PathStatus = PATH_PENDING;
+	nav->Request ( getID(), getPosition(), target );
+}
+
+void Character::SetPath ( std::vector<Vec3F>& path, bool found )
+{
+	m_Path = path;
+	m_PathNext = 0;
+	m_PathU = 0;
+	m_PathStatus = found ? PATH_FOLLOW : PATH_DONE;
+	if ( found && m_Path.size() > 0 )
+		m_Target = m_Path[0];
 }
 
 Vec3F Character::getPosition () 
@@ -522,9 +751,9 @@ float Character::getStartTime ( unsigned int flags, int new_cycle, float new_dur
 	
 	Motion& mprev = m_Motions[ prev_cycle_id ];
 	
-	//if ( mprev.cycle != new_cycle ) 
-	//	transition = cycleset->FindTransition ( mprev.cycle, new_cycle, mprev.frame );
-	transition.x = -1;
+	MotionCycles* cycleset = dynamic_cast<MotionCycles*> (getInput("motions"));
+	if ( cycleset != 0x0 && mprev.cycle != new_cycle ) 
+		transition = cycleset->FindTransition ( mprev.cycle, new_cycle, int(mprev.frame) );		// pose search
 
 	float FRAMEtoTIME = 1.0f / (m_FPS*mprev.speed);
 	float INTERP_TIME = m_InterpFrames * FRAMEtoTIME;
@@ -735,6 +964,9 @@ void Character::getTargetDirection ( float speed )
 	mTargetDir = Vec3F(m_Target.x - m_Orient[JNTS_A].pos.x, 0.f, m_Target.z - m_Orient[JNTS_A].pos.z); 
 	mTargetDist = mTargetDir.Length();
 	mTargetDir.Normalize();
+	mTargetDir += getAvoidance();
+	mTargetDir.y = 0;
+	mTargetDir.Normalize();
 	mTargetAng = atan2( mTargetDir.x, mTargetDir.z)/DEGtoRAD; if ( mTargetAng < 0 ) mTargetAng += 360;
 
 	// Current forward direction & angle
@@ -755,10 +987,49 @@ void Character::getTargetDirection ( float speed )
 	mTargetDA.fromAngleAxis (  mTargetDelta * ang_momentum * m_Orient[JNTS_A].vel.Length(), Vec3F(0,1,0) );	 
 }
 
+// Avoidance
+// - neighbors within CROWD_AVOID_DIST push away, weighted by (1 - dist/radius) / dist,
+//   added to the target direction (unit) before the heading is taken
+Vec3F Character::getAvoidance ()
+{
+	Vec3F sep (0, 0, 0);
+	if ( m_Crowd == 0x0 || m_CrowdNdx < 0 ) return sep;
+
+	int nbrs[CROWD_MAX_NBRS];
+	int cnt = m_Crowd->FindNeighbors ( m_CrowdNdx, CROWD_AVOID_DIST, nbrs, CROWD_MAX_NBRS );
+	Vec3F pos = getPosition();
+	Vec3F d;
+	float dist;
+	for (int n=0; n < cnt; n++) {
+		d = pos - m_Crowd->getNeighborPos ( nbrs[n] );
+		d.y = 0;
+		dist = d.Length();
+		if ( dist < 1e-4f ) continue;
+		sep += d * ((1.0f - dist / CROWD_AVOID_DIST) / dist);
+	}
+	return sep;
+}
+
 void Character::EvaluatePathMotion ( float t, Motion& m )
 {
 	if (m.id != m_PrimaryMotion) return;	
-	if (m_PathStatus==1) return;
+	if (m_PathStatus != PATH_FOLLOW) return;
+
+	// Planned path, advance through waypoints
+	if ( m_Path.size() > 0 ) {
+		Vec3F d = m_Path[m_PathNext] - m_Orient[JNTS_A].pos;
+		d.y = 0;
+		if ( d.Length() < THIT ) {
+			if ( m_PathNext < (int) m_Path.size() - 1 ) {
+				m_PathNext++;
+			} else {
+				m_PathStatus = PATH_DONE;
+				AddMotion ( "runstand", M_TARGET | M_NOW );
+			}
+		}
+		m_Target = m_Path[m_PathNext];
+		return;
+	}
 
 	Curve* curv = dynamic_cast<Curve*> ( getInput ( "path" ) );
 	if ( curv== 0x0 ) return;
@@ -768,8 +1039,8 @@ void Character::EvaluatePathMotion ( float t, Motion& m )
 	m_PathU += 0.1f * (1.f/curvelen) / (mTargetDist + 2);
 	
 	if ( m_PathU > 0.98 ) {
-		if (m_PathStatus==0) {
-			m_PathStatus = 1;
+		if (m_PathStatus==PATH_FOLLOW) {
+			m_PathStatus = PATH_DONE;
 			m_PathU = 1;
 			AddMotion ( "runstand", M_TARGET | M_NOW );	
 		}
@@ -848,6 +1119,7 @@ void Character::EvaluateCycleMotion ( float t, Motion& m, bool bPoseChange )
 	
 	// Get interpolated motion poses for the current and previous frames (fractional)
 	cycleset->AssignCycleToJoints ( m.cycle, m_Joints[jset], m.frame, m.frame_last, cp, cpl, co, col );
+	m_EvalSource[jset] = cycleset->getPoseKey ( m.cycle, int(m.frame) );		// shared pose (see PoseCache)
 
 	// Determine motion delta from cycles
 	m_Orient[jset].vel = 0; 
@@ -891,6 +1163,7 @@ void Character::EvaluateCycleInterpolation ( float t )
 		o1.slerp ( o1, o2, u );
 		m_Joints[JNTS_A][n].orient = o1;		
 	}
+	m_EvalSource[JNTS_A] = 0;							// blended pose, not shared
 	// use second cycle orientation
 	o1 = m_Orient[JNTS_A].rot;
 	o2 = m_Orient[JNTS_B].rot;
@@ -1442,7 +1715,9 @@ void Character::LoadBVH ( std::string fname )
 		case BVH_END: case BVH_MOTION:
 			break;
 		}; 
+		if ( mode == BVH_MOTION ) break;		// hierarchy done. motion data is read by MotionCycles
 	}
+	fclose ( fp );
 
 	// Create shapes	
 
@@ -1591,9 +1866,30 @@ void Character::EvaluateJoints (int jset, int method )
 
 void Character::EvaluateJoints ( std::vector<Joint>& joints, Matrix4F& world, Quaternion& orient )
 {
+	if ( m_DeferJoints ) {
+		// record root only, last evaluation of a joint set wins
+		for (int s=0; s < JNTS_MAX; s++) {
+			if ( &joints == &m_Joints[s] ) {
+				m_EvalPending[s] = true;
+				m_EvalOrient[s] = orient;
+				m_EvalPos[s] = world.getTrans();
+				return;
+			}
+		}
+	}
 	EvaluateJointsRecurse ( joints, 0, world, orient );
 }
 
+bool Character::getPendingJoints ( int s, Quaternion& orient, Vec3F& pos, uint64_t& source )
+{
+	if ( !m_EvalPending[s] ) return false;
+	m_EvalPending[s] = false;
+	orient = m_EvalOrient[s];
+	pos = m_EvalPos[s];
+	source = m_EvalSource[s];
+	return true;
+}
+
 // recursive funcs
 void Character::EvaluateJointsRecurse ( std::vector<Joint>& joints, int curr_jnt, Matrix4F world, Quaternion morient )
 {
@@ -40,6 +40,10 @@
 	#define M_RESET_ROT		512
 	#define M_RESET_POS		1024
 
+	#define PATH_FOLLOW			0			// path status
+	#define PATH_DONE			1
+	#define PATH_PENDING		2			// waiting on navigation request
+
 	#define EVAL_IDENTITY		0			// no world transform (testing)
 	#define EVAL_CHARACTER		1			// current character orientation
 	#define EVAL_ORIENT			2			// joint set orientation
@@ -117,6 +121,9 @@
 	class MotionCycles;
 	class Scene;
 	class Curve;
+	class Navigation;
+	class Crowd;
+	class Muscles;
 
 	class Character : public Object {
 	public:
@@ -153,6 +160,8 @@
 		void EvaluateJoints ( int jset, int method );
 		void EvaluateJoints ( JointSet& joints, Matrix4F& world, Quaternion& orient );						// Evaluate cycle to joints
 		void EvaluateJointsRecurse ( JointSet& joints, int curr_jnt, Matrix4F tform, Quaternion orient );	// Update joint transforms		
+		void SetDeferJoints ( bool d )	{ m_DeferJoints = d; }												// Defer evaluation to crowd (see crowd.h)
+		bool getPendingJoints ( int s, Quaternion& orient, Vec3F& pos, uint64_t& source );
 
 		Joint* FindJoint (int jset, std::string name, int& j );
 		Joint* getJoint (int s, int i)	{ return &m_Joints[s][i]; }
@@ -174,8 +183,12 @@
 		void EvaluatePathMotion ( float t, Motion& m );
 		void EvaluateTargetingMotion ( float t, Motion& m );
 		void getTargetDirection ( float speed );		
+		Vec3F getAvoidance ();													// steer away from nearby characters
+		void SetCrowd ( Crowd* c, int ndx )		{ m_Crowd = c; m_CrowdNdx = ndx; }
 
-		void PlanPath ( Vec3F target );
+		void PlanPath ( Vec3F target );											// request path from navigation (see navigation.h)
+		void SetPath ( std::vector<Vec3F>& path, bool found );					// path delivered by navigation
+		Navigation* getNav ();
 
 		float getStartTime ( unsigned int flags, int new_cycle, float new_duration );
 		int getActiveCycle ();
@@ -186,12 +199,17 @@
 		// Bindings
 		void ResetTPose();
 		void BindBones ();
+		void PackBoneBinds ();
 		void EvaluateBones ();		
+		void EvaluateBones ( Shapes* bones );
 		void ResetBones();		
 		void BindMuscles ();
+		void PackMuscleBinds ();
 		Quaternion getMuscleRotation(Vec3F muscle_dir, Quaternion& bone_rot, float angle=0);
 		void EvaluateMuscles();
+		void EvaluateMuscles ( Muscles* muscles, Shapes* mush, Shapes* bones );
 		void ResetMuscles();
+		static int SelfTest ();
 
 
 		void SetScene ( Scene* s )	{ m_Scene = s; }
@@ -217,6 +235,11 @@
 		Orientation				m_Orient[JNTS_MAX];		
 		
 		JointSet				m_Joints[JNTS_MAX];		// joint state
+		bool					m_DeferJoints;			// deferred joint evaluation
+		bool					m_EvalPending[JNTS_MAX];
+		Quaternion				m_EvalOrient[JNTS_MAX];	// root orientation & pos of deferred evaluation
+		Vec3F					m_EvalPos[JNTS_MAX];
+		uint64_t				m_EvalSource[JNTS_MAX];	// cycle frame the joint set was assigned from, 0 = blended
 		std::vector<Vec3I>	m_Channels;				
 
 		std::vector<Motion>		m_Motions;				// motion events
@@ -226,6 +249,8 @@
 		objID					m_PathID;		
 		float					m_PathU;
 		int						m_PathStatus;
+		std::vector<Vec3F>		m_Path;					// planned waypoints
+		int						m_PathNext;
 		Vec3F				m_Target;				
 		Vec3F				mTargetDir;
 		float					mTargetDist, mTargetAng, mTargetDelta;
@@ -240,6 +265,8 @@
 		float					m_TimelineStart;
 
 		Scene*					m_Scene;
+		Crowd*					m_Crowd;				// neighbor queries, set each frame by the crowd
+		int						m_CrowdNdx;
 		
 		float					m_FPS;
 		bool					m_bBones;
@@ -249,6 +276,14 @@
 		std::vector<BindInfo>	m_BoneBinds;
 		std::vector<BindInfo>	m_MuscleBinds;
 
+		// bind data for evaluation, one array per field
+		std::vector<Dualquat>	m_BoneRel;			// bone in local space of its joint
+		std::vector<int>		m_BoneJoint;		// bound joint
+		std::vector<Dualquat>	m_MuscleRel[2];		// muscle start & end in local space of bone 1 & 2
+		std::vector<Vec3I>		m_MuscleBone;		// x = bone 1 shape, y = bone 2 shape
+		std::vector<Dualquat>	m_JointDQ;			// current joint transforms (scratch)
+		std::vector<Dualquat>	m_BoneDQ;			// current bone transforms (scratch)
+
 	};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,630 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#include "crowd.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "navigation.h"
+#include "main.h"
+#include "timex.h"
+#include "selftest.h"
+#include "quat_conv.h"
+#include <algorithm>
+
+#define JUNDEF		0xFFFF
+
+#define CROWD_GRAIN		64			// instances per parallel chunk
+
+Crowd::Crowd ()
+{
+}
+
+// skeleton key - hierarchy & bone lengths only. animated values are excluded,
+// so every character loaded from the same skeleton shares a key
+uint64_t Crowd::getSkeletonKey ( JointSet& joints )
+{
+	uint64_t h = hashValue ( 0, (int) joints.size() );
+	for (int j=0; j < joints.size(); j++) {
+		Joint& jt = joints[j];
+		int links[3] = { jt.parent, jt.child, jt.next };
+		h = hashValue ( h, links );
+		h = hashValue ( h, jt.length );
+	}
+	return h;
+}
+
+// flatten hierarchy depth-first from the root, parents always before children
+void Crowd::BuildLayout ( JointSet& joints, SkelLayout& lay )
+{
+	std::vector<int> remap ( joints.size(), -1 );
+	std::vector<int> stk;
+
+	lay.order.clear();
+	lay.parent.clear();
+	lay.length.clear();
+	if ( joints.size()==0 ) return;
+
+	stk.push_back ( 0 );
+	while ( stk.size() > 0 ) {
+		int j = stk.back(); stk.pop_back();
+		remap[j] = (int) lay.order.size();
+		lay.order.push_back ( j );
+		lay.parent.push_back ( (joints[j].parent==JUNDEF || j==0) ? -1 : remap[ joints[j].parent ] );
+		lay.length.push_back ( joints[j].length );
+		for (int c = joints[j].child; c != JUNDEF; c = joints[c].next )
+			stk.push_back ( c );
+	}
+}
+
+int Crowd::FindLayout ( JointSet& joints )
+{
+	uint64_t key = getSkeletonKey ( joints );
+	std::map<uint64_t, int>::iterator it = m_LayoutMap.find ( key );
+	if ( it != m_LayoutMap.end() ) return it->second;
+
+	int i = (int) m_Layouts.size();
+	m_Layouts.push_back ( SkelLayout() );
+	m_Groups.push_back ( CrowdGroup() );
+	BuildLayout ( joints, m_Layouts[i] );
+	m_Layouts[i].key = key;
+	m_LayoutMap[key] = i;
+	return i;
+}
+
+// EvaluateSoA
+// - poses [start,end) of a group, one forward pass over the flat joints
+// - Mw(j) = Mw(parent) T(len parent) R(j), as in Character::EvaluateJointsRecurse:
+//     world orient = parent orient * local orient        (library quaternion product)
+//     world pos    = parent pos + parent orient * <0, len parent, 0>
+// - root takes root_orient & root_pos of each pose
+void Crowd::EvaluateSoA ( SkelLayout& lay, CrowdGroup& g, int start, int end )
+{
+	int num = (int) g.root_orient.size();
+	int nj = (int) lay.order.size();
+	float *lx = &g.lq[0][0], *ly = &g.lq[1][0], *lz = &g.lq[2][0], *lw = &g.lq[3][0];
+	float *qx = &g.wq[0][0], *qy = &g.wq[1][0], *qz = &g.wq[2][0], *qw = &g.wq[3][0];
+	float *px = &g.wp[0][0], *py = &g.wp[1][0], *pz = &g.wp[2][0];
+
+	for (int i=start; i < end; i++) {
+		Quaternion& r = g.root_orient[i];
+		qx[i] = (float) r.X; qy[i] = (float) r.Y; qz[i] = (float) r.Z; qw[i] = (float) r.W;
+		px[i] = g.root_pos[i].x; py[i] = g.root_pos[i].y; pz[i] = g.root_pos[i].z;
+	}
+	for (int j=1; j < nj; j++) {
+		int a = lay.parent[j] * num;		// parent row
+		int b = j * num;					// joint row
+		float len = lay.length[ lay.parent[j] ];
+		for (int i=start; i < end; i++) {
+			float rx = qx[a+i], ry = qy[a+i], rz = qz[a+i], rw = qw[a+i];
+			quatMulLib ( rx, ry, rz, rw, lx[b+i], ly[b+i], lz[b+i], lw[b+i], qx[b+i], qy[b+i], qz[b+i], qw[b+i] );
+			// rotate <0,len,0> by parent: v + w t + q x t, t = 2 q x v
+			float tx = -2.0f * len * rz;
+			float tz =  2.0f * len * rx;
+			px[b+i] = px[a+i] + rw*tx + ry*tz;
+			py[b+i] = py[a+i] + len + rz*tx - rx*tz;
+			pz[b+i] = pz[a+i] + rw*tz - ry*tx;
+		}
+	}
+}
+
+// apply character root to a root-space pose: orient = R * q, pos = T + R * p
+static inline void ApplyRoot ( float rx, float ry, float rz, float rw, Vec3F& T, const float* q, const float* p, Joint& jt )
+{
+	float qw, qx, qy, qz, v[3];
+	quatMulLib ( rx, ry, rz, rw, q[0], q[1], q[2], q[3], qx, qy, qz, qw );
+	jt.Morient.set ( qx, qy, qz, qw );
+	quatRotate ( rx, ry, rz, rw, p, v );
+	jt.pos.Set ( T.x + v[0], T.y + v[1], T.z + v[2] );
+	jt.Morient.getMatrix ( jt.Mworld );
+	jt.Mworld.PostTranslate ( jt.pos );
+}
+
+static Quaternion RandomRot ( uint64_t seed, int i )
+{
+	Quaternion q;
+	q.fromAngleAxis ( hashRandF ( seed, i*4 ) * 6.0f, Vec3F( hashRandF(seed, i*4+1) - 0.5f, hashRandF(seed, i*4+2) - 0.5f, hashRandF(seed, i*4+3) - 0.5f ).Normalize() );
+	return q;
+}
+
+static bool SameRot ( Quaternion& a, float x, float y, float z, float w )
+{
+	return fabs ( a.X*x + a.Y*y + a.Z*z + a.W*w ) > 1 - 1e-4f;
+}
+
+static bool SamePos ( Vec3F a, float x, float y, float z )
+{
+	return fabs(a.x - x) < 1e-3f && fabs(a.y - y) < 1e-3f && fabs(a.z - z) < 1e-3f;
+}
+
+// SoA evaluation matches the matrix & quaternion path of Character::EvaluateJointsRecurse,
+// and ApplyRoot matches the library product (checks the conventions in quat_conv.h)
+int Crowd::SelfTest ()
+{
+	int bad = 0;
+	SkelLayout lay;
+	int parent[6] = { -1, 0, 1, 1, 3, 0 };
+	for (int j=0; j < 6; j++) {
+		lay.order.push_back ( j );
+		lay.parent.push_back ( parent[j] );
+		lay.length.push_back ( 0.5f + hashRandF ( 21, j ) );
+	}
+	int nj = 6, num = 40;
+	CrowdGroup g;
+	g.root_orient.resize ( num );
+	g.root_pos.resize ( num );
+	for (int k=0; k < 4; k++) { g.lq[k].resize ( nj*num ); g.wq[k].resize ( nj*num ); }
+	for (int k=0; k < 3; k++) g.wp[k].resize ( nj*num );
+	std::vector<Quaternion> local ( nj*num );
+	for (int i=0; i < num; i++) {
+		g.root_orient[i] = RandomRot ( 22, i );
+		g.root_pos[i].Set ( hashRandF(23, i*3), hashRandF(23, i*3+1), hashRandF(23, i*3+2) );
+		for (int j=0; j < nj; j++) {
+			Quaternion& q = local[j*num+i];
+			q = RandomRot ( 24, j*num+i );
+			g.lq[0][j*num+i] = (float) q.X;	g.lq[1][j*num+i] = (float) q.Y;
+			g.lq[2][j*num+i] = (float) q.Z;	g.lq[3][j*num+i] = (float) q.W;
+		}
+	}
+	EvaluateSoA ( lay, g, 0, num );
+
+	// reference, as EvaluateJointsRecurse
+	int rot_bad = 0, pos_bad = 0;
+	Matrix4F world[6], orient_mtx;
+	Quaternion morient[6];
+	for (int i=0; i < num; i++) {
+		for (int j=0; j < nj; j++) {
+			if ( j == 0 ) {
+				morient[0] = g.root_orient[i];
+				morient[0].getMatrix ( world[0] );
+				world[0].PostTranslate ( g.root_pos[i] );
+			} else {
+				world[j] = world[ parent[j] ];
+				world[j].PreTranslate ( Vec3F(0.f, lay.length[ parent[j] ], 0.f) );
+				local[j*num+i].getMatrix ( orient_mtx );
+				world[j] *= orient_mtx;
+				morient[j] = morient[ parent[j] ] * local[j*num+i];
+			}
+			int k = j*num + i;
+			if ( !SameRot ( morient[j], g.wq[0][k], g.wq[1][k], g.wq[2][k], g.wq[3][k] ) ) rot_bad++;
+			if ( !SamePos ( world[j].getTrans(), g.wp[0][k], g.wp[1][k], g.wp[2][k] ) ) pos_bad++;
+		}
+	}
+	bad += selfCheck ( rot_bad == 0, "crowd", "SoA orientations differ from quaternion path" );
+	bad += selfCheck ( pos_bad == 0, "crowd", "SoA positions differ from matrix path" );
+
+	// root applied to a root-space pose
+	Joint jt;
+	int root_bad = 0;
+	for (int i=0; i < num; i++) {
+		Quaternion r = RandomRot ( 25, i ), q = RandomRot ( 26, i );
+		Vec3F T ( 1, 2, 3 ), p ( hashRandF(27, i), hashRandF(28, i), hashRandF(29, i) );
+		float qf[4] = { (float) q.X, (float) q.Y, (float) q.Z, (float) q.W };
+		float pf[3] = { p.x, p.y, p.z };
+		ApplyRoot ( (float) r.X, (float) r.Y, (float) r.Z, (float) r.W, T, qf, pf, jt );
+		Quaternion rq = r * q;
+		Matrix4F m;
+		r.getMatrix ( m );
+		m.PostTranslate ( T );
+		m.PreTranslate ( p );
+		Vec3F ref = m.getTrans ();
+		if ( !SameRot ( rq, (float) jt.Morient.X, (float) jt.Morient.Y, (float) jt.Morient.Z, (float) jt.Morient.W ) ) root_bad++;
+		if ( !SamePos ( ref, jt.pos.x, jt.pos.y, jt.pos.z ) ) root_bad++;
+	}
+	bad += selfCheck ( root_bad == 0, "crowd", "root application differs from library" );
+	return selfReport ( "crowd", bad );
+}
+
+void Crowd::Run ( std::vector<Character*>& chars, float time )
+{
+	Quaternion orient, ident;
+	Vec3F pos;
+	uint64_t src;
+	ident.Identity();
+
+	// Neighbor queries into the frame grid (see BuildNeighbors)
+	std::map<Character*, int>::iterator it;
+	for (int c=0; c < chars.size(); c++) {
+		it = m_Index.find ( chars[c] );
+		chars[c]->SetCrowd ( this, (it != m_Index.end()) ? it->second : -1 );
+	}
+
+	// Run motions, joint evaluation deferred
+	for (int c=0; c < chars.size(); c++) {
+		chars[c]->SetDeferJoints ( true );
+		if ( time >= 0 )
+			chars[c]->ProcessMotions ( time );
+		chars[c]->SetDeferJoints ( false );
+	}
+
+	// Path requests queued by motions, solved together per navigation object
+	Navigation* nav;
+	for (int c=0; c < chars.size(); c++) {
+		nav = chars[c]->getNav ();
+		if ( nav != 0x0 && nav->getNumRequests() > 0 )
+			nav->SolveRequests ();
+	}
+
+	// Group pending joint sets by skeleton
+	for (int n=0; n < m_Groups.size(); n++) {
+		m_Groups[n].inst.clear();
+		m_Groups[n].inst_orient.clear();
+		m_Groups[n].inst_pos.clear();
+		m_Groups[n].inst_key.clear();
+	}
+	for (int c=0; c < chars.size(); c++) {
+		for (int s=0; s < JNTS_MAX; s++) {
+			if ( !chars[c]->getPendingJoints ( s, orient, pos, src ) ) continue;
+			if ( chars[c]->getNumJoints(s) == 0 ) continue;
+			int l = FindLayout ( chars[c]->getJoints(s) );
+			m_Groups[l].inst.push_back ( Vec3I(c, s, 0) );
+			m_Groups[l].inst_orient.push_back ( orient );
+			m_Groups[l].inst_pos.push_back ( pos );
+			m_Groups[l].inst_key.push_back ( (src == 0) ? 0 : hashValue ( src, m_Layouts[l].key ) );
+		}
+	}
+
+	for (int l=0; l < m_Groups.size(); l++) {
+		CrowdGroup& g = m_Groups[l];
+		SkelLayout& lay = m_Layouts[l];
+		int num = (int) g.inst.size();
+		int nj = (int) lay.order.size();
+		if ( num == 0 ) continue;
+
+		// Assign pose slots. cached poses are reused, the same key is evaluated once
+		g.inst_cached.assign ( num, (const float*) 0x0 );
+		g.pose_inst.clear();
+		g.pose_key.clear();
+		m_Slots.clear();
+		for (int i=0; i < num; i++) {
+			uint64_t key = g.inst_key[i];
+			if ( key != 0 ) {
+				g.inst_cached[i] = m_Cache.Find ( key );
+				if ( g.inst_cached[i] != 0x0 ) continue;
+				std::map<uint64_t, int>::iterator it = m_Slots.find ( key );
+				if ( it != m_Slots.end() ) { g.inst[i].z = it->second; continue; }
+				m_Slots[key] = (int) g.pose_inst.size();
+			}
+			g.inst[i].z = (int) g.pose_inst.size();
+			g.pose_inst.push_back ( i );
+			g.pose_key.push_back ( key );
+		}
+		int npose = (int) g.pose_inst.size();
+		g.root_orient.assign ( npose, ident );
+		g.root_pos.assign ( npose, Vec3F(0,0,0) );
+		int sz = npose * nj;
+		for (int k=0; k < 4; k++) { g.lq[k].resize ( sz ); g.wq[k].resize ( sz ); }
+		for (int k=0; k < 3; k++) g.wp[k].resize ( sz );
+
+		// Evaluate poses in parallel, root at identity
+		ParallelFor ( npose, CROWD_GRAIN, [&](int start, int end, int chunk) {
+			for (int p=start; p < end; p++) {
+				Vec3I& in = g.inst[ g.pose_inst[p] ];
+				JointSet& joints = chars[ in.x ]->getJoints ( in.y );
+				for (int j=0; j < nj; j++) {
+					Quaternion& q = joints[ lay.order[j] ].orient;
+					g.lq[0][j*npose+p] = (float) q.X;	g.lq[1][j*npose+p] = (float) q.Y;
+					g.lq[2][j*npose+p] = (float) q.Z;	g.lq[3][j*npose+p] = (float) q.W;
+				}
+			}
+			EvaluateSoA ( lay, g, start, end );
+		} );
+
+		// Write back, each instance applies its own root
+		ParallelFor ( num, CROWD_GRAIN, [&](int start, int end, int chunk) {
+			float q[4], p[3];
+			for (int i=start; i < end; i++) {
+				JointSet& joints = chars[ g.inst[i].x ]->getJoints ( g.inst[i].y );
+				Quaternion& r = g.inst_orient[i];
+				float rx = (float) r.X, ry = (float) r.Y, rz = (float) r.Z, rw = (float) r.W;
+				const float* cached = g.inst_cached[i];
+				int slot = g.inst[i].z;
+				for (int j=0; j < nj; j++) {
+					if ( cached != 0x0 ) {
+						ApplyRoot ( rx, ry, rz, rw, g.inst_pos[i], cached + j*7, cached + j*7 + 4, joints[ lay.order[j] ] );
+					} else {
+						int k = j*npose + slot;
+						q[0] = g.wq[0][k]; q[1] = g.wq[1][k]; q[2] = g.wq[2][k]; q[3] = g.wq[3][k];
+						p[0] = g.wp[0][k]; p[1] = g.wp[1][k]; p[2] = g.wp[2][k];
+						ApplyRoot ( rx, ry, rz, rw, g.inst_pos[i], q, p, joints[ lay.order[j] ] );
+					}
+				}
+			}
+		} );
+
+		// Store new shared poses (after write back, eviction may free cached poses)
+		std::vector<float> data ( nj * 7 );
+		for (int p=0; p < npose; p++) {
+			if ( g.pose_key[p] == 0 ) continue;
+			for (int j=0; j < nj; j++) {
+				int k = j*npose + p;
+				float* d = &data[j*7];
+				d[0] = g.wq[0][k]; d[1] = g.wq[1][k]; d[2] = g.wq[2][k]; d[3] = g.wq[3][k];
+				d[4] = g.wp[0][k]; d[5] = g.wp[1][k]; d[6] = g.wp[2][k];
+			}
+			m_Cache.Insert ( g.pose_key[p], &data[0], nj * 7 );
+		}
+	}
+
+	// Bones & muscles
+	for (int c=0; c < chars.size(); c++) {
+		chars[c]->EvaluateBones ();
+		chars[c]->EvaluateMuscles ();
+		chars[c]->SetCrowd ( 0x0, -1 );				// no neighbor queries outside the batch
+		chars[c]->MarkClean ();
+	}
+}
+
+// Neighbor grid of all scene characters, once per frame before any batch
+// - positions at start of frame, so every batch of the frame sees every character
+void Crowd::BuildNeighbors ( std::vector<Character*>& chars )
+{
+	m_Pos.resize ( chars.size() );
+	m_Index.clear ();
+	for (int c=0; c < chars.size(); c++) {
+		m_Pos[c] = chars[c]->getPosition ();
+		m_Index[ chars[c] ] = c;
+	}
+	m_Grid.Build ( m_Pos, CROWD_AVOID_DIST );
+}
+
+//-------------------------------- Pose cache
+
+PoseCache::PoseCache ()
+{
+	m_Bytes = 0;
+	m_Budget = POSE_CACHE_BUDGET;
+	m_Hits = 0;
+	m_Misses = 0;
+}
+
+void PoseCache::Clear ()
+{
+	m_Entries.clear();
+	m_LRU.clear();
+	m_Bytes = 0;
+}
+
+const float* PoseCache::Find ( uint64_t key )
+{
+	std::map<uint64_t, Entry>::iterator it = m_Entries.find ( key );
+	if ( it == m_Entries.end() ) { m_Misses++; return 0x0; }
+	m_Hits++;
+	m_LRU.splice ( m_LRU.begin(), m_LRU, it->second.lru );		// most recent
+	return &it->second.data[0];
+}
+
+void PoseCache::Insert ( uint64_t key, const float* data, int cnt )
+{
+	if ( cnt <= 0 || m_Entries.find ( key ) != m_Entries.end() ) return;
+	uint64_t bytes = cnt * sizeof(float);
+	if ( bytes > m_Budget ) return;
+
+	// evict least recently used
+	while ( m_Bytes + bytes > m_Budget && m_LRU.size() > 0 ) {
+		std::map<uint64_t, Entry>::iterator it = m_Entries.find ( m_LRU.back() );
+		m_Bytes -= it->second.data.size() * sizeof(float);
+		m_Entries.erase ( it );
+		m_LRU.pop_back ();
+	}
+	Entry& e = m_Entries[key];
+	e.data.assign ( data, data + cnt );
+	m_LRU.push_front ( key );
+	e.lru = m_LRU.begin();
+	m_Bytes += bytes;
+}
+
+// Hits return the inserted pose, least recently used poses are evicted over budget
+int PoseCache::SelfTest ()
+{
+	int bad = 0;
+	PoseCache pc;
+	float a[7] = { 1, 2, 3, 4, 5, 6, 7 }, b[7] = { 8, 9, 10, 11, 12, 13, 14 }, c[7] = { 0 };
+	pc.SetBudget ( 2 * 7 * sizeof(float) );						// room for two poses
+	pc.Insert ( 1, a, 7 );
+	pc.Insert ( 2, b, 7 );
+	const float* f = pc.Find ( 1 );
+	bad += selfCheck ( f != 0x0 && f[0] == 1 && f[6] == 7, "pose_cache", "inserted pose not found" );
+	bad += selfCheck ( pc.Find ( 3 ) == 0x0, "pose_cache", "found a pose never inserted" );
+	pc.Insert ( 3, c, 7 );										// evicts 2, least recently used
+	bad += selfCheck ( pc.Find ( 2 ) == 0x0, "pose_cache", "least recently used pose kept" );
+	bad += selfCheck ( pc.Find ( 1 ) != 0x0 && pc.Find ( 3 ) != 0x0, "pose_cache", "recent pose evicted" );
+	bad += selfCheck ( pc.getBytes() <= 2 * 7 * sizeof(float), "pose_cache", "over budget" );
+	pc.Insert ( 1, b, 7 );										// existing key keeps its pose
+	f = pc.Find ( 1 );
+	bad += selfCheck ( f != 0x0 && f[0] == 1, "pose_cache", "existing pose replaced" );
+	bad += selfCheck ( pc.getHits() == 4 && pc.getMisses() == 2, "pose_cache", "hit & miss counts" );
+	pc.Clear ();
+	bad += selfCheck ( pc.Find ( 1 ) == 0x0 && pc.getBytes() == 0, "pose_cache", "clear kept poses" );
+	return selfReport ( "pose_cache", bad );
+}
+
+//-------------------------------- Neighbor grid
+
+CrowdGrid::CrowdGrid ()
+{
+	m_cell = CROWD_AVOID_DIST;
+	m_mask = 0;
+}
+
+void CrowdGrid::Build ( const std::vector<Vec3F>& pos, float cell )
+{
+	int num = (int) pos.size();
+	uint32_t buckets = 64;
+	while ( buckets < uint32_t(num) * 2 ) buckets <<= 1;
+	m_cell = cell;
+	m_mask = buckets - 1;
+
+	// bucket keys
+	m_key.resize ( num );
+	ParallelFor ( num, 1024, [&](int start, int end, int chunk) {
+		for (int i = start; i < end; i++)
+			m_key[i] = getBucket ( int(floor(pos[i].x / m_cell)), int(floor(pos[i].z / m_cell)) );
+	} );
+
+	// counting sort
+	m_start.assign ( buckets + 1, 0 );
+	for (int i = 0; i < num; i++)
+		m_start[ m_key[i] + 1 ]++;
+	for (uint32_t b = 0; b < buckets; b++)
+		m_start[b + 1] += m_start[b];
+	m_items.resize ( num );
+	std::vector<int> fill ( m_start.begin(), m_start.end() - 1 );
+	for (int i = 0; i < num; i++)
+		m_items[ fill[ m_key[i] ]++ ] = i;
+}
+
+int CrowdGrid::FindNeighbors ( const std::vector<Vec3F>& pos, Vec3F p, float radius, int self, int* out, int max_out )
+{
+	if ( m_items.size() == 0 ) return 0;
+
+	int x0 = int(floor( (p.x - radius) / m_cell )), x1 = int(floor( (p.x + radius) / m_cell ));
+	int z0 = int(floor( (p.z - radius) / m_cell )), z1 = int(floor( (p.z + radius) / m_cell ));
+	float r2 = radius * radius;
+	float dx, dz;
+	int cnt = 0, nvis = 0, j;
+	uint32_t b, visited[16];
+	bool seen;
+	bool by_cell = (x1 - x0 + 1) * (z1 - z0 + 1) > 16;		// too many cells to track buckets, check each item's cell instead
+
+	for (int cz = z0; cz <= z1; cz++) {
+		for (int cx = x0; cx <= x1; cx++) {
+			b = getBucket ( cx, cz );
+			if ( !by_cell ) {
+				seen = false;									// two cells may share a bucket
+				for (int v = 0; v < nvis; v++) if ( visited[v] == b ) seen = true;
+				if ( seen ) continue;
+				visited[nvis++] = b;
+			}
+			for (int k = m_start[b]; k < m_start[b + 1]; k++) {
+				j = m_items[k];
+				if ( j == self ) continue;
+				if ( by_cell && ( int(floor(pos[j].x / m_cell)) != cx || int(floor(pos[j].z / m_cell)) != cz ) ) continue;
+				dx = pos[j].x - p.x;
+				dz = pos[j].z - p.z;
+				if ( dx*dx + dz*dz > r2 ) continue;
+				out[cnt++] = j;
+				if ( cnt >= max_out ) return cnt;
+			}
+		}
+	}
+	return cnt;
+}
+
+// Grid queries match brute force, as sets
+// - agents around the origin (negative cells), some exactly on cell borders
+// - radii from under one cell to several cells (many cells share a bucket)
+// - a capped query returns min(count, cap) distinct neighbors from the full set
+int CrowdGrid::SelfTest ()
+{
+	int bad = 0;
+	int num = 300;
+	float cell = 2.0f;
+	std::vector<Vec3F> pos ( num );
+	for (int i = 0; i < num; i++) {
+		if ( i % 5 == 0 )
+			pos[i].Set ( cell * int( hashRandF(22, i*2) * 16 - 8 ), 0, cell * int( hashRandF(22, i*2+1) * 16 - 8 ) );
+		else
+			pos[i].Set ( hashRandF(22, i*2) * 32 - 16, 0, hashRandF(22, i*2+1) * 32 - 16 );
+	}
+	CrowdGrid grid;
+	grid.Build ( pos, cell );
+
+	float radii[4] = { 0.7f, 2.0f, 3.5f, 7.0f };
+	int out[512], cnt, cap;
+	int wrong = 0, wrong_cap = 0;
+	std::vector<int> ref, got;
+	float dx, dz;
+	for (int r = 0; r < 4; r++) {
+		for (int i = 0; i < num; i++) {
+			ref.clear ();
+			for (int j = 0; j < num; j++) {
+				if ( j == i ) continue;
+				dx = pos[j].x - pos[i].x;
+				dz = pos[j].z - pos[i].z;
+				if ( dx*dx + dz*dz <= radii[r] * radii[r] ) ref.push_back ( j );
+			}
+			cnt = grid.FindNeighbors ( pos, pos[i], radii[r], i, out, 512 );
+			got.assign ( out, out + cnt );
+			std::sort ( got.begin(), got.end() );
+			if ( got != ref ) wrong++;
+
+			cap = 1 + i % 8;
+			cnt = grid.FindNeighbors ( pos, pos[i], radii[r], i, out, cap );
+			got.assign ( out, out + cnt );
+			std::sort ( got.begin(), got.end() );
+			if ( cnt != std::min( cap, (int) ref.size() ) || std::unique ( got.begin(), got.end() ) != got.end() ) { wrong_cap++; continue; }
+			for (int k = 0; k < cnt; k++)
+				if ( !std::binary_search ( ref.begin(), ref.end(), got[k] ) ) { wrong_cap++; break; }
+		}
+	}
+	bad += selfCheck ( wrong == 0, "crowd_grid", "neighbors differ from brute force" );
+	bad += selfCheck ( wrong_cap == 0, "crowd_grid", "capped query count or members" );
+
+	std::vector<Vec3F> none;
+	grid.Build ( none, cell );
+	bad += selfCheck ( grid.FindNeighbors ( none, Vec3F(0,0,0), 5.0f, -1, out, 512 ) == 0, "crowd_grid", "empty grid" );
+	return selfReport ( "crowd_grid", bad );
+}
+
+// Benchmark neighbor grid
+// - num agents at ~1 per 4 m^2, grid build and one avoidance query per agent,
+//   checked against brute force for moderate counts
+//
+void Crowd::BenchmarkNeighbors ( int num )
+{
+	if ( num <= 0 ) return;
+
+	float side = sqrt( float(num) * 4.0f );
+	std::vector<Vec3F> pos ( num );
+	for (int i = 0; i < num; i++)
+		pos[i].Set ( hashRandF(1, i*2) * side, 0, hashRandF(1, i*2+1) * side );
+
+	CrowdGrid grid;
+	std::vector<int> cnt ( num );
+	TimeX t1, t2, t3;
+
+	t1.SetTimeNSec ();
+	grid.Build ( pos, CROWD_AVOID_DIST );
+	t2.SetTimeNSec ();
+	ParallelFor ( num, 256, [&](int start, int end, int chunk) {
+		int nbrs[CROWD_MAX_NBRS];
+		for (int i = start; i < end; i++)
+			cnt[i] = grid.FindNeighbors ( pos, pos[i], CROWD_AVOID_DIST, i, nbrs, CROWD_MAX_NBRS );
+	} );
+	t3.SetTimeNSec ();
+
+	uint64_t total = 0;
+	for (int i = 0; i < num; i++) total += cnt[i];
+	dbgprintf ( "Benchmark: crowd grid, %d agents, build %6.2f ms, query %6.2f ms, %4.1f nbrs/agent\n",
+		num, t2.GetElapsedMSec(t1), t3.GetElapsedMSec(t2), double(total) / num );
+
+	if ( num > 20000 ) return;
+
+	// brute force reference, O(n^2)
+	int bad = 0, c;
+	float dx, dz, r2 = CROWD_AVOID_DIST * CROWD_AVOID_DIST;
+	t1.SetTimeNSec ();
+	for (int i = 0; i < num; i++) {
+		c = 0;
+		for (int j = 0; j < num; j++) {
+			if ( j == i ) continue;
+			dx = pos[j].x - pos[i].x;
+			dz = pos[j].z - pos[i].z;
+			if ( dx*dx + dz*dz <= r2 ) c++;
+		}
+		if ( std::min(c, CROWD_MAX_NBRS) != cnt[i] ) bad++;
+	}
+	t2.SetTimeNSec ();
+	dbgprintf ( "Benchmark: brute force, %d agents, query %6.2f ms, %d mismatches\n", num, t2.GetElapsedMSec(t1), bad );
+}
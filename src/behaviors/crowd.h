@@ -0,0 +1,149 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_CROWD
+	#define DEF_CROWD
+
+	#include "character.h"
+	#include <stdint.h>
+	#include <vector>
+	#include <map>
+	#include <list>
+
+	// Crowd evaluation
+	// - Characters run their motions as usual, but joint evaluation is deferred.
+	//   Deferred joint sets are grouped by skeleton and evaluated together.
+	// - Skeleton is flattened in parent-first order, so local-to-world is a single
+	//   forward pass (no recursion, no matrices). World orientation & pos are kept
+	//   as SoA arrays [joint * num + instance]; the inner loop runs over instances.
+	// - Instances are split across threads (ParallelFor), results written back to
+	//   Joint::Morient, pos & Mworld for bones, muscles and drawing.
+	// - Poses are evaluated with the root at identity, then each character applies
+	//   its own root orientation & pos. Joint sets assigned straight from a cycle
+	//   frame are shared through the PoseCache, keyed by (cycle, frame, skeleton).
+
+	struct SkelLayout {
+		uint64_t			key;
+		std::vector<int>	order;			// flat index -> joint index
+		std::vector<int>	parent;			// flat index of parent, -1 = root
+		std::vector<float>	length;			// bone length, in flat order
+	};
+
+	struct CrowdGroup {						// joint sets sharing a skeleton
+		std::vector<Vec3I>		inst;		// x=character, y=joint set, z=pose slot
+		std::vector<Quaternion>	inst_orient;	// character root
+		std::vector<Vec3F>		inst_pos;
+		std::vector<uint64_t>	inst_key;		// pose cache key, 0 = not shared
+		std::vector<const float*> inst_cached;	// cached pose, or null
+
+		std::vector<int>		pose_inst;		// per evaluated pose, instance to read orientations from
+		std::vector<uint64_t>	pose_key;
+		std::vector<Quaternion>	root_orient;	// per evaluated pose
+		std::vector<Vec3F>		root_pos;
+		std::vector<float>		lq[4];		// local orientation (x,y,z,w)	[joint * poses + pose]
+		std::vector<float>		wq[4];		// world orientation
+		std::vector<float>		wp[3];		// world position
+	};
+
+	// Pose cache
+	// - root-space joint orientation & pos (7 floats per joint, flat order)
+	// - least recently used poses are evicted over the memory budget
+	class PoseCache {
+	public:
+		PoseCache ();
+		const float*	Find ( uint64_t key );
+		void			Insert ( uint64_t key, const float* data, int cnt );
+		void			Clear ();
+		void			SetBudget ( uint64_t bytes )	{ m_Budget = bytes; }
+		uint64_t		getBytes ()		{ return m_Bytes; }
+		uint64_t		getHits ()		{ return m_Hits; }
+		uint64_t		getMisses ()	{ return m_Misses; }
+
+		static int		SelfTest ();
+
+	private:
+		struct Entry {
+			std::vector<float>				data;
+			std::list<uint64_t>::iterator	lru;
+		};
+		std::map<uint64_t, Entry>	m_Entries;
+		std::list<uint64_t>			m_LRU;			// front = most recent
+		uint64_t					m_Bytes, m_Budget;
+		uint64_t					m_Hits, m_Misses;
+	};
+
+	#define POSE_CACHE_BUDGET		(64ULL << 20)
+
+	// Neighbor grid
+	// - character positions (xz) hashed into a uniform grid, rebuilt each frame:
+	//   cell keys in parallel, then a linear counting sort into buckets
+	// - hashed buckets, so the grid needs no world bounds. a query visits the cells
+	//   overlapping its radius and filters by distance, so steering stays linear in agents
+	class CrowdGrid {
+	public:
+		CrowdGrid ();
+		void	Build ( const std::vector<Vec3F>& pos, float cell );
+		int		FindNeighbors ( const std::vector<Vec3F>& pos, Vec3F p, float radius, int self, int* out, int max_out );
+
+		static int SelfTest ();
+
+	private:
+		uint32_t	getBucket ( int cx, int cz )	{ return (uint32_t(cx) * 73856093u ^ uint32_t(cz) * 19349663u) & m_mask; }
+
+		float					m_cell;
+		uint32_t				m_mask;			// buckets - 1 (power of 2)
+		std::vector<uint32_t>	m_key;			// bucket per item
+		std::vector<int>		m_start;		// bucket -> first of its items in m_items
+		std::vector<int>		m_items;
+	};
+
+	#define CROWD_AVOID_DIST		2.0f		// avoidance radius (m), also the grid cell size
+	#define CROWD_MAX_NBRS			32
+
+	class Crowd {
+	public:
+		Crowd ();
+
+		void Run ( std::vector<Character*>& chars, float time );
+		void BuildNeighbors ( std::vector<Character*>& chars );
+
+		static uint64_t	getSkeletonKey ( JointSet& joints );
+		static void		BuildLayout ( JointSet& joints, SkelLayout& lay );
+		static void		EvaluateSoA ( SkelLayout& lay, CrowdGroup& g, int start, int end );
+
+		int		getNumLayouts ()		{ return (int) m_Layouts.size(); }
+		PoseCache& getPoseCache ()		{ return m_Cache; }
+
+		// Neighbors, by crowd index (see Character::SetCrowd)
+		int		FindNeighbors ( int self, float radius, int* out, int max_out )	{ return m_Grid.FindNeighbors ( m_Pos, m_Pos[self], radius, self, out, max_out ); }
+		Vec3F	getNeighborPos ( int i )	{ return m_Pos[i]; }
+
+		static void BenchmarkNeighbors ( int num );
+		static int	SelfTest ();
+
+	private:
+		int		FindLayout ( JointSet& joints );
+
+		std::vector<SkelLayout>		m_Layouts;
+		std::map<uint64_t, int>		m_LayoutMap;
+		std::vector<CrowdGroup>		m_Groups;		// one per layout, reused each frame
+		std::map<uint64_t, int>		m_Slots;		// pose key -> slot, current group
+		PoseCache					m_Cache;
+
+		CrowdGrid					m_Grid;
+		std::vector<Vec3F>			m_Pos;			// all character positions, at start of frame
+		std::map<Character*, int>	m_Index;		// character -> m_Pos index
+	};
+
+#endif
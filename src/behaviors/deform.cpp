@@ -14,6 +14,12 @@
 
 #include "deform.h"
 #include "shapes.h"
+#include "object_list.h"
+#include "parallel.h"
+#include "selftest.h"
+#include "quat_conv.h"
+
+#include <string.h>
 
 #define D_BEND_CTR		0
 #define D_BEND_SIZE		1
@@ -56,13 +62,78 @@ void Deform::Define (int x, int y)
 	mTimeRange = Vec3F(0, 10000, 0);
 }
 
-void Deform::DeformBend()
+static bool isZero ( Vec3F v )
+{
+	return v.x == 0 && v.y == 0 && v.z == 0;
+}
+
+// turn (a,b) plane by angles (radians, right-hand rule)
+static inline void TurnBlock ( float* a, float* b, const float* ang, int n )
+{
+	float c, s, t;
+	for (int i = 0; i < n; i++) {
+		c = cosf ( ang[i] );
+		s = sinf ( ang[i] );
+		t = c * a[i] - s * b[i];
+		b[i] = s * a[i] + c * b[i];
+		a[i] = t;
+	}
+}
+
+// turn about axis 0=X (y->z), 1=Y (z->x), 2=Z (x->y)
+static inline void TurnAxis ( int axis, float* px, float* py, float* pz, const float* ang, int n )
+{
+	switch ( axis ) {
+	case 0:	TurnBlock ( py, pz, ang, n );	break;
+	case 1:	TurnBlock ( pz, px, ang, n );	break;
+	case 2:	TurnBlock ( px, py, ang, n );	break;
+	};
+}
+
+// bend along axis a (0=X, 1=Y, 2=Z) by ang degrees, over [0, sz] about ctr
+static DeformOp getBendOp ( int a, float ang, float ctr, float sz )
 {
-	Vec3F p, k, c;
-	Vec3F dp;
-	Quaternion q, r1, r2;
-	Vec3F d;
-	float v, a0, a1, r, bsgn;
+	DeformOp op;
+	op.type = DOP_BEND_X + a;
+	op.bsz = sz;
+	op.bctr = ctr;
+	op.sgn = (ang > 0) ? 1 : -1;
+	op.r = (360.0 / ang) * op.bsz / (2 * 3.141592);		// C = 2*PI*r = 360/ang * L    -> when ang=360, length wraps to circumference
+	op.a0 = -fabs(ang) * op.bctr / op.bsz;
+	op.a1 = ang + op.a0;
+	op.e = op.r + cosf( std::min(op.a0, op.a1) * op.sgn * DEGtoRAD ) * (-op.r * op.sgn);
+	return op;
+}
+
+void Deform::AddOps ( std::vector<DeformOp>& ops )
+{
+	DeformOp op;
+
+	// Folding is a constant rotation that is neg/pos on either side of the axis,
+	// where the angle is same on both sides
+	//    \    /
+	//     \  /       looking straight down x-axis
+	//     a\/a
+	//  <---0----> z-axis     0 = origin
+	//
+	op.type = DOP_FOLD;
+	op.ctr = getParamV3(D_FOLD_CTR);
+	op.size = getParamV3(D_FOLD_SIZE);
+	op.amt0 = getParamV3(D_FOLD_AMT0);
+	op.amt1 = getParamV3(D_FOLD_AMT1);
+	if ( !isZero(op.amt0) || !isZero(op.amt1) ) ops.push_back ( op );
+
+	// Twist is simply a rotation along the twist axis
+	//      v             v = fraction of rotation = x / s
+	//      |
+	// --x--|----------s  --> twist axis, where s = twist_size.x 
+	//      |
+	op.type = DOP_TWIST;
+	op.ctr = getParamV3(D_TWIST_CTR);
+	op.size = getParamV3(D_TWIST_SIZE);
+	op.amt0 = getParamV3(D_TWIST_AMT0);
+	op.amt1 = getParamV3(D_TWIST_AMT1);
+	if ( !isZero(op.amt0) || !isZero(op.amt1) ) ops.push_back ( op );
 
 	// Bending moves the original geometry along a displaced circle:
 	//
@@ -84,188 +155,304 @@ void Deform::DeformBend()
 	//            .......    
 	// Solution: construct a right triangle with bend center at: <x, x/tan(a0), 0>,   tan(a0) = x / Cy
 	//
+	// e = offset that puts the start of the bend back on the axis. cos is even,
+	// so it does not depend on the rotation direction
 	Vec3F bend_ctr = getParamV3(D_BEND_CTR);
 	Vec3F bend_size = getParamV3(D_BEND_SIZE);
 	Vec3F bend_amt = getParamV3(D_BEND_AMT);
-	float e, ang, sz, ctr;
-	
-	//----------- Bend along X-axis, toward Y-axis, rotation in Z-axis
-	ang = bend_amt.x;
-	if ( ang != 0) {
-		sz = bend_size.x;
-		ctr = bend_ctr.x;
-		bsgn = (ang > 0) ? 1 : -1;
-		r = (360.0 / ang) * sz / (2*3.141592);		// C = 2*PI*r = 360/ang * L    -> when ang=360, length wraps to circumference
-		a0 = -fabs(ang) * ctr/sz;
-		a1 = ang + a0;
-		c = Vec3F( ctr, r, 0 );
-		k = Vec3F(0, -r * bsgn, 0); r1.fromAngleAxis(std::min(a0, a1) * bsgn * DEGtoRAD, Vec3F(0, 0, 1)); p = c + (k * r1); e = p.y;
-		Shape* s;
-		for (int n = 0; n < getNumShapes(); n++) {
-			s = getShape(n);
-			p = s->pos;
-			v = (ctr/sz) + (p.x-ctr) / sz;				// bend fraction (0 < v < 1)
-			k = Vec3F(0, -r * bsgn, 0);
-			p.x = 0;									// move cross-section to 0
-			r1.fromAngleAxis((a0 + v * (a1 - a0)) * bsgn * DEGtoRAD, Vec3F(0, 0, 1));		// Z-axis
-			p *= r1;									// rotate cross-section		
-			p += c + (k * r1) - Vec3F(0,e,0);		// bend - shift section onto the circle
-			s->pos = p;
-			s->rot *= r1;
-		}
+	float ang;
+	for (int a = 0; a < 3; a++) {
+		ang = (a == 0) ? bend_amt.x : (a == 1) ? bend_amt.y : bend_amt.z;
+		if ( ang == 0 ) continue;
+		ops.push_back ( getBendOp ( a, ang, (a == 0) ? bend_ctr.x : (a == 1) ? bend_ctr.y : bend_ctr.z,
+										   (a == 0) ? bend_size.x : (a == 1) ? bend_size.y : bend_size.z ) );
 	}
+}
+
+// Run deform ops on shape positions
+// - each block loads positions into x/y/z streams, runs every op as a plain float
+//   loop over the block (auto-vectorized), then stores positions back
+void Deform::RunOps ( std::vector<DeformOp>& ops, Shape* shapes, int cnt )
+{
+	if ( ops.size() == 0 ) return;
 
-	//----------- Bend along Y-axis, toward X-axis, rotation in Z-axis
-	ang = bend_amt.y;
-	if (ang != 0) {
-		sz = bend_size.y;
-		ctr = bend_ctr.y;
-		bsgn = (ang > 0) ? 1 : -1;
-		r = (360.0 / ang) * sz / (2 * 3.141592);		// C = 2*PI*r = 360/ang * L    -> when ang=360, length wraps to circumference
-		a0 = -fabs(ang) * ctr / sz;
-		a1 = ang + a0;
-		c = Vec3F(r, ctr, 0);
-		k = Vec3F(-r*bsgn,0,0); r1.fromAngleAxis( std::min(a0,a1) * bsgn * DEGtoRAD, Vec3F(0, 0, -1)); p = c + (k*r1); e = p.x;
-		Shape* s;
-		for (int n = 0; n < getNumShapes(); n++) {
-			s = getShape(n);
-			p = s->pos;
-			v = (ctr / sz) + (p.y - ctr) / sz;			// bend fraction (0 < v < 1)
-			k = Vec3F(-r * bsgn, 0, 0);			// toward X-axis
-			p.y = 0;									// move cross-section to 0
-			r1.fromAngleAxis((a0 + v * (a1 - a0)) * bsgn * DEGtoRAD, Vec3F(0, 0, -1));		// Z-axis
-			p *= r1;									// rotate cross-section		
-			p += c + (k * r1) - Vec3F(e,0,0);		// bend - shift section onto the circle
-			s->pos = p;
-			s->rot *= r1;
+	ParallelFor ( cnt, DEFORM_BLOCK, [&](int start, int end, int chunk) {
+		float px[DEFORM_BLOCK], py[DEFORM_BLOCK], pz[DEFORM_BLOCK];
+		float ax[DEFORM_BLOCK], ay[DEFORM_BLOCK], az[DEFORM_BLOCK];
+		int n = end - start;
+		Shape* s = shapes + start;
+		float t, v, c, sn, x, k;
+
+		for (int i = 0; i < n; i++) {
+			px[i] = s[i].pos.x;
+			py[i] = s[i].pos.y;
+			pz[i] = s[i].pos.z;
 		}
-	}
 
-	//----------- Bend along Z-axis, toward X-axis, rotation in Y
-	ang = bend_amt.z;
-	if (ang != 0) {
-		sz = bend_size.z;
-		ctr = bend_ctr.z;
-		bsgn = (ang > 0) ? 1 : -1;
-		r = (360.0 / ang) * sz / (2 * 3.141592);		// C = 2*PI*r = 360/ang * L    -> when ang=360, length wraps to circumference
-		a0 = -fabs(ang) * ctr / sz;
-		a1 = ang + a0;
-		c = Vec3F(r, 0, ctr);
-		k = Vec3F(-r * bsgn, 0, 0); r1.fromAngleAxis(std::min(a0, a1) * bsgn * DEGtoRAD, Vec3F(0, 1, 0)); p = c + (k * r1); e = p.x;
-		Shape* s;
-		for (int n = 0; n < getNumShapes(); n++) {
-			s = getShape(n);
-			p = s->pos;
-			v = (ctr / sz) + (p.z - ctr) / sz;		// bend fraction (0 < v < 1)
-			k = Vec3F(-r * bsgn, 0, 0);				// toward X-axis
-			p.z = 0;									// move cross-section to 0
-			r1.fromAngleAxis((a0 + v * (a1 - a0)) * bsgn * DEGtoRAD, Vec3F(0, 1, 0));		// Y-axis rotation 
-			p *= r1;									// rotate cross-section		
-			p += c + (k * r1) - Vec3F(e, 0, 0);		// bend - shift section onto the circle
-			s->pos = p;
-			s->rot *= r1;
+		for (int o = 0; o < ops.size(); o++) {
+			const DeformOp& op = ops[o];
+			switch ( op.type ) {
+			case DOP_FOLD:
+				for (int i = 0; i < n; i++) {
+					px[i] -= op.ctr.x;	py[i] -= op.ctr.y;	pz[i] -= op.ctr.z;
+					ax[i] = op.amt0.x + (op.amt1.x - op.amt0.x) * (px[i] / op.size.x);
+					ay[i] = op.amt0.y + (op.amt1.y - op.amt0.y) * (py[i] / op.size.y);
+					az[i] = op.amt0.z + (op.amt1.z - op.amt0.z) * (pz[i] / op.size.z);
+					// sign by side of the fold axis (conjugate = negative rotation)
+					ax[i] = (pz[i] == 0) ? 0 : (pz[i] < 0) ? ax[i] : -ax[i];
+					ay[i] = (px[i] == 0) ? 0 : (px[i] > 0) ? ay[i] : -ay[i];
+					az[i] = (px[i] == 0) ? 0 : (px[i] > 0) ? az[i] : -az[i];
+					ax[i] *= DEGtoRAD;
+					ay[i] *= DEGtoRAD;
+					az[i] *= DEGtoRAD;
+				}
+				// fold = qx * qy * qz, left turns first (see quat_conv.h)
+				TurnAxis ( 0, px, py, pz, ax, n );	TurnAxis ( 1, px, py, pz, ay, n );	TurnAxis ( 2, px, py, pz, az, n );
+				for (int i = 0; i < n; i++) {
+					px[i] += op.ctr.x;	py[i] += op.ctr.y;	pz[i] += op.ctr.z;
+				}
+				break;
+			case DOP_TWIST:
+				for (int i = 0; i < n; i++) {
+					px[i] -= op.ctr.x;	py[i] -= op.ctr.y;	pz[i] -= op.ctr.z;
+					t = px[i] / op.size.x;	ax[i] = t * (op.amt0.x + (op.amt1.x - op.amt0.x) * t) * DEGtoRAD;
+					t = py[i] / op.size.y;	ay[i] = t * (op.amt0.y + (op.amt1.y - op.amt0.y) * t) * DEGtoRAD;
+					t = pz[i] / op.size.z;	az[i] = t * (op.amt0.z + (op.amt1.z - op.amt0.z) * t) * DEGtoRAD;
+				}
+				// twist = qz * qy * qx
+				TurnAxis ( 2, px, py, pz, az, n );	TurnAxis ( 1, px, py, pz, ay, n );	TurnAxis ( 0, px, py, pz, ax, n );
+				for (int i = 0; i < n; i++) {
+					px[i] += op.ctr.x;	py[i] += op.ctr.y;	pz[i] += op.ctr.z;
+				}
+				break;
+			case DOP_BEND_X:			// rotation in Z. cross-section moved to x=0, turned, shifted onto the circle
+				k = -op.r * op.sgn;
+				for (int i = 0; i < n; i++) {
+					v = (op.bctr / op.bsz) + (px[i] - op.bctr) / op.bsz;		// bend fraction (0 < v < 1)
+					t = (op.a0 + v * (op.a1 - op.a0)) * op.sgn * DEGtoRAD;
+					c = cosf ( t );	sn = sinf ( t );
+					px[i] = op.bctr - sn * (py[i] + k);
+					py[i] = op.r + c * (py[i] + k) - op.e;
+				}
+				break;
+			case DOP_BEND_Y:			// rotation in -Z
+				k = -op.r * op.sgn;
+				for (int i = 0; i < n; i++) {
+					v = (op.bctr / op.bsz) + (py[i] - op.bctr) / op.bsz;
+					t = -(op.a0 + v * (op.a1 - op.a0)) * op.sgn * DEGtoRAD;
+					c = cosf ( t );	sn = sinf ( t );
+					x = px[i] + k;
+					px[i] = op.r + c * x - op.e;
+					py[i] = op.bctr + sn * x;
+				}
+				break;
+			case DOP_BEND_Z:			// rotation in Y
+				k = -op.r * op.sgn;
+				for (int i = 0; i < n; i++) {
+					v = (op.bctr / op.bsz) + (pz[i] - op.bctr) / op.bsz;
+					t = (op.a0 + v * (op.a1 - op.a0)) * op.sgn * DEGtoRAD;
+					c = cosf ( t );	sn = sinf ( t );
+					x = px[i] + k;
+					px[i] = op.r + c * x - op.e;
+					pz[i] = op.bctr - sn * x;
+				}
+				break;
+			};
 		}
-	}
+
+		for (int i = 0; i < n; i++)
+			s[i].pos.Set ( px[i], py[i], pz[i] );
+	} );
 }
 
-void Deform::DeformTwist()
-{
-	Vec3F p;
-	Vec3F dp;
-	Vec3F u;
-	Quaternion q, q1, q2, q3;
+//-------------------------------- Self test
 
-	// Twist is simply a rotation along the twist axis
-	//      v             v = fraction of rotation = x / s
-	//      |
-	// --x--|----------s  --> twist axis, where s = twist_size.x 
-	//      |
-
-	Vec3F twist_ctr = getParamV3(D_TWIST_CTR);
-	Vec3F twist_size = getParamV3(D_TWIST_SIZE);
-	Vec3F twist_amt0 = getParamV3(D_TWIST_AMT0);
-	Vec3F twist_amt1 = getParamV3(D_TWIST_AMT1);
-	
-	Shape* s;
-	Vec3F t;
-	Vec3F amt;
-	for (int n = 0; n < getNumShapes(); n++) {
-		s = getShape(n);
-		p = s->pos - twist_ctr;
-		t = p / twist_size;
-		amt = twist_amt0 + (twist_amt1-twist_amt0)*t;
+// Per-shape quaternion reference (the deform path before fusing)
+static void RefFold ( const DeformOp& op, Shape* s, int cnt )
+{
+	Vec3F p, t, amt;
+	Quaternion q1, q2, q3, qx;
+	for (int n = 0; n < cnt; n++) {
+		p = s[n].pos - op.ctr;
+		t = p / op.size;
+		amt = op.amt0 + (op.amt1 - op.amt0) * t;
+		q1.fromAngleAxis( amt.x * DEGtoRAD, Vec3F(1, 0, 0));
+		q2.fromAngleAxis( amt.y * DEGtoRAD, Vec3F(0, 1, 0));
+		q3.fromAngleAxis( amt.z * DEGtoRAD, Vec3F(0, 0, 1));
+		qx = (p.z == 0) ? q1.identity() : (p.z < 0) ? q1 : q1.conjugate();
+		qx *= (p.x == 0) ? q2.identity() : (p.x > 0) ? q2 : q2.conjugate();
+		qx *= (p.x == 0) ? q3.identity() : (p.x > 0) ? q3 : q3.conjugate();
+		p *= qx;
+		s[n].pos = p + op.ctr;
+	}
+}
 
+static void RefTwist ( const DeformOp& op, Shape* s, int cnt )
+{
+	Vec3F p, t, amt;
+	Quaternion q1, q2, q3;
+	for (int n = 0; n < cnt; n++) {
+		p = s[n].pos - op.ctr;
+		t = p / op.size;
+		amt = op.amt0 + (op.amt1 - op.amt0) * t;
 		q1.fromAngleAxis(t.x * amt.x * DEGtoRAD, Vec3F(1, 0, 0));
 		q2.fromAngleAxis(t.y * amt.y * DEGtoRAD, Vec3F(0, 1, 0));
 		q3.fromAngleAxis(t.z * amt.z * DEGtoRAD, Vec3F(0, 0, 1));
 		q1 = q3 * q2 * q1;
-
 		p *= q1;
-		q = s->rot * q1;
+		s[n].pos = p + op.ctr;
+	}
+}
 
-		s->pos = p + twist_ctr;
-		s->rot = q;
+static void RefBend ( int a, float ang, float ctr, float sz, Shape* s, int cnt )
+{
+	Vec3F axis = (a == 0) ? Vec3F(0, 0, 1) : (a == 1) ? Vec3F(0, 0, -1) : Vec3F(0, 1, 0);
+	float bsgn = (ang > 0) ? 1 : -1;
+	float r = (360.0 / ang) * sz / (2 * 3.141592);
+	float a0 = -fabs(ang) * ctr / sz;
+	float a1 = ang + a0;
+	Vec3F c = (a == 0) ? Vec3F(ctr, r, 0) : (a == 1) ? Vec3F(r, ctr, 0) : Vec3F(r, 0, ctr);
+	Vec3F k = (a == 0) ? Vec3F(0, -r * bsgn, 0) : Vec3F(-r * bsgn, 0, 0);
+	Vec3F p, e;
+	Quaternion r1;
+	r1.fromAngleAxis ( std::min(a0, a1) * bsgn * DEGtoRAD, axis );
+	p = c + (k * r1);
+	e = (a == 0) ? Vec3F(0, p.y, 0) : Vec3F(p.x, 0, 0);
+	float v;
+	for (int n = 0; n < cnt; n++) {
+		p = s[n].pos;
+		v = (a == 0) ? p.x : (a == 1) ? p.y : p.z;
+		v = (ctr / sz) + (v - ctr) / sz;
+		if ( a == 0 ) p.x = 0; else if ( a == 1 ) p.y = 0; else p.z = 0;
+		r1.fromAngleAxis ( (a0 + v * (a1 - a0)) * bsgn * DEGtoRAD, axis );
+		p *= r1;
+		p += c + (k * r1) - e;
+		s[n].pos = p;
 	}
 }
 
-void Deform::DeformFold()
+static int CompareShapes ( Shape* a, Shape* b, int cnt )
 {
-	Vec3F p;
-	Vec3F dp;
-	Vec3F u;
-	Quaternion q, q1, q2, q3, qx;
+	int wrong = 0;
+	for (int n = 0; n < cnt; n++)
+		if ( (a[n].pos - b[n].pos).Length() > 1e-3f * (1.0f + b[n].pos.Length()) ) wrong++;
+	return wrong;
+}
 
-	// Folding is a constant rotation that is neg/pos on either side of the axis,
-	// where the angle is same on both sides
-	//    \    /
-	//     \  /       looking straight down x-axis
-	//     a\/a
-	//  <---0----> z-axis     0 = origin
-	//
-	Vec3F fold_ctr = getParamV3(D_FOLD_CTR);
-	Vec3F fold_size = getParamV3(D_FOLD_SIZE);
-	Vec3F fold_amt0 = getParamV3(D_FOLD_AMT0);
-	Vec3F fold_amt1 = getParamV3(D_FOLD_AMT1);
-
-	Shape* s;
-	Vec3F t, amt;
-	for (int n = 0; n < getNumShapes(); n++) {
-		s = getShape(n);
-		p = s->pos - fold_ctr;
-		t = p / fold_size;
-		amt = fold_amt0 + (fold_amt1 - fold_amt0) * t;
+// Fused block ops match the per-shape quaternion path
+// - fold, twist and each bend alone, then all chained as one op list
+// - shapes span several blocks, some lie on the fold planes (x=0, z=0)
+int Deform::SelfTest ()
+{
+	int bad = 0;
+	int cnt = 2 * DEFORM_BLOCK + 37;
+	std::vector<Shape> src ( cnt ), ref, fused;
+	for (int n = 0; n < cnt; n++) {
+		src[n].pos.Set ( hashRandF(23, n*3) * 4 - 2, hashRandF(23, n*3+1) * 6, hashRandF(23, n*3+2) * 4 - 2 );
+		if ( n % 17 == 0 ) src[n].pos.x = 0;
+		if ( n % 13 == 0 ) src[n].pos.z = 0;
+	}
+	DeformOp fold, twist;
+	fold.type = DOP_FOLD;
+	fold.ctr.Set ( 0.1f, 0, -0.2f );	fold.size.Set ( 2, 3, 2 );
+	fold.amt0.Set ( 10, -5, 20 );		fold.amt1.Set ( 30, 15, -10 );
+	twist.type = DOP_TWIST;
+	twist.ctr.Set ( 0, 1, 0 );			twist.size.Set ( 3, 6, 4 );
+	twist.amt0.Set ( 5, 40, -15 );		twist.amt1.Set ( 25, 90, 10 );
+	float bang[3] = { 60, -45, 80 }, bctr[3] = { 0.5f, 2.0f, -0.5f }, bsz[3] = { 4, 6, 3 };
+	std::vector<DeformOp> ops;
 
-		q1.fromAngleAxis( amt.x * DEGtoRAD, Vec3F(1, 0, 0));
-		q2.fromAngleAxis( amt.y * DEGtoRAD, Vec3F(0, 1, 0));
-		q3.fromAngleAxis( amt.z * DEGtoRAD, Vec3F(0, 0, 1));		
+	ref = src;	RefFold ( fold, &ref[0], cnt );
+	fused = src;	ops.assign ( 1, fold );		RunOps ( ops, &fused[0], cnt );
+	bad += selfCheck ( CompareShapes ( &fused[0], &ref[0], cnt ) == 0, "deform", "fold differs from reference" );
 
-		qx = (p.z == 0) ? q1.identity() : (p.z < 0) ? q1 : q1.conjugate();		// quaternion conjugate = negative rotation
-		qx *= (p.x == 0) ? q2.identity() : (p.x > 0) ? q2 : q2.conjugate();
-		qx *= (p.x == 0) ? q3.identity() : (p.x > 0) ? q3 : q3.conjugate();
-		p *= qx;
-		q = s->rot * qx;
+	ref = src;	RefTwist ( twist, &ref[0], cnt );
+	fused = src;	ops.assign ( 1, twist );	RunOps ( ops, &fused[0], cnt );
+	bad += selfCheck ( CompareShapes ( &fused[0], &ref[0], cnt ) == 0, "deform", "twist differs from reference" );
 
-		s->pos = p + fold_ctr;
-		s->rot = q;
+	int wrong = 0;
+	for (int a = 0; a < 3; a++) {
+		ref = src;	RefBend ( a, bang[a], bctr[a], bsz[a], &ref[0], cnt );
+		fused = src;	ops.assign ( 1, getBendOp ( a, bang[a], bctr[a], bsz[a] ) );	RunOps ( ops, &fused[0], cnt );
+		wrong += CompareShapes ( &fused[0], &ref[0], cnt );
 	}
+	bad += selfCheck ( wrong == 0, "deform", "bend differs from reference" );
+
+	ref = src;
+	RefFold ( fold, &ref[0], cnt );
+	RefTwist ( twist, &ref[0], cnt );
+	for (int a = 0; a < 3; a++) RefBend ( a, bang[a], bctr[a], bsz[a], &ref[0], cnt );
+	ops.clear ();
+	ops.push_back ( fold );
+	ops.push_back ( twist );
+	for (int a = 0; a < 3; a++) ops.push_back ( getBendOp ( a, bang[a], bctr[a], bsz[a] ) );
+	fused = src;	RunOps ( ops, &fused[0], cnt );
+	bad += selfCheck ( CompareShapes ( &fused[0], &ref[0], cnt ) == 0, "deform", "chained ops differ from reference" );
+
+	return selfReport ( "deform", bad );
 }
 
+// Collapsed deform
+// - hidden, and its output feeds exactly one object: a defm, through "shapes"
+bool Deform::isCollapsed ()
+{
+	if ( isVisible() ) return false;						// rendered, output is consumed
+
+	Object* out = getOutput();
+	objID out_id = (out != 0x0) ? out->getID() : OBJ_NULL;
+	Object* obj;
+	Object* user = 0x0;
+	int users = 0;
+	for (int n = 0; n < gAssets.getNumObj(); n++) {
+		obj = gAssets.getObj(n);
+		if ( obj == 0x0 ) continue;
+		for (int i = 0; i < obj->getNumInputs(); i++) {
+			if ( obj->getInput(i) == getID() || (out_id != OBJ_NULL && obj->getInput(i) == out_id) ) {
+				users++;
+				user = obj;
+			}
+		}
+	}
+	if ( users != 1 || user->getType() != 'defm' ) return false;
+	return user->getInput ( "shapes" ) == this;
+}
 
 void Deform::Generate (int x, int y)
 {
 	CreateOutput ( 'Ashp' );
 
+	// Collapsed, the downstream defm applies our ops
+	if ( isCollapsed() ) {
+		MarkClean();
+		return;
+	}
+
+	// Upstream chain of collapsed deforms, applied first
+	std::vector<Deform*> chain;
+	chain.push_back ( this );
+	Deform* d = this;
+	Deform* up;
+	while ( (up = dynamic_cast<Deform*>( d->getInput("shapes") )) != 0x0 && up->isCollapsed() ) {
+		chain.insert ( chain.begin(), up );
+		d = up;
+	}
+
 	// Copy input shapes
-	if (!CopyShapesFromInput ( "shapes" )) return;
+	Shapes* src = d->getInputShapes ( "shapes" );
+	if ( src == 0x0 ) return;
+	int first, cnt = src->getNumShapes();
+	Shape* dest = AddShapes ( cnt, first );
+	if ( dest == 0x0 ) return;
+	memcpy ( dest, src->getShape(0), cnt * sizeof(Shape) );
 
-	// Deform
-	DeformFold();
-	DeformTwist();
-	DeformBend();
+	// Deform (fold, twist, bend), fused over the chain
+	std::vector<DeformOp> ops;
+	for (int i = 0; i < chain.size(); i++)
+		chain[i]->AddOps ( ops );
+	RunOps ( ops, dest, cnt );
 
 	// Place end-to-end
 	PlaceShapesEndToEnd();
 	
 	MarkClean();
 }
-
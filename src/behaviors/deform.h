@@ -16,7 +16,30 @@
 	#define DEF_DEFORM
 
 	#include "object.h"	
-	
+	#include <vector>
+
+	// Deform ops
+	// - bend, twist & fold only move positions. rotation, length and pivot are
+	//   rebuilt from the deformed positions (PlaceShapesEndToEnd)
+	// - all enabled ops run fused in one pass over position streams (x, y, z), in
+	//   blocks of DEFORM_BLOCK shapes, blocks in parallel
+	// - a defm whose output only feeds another (hidden, single consumer) is collapsed:
+	//   the downstream node applies its ops too, the upstream node outputs nothing
+
+	#define DOP_FOLD		0
+	#define DOP_TWIST		1
+	#define DOP_BEND_X		2			// along X, toward Y
+	#define DOP_BEND_Y		3			// along Y, toward X
+	#define DOP_BEND_Z		4			// along Z, toward X
+
+	#define DEFORM_BLOCK	256
+
+	struct DeformOp {
+		int			type;
+		Vec3F		ctr, size, amt0, amt1;				// fold & twist
+		float		bctr, bsz, a0, a1, sgn, r, e;		// bend
+	};
+
 	class Deform : public Object {
 	public:
 
@@ -26,9 +49,12 @@
 		//virtual void Sketch (int w,int h, Camera3D* cam);
 		//virtual void Run(float time);
 		
-		void DeformBend();
-		void DeformTwist();
-		void DeformFold ();
+		void AddOps ( std::vector<DeformOp>& ops );
+		static void RunOps ( std::vector<DeformOp>& ops, Shape* s, int cnt );
+
+		bool isCollapsed ();				// output consumed only by a downstream defm
+
+		static int SelfTest ();
 
 	private:
 
@@ -20,13 +20,140 @@
 #include "mesh.h"
 #include "image.h"
 #include "material.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "blob_cache.h"
+#include "selftest.h"
 
 #include "gxlib.h"
 
 #include <stack>
 #include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <map>
+#include <deque>
 
 #define D_SUBDIVS	0
+#define D_MAX_ERROR	1
+#define D_CACHE		2
+
+#define D_CACHE_VERSION		2				// bump when generated output changes
+#define D_CACHE_BUDGET		(512ULL << 20)	// in-memory cache bytes
+
+// Filtered displacement sampler
+// - bilinear, u wraps, v clamps. result in [0,1]
+// - batched over a face so the 16-bit path is a tight loop without calls or branches
+//
+struct DispSampler {
+	Image*			img;
+	const uint16_t*	pix;
+	int				w, h;
+
+	void Sample ( const Vec2F* uv, Vec2F ofs, float* out, int cnt )
+	{
+		if ( pix == 0x0 ) {
+			for (int i = 0; i < cnt; i++)
+				out[i] = img->GetPixelFilteredUV16 ( uv[i].x + ofs.x, uv[i].y + ofs.y );
+			return;
+		}
+		const float inv = 1.0f / 65535.0f;
+		for (int i = 0; i < cnt; i++) {
+			float x = (uv[i].x + ofs.x) * w - 0.5f;
+			float y = (uv[i].y + ofs.y) * h - 0.5f;
+			x -= floorf( x / w ) * w;									// wrap u
+			y = std::min( std::max( y, 0.0f ), float(h - 1) );			// clamp v
+			int x0 = std::min( int(x), w - 1 );
+			int y0 = int(y);
+			int x1 = (x0 + 1 == w) ? 0 : x0 + 1;
+			int y1 = std::min( y0 + 1, h - 1 );
+			float fx = x - x0, fy = y - y0;
+			const uint16_t* r0 = pix + size_t(y0) * w;
+			const uint16_t* r1 = pix + size_t(y1) * w;
+			float a = r0[x0] + (r0[x1] - float(r0[x0])) * fx;
+			float b = r1[x0] + (r1[x1] - float(r1[x0])) * fx;
+			out[i] = (a + (b - a) * fy) * inv;
+		}
+	}
+};
+
+// Tangent frame of a source triangle, T = dP/du, B = dP/dv
+static void TangentFrame ( Vec3F* v, Vec2F* t, Vec3F& T, Vec3F& B )
+{
+	float du1 = t[1].x - t[0].x, dv1 = t[1].y - t[0].y;
+	float du2 = t[2].x - t[0].x, dv2 = t[2].y - t[0].y;
+	float det = du1 * dv2 - du2 * dv1;
+	if ( fabs(det) > 1e-12 ) {
+		T = ((v[1] - v[0]) * dv2 - (v[2] - v[0]) * dv1) / det;
+		B = ((v[2] - v[0]) * du1 - (v[1] - v[0]) * du2) / det;
+	} else {
+		T.Set(0,0,0); B.Set(0,0,0);
+	}
+}
+
+// Displaced normal from the height gradient (hu = dh/du, hv = dh/dv, already scaled by depth)
+// - surface gradients of u,v: grad u = (B x N)/J, grad v = (N x T)/J, J = N.(T x B)
+static Vec3F GradientNormal ( Vec3F norm, Vec3F& T, Vec3F& B, float hu, float hv )
+{
+	Vec3F gu, gv, c;
+	c = B; c.Cross ( norm );	gu = c;
+	c = norm; c.Cross ( T );	gv = c;
+	c = T; c.Cross ( B );
+	float J = (float) norm.Dot ( c );
+	if ( fabs(J) > 1e-12 ) {
+		norm = norm - gu * (hu / J) - gv * (hv / J);
+		norm.Normalize ();
+	}
+	return norm;
+}
+
+// Generated displacement mesh
+struct DispMesh {
+	std::vector<Vec3F>	pos, norm;
+	std::vector<Vec2F>	tex;
+	std::vector<AttrV3>	faces;
+
+	uint64_t getBytes ()	{ return pos.size() * (2*sizeof(Vec3F) + sizeof(Vec2F)) + faces.size() * sizeof(AttrV3); }
+};
+
+// Displacement result cache
+// - content-addressed, shared by all displace nodes. same inputs give the same key
+// - in memory up to D_CACHE_BUDGET, oldest entries dropped first
+// - optional disk blob per key (displace_{key}.bin in the BlobCache directory), reused on next start
+//
+static std::map<uint64_t, DispMesh>	gDispCache;
+static std::deque<uint64_t>			gDispOrder;
+static uint64_t						gDispBytes = 0;
+
+// Triangle grid topology with n segments per edge
+// - same vertex & face order as BuildSubdiv. vertex i at grid (u,v), b1 = u/n, b0 = v/n
+//
+struct TriGrid {
+	int					n;
+	std::vector<int>	u, v;
+	std::vector<AttrV3>	f;
+
+	void Build ( int segs )
+	{
+		n = segs;
+		int s = n + 1;						// points per edge
+		for (int j = 0; j < s; j++)
+			for (int i = 0; i < s - j; i++) { u.push_back(i); v.push_back(j); }
+		AttrV3 a;
+		int c0 = 0, c;
+		for (int j = 0; j < s-1; j++) {
+			c = c0;
+			for (int i = 0; i <= s - j - 2; i++) {
+				a.v1 = c + (s-j);	a.v2 = c + 1;		a.v3 = c;				f.push_back ( a );
+				if (i < s-j-2) {
+					a.v1 = c + 1;	a.v2 = c + (s-j);	a.v3 = c + (s-j) + 1;	f.push_back ( a );
+				}
+				c++;
+			}
+			c0 += s - j;
+		}
+	}
+};
 
 Displace::Displace() : Object()
 {
@@ -40,6 +167,8 @@ void Displace::Define(int x, int y)
 	AddInput("mesh0", 'Amsh');
 
 	AddParam(D_SUBDIVS, "subdivs", "i");	SetParamI(D_SUBDIVS, 0, 16);
+	AddParam(D_CACHE, "cache", "i");		SetParamI(D_CACHE, 0, 1);			// result cache, 0 = off, 1 = memory, 2 = memory & disk
+	AddParam(D_MAX_ERROR, "max_error", "f");	SetParamF(D_MAX_ERROR, 0, 0);		// adaptive subdivision error bound (object units), 0 = uniform
 
 	//----------- static common
 	// LOD grids	
@@ -73,6 +202,8 @@ void Displace::BuildSubdiv ()
 
 	int subdivs = 1 + getParamI( D_SUBDIVS );
 
+	mesh->CreateFV ();			// clear previous grid
+
 	Shape* xfm = mesh->getLocalXform();
 	xfm->pos.Set( 0, 0, 0 );
 			
@@ -149,112 +280,472 @@ void Displace::Generate (int x, int y)
 	s->rot.Identity();		
 	
 	// Get pre-divided triangle grid
+	// - shared by all displace nodes, rebuilt when subdivs differs from the current grid
 	Mesh* trimesh;
 	trimesh = (Mesh*) getInput ( "mesh0" );	
-	if ( trimesh->GetNumVert()==0 )
+	int tri_r = 1 + getParamI( D_SUBDIVS );
+	if ( trimesh->GetNumVert() != tri_r * (tri_r+1) / 2 )
 		BuildSubdiv ();		// build subdiv tri grid
 
-	int subdivs = 1 + getParamI( D_SUBDIVS );
+	Vec4F displace_depth = mtl->getParamV4 ( M_DISPLACE_DEPTH );
+	float depth = displace_depth.y;
 
-	// Sub-divide each triangle in source
-	int src_numv, src_numf;
-	int tri_numv, tri_numf;
-	float b0, b1, b2;
-	Vec3F v[3], pos;
-	Vec3F n[3], norm;
-	Vec2F t[3], uv;
+	// 16-bit displacement sampled directly from pixels, other formats through the image
+	DispSampler smp;
+	smp.img = img;
+	smp.pix = (img->GetFormat() == ImageOp::BW16) ? (const uint16_t*) img->GetData() : 0x0;
+	smp.w = res.x;
+	smp.h = res.y;
 
-	src_numv = mesh_in->GetNumVert();
-	src_numf = mesh_in->GetNumFace3();
-	tri_numv = trimesh->GetNumVert();
-	tri_numf = trimesh->GetNumFace3();
+	dbgprintf( "  Displace node:\n");
 
-	int maxv = src_numf * tri_numv;
-	int maxf = src_numf * tri_numf;
+	// Cached result, key from input mesh, displacement image & params
+	float max_err = getParamF( D_MAX_ERROR );
+	int cache = getParamI( D_CACHE );
+	uint64_t key = (cache > 0) ? CacheKey ( mesh_in, trimesh, img, displace_depth ) : 0;
+	DispMesh* dm = (cache > 0) ? CacheFind ( key, cache > 1 ) : 0x0;
+	DispMesh out;
+
+	if ( dm == 0x0 ) {
+		if ( max_err > 0 )
+			GenerateAdaptive ( mesh_in, &smp, depth, max_err, out );		// adaptive subdivision
+		else
+			GenerateUniform ( mesh_in, trimesh, &smp, depth, out );			// uniform subdivision
+		dm = CacheStore ( key, out, cache );
+	} else {
+		dbgprintf( "    Cached result %s\n", hashToStr(key).c_str() );
+	}
 
-	dbgprintf( "  Displace node:\n");
+	// output mesh, one copy per buffer
+	if ( dm->pos.size() > 0 ) {
+		mesh_out->MemcpyBuffer ( BVERTPOS,	&dm->pos[0],	dm->pos.size() * sizeof(Vec3F),		(int) dm->pos.size() );
+		mesh_out->MemcpyBuffer ( BVERTNORM,	&dm->norm[0],	dm->norm.size() * sizeof(Vec3F),	(int) dm->norm.size() );
+		mesh_out->MemcpyBuffer ( BVERTTEX,	&dm->tex[0],	dm->tex.size() * sizeof(Vec2F),		(int) dm->tex.size() );
+		mesh_out->MemcpyBuffer ( BFACEV3,	&dm->faces[0],	dm->faces.size() * sizeof(AttrV3),	(int) dm->faces.size() );
+	}
 
-	dbgprintf ( "    Sub-dividing.." );
-	for (int f=0; f < src_numf; f++) {
+	Vec4F stat = mesh_out->GetStats();
+	dbgprintf ( "    Mesh. %4.2f bytes, %8.0f faces\n", stat.x, stat.y );
 
-		if (f % 100==0) dbgprintf ( "%2.0f%% ", float(f)*100.0 / src_numf);
+	mesh_out->MarkDirty ();
 
-		// get source triangle
-		AttrV3* face = mesh_in->GetFace3(f);
-		v[0] = *mesh_in->GetVertPos(face->v1);
-		v[1] = *mesh_in->GetVertPos(face->v2);
-		v[2] = *mesh_in->GetVertPos(face->v3);
-		t[0] = *mesh_in->GetVertTex(face->v1);
-		t[1] = *mesh_in->GetVertTex(face->v2);
-		t[2] = *mesh_in->GetVertTex(face->v3);
-		n[0] = *mesh_in->GetVertNorm(face->v1);
-		n[1] = *mesh_in->GetVertNorm(face->v2);
-		n[2] = *mesh_in->GetVertNorm(face->v3);
-
-		// replace with triangle sub-grid
-		mesh_out->AppendMesh ( trimesh, maxf, maxv );
-
-		int first_v = mesh_out->GetNumVert() - tri_numv;	// index of first vertex for this group
-
-		// destination buffers  
-		Vec3F* dest_vpos =	mesh_out->GetElemVec3 ( BVERTPOS,	first_v );
-		Vec3F* dest_vnorm =	mesh_out->GetElemVec3 ( BVERTNORM,	first_v );
-		Vec2F* dest_vtex =	mesh_out->GetElemVec2 ( BVERTTEX,	first_v );
-
-		for (int vi = 0; vi < subdivs; vi++) {
-			for (int ui = 0; ui < subdivs - vi; ui++) {
-				b1 = float(ui)/(subdivs-1);		// barycentric coordinates
-				b0 = float(vi)/(subdivs-1);
-				b2 = 1-b0-b1;
-				uv =  t[0]*b0 + t[1]*b1 + t[2]*b2;		// interpolate vertex components
-				norm= n[0]*b0 + n[1]*b1 + n[2]*b2;
-				pos = v[0]*b0 + v[1]*b1 + v[2]*b2;
-				norm.Normalize();
-				*dest_vpos++ = pos;
-				*dest_vnorm++ = norm;
-				*dest_vtex++ = uv;				
-			}
-		}		
+	MarkDirty ();
+}
+
+
+// Adaptive subdivision
+// - per-triangle level, a power of 2 up to subdivs, is the coarsest whose piecewise-linear
+//   height over the triangle's uv footprint stays within max_error of the finest grid
+// - shared edges use the coarser level of the two faces. edge vertices are placed on the canonical
+//   coarse edge (ordered by vertex index), so both faces produce identical positions, no cracks
+//
+void Displace::GenerateAdaptive ( Mesh* mesh_in, DispSampler* smp, float depth, float max_err, DispMesh& out )
+{
+	int src_numf = mesh_in->GetNumFace3();
+	if ( src_numf == 0 ) return;
+
+	// levels
+	int S = 1;
+	while ( S * 2 <= getParamI( D_SUBDIVS ) ) S *= 2;
+	std::vector<TriGrid> grids;
+	for (int n = 1; n <= S; n *= 2) {
+		grids.push_back ( TriGrid() );
+		grids.back().Build ( n );
 	}
-	dbgprintf ( "\n" );
+	TriGrid& fine = grids.back();
+	int fine_numv = (int) fine.u.size();
+	std::vector<int> rowstart ( S + 2 );
+	for (int j = 0, c = 0; j <= S + 1; j++) { rowstart[j] = c; c += S + 1 - j; }
+
+	dbgprintf( "    Adaptive sub-division of %d faces, max level %d, max error %f..\n", src_numf, S, max_err );
+
+	// Pass 1. Measure error and pick level per face
+	std::vector<int> level ( src_numf );
+	ParallelFor ( src_numf, 256, [&](int start, int end, int chunk) {
+		Vec2F t[3];
+		std::vector<Vec2F> uv ( fine_numv );
+		std::vector<float> H ( fine_numv );
+		for (int f = start; f < end; f++) {
+			AttrV3* face = mesh_in->GetFace3(f);
+			t[0] = *mesh_in->GetVertTex(face->v1);	t[1] = *mesh_in->GetVertTex(face->v2);	t[2] = *mesh_in->GetVertTex(face->v3);
+			for (int i = 0; i < fine_numv; i++) {
+				float b1 = float(fine.u[i]) / S, b0 = float(fine.v[i]) / S;
+				uv[i] = t[0]*b0 + t[1]*b1 + t[2]*(1 - b0 - b1);
+			}
+			smp->Sample ( &uv[0], Vec2F(0,0), &H[0], fine_numv );
+
+			int lev = (int) grids.size() - 1;
+			for (int g = 0; g < grids.size() - 1; g++) {
+				int step = S / grids[g].n;
+				float err = 0, hi, fx, fy, h00, h10, h01, h11;
+				for (int i = 0; i < fine_numv && err * depth <= max_err; i++) {
+					int u = fine.u[i], v = fine.v[i];
+					int cu = (u / step) * step, cv = (v / step) * step;
+					if ( cu == u && cv == v ) continue;
+					fx = float(u - cu) / step;
+					fy = float(v - cv) / step;
+					h00 = H[ rowstart[cv] + cu ];
+					h10 = H[ rowstart[cv] + cu + step ];
+					h01 = H[ rowstart[cv + step] + cu ];
+					if ( fx + fy <= 1 ) {
+						hi = h00 + (h10 - h00) * fx + (h01 - h00) * fy;
+					} else {
+						h11 = H[ rowstart[cv + step] + cu + step ];
+						hi = h11 + (h01 - h11) * (1 - fx) + (h10 - h11) * (1 - fy);
+					}
+					err = std::max( err, (float) fabs( H[i] - hi ) );
+				}
+				if ( err * depth <= max_err ) { lev = g; break; }
+			}
+			level[f] = lev;
+		}
+	});
 
+	// Pass 2. Edge levels, min of the faces sharing each edge
+	// edge k of a face joins corners (k, k+1)
+	std::vector< std::pair<uint64_t, int> > edges ( src_numf * 3 );
+	for (int f = 0; f < src_numf; f++) {
+		AttrV3* face = mesh_in->GetFace3(f);
+		uint32_t g[3] = { (uint32_t) face->v1, (uint32_t) face->v2, (uint32_t) face->v3 };
+		for (int k = 0; k < 3; k++) {
+			uint32_t a = g[k], b = g[(k+1) % 3];
+			edges[f*3 + k].first = (uint64_t( std::min(a,b) ) << 32) | std::max(a,b);
+			edges[f*3 + k].second = f*3 + k;
+		}
+	}
+	std::sort ( edges.begin(), edges.end() );
+	std::vector<int> edge_lev ( src_numf * 3 );
+	for (int i = 0, j; i < edges.size(); i = j) {
+		int lev = level[ edges[i].second / 3 ];
+		for (j = i + 1; j < edges.size() && edges[j].first == edges[i].first; j++)
+			lev = std::min( lev, level[ edges[j].second / 3 ] );
+		for (int k = i; k < j; k++)
+			edge_lev[ edges[k].second ] = lev;
+	}
 
-	// Displace vertices
-	src_numv = mesh_out->GetNumVert();
-	src_numf = mesh_out->GetNumFace3();
-	Vec3F* dest_vpos =	mesh_out->GetElemVec3 ( BVERTPOS,	0 );
-	Vec3F* dest_vnorm =	mesh_out->GetElemVec3 ( BVERTNORM,	0 );
-	Vec2F* dest_vtex =	mesh_out->GetElemVec2 ( BVERTTEX,	0 );
-	float h;
+	// Pass 3. Output offsets, sized once
+	std::vector<int> first_v ( src_numf + 1 ), first_f ( src_numf + 1 );
+	first_v[0] = 0; first_f[0] = 0;
+	for (int f = 0; f < src_numf; f++) {
+		TriGrid& gr = grids[ level[f] ];
+		first_v[f+1] = first_v[f] + (int) gr.u.size();
+		first_f[f+1] = first_f[f] + (int) gr.f.size();
+	}
+	int maxv = first_v[src_numf];
+	int maxf = first_f[src_numf];
+	std::vector<Vec3F>&		vpos = out.pos;		vpos.resize ( maxv );
+	std::vector<Vec3F>&		vnorm = out.norm;	vnorm.resize ( maxv );
+	std::vector<Vec2F>&		vtex = out.tex;		vtex.resize ( maxv );
+	std::vector<AttrV3>&	faces = out.faces;	faces.resize ( maxf );
+
+	// Pass 4. Subdivide & displace
+	float tx = 1.0f / smp->w, ty = 1.0f / smp->h;
+	ParallelFor ( src_numf, 256, [&](int start, int end, int chunk) {
+		Vec3F v[3], n[3], T, B, P, N;
+		Vec2F t[3], uv;
+		uint32_t g[3];
+		std::vector<float> h, hu0, hu1, hv0, hv1;
+		std::vector<Vec3F> nrm;
+		float hc;
+
+		// coarse vertex j of e on edge lo->hi, computed only from edge data so both faces agree
+		auto coarse = [&](int lo, int hi, int j, int e, Vec3F& pos, Vec3F& nm, Vec2F& tc) {
+			float s = float(j) / e;
+			tc = t[lo] * (1 - s) + t[hi] * s;
+			nm = n[lo] * (1 - s) + n[hi] * s;
+			nm.Normalize ();
+			smp->Sample ( &tc, Vec2F(0,0), &hc, 1 );
+			pos = v[lo] * (1 - s) + v[hi] * s + nm * hc * depth;
+		};
+
+		for (int f = start; f < end; f++) {
+			AttrV3* face = mesh_in->GetFace3(f);
+			g[0] = face->v1;	g[1] = face->v2;	g[2] = face->v3;
+			for (int k = 0; k < 3; k++) {
+				v[k] = *mesh_in->GetVertPos(g[k]);
+				t[k] = *mesh_in->GetVertTex(g[k]);
+				n[k] = *mesh_in->GetVertNorm(g[k]);
+			}
+			TangentFrame ( v, t, T, B );
+
+			TriGrid& gr = grids[ level[f] ];
+			int numv = (int) gr.u.size();
+			int nseg = gr.n;
+			Vec3F* dest_vpos = &vpos[ first_v[f] ];
+			Vec3F* dest_vnorm = &vnorm[ first_v[f] ];
+			Vec2F* dest_vtex = &vtex[ first_v[f] ];
+
+			// interpolate
+			nrm.resize ( numv );
+			for (int i = 0; i < numv; i++) {
+				float b1 = float(gr.u[i]) / nseg, b0 = float(gr.v[i]) / nseg;
+				dest_vtex[i] = t[0]*b0 + t[1]*b1 + t[2]*(1 - b0 - b1);
+				dest_vpos[i] = v[0]*b0 + v[1]*b1 + v[2]*(1 - b0 - b1);
+				nrm[i] = n[0]*b0 + n[1]*b1 + n[2]*(1 - b0 - b1);
+				nrm[i].Normalize ();
+			}
+			h.resize ( numv );
+			smp->Sample ( dest_vtex, Vec2F(0,0), &h[0], numv );
+			for (int i = 0; i < numv; i++)
+				dest_vpos[i] += nrm[i] * h[i] * depth;
+
+			// edge vertices. corner weights w0 = v, w1 = u, w2 = n-u-v
+			for (int i = 0; i < numv; i++) {
+				int w[3] = { gr.v[i], gr.u[i], nseg - gr.u[i] - gr.v[i] };
+				int k = (w[2] == 0) ? 0 : (w[0] == 0) ? 1 : (w[1] == 0) ? 2 : -1;
+				if ( k < 0 ) continue;
+				int a = k, b = (k + 1) % 3;
+				int lo = (g[a] < g[b]) ? a : b;
+				int hi = (lo == a) ? b : a;
+				int e = grids[ edge_lev[f*3 + k] ].n;
+				int j = (w[hi] * e) / nseg;
+				int rem = w[hi] * e - j * nseg;
+
+				coarse ( lo, hi, j, e, dest_vpos[i], nrm[i], dest_vtex[i] );
+				if ( rem != 0 ) {
+					float s = float(rem) / nseg;								// snap onto coarser edge
+					coarse ( lo, hi, j + 1, e, P, N, uv );
+					dest_vpos[i] = dest_vpos[i] * (1 - s) + P * s;
+					dest_vtex[i] = dest_vtex[i] * (1 - s) + uv * s;
+					nrm[i] = nrm[i] * (1 - s) + N * s;
+					nrm[i].Normalize ();
+				}
+			}
 
-	Vec4F displace_amt   = mtl->getParamV4 ( M_DISPLACE_AMT );
-	Vec4F displace_depth = mtl->getParamV4 ( M_DISPLACE_DEPTH );		
+			// normals from height gradient
+			hu0.resize ( numv ); hu1.resize ( numv ); hv0.resize ( numv ); hv1.resize ( numv );
+			smp->Sample ( dest_vtex, Vec2F(-tx, 0), &hu0[0], numv );
+			smp->Sample ( dest_vtex, Vec2F( tx, 0), &hu1[0], numv );
+			smp->Sample ( dest_vtex, Vec2F(0, -ty), &hv0[0], numv );
+			smp->Sample ( dest_vtex, Vec2F(0,  ty), &hv1[0], numv );
+			for (int i = 0; i < numv; i++)
+				dest_vnorm[i] = GradientNormal ( nrm[i], T, B, (hu1[i] - hu0[i]) * 0.5f * smp->w * depth, (hv1[i] - hv0[i]) * 0.5f * smp->h * depth );
+
+			// faces
+			AttrV3* dest_f = &faces[ first_f[f] ];
+			for (int i = 0; i < gr.f.size(); i++, dest_f++) {
+				dest_f->v1 = gr.f[i].v1 + first_v[f];
+				dest_f->v2 = gr.f[i].v2 + first_v[f];
+				dest_f->v3 = gr.f[i].v3 + first_v[f];
+			}
+		}
+	});
 
-	dbgprintf ( "    Displacing.." );
-	for (int v=0; v < src_numv; v++) {
+	dbgprintf ( "    Adaptive. %d faces (uniform: %d faces)\n", maxf, src_numf * S * S );
+}
 
-		if (v % 10000==0) dbgprintf ( "%2.0f%% ", float(v)*100.0 / src_numv);
 
-		uv = *dest_vtex;
-		uv.x = (uv.x > 0.999) ? 0 : uv.x;
+// Uniform subdivision
+// - output sized once, src_numf copies of the triangle grid
+// - faces processed in parallel chunks, each writes its own vertex & face range
+//
+void Displace::GenerateUniform ( Mesh* mesh_in, Mesh* trimesh, DispSampler* smp, float depth, DispMesh& out )
+{
+	int src_numf = mesh_in->GetNumFace3();
+	int tri_numv = trimesh->GetNumVert();
+	int tri_numf = trimesh->GetNumFace3();
+	int maxv = src_numf * tri_numv;
+	int maxf = src_numf * tri_numf;
+	if ( maxv == 0 || maxf == 0 ) return;
+
+	std::vector<Vec3F>&		vpos = out.pos;		vpos.resize ( maxv );
+	std::vector<Vec3F>&		vnorm = out.norm;	vnorm.resize ( maxv );
+	std::vector<Vec2F>&		vtex = out.tex;		vtex.resize ( maxv );
+	std::vector<AttrV3>&	faces = out.faces;	faces.resize ( maxf );
+
+	float tx = 1.0f / smp->w;			// one texel, for gradients
+	float ty = 1.0f / smp->h;
+
+	dbgprintf( "    Sub-dividing & displacing %d faces..\n", src_numf );
+
+	ParallelFor ( src_numf, 256, [&](int start, int end, int chunk) {
+		Vec3F v[3], n[3], T, B, norm;
+		Vec2F t[3], bc;
+		std::vector<float> h ( tri_numv ), hu0 ( tri_numv ), hu1 ( tri_numv ), hv0 ( tri_numv ), hv1 ( tri_numv );
+
+		for (int f = start; f < end; f++) {
+			// get source triangle
+			AttrV3* face = mesh_in->GetFace3(f);
+			v[0] = *mesh_in->GetVertPos(face->v1);	v[1] = *mesh_in->GetVertPos(face->v2);	v[2] = *mesh_in->GetVertPos(face->v3);
+			t[0] = *mesh_in->GetVertTex(face->v1);	t[1] = *mesh_in->GetVertTex(face->v2);	t[2] = *mesh_in->GetVertTex(face->v3);
+			n[0] = *mesh_in->GetVertNorm(face->v1);	n[1] = *mesh_in->GetVertNorm(face->v2);	n[2] = *mesh_in->GetVertNorm(face->v3);
+
+			TangentFrame ( v, t, T, B );
+
+			// interpolate vertex components, barycentric coords from the triangle grid
+			int first_v = f * tri_numv;
+			Vec3F* dest_vpos = &vpos[ first_v ];
+			Vec3F* dest_vnorm = &vnorm[ first_v ];
+			Vec2F* dest_vtex = &vtex[ first_v ];
+			for (int i = 0; i < tri_numv; i++) {
+				bc = *trimesh->GetVertTex(i);			// x = b1, y = b0
+				dest_vtex[i] = t[0]*bc.y + t[1]*bc.x + t[2]*(1 - bc.x - bc.y);
+				dest_vpos[i] = v[0]*bc.y + v[1]*bc.x + v[2]*(1 - bc.x - bc.y);
+				dest_vnorm[i] = n[0]*bc.y + n[1]*bc.x + n[2]*(1 - bc.x - bc.y);
+				dest_vnorm[i].Normalize();
+			}
 
-		h = img->GetPixelFilteredUV16 ( uv.x, uv.y );				
+			// batched height & gradient samples for the face
+			smp->Sample ( dest_vtex, Vec2F(0,0), &h[0], tri_numv );
+			smp->Sample ( dest_vtex, Vec2F(-tx, 0), &hu0[0], tri_numv );
+			smp->Sample ( dest_vtex, Vec2F( tx, 0), &hu1[0], tri_numv );
+			smp->Sample ( dest_vtex, Vec2F(0, -ty), &hv0[0], tri_numv );
+			smp->Sample ( dest_vtex, Vec2F(0,  ty), &hv1[0], tri_numv );
+
+			// displace along normal. normal perturbed by the surface gradient of height
+			for (int i = 0; i < tri_numv; i++) {
+				norm = dest_vnorm[i];
+				dest_vpos[i] += norm * h[i] * depth;
+				dest_vnorm[i] = GradientNormal ( norm, T, B, (hu1[i] - hu0[i]) * 0.5f * smp->w * depth, (hv1[i] - hv0[i]) * 0.5f * smp->h * depth );
+			}
 
-		*dest_vpos = *dest_vpos + (*dest_vnorm) * h * displace_depth.y;
+			// faces
+			AttrV3* dest_f = &faces[ f * tri_numf ];
+			for (int i = 0; i < tri_numf; i++, dest_f++) {
+				AttrV3* sf = trimesh->GetFace3(i);
+				dest_f->v1 = sf->v1 + first_v;
+				dest_f->v2 = sf->v2 + first_v;
+				dest_f->v3 = sf->v3 + first_v;
+			}
+		}
+	});
+}
 
-		dest_vpos++;
-		dest_vnorm++;
-		dest_vtex++;
-	} 
-	dbgprintf ("\n"); 
 
+// Cache key
+// - input mesh buffers, subdiv grid, displacement pixels, subdivision & material displacement params
+//
+uint64_t Displace::CacheKey ( Mesh* mesh_in, Mesh* trimesh, Image* img, Vec4F displace_depth )
+{
+	uint64_t h = hashValue ( 0, (int) D_CACHE_VERSION );
+	int bufs[4] = { BVERTPOS, BVERTNORM, BVERTTEX, BFACEV3 };
+	for (int b = 0; b < 4; b++) {
+		if ( !mesh_in->isActive(bufs[b]) ) continue;
+		h = hashBytes ( h, mesh_in->GetStart(bufs[b]), size_t(mesh_in->GetNumElem(bufs[b])) * mesh_in->GetBufStride(bufs[b]) );
+	}
+	int tbufs[2] = { BVERTTEX, BFACEV3 };			// grid used by GenerateUniform
+	for (int b = 0; b < 2; b++) {
+		if ( !trimesh->isActive(tbufs[b]) ) continue;
+		h = hashBytes ( h, trimesh->GetStart(tbufs[b]), size_t(trimesh->GetNumElem(tbufs[b])) * trimesh->GetBufStride(tbufs[b]) );
+	}
+	h = hashValue ( h, img->GetWidth() );
+	h = hashValue ( h, img->GetHeight() );
+	h = hashValue ( h, (int) img->GetFormat() );
+	h = hashBytes ( h, img->GetData(), size_t(img->GetWidth()) * img->GetHeight() * img->GetBytesPerPix() );
+	h = hashValue ( h, getParamI( D_SUBDIVS ) );
+	h = hashValue ( h, getParamF( D_MAX_ERROR ) );
+	h = hashValue ( h, displace_depth );
+	return h;
+}
 
-	Vec4F stat = mesh_out->GetStats();
-	dbgprintf ( "    Mesh. %4.2f bytes, %8.0f faces\n", stat.x, stat.y );
+DispMesh* Displace::CacheFind ( uint64_t key, bool disk )
+{
+	std::map<uint64_t, DispMesh>::iterator it = gDispCache.find ( key );
+	if ( it != gDispCache.end() ) return &it->second;
+	if ( !disk ) return 0x0;
+
+	// disk blob, count = verts, faces
+	BlobHeader hdr;
+	FILE* fp = BlobCache::OpenRead ( "displace", "DSPC", D_CACHE_VERSION, key, hdr );
+	if ( fp == 0x0 ) return 0x0;
+	int numv = hdr.count[0], numf = hdr.count[1];
+	DispMesh dm;
+	bool ok = numv > 0 && numf > 0;
+	if ( ok ) {
+		dm.pos.resize ( numv );	dm.norm.resize ( numv );	dm.tex.resize ( numv );	dm.faces.resize ( numf );
+		ok = fread ( &dm.pos[0],   sizeof(Vec3F),  numv, fp ) == numv
+			&& fread ( &dm.norm[0],  sizeof(Vec3F),  numv, fp ) == numv
+			&& fread ( &dm.tex[0],   sizeof(Vec2F),  numv, fp ) == numv
+			&& fread ( &dm.faces[0], sizeof(AttrV3), numf, fp ) == numf;
+	}
+	BlobCache::CloseRead ( fp, "displace", key, ok );
+	if ( !ok ) return 0x0;
+	return CacheStore ( key, dm, 1 );
+}
 
-	mesh_out->ComputeNormals ();
+// Store result, returns the cached copy (or dm itself when caching is off)
+DispMesh* Displace::CacheStore ( uint64_t key, DispMesh& dm, int cache )
+{
+	if ( cache <= 0 ) return &dm;
+
+	// disk blob
+	if ( cache > 1 && dm.pos.size() > 0 && dm.faces.size() > 0 ) {
+		BlobHeader hdr;
+		hdr.Set ( "DSPC", D_CACHE_VERSION, key );
+		int numv = hdr.count[0] = (int) dm.pos.size();
+		int numf = hdr.count[1] = (int) dm.faces.size();
+		FILE* fp = BlobCache::OpenWrite ( "displace", hdr );
+		if ( fp != 0x0 ) {
+			fwrite ( &dm.pos[0],   sizeof(Vec3F),  numv, fp );
+			fwrite ( &dm.norm[0],  sizeof(Vec3F),  numv, fp );
+			fwrite ( &dm.tex[0],   sizeof(Vec2F),  numv, fp );
+			fwrite ( &dm.faces[0], sizeof(AttrV3), numf, fp );
+			BlobCache::CloseWrite ( fp, "displace", key );
+		}
+	}
 
-	mesh_out->MarkDirty ();
+	// memory, drop oldest entries over budget
+	DispMesh& entry = gDispCache[key];
+	if ( entry.pos.size() == 0 ) gDispOrder.push_back ( key );
+	gDispBytes -= entry.getBytes();
+	entry.pos.swap ( dm.pos );
+	entry.norm.swap ( dm.norm );
+	entry.tex.swap ( dm.tex );
+	entry.faces.swap ( dm.faces );
+	gDispBytes += entry.getBytes();
+
+	while ( gDispBytes > D_CACHE_BUDGET && gDispOrder.size() > 1 && gDispOrder.front() != key ) {
+		std::map<uint64_t, DispMesh>::iterator it = gDispCache.find ( gDispOrder.front() );
+		if ( it != gDispCache.end() ) {
+			gDispBytes -= it->second.getBytes();
+			gDispCache.erase ( it );
+		}
+		gDispOrder.pop_front ();
+	}
+	return &entry;
+}
 
-	MarkDirty ();
+// Cache key covers mesh, grid, pixels & depth. stored results are found by key
+int Displace::SelfTest ()
+{
+	int bad = 0;
+	Displace disp;
+	disp.Define ( 0, 0 );
+
+	Mesh mesh, tri;
+	mesh.CreateFV ();
+	mesh.AddVert ( 0, 0, 0 );	mesh.AddVert ( 1, 0, 0 );	mesh.AddVert ( 0, 0, 1 );
+	mesh.AddFaceFast3FV ( 0, 1, 2 );
+	tri.CreateFV ();
+	tri.AddVert ( 0, 0, 0 );	tri.AddVertTex ( Vec2F(0, 0) );
+	tri.AddVert ( 1, 0, 0 );	tri.AddVertTex ( Vec2F(1, 0) );
+	tri.AddVert ( 0, 0, 1 );	tri.AddVertTex ( Vec2F(0, 1) );
+	tri.AddFaceFast3FV ( 0, 1, 2 );
+	Image img;
+	img.ResizeImage ( 4, 4, ImageOp::RGB24 );
+	memset ( img.GetData(), 0, 4 * 4 * img.GetBytesPerPix() );
+	Vec4F depth ( 1, 0, 0, 0 );
+
+	uint64_t k1 = disp.CacheKey ( &mesh, &tri, &img, depth );
+	bad += selfCheck ( k1 == disp.CacheKey ( &mesh, &tri, &img, depth ), "displace", "key not repeatable" );
+	bad += selfCheck ( k1 != disp.CacheKey ( &mesh, &tri, &img, Vec4F(2,0,0,0) ), "displace", "depth not in key" );
+	img.GetData()[5] = 200;
+	uint64_t k2 = disp.CacheKey ( &mesh, &tri, &img, depth );
+	bad += selfCheck ( k1 != k2, "displace", "pixels not in key" );
+	((Vec3F*) mesh.GetStart(BVERTPOS))[1].y = 0.5f;
+	uint64_t k3 = disp.CacheKey ( &mesh, &tri, &img, depth );
+	bad += selfCheck ( k2 != k3, "displace", "mesh not in key" );
+	((Vec2F*) tri.GetStart(BVERTTEX))[1].x = 0.5f;
+	bad += selfCheck ( k3 != disp.CacheKey ( &mesh, &tri, &img, depth ), "displace", "subdiv grid not in key" );
+
+	// store & find
+	DispMesh dm;
+	dm.pos.assign ( 3, Vec3F(1,2,3) );	dm.norm.assign ( 3, Vec3F(0,1,0) );	dm.tex.assign ( 3, Vec2F(0,0) );
+	dm.faces.resize ( 1 );	dm.faces[0].v1 = 0;	dm.faces[0].v2 = 1;	dm.faces[0].v3 = 2;
+	DispMesh* e = disp.CacheStore ( k3, dm, 1 );
+	DispMesh* f = disp.CacheFind ( k3, false );
+	bad += selfCheck ( f != 0x0 && f == e, "displace", "stored result not found" );
+	bad += selfCheck ( f != 0x0 && f->pos.size() == 3 && f->pos[2].z == 3 && f->faces.size() == 1, "displace", "stored result changed" );
+	bad += selfCheck ( disp.CacheFind ( hashValue ( k3, 1 ), false ) == 0x0, "displace", "found a result never stored" );
+	return selfReport ( "displace", bad );
 }
@@ -18,6 +18,11 @@
 	#include "object.h"	
 	#include <vector>
 
+	class Mesh;
+	class Image;
+	struct DispSampler;
+	struct DispMesh;
+
 	class Displace : public Object {
 	public:
 		Displace();
@@ -28,6 +33,15 @@
 		virtual void Generate (int x, int y);
 
 		void BuildSubdiv ();
+		void GenerateUniform ( Mesh* mesh_in, Mesh* trimesh, DispSampler* smp, float depth, DispMesh& out );
+		void GenerateAdaptive ( Mesh* mesh_in, DispSampler* smp, float depth, float max_err, DispMesh& out );
+
+		// Result cache (content-addressed, memory & optional disk)
+		uint64_t	CacheKey ( Mesh* mesh_in, Mesh* trimesh, Image* img, Vec4F displace_depth );
+		DispMesh*	CacheFind ( uint64_t key, bool disk );
+		DispMesh*	CacheStore ( uint64_t key, DispMesh& dm, int cache );
+
+		static int	SelfTest ();
 
 	private:		
 	
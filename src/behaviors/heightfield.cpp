@@ -20,18 +20,38 @@
 #include "mesh.h"
 #include "image.h"
 #include "material.h"
+#include "parallel.h"
+#include "selftest.h"
 
 #include "gxlib.h"
 using namespace glib;
 
 #include <stack>
+#include <algorithm>
 #include <vector>
 
 #define HF_CELL_CNT		0
 #define HF_CELL_LODS	1
+#define HF_QT_LEVELS	2
+#define HF_QT_GRID		3
+#define HF_LOD_DIST		4
+#define HF_MORPH		5
+
+#define HF_MAX_LEVELS	10
+#define HF_MORPH_MAX	(65535.f / 256.f)		// morph end in node sizes, 8.8 fixed point in instance clr
 
 Heightfield::Heightfield() : Object()
 {
+	m_qtlevels = 0;
+	m_qtgrid = 64;
+	m_depth = 1;
+	m_mtl.x = NULL_NDX;
+}
+
+Image* Heightfield::getHeightImage ()
+{
+	if ( m_mtl.x == NULL_NDX ) return 0x0;
+	return (Image*) getInputOnObj ( m_mtl.x, "displace" );
 }
 
 bool Heightfield::RunCommand(std::string cmd, vecStrs args)
@@ -54,6 +74,10 @@ void Heightfield::Define (int x, int y)
 
 	AddParam ( HF_CELL_CNT,	"cell_cnt",		"I");	SetParamI3 ( HF_CELL_CNT, 0, Vec3I(8, 8, 1) );
 	AddParam ( HF_CELL_LODS,"cell_lods",	"4");	SetParamV4 ( HF_CELL_LODS, 0, Vec4F(512, 256, 128, 64) );
+	AddParam ( HF_QT_LEVELS,"qt_levels",	"i");	SetParamI ( HF_QT_LEVELS, 0, 0 );			// quadtree levels, 0 = auto from image res
+	AddParam ( HF_QT_GRID,	"qt_grid",		"i");	SetParamI ( HF_QT_GRID, 0, 3 );				// grid mesh used for nodes (mesh0..mesh3)
+	AddParam ( HF_LOD_DIST,	"lod_dist",		"f");	SetParamF ( HF_LOD_DIST, 0, 0 );			// lod range of finest level, 0 = auto
+	AddParam ( HF_MORPH,	"morph",		"f");	SetParamF ( HF_MORPH, 0, 0.7 );				// geomorph start, fraction of lod range
 
 	//-- bake 
 	Shapes* sh = (Shapes*) gAssets.AddObject ( 'Ashp', "HFbakeout" );
@@ -79,8 +103,8 @@ void Heightfield::Define (int x, int y)
 
 			// define resolution by LOD
 			Vec4F cell_lods = getParamV4( HF_CELL_LODS );			
-			int ures = cell_lods.C(lod);
-			int vres = cell_lods.C(lod);
+			int ures = cell_lods.C(lod) + 1;						// power-of-2 quads, required for geomorph
+			int vres = cell_lods.C(lod) + 1;
 
 			Shape* xfm = mesh->getLocalXform();
 			xfm->pos.Set( 0, 0, 0 );
@@ -126,13 +150,13 @@ void Heightfield::Generate (int x, int y)
 {
 	Shape* s;
 
-	// Each shape represents a sub-region of the terrain 
-	// Shape detail selects a trimesh on the fly for camera LOD
+	// Shapes are the visible quadtree nodes, selected each frame (see Run func)
+	// Node detail is a fixed grid mesh, morphed on the GPU for continuous LOD
 	ClearShapes();
 
-
 	// Create new shapes	
 	CreateOutput ( 'Ashp' );
+	m_qtlevels = 0;
 
 	// Grid meshes - fixed LOD tesselations
 	Mesh* gridmesh[4];
@@ -146,6 +170,7 @@ void Heightfield::Generate (int x, int y)
 		dbgprintf("WARNING: No material assigned to heightfield.\n");
 		return;
 	}
+	m_mtl = mtl_id;
 
 	// Get height texture dimensions
 	Image* img = (Image*) getInputOnObj (mtl_id.x, "displace" );
@@ -154,35 +179,16 @@ void Heightfield::Generate (int x, int y)
 		return;
 	}
 	m_res = Vec3I(img->GetWidth(), img->GetHeight(), 1 );
-	 
-	Vec3F dtc (2.0/m_res.x, 2.0/m_res.y, 0);		// pixel delta
 
 	Vec3I cell_cnt = getParamI3( HF_CELL_CNT );	
-	Vec3I cell_res = m_res / cell_cnt;
-
-	float ratio_x = 1.0;  //0.67;
-	float ratio_y = 1.0;	
 
 	// get displacement amount (for baking)
 	Material* mtl = (Material*) gAssets.getObj(mtl_id.x );	
 	Vec4F displace_amt = mtl->getParamV4( M_DISPLACE_DEPTH );
-	
-	// Generate dynamic grid (openGL only)
-	// - instance sub-shapes with dynamic LOD (see Run func) covering terrain domain
-	for (int y=0; y < cell_cnt.y; y++) {
-		for (int x=0; x < cell_cnt.x; x++) {
-
-			s = AddShape ();
-			s->type = S_MESH;			
-			s->meshids = Vec4F(gridmesh[0]->getID(), 0, 0, 0 );		// grid mesh
-			s->matids = mtl_id;			
-			s->ids = getIDS(y*cell_cnt.x + x,0,0);
-			s->texsub.Set ( float(x)*ratio_x/cell_cnt.x, float(y)*ratio_y/cell_cnt.y, ratio_x/cell_cnt.x, ratio_y/cell_cnt.y );
-			s->pos.Set ( float(x)/cell_cnt.x, 0, float(y)/cell_cnt.y );
-			s->scale.Set ( 1.0/cell_cnt.x, displace_amt.y, 1.0/cell_cnt.y );		// y = vertical scale
-			s->rot.Identity();
-		}
-	}
+	m_depth = displace_amt.y;
+
+	// Build quadtree with height bounds
+	BuildQuadtree ( img );
 
 	// Generate bake shape (optiX raytrace)
 	// - geometry baked into a single mesh object for raytracing
@@ -191,6 +197,7 @@ void Heightfield::Generate (int x, int y)
 	Mesh* bakem = (Mesh*)getInput("bakemesh");		// use baked mesh	
 
 	Shapes* sh = (Shapes*) getInput ( "bake" );			// output bake shape
+	sh->Clear ();
 	s = sh->Add (i);
 	s->type = S_MESH;
 	s->meshids = Vec4F( bakem->getID(), 0, 0, 0 );
@@ -200,84 +207,16 @@ void Heightfield::Generate (int x, int y)
 	s->scale.Set ( 1, 1, 1 );
 	s->rot.Identity();		
 
-	// bake all instance cells into single dest mesh
-	Mesh* src;
-	
+	// bake all instance cells into single dest mesh	
 	int lod = 1;		
-	
-	dbgprintf("Baking heightfield..");
-	for (int y=0; y < cell_cnt.y; y++) {
-		for (int x=0; x < cell_cnt.x; x++) {
-
-			dbgprintf ( "%2.0f%% ", float(y*cell_cnt.x+x)*100.0 / (cell_cnt.x*cell_cnt.y) );
-			// source mesh at given lod
-			src = gridmesh[lod];
-
-			// append grid to baked mesh
-			bakem->AppendMesh ( src );
-			int src_numv = src->GetNumVert();
-			int src_numf = src->GetNumFace3();
-			int first_v = bakem->GetNumVert() - src_numv;	// index of first vertex is bakemesh to modify
-
-			// destination buffers for most recent grid mesh
-			Vec3F* dest_vpos =	bakem->GetElemVec3 ( BVERTPOS,	first_v );
-			Vec3F* dest_vnorm =	bakem->GetElemVec3 ( BVERTNORM,	first_v );
-			Vec2F* dest_vtex =	bakem->GetElemVec2 ( BVERTTEX,	first_v );
-
-			// get instance cell parameters
-			Shape* cell = getShape( y*cell_cnt.x + x );
-			float h, hx, hy;			
-
-			Vec3F normal_scale = cell->scale / getLocalXform()->scale;
-
-			// displace each vertex while computing
-			// uv coord, height, position, and normal
-			//
-			if (img->GetFormat() == ImageOp::BW16) {
-				// 16-bit integer displacement
-				for (int v = 0; v < src_numv; v++) {
-					*dest_vtex = *dest_vtex * Vec2F(cell->texsub.z, cell->texsub.w) + Vec2F(cell->texsub.x, cell->texsub.y);		// cell texture range
-
-					h = img->GetPixelUV16(dest_vtex->x, dest_vtex->y);
-					hx = 0.5 * (img->GetPixelUV16(dest_vtex->x + dtc.x, dest_vtex->y) - img->GetPixelUV16(dest_vtex->x - dtc.x, dest_vtex->y));
-					hy = 0.5 * (img->GetPixelUV16(dest_vtex->x, dest_vtex->y + dtc.y) - img->GetPixelUV16(dest_vtex->x, dest_vtex->y - dtc.y));
-
-					dest_vpos->y += h;											// height displace
-					*dest_vpos = *dest_vpos * cell->scale + cell->pos;			// cell position & scale		
-					*dest_vnorm = Vec3F(-hx, 1, -hy) / normal_scale;			// surface normal (of a heightmap)				
-					dest_vnorm->Normalize();
-					dest_vpos++; dest_vnorm++; dest_vtex++;
-				}
-			}
-			else if (img->GetFormat() == ImageOp::F32) {
-				// 32-bit float displacement
-				for (int v = 0; v < src_numv; v++) {
-					*dest_vtex = *dest_vtex * Vec2F(cell->texsub.z, cell->texsub.w) + Vec2F(cell->texsub.x, cell->texsub.y);		// cell texture range
-
-					h = img->GetPixelUV(dest_vtex->x, dest_vtex->y).x;
-					hx = 0.5 * (img->GetPixelUV(dest_vtex->x + dtc.x, dest_vtex->y).x - img->GetPixelUV(dest_vtex->x - dtc.x, dest_vtex->y).x);
-					hy = 0.5 * (img->GetPixelUV(dest_vtex->x, dest_vtex->y + dtc.y).x - img->GetPixelUV(dest_vtex->x, dest_vtex->y - dtc.y).x);
-
-					dest_vpos->y += h;											// height displace
-					*dest_vpos = *dest_vpos * cell->scale + cell->pos;			// cell position & scale		
-					*dest_vnorm = Vec3F(-hx, 1, -hy) / normal_scale;			// surface normal (of a heightmap)				
-					dest_vnorm->Normalize();
-					dest_vpos++; dest_vnorm++; dest_vtex++;
-				}
-			}
-			
-		}
-	}
-	dbgprintf ( "\n" );
-	
-	bakem->ComputeNormals ();
+	BakeMesh ( img, gridmesh[lod], bakem, cell_cnt );
 
 	bakem->MarkDirty ();
 
 	SetBake ( true );		// enable bake 
 	
 
-	dbgprintf ( "  Heightfield: in %s, out %s, cell_cnt:%d,%d\n", img->getName().c_str(), getOutputName().c_str(), cell_cnt.x, cell_cnt.y );
+	dbgprintf ( "  Heightfield: in %s, out %s, cell_cnt:%d,%d, qt_levels:%d, nodes:%d\n", img->getName().c_str(), getOutputName().c_str(), cell_cnt.x, cell_cnt.y, m_qtlevels, getNumNodes() );
 
 	// heightfield is always dirty for camera frustum culling
 	MarkDirty ();
@@ -286,37 +225,306 @@ void Heightfield::Generate (int x, int y)
 
 
 
+// Height/normal map for baking
+// - one sample per lattice point (gx * gy), xyz = local space normal, w = height [0,1]
+// - normals by central differences of the lattice in local space, one-sided at the border
+//
+void Heightfield::BuildHeightNormalMap ( Image* img, int gx, int gy, std::vector<Vec4F>& map )
+{
+	map.resize ( size_t(gx) * gy );
+	bool bw16 = (img->GetFormat() == ImageOp::BW16);
+
+	// heights
+	ParallelFor ( gy, 16, [&](int start, int end, int chunk) {
+		float u, v;
+		for (int j = start; j < end; j++) {
+			v = float(j) / (gy - 1);
+			Vec4F* m = &map[ size_t(j) * gx ];
+			for (int i = 0; i < gx; i++, m++) {
+				u = float(i) / (gx - 1);
+				m->w = bw16 ? img->GetPixelUV16(u, v) : img->GetPixelUV(u, v).x;
+			}
+		}
+	});
+
+	// normals
+	float sx = m_depth * (gx - 1) * 0.5f;			// d(height)/dx, local units
+	float sy = m_depth * (gy - 1) * 0.5f;
+	ParallelFor ( gy, 16, [&](int start, int end, int chunk) {
+		int i0, i1, j0, j1;
+		Vec3F n;
+		for (int j = start; j < end; j++) {
+			j0 = std::max(j - 1, 0);
+			j1 = std::min(j + 1, gy - 1);
+			Vec4F* row0 = &map[ size_t(j0) * gx ];
+			Vec4F* row1 = &map[ size_t(j1) * gx ];
+			Vec4F* m = &map[ size_t(j) * gx ];
+			for (int i = 0; i < gx; i++) {
+				i0 = std::max(i - 1, 0);
+				i1 = std::min(i + 1, gx - 1);
+				n.x = -(m[i1].w - m[i0].w) * sx * 2.0f / (i1 - i0);
+				n.y = 1;
+				n.z = -(row1[i].w - row0[i].w) * sy * 2.0f / (j1 - j0);
+				n.Normalize ();
+				m[i].x = n.x; m[i].y = n.y; m[i].z = n.z;
+			}
+		}
+	});
+}
+
+// Bake heightfield into a single mesh
+// - each cell is a copy of the src grid, cells share the lattice of the height/normal map
+// - output buffers sized once, cells filled in parallel into their own vertex & face ranges
+//
+void Heightfield::BakeMesh ( Image* img, Mesh* src, Mesh* bakem, Vec3I cell_cnt )
+{
+	int src_numv = src->GetNumVert();
+	int src_numf = src->GetNumFace3();
+	int num_cells = cell_cnt.x * cell_cnt.y;
+	if ( src_numv == 0 || num_cells <= 0 ) return;
+
+	// lattice from grid resolution (row-major grid, u inner)
+	int ures = 1;
+	while ( ures < src_numv && src->GetVertTex(ures)->y == src->GetVertTex(0)->y ) ures++;
+	int vres = src_numv / ures;
+	if ( ures < 2 || vres < 2 ) return;
+	int qx = ures - 1, qy = vres - 1;
+	int gx = cell_cnt.x * qx + 1;
+	int gy = cell_cnt.y * qy + 1;
+
+	std::vector<Vec4F> map;
+	BuildHeightNormalMap ( img, gx, gy, map );
+
+	std::vector<Vec3F>	vpos ( size_t(num_cells) * src_numv );
+	std::vector<Vec3F>	vnorm ( size_t(num_cells) * src_numv );
+	std::vector<Vec2F>	vtex ( size_t(num_cells) * src_numv );
+	std::vector<AttrV3>	faces ( size_t(num_cells) * src_numf );
+
+	ParallelFor ( num_cells, 1, [&](int start, int end, int chunk) {
+		int i, j;
+		for (int c = start; c < end; c++) {
+			int cx = c % cell_cnt.x;
+			int cy = c / cell_cnt.x;
+			int first_v = c * src_numv;
+
+			// vertices
+			Vec3F* dest_vpos = &vpos[ first_v ];
+			Vec3F* dest_vnorm = &vnorm[ first_v ];
+			Vec2F* dest_vtex = &vtex[ first_v ];
+			for (int v = 0; v < src_numv; v++) {
+				Vec2F* t = src->GetVertTex(v);
+				i = cx * qx + int( t->x * qx + 0.5f );				// lattice point of grid vertex
+				j = cy * qy + int( t->y * qy + 0.5f );
+				Vec4F& m = map[ size_t(j) * gx + i ];
+				*dest_vtex = Vec2F( float(i) / (gx - 1), float(j) / (gy - 1) );
+				dest_vpos->Set ( dest_vtex->x, m.w * m_depth, dest_vtex->y );
+				dest_vnorm->Set ( m.x, m.y, m.z );
+				dest_vpos++; dest_vnorm++; dest_vtex++;
+			}
+			// faces
+			AttrV3* dest_f = &faces[ size_t(c) * src_numf ];
+			for (int f = 0; f < src_numf; f++, dest_f++) {
+				AttrV3* sf = src->GetFace3(f);
+				dest_f->v1 = sf->v1 + first_v;
+				dest_f->v2 = sf->v2 + first_v;
+				dest_f->v3 = sf->v3 + first_v;
+			}
+		}
+	});
+
+	bakem->MemcpyBuffer ( BVERTPOS,	 &vpos[0],	vpos.size() * sizeof(Vec3F),	(int) vpos.size() );
+	bakem->MemcpyBuffer ( BVERTNORM, &vnorm[0],	vnorm.size() * sizeof(Vec3F),	(int) vnorm.size() );
+	bakem->MemcpyBuffer ( BVERTTEX,	 &vtex[0],	vtex.size() * sizeof(Vec2F),	(int) vtex.size() );
+	bakem->MemcpyBuffer ( BFACEV3,	 &faces[0],	faces.size() * sizeof(AttrV3),	(int) faces.size() );
+}
+
+// Build quadtree over height image
+// - leaf min/max from the texels covered by each leaf (parallel over leaf rows)
+// - parent bounds reduced from children
+// - lod ranges double per level, from lod_dist at the finest level
+//
+void Heightfield::BuildQuadtree ( Image* img )
+{
+	Vec4F cell_lods = getParamV4( HF_CELL_LODS );
+	int grid = std::min( std::max( getParamI( HF_QT_GRID ), 0), 3 );
+	m_qtgrid = cell_lods.C(grid);
+
+	// number of levels
+	int lev = getParamI( HF_QT_LEVELS );
+	if ( lev <= 0 ) {
+		float leaf_texels = float( std::max(m_res.x, m_res.y) ) / m_qtgrid;			// finest node ~ one texel per grid quad
+		lev = 1 + std::max( 0, int(ceil( log2( leaf_texels ) )) );
+	}
+	m_qtlevels = std::min( std::max(lev, 1), HF_MAX_LEVELS );
+
+	// node offsets by level
+	int total = 0;
+	m_qtoff.resize ( m_qtlevels );
+	for (int l=0; l < m_qtlevels; l++) {
+		m_qtoff[l] = total;
+		total += (1 << l) * (1 << l);
+	}
+	m_qthgt.resize ( total );
+
+	// leaf bounds
+	int leaf = m_qtlevels - 1;
+	int n = 1 << leaf;
+	bool bw16 = (img->GetFormat() == ImageOp::BW16);
+	ParallelFor ( n, 1, [&](int start, int end, int chunk) {
+		int x0, x1, y0, y1;
+		float h, u, v;
+		for (int y = start; y < end; y++) {
+			y0 = std::max( 0, int(floor( float(y) * m_res.y / n )) - 1 );			// include shared edge texels
+			y1 = std::min( m_res.y - 1, int(ceil( float(y + 1) * m_res.y / n )) );
+			for (int x = 0; x < n; x++) {
+				x0 = std::max( 0, int(floor( float(x) * m_res.x / n )) - 1 );
+				x1 = std::min( m_res.x - 1, int(ceil( float(x + 1) * m_res.x / n )) );
+				Vec2F hb ( 1.0e10, -1.0e10 );
+				for (int j = y0; j <= y1; j++) {
+					v = (j + 0.5f) / m_res.y;
+					for (int i = x0; i <= x1; i++) {
+						u = (i + 0.5f) / m_res.x;
+						h = bw16 ? img->GetPixelUV16(u, v) : img->GetPixelUV(u, v).x;
+						hb.x = std::min(hb.x, h);
+						hb.y = std::max(hb.y, h);
+					}
+				}
+				m_qthgt[ getNodeNdx(leaf, x, y) ] = hb;
+			}
+		}
+	});
+
+	// parent bounds
+	Vec2F hb, c;
+	for (int l = leaf - 1; l >= 0; l--) {
+		n = 1 << l;
+		for (int y = 0; y < n; y++) {
+			for (int x = 0; x < n; x++) {
+				hb.Set ( 1.0e10, -1.0e10 );
+				for (int k = 0; k < 4; k++) {
+					c = m_qthgt[ getNodeNdx(l + 1, x*2 + (k & 1), y*2 + (k >> 1)) ];
+					hb.x = std::min(hb.x, c.x);
+					hb.y = std::max(hb.y, c.y);
+				}
+				m_qthgt[ getNodeNdx(l, x, y) ] = hb;
+			}
+		}
+	}
+
+	// lod ranges
+	Vec3F wscal = getLocalXform()->scale;
+	float leaf_size = std::max(wscal.x, wscal.z) / (1 << leaf);
+	float lod_dist = getParamF( HF_LOD_DIST );
+	if ( lod_dist <= 0 ) lod_dist = 2.5f * leaf_size;
+	m_qtrange.resize ( m_qtlevels );
+	for (int l=0; l < m_qtlevels; l++)
+		m_qtrange[l] = lod_dist * (1 << (leaf - l));
+
+	if ( lod_dist / leaf_size > HF_MORPH_MAX )
+		dbgprintf ( "WARNING: Heightfield lod_dist is %4.1f leaf nodes, geomorph limited to %4.1f.\n", lod_dist / leaf_size, HF_MORPH_MAX );
+}
+
+// Geomorph params in per-instance clr (see shade_terrain.vert)
+// - x = morph start as a fraction of end (1/255 units), z = log2 grid quads (1/16 units)
+// - y,w = morph end in node sizes, 8.8 fixed point (y low byte), up to HF_MORPH_MAX
+// - range/node size is the same at every level
+//
+uint Heightfield::getMorphClr ()
+{
+	Vec3F wscal = getLocalXform()->scale;
+	float leaf_size = std::max(wscal.x, wscal.z) / (1 << (m_qtlevels - 1));
+	float morph = getParamF( HF_MORPH );
+	float mend = std::min( m_qtrange[m_qtlevels - 1] / leaf_size, HF_MORPH_MAX );		// range checked in BuildQuadtree
+	float mfrac = std::min( std::max(morph, 0.f), 0.99f );
+	uint mfix = uint(mend * 256);
+	return uint(mfrac * 255) | ((mfix & 255u) << 8) | (uint(log2(float(m_qtgrid)) * 16) << 16) | ((mfix >> 8) << 24);
+}
+
+// Select visible quadtree nodes (CDLOD)
+// - hierarchical frustum culling with real height bounds, a culled node skips its subtree
+// - node subdivides when the camera is within the lod range of the next finer level
+// - output in m_qtvis as (x, y, level)
+//
+void Heightfield::SelectNodes ( Camera3D* cam, Matrix4F& objxform )
+{
+	Vec3F a, b, lo, hi, d;
+	Vec3F cpos = cam->getPos();
+
+	m_qtvis.clear ();
+
+	std::stack<Vec3I> stk;
+	Vec3I n;
+	Vec2F hb;
+	float sz, dist;
+	stk.push ( Vec3I(0, 0, 0) );					// x, y, level
+	
+	while ( !stk.empty() ) {
+		n = stk.top(); stk.pop();
+		sz = 1.0f / (1 << n.z);
+		hb = m_qthgt[ getNodeNdx(n.z, n.x, n.y) ];
+		
+		a = Vec3F(n.x * sz, hb.x * m_depth, n.y * sz) * objxform;
+		b = Vec3F((n.x+1) * sz, hb.y * m_depth, (n.y+1) * sz) * objxform;
+		lo.Set ( std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z) );
+		hi.Set ( std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z) );
+
+		if ( !cam->boxInFrustum(lo, hi) ) continue;		// cull node & subtree
+
+		// distance to node bounds
+		d.x = std::max( std::max(lo.x - cpos.x, cpos.x - hi.x), 0.f );
+		d.y = std::max( std::max(lo.y - cpos.y, cpos.y - hi.y), 0.f );
+		d.z = std::max( std::max(lo.z - cpos.z, cpos.z - hi.z), 0.f );
+		dist = d.Length();
+
+		if ( n.z < m_qtlevels - 1 && dist < m_qtrange[n.z + 1] ) {
+			for (int k = 3; k >= 0; k--)
+				stk.push ( Vec3I(n.x*2 + (k & 1), n.y*2 + (k >> 1), n.z + 1) );
+			continue;
+		}
+
+		m_qtvis.push_back ( n );					// visible node
+	}
+}
+
+// Emit visible quadtree nodes
+// - visible nodes are gathered first, then written as one span of shapes
+//
 void Heightfield::Run ( float time )
 {	
+	if ( m_qtlevels == 0 ) {
+		MarkDirty ();
+		return;
+	}
 	Shape* s;
-	Vec3F a, b;
-	
-	Camera3D* cam = gScene->getCamera3D();
-
-	Vec3I cell_cnt = getParamI3( HF_CELL_CNT );	
-	Vec3I cell_res = m_res / cell_cnt;
 	Matrix4F objxform = getXform();
-	int gridmesh[4];
-	gridmesh[0] = getInputID ( "mesh0", 'Amsh' );
-	gridmesh[1] = getInputID ( "mesh1", 'Amsh' );
-	gridmesh[2] = getInputID ( "mesh2", 'Amsh' );
-	gridmesh[3] = getInputID ( "mesh3", 'Amsh' );
-
-	int lod;
-	int max_lod = 3;
-	Vec3F scal = getLocalXform()->scale; scal.y = 0;
-	float range = scal.Length() / (max_lod+1);			// divided by lods
-
-	for (int n = 0; n < getNumShapes(); n++) {			// skip every other pnt (faster)
-		
-		s = getShape(n);			
-		a = s->pos * objxform;
-		b = (s->pos + s->scale + Vec3F(0,100,0) ) * objxform;		
-		
-		lod = fmin(max_lod, fmax(0, (a - cam->getPos()).Length() / range) );
-		s->meshids.x = gridmesh[lod];					// select gridcell res based on LOD		
-		
-		s->invisible = !cam->boxInFrustum(a, b);		// set visibility based on gridcell in camera frustum
+	int grid = std::min( std::max( getParamI( HF_QT_GRID ), 0), 3 );
+	int gridmesh = getInputID ( "mesh" + iToStr(grid), 'Amsh' );
+	uint mclr = getMorphClr ();
+
+	SelectNodes ( gScene->getCamera3D(), objxform );
+
+	// Emit visible nodes
+	ClearShapes ();
+	Vec3I n;
+	float sz;
+	int first;
+	s = AddShapes ( (int) m_qtvis.size(), first );
+	if ( s != 0x0 ) {
+		for (int i = 0; i < m_qtvis.size(); i++, s++) {
+			n = m_qtvis[i];
+			sz = 1.0f / (1 << n.z);
+			s->Clear ();
+			s->type = S_MESH;
+			s->meshids = Vec4F(gridmesh, 0, 0, 0 );
+			s->matids = m_mtl;
+			s->ids = getIDS( getNodeNdx(n.z, n.x, n.y), 0, 0 );
+			s->texsub.Set ( n.x * sz, n.y * sz, sz, sz );
+			s->pos.Set ( n.x * sz, 0, n.y * sz );
+			s->scale.Set ( sz, m_depth, sz );				// y = vertical scale
+			s->rot.Identity();
+			s->lod = n.z;
+			s->clr = mclr;
+		}
 	}
 
 	// heightfield is always dirty for camera frustum culling
@@ -330,10 +538,7 @@ void Heightfield::Render ()
 void Heightfield::Sketch (int w, int h, Camera3D* cam )
 {
 	Shape* s;
-	Vec4F pix(1, 1, 1, 1);
 	Vec3F a,b;
-	float c;
-	int lod;
 
 	Vec3F pal[4];
 	pal[0].Set(1,0,0);
@@ -345,33 +550,199 @@ void Heightfield::Sketch (int w, int h, Camera3D* cam )
 
 	start2D( w, h );
 
-	// grid resolution
-	Vec3I cell_cnt = getParamI3( HF_CELL_CNT );	
-	Vec3I cell_res = m_res / cell_cnt;
 	Matrix4F objxform = getXform();
 
 	// world scale
-	int max_lod = 3;
 	Vec3F wmin = getLocalXform()->pos;
 	Vec3F wscal = getLocalXform()->scale; wscal.y = 0;
 	float ws = 500 / wscal.x;
-	float range = wscal.Length() / (max_lod+1);
 	
-	// draw view-frustum grid tiles	
-	for (int n = 0; n < getNumShapes(); n++) {			// skip every other pnt (faster)
-		s = getShape( n );
+	// draw selected quadtree nodes, colored by level
+	for (int n = 0; n < getNumShapes(); n++) {
+		s = readShape( n );
 		a = s->pos * objxform;
-		b = (s->pos + s->scale + Vec3F(0, 100, 1) ) * objxform;
-		c = (cam->boxInFrustum(a, b)) ? 1 : .1;
-		lod = fmin(max_lod, fmax(0, (a - cam->getPos()).Length() / range) );
-		drawRect ( Vec2F((a.x-wmin.x)*ws, (a.z-wmin.z)*ws), Vec2F((b.x-wmin.x)*ws, (b.z-wmin.z)*ws), Vec4F(pal[lod], c) );
+		b = (s->pos + s->scale) * objxform;
+		drawRect ( Vec2F((a.x-wmin.x)*ws, (a.z-wmin.z)*ws), Vec2F((b.x-wmin.x)*ws, (b.z-wmin.z)*ws), Vec4F(pal[s->lod % 4], 1) );
 	}
 	end2D();
 
 	start3D(cam);
 }
 
+// Quadtree bounds hold their texels & children, geomorph clr decodes as in shade_terrain.vert,
+// selected nodes are disjoint and follow the lod ranges. Bake follows the height/normal lattice
+int Heightfield::SelfTest ()
+{
+	int bad = 0;
+	Heightfield hf;
+	hf.AddParam ( HF_CELL_LODS,"cell_lods",	"4");	hf.SetParamV4 ( HF_CELL_LODS, 0, Vec4F(512, 256, 128, 4) );
+	hf.AddParam ( HF_QT_LEVELS,"qt_levels",	"i");	hf.SetParamI ( HF_QT_LEVELS, 0, 0 );
+	hf.AddParam ( HF_QT_GRID,	"qt_grid",		"i");	hf.SetParamI ( HF_QT_GRID, 0, 3 );
+	hf.AddParam ( HF_LOD_DIST,	"lod_dist",		"f");	hf.SetParamF ( HF_LOD_DIST, 0, 0 );
+	hf.AddParam ( HF_MORPH,	"morph",		"f");	hf.SetParamF ( HF_MORPH, 0, 0.7 );
+	hf.getLocalXform()->scale.Set ( 1, 1, 1 );
+	hf.m_depth = 0.2f;
+
+	// non-square height image, 4 quads per leaf: 1 + log2(ceil(640/4)) = 9 levels
+	int rx = 640, ry = 384;
+	Image img;
+	img.ResizeImage ( rx, ry, ImageOp::RGB24 );
+	uchar* pix = (uchar*) img.GetData();
+	int bpp = img.GetBytesPerPix();
+	for (int n=0; n < rx*ry; n++)
+		for (int b=0; b < bpp; b++) pix[n*bpp + b] = uchar( hashRand64(30, n) & 255 );
+	hf.m_res = Vec3I( rx, ry, 1 );
+	hf.BuildQuadtree ( &img );
+	bad += selfCheck ( hf.m_qtlevels == 9 && hf.getNumNodes() == (4*256*256 - 1) / 3, "heightfield", "quadtree size" );
+
+	// leaves hold their texel centers (checked on a stride of leaves), parents hold children
+	int leaf = hf.m_qtlevels - 1, nl = 1 << leaf, loose = 0;
+	float h, u, v;
+	for (int y = 0; y < nl; y += 7) {
+		for (int x = 0; x < nl; x += 5) {
+			Vec2F hb = hf.m_qthgt[ hf.getNodeNdx(leaf, x, y) ];
+			for (int j = y*ry/nl; j <= (y+1)*ry/nl && j < ry; j++) {
+				v = (j + 0.5f) / ry;
+				if ( v < float(y) / nl || v > float(y+1) / nl ) continue;
+				for (int i = x*rx/nl; i <= (x+1)*rx/nl && i < rx; i++) {
+					u = (i + 0.5f) / rx;
+					if ( u < float(x) / nl || u > float(x+1) / nl ) continue;
+					h = img.GetPixelUV(u, v).x;
+					if ( h < hb.x || h > hb.y ) loose++;
+				}
+			}
+		}
+	}
+	bad += selfCheck ( loose == 0, "heightfield", "leaf bounds miss a texel" );
+	loose = 0;
+	for (int l = 0; l < leaf; l++) {
+		int n = 1 << l;
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++) {
+				Vec2F hb = hf.m_qthgt[ hf.getNodeNdx(l, x, y) ];
+				for (int k = 0; k < 4; k++) {
+					Vec2F c = hf.m_qthgt[ hf.getNodeNdx(l+1, x*2 + (k & 1), y*2 + (k >> 1)) ];
+					if ( c.x < hb.x || c.y > hb.y || c.x > c.y ) loose++;
+				}
+			}
+	}
+	bad += selfCheck ( loose == 0, "heightfield", "parent bounds miss a child" );
+
+	// geomorph clr, decoded as in shade_terrain.vert
+	float leaf_size = 1.0f / nl;
+	float dists[3] = { 2.5f, 40.0f, 300.0f };			// in leaf nodes. last is over HF_MORPH_MAX
+	float morphs[3] = { 0.7f, 0.0f, 1.0f };
+	int wrong = 0;
+	for (int t = 0; t < 3; t++) {
+		hf.SetParamF ( HF_LOD_DIST, 0, dists[t] * leaf_size );
+		hf.SetParamF ( HF_MORPH, 0, morphs[t] );
+		hf.BuildQuadtree ( &img );
+		uint c = hf.getMorphClr ();
+		float mfrac = float(c & 255u) / 255.0f;
+		float mend = float( ((c >> 8u) & 255u) | ((c >> 16u) & 0xFF00u) ) / 256.0f;
+		float lgrid = float( (c >> 16u) & 255u ) / 16.0f;
+		float want = std::min( dists[t], HF_MORPH_MAX );
+		if ( fabs(mend - want) > 1.0f/256.0f + want * 1e-5f ) wrong++;
+		if ( fabs(mfrac - std::min(morphs[t], 0.99f)) > 1.0f/255.0f ) wrong++;
+		if ( lgrid != 2.0f ) wrong++;
+	}
+	bad += selfCheck ( wrong == 0, "heightfield", "geomorph clr does not round trip" );
+
+	// node selection from a low camera near one corner
+	hf.SetParamF ( HF_LOD_DIST, 0, 2.5f * leaf_size );
+	hf.BuildQuadtree ( &img );
+	Camera3D cam;
+	cam.setFov ( 60.0f );	cam.setAspect ( 1.0f );	cam.setNearFar ( 0.001f, 100.0f );
+	cam.setOrbit ( Vec3F(45, 20, 0), Vec3F(0.3f, 0, 0.3f), 0.3f, 1 );
+	Matrix4F xform;
+	xform.SRT ( Vec3F(1,0,0), Vec3F(0,1,0), Vec3F(0,0,1), Vec3F(0,0,0), 1.0f );
+	hf.SelectNodes ( &cam, xform );
+	std::vector<Vec3I>& vis = hf.m_qtvis;
+
+	Vec3F cpos = cam.getPos();
+	auto nodeDist = [&](Vec3I n) -> float {
+		float sz = 1.0f / (1 << n.z);
+		Vec2F hb = hf.m_qthgt[ hf.getNodeNdx(n.z, n.x, n.y) ];
+		Vec3F d ( std::max( std::max(n.x*sz - cpos.x, cpos.x - (n.x+1)*sz), 0.f ),
+				  std::max( std::max(hb.x*hf.m_depth - cpos.y, cpos.y - hb.y*hf.m_depth), 0.f ),
+				  std::max( std::max(n.y*sz - cpos.z, cpos.z - (n.y+1)*sz), 0.f ) );
+		return d.Length();
+	};
+	int overlap = 0, range = 0, minl = leaf, maxl = 0;
+	for (int i=0; i < vis.size(); i++) {
+		Vec3I n = vis[i];
+		minl = std::min(minl, n.z);
+		maxl = std::max(maxl, n.z);
+		if ( n.z < leaf && nodeDist(n) < hf.m_qtrange[n.z+1] ) range++;						// should have split
+		if ( n.z > 0 && nodeDist( Vec3I(n.x/2, n.y/2, n.z-1) ) >= hf.m_qtrange[n.z] ) range++;	// parent should not have split
+		for (int j=0; j < vis.size(); j++) {
+			Vec3I m = vis[j];
+			if ( i == j || m.z > n.z ) continue;
+			if ( (n.x >> (n.z - m.z)) == m.x && (n.y >> (n.z - m.z)) == m.y ) overlap++;		// m contains n
+		}
+	}
+	bad += selfCheck ( vis.size() > 0 && maxl - minl >= 3, "heightfield", "selection not spread over levels" );
+	bad += selfCheck ( overlap == 0, "heightfield", "selected nodes overlap" );
+	bad += selfCheck ( range == 0, "heightfield", "selected node breaks the lod ranges" );
+
+	// bake. height/normal map on a non-square lattice, normals from central differences
+	int gx = 9, gy = 5;
+	std::vector<Vec4F> map;
+	hf.BuildHeightNormalMap ( &img, gx, gy, map );
+	float sx = hf.m_depth * (gx - 1) * 0.5f, sy = hf.m_depth * (gy - 1) * 0.5f;
+	wrong = 0;
+	for (int j = 0; j < gy; j++) {
+		for (int i = 0; i < gx; i++) {
+			Vec4F& m = map[ j*gx + i ];
+			int i0 = std::max(i-1, 0), i1 = std::min(i+1, gx-1), j0 = std::max(j-1, 0), j1 = std::min(j+1, gy-1);
+			Vec3F n ( -(map[j*gx + i1].w - map[j*gx + i0].w) * sx * 2.0f / (i1 - i0), 1, -(map[j1*gx + i].w - map[j0*gx + i].w) * sy * 2.0f / (j1 - j0) );
+			n.Normalize ();
+			if ( m.w != img.GetPixelUV( float(i) / (gx-1), float(j) / (gy-1) ).x ) wrong++;
+			if ( fabs(m.x - n.x) > 1e-5f || fabs(m.y - n.y) > 1e-5f || fabs(m.z - n.z) > 1e-5f ) wrong++;
+		}
+	}
+	bad += selfCheck ( map.size() == gx * gy && wrong == 0, "heightfield", "height/normal map" );
+
+	// bake mesh. 3x2 cells of a 4x2 quad grid, cells share the lattice
+	Mesh grid, bakem;
+	grid.CreateFV ();
+	bakem.CreateFV ();
+	int ures = 5, vres = 3;
+	for (int v = 0; v < vres; v++)
+		for (int u = 0; u < ures; u++) {
+			grid.AddVert ( float(u)/(ures-1), 0, float(v)/(vres-1) );
+			grid.AddVertTex ( Vec2F( float(u)/(ures-1), float(v)/(vres-1) ) );
+			grid.AddVertNorm ( Vec3F(0,1,0) );
+		}
+	for (int v = 0; v < vres-1; v++)
+		for (int u = 0; u < ures-1; u++) {
+			int c = v * ures + u;
+			grid.AddFaceFast3FV ( c+ures, c+1, c );
+			grid.AddFaceFast3FV ( c+ures, c+ures+1, c+1 );
+		}
+	Vec3I cells ( 3, 2, 1 );
+	hf.BakeMesh ( &img, &grid, &bakem, cells );
+	int nv = ures * vres, nf = 2 * (ures-1) * (vres-1);
+	bad += selfCheck ( bakem.GetNumVert() == 6 * nv && bakem.GetNumFace3() == 6 * nf, "heightfield", "bake mesh size" );
+
+	gx = 3 * (ures-1) + 1;	gy = 2 * (vres-1) + 1;
+	hf.BuildHeightNormalMap ( &img, gx, gy, map );
+	wrong = 0;
+	for (int c = 0; c < 6 && bakem.GetNumVert() == 6 * nv; c++) {
+		for (int v = 0; v < nv; v++) {
+			int i = (c % 3) * (ures-1) + v % ures, j = (c / 3) * (vres-1) + v / ures;		// lattice point
+			Vec4F& m = map[ j*gx + i ];
+			Vec3F p = *bakem.GetVertPos ( c*nv + v ), n = *bakem.GetVertNorm ( c*nv + v );
+			if ( fabs(p.x - float(i)/(gx-1)) > 1e-6f || fabs(p.z - float(j)/(gy-1)) > 1e-6f || p.y != m.w * hf.m_depth ) wrong++;
+			if ( n.x != m.x || n.y != m.y || n.z != m.z ) wrong++;
+		}
+		for (int f = 0; f < nf; f++) {
+			AttrV3 fv = *bakem.GetFace3 ( c*nf + f );
+			AttrV3 sv = *grid.GetFace3 ( f );
+			if ( fv.v1 != sv.v1 + c*nv || fv.v2 != sv.v2 + c*nv || fv.v3 != sv.v3 + c*nv ) wrong++;
+		}
+	}
+	bad += selfCheck ( wrong == 0, "heightfield", "bake mesh not on the shared lattice" );
 
-
-
-
+	return selfReport ( "heightfield", bad );
+}
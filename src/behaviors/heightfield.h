@@ -18,6 +18,8 @@
 	#include "object.h"	
 	#include <vector>
 
+	class Mesh;
+
 	class Heightfield : public Object {
 	public:
 		Heightfield();
@@ -30,9 +32,40 @@
 		virtual void Render ();
 		virtual void Sketch ( int w, int h, Camera3D* cam );
 	
+		// Quadtree (CDLOD)
+		// - implicit quadtree over the height image, nodes stored level by level
+		// - per-node min/max heights give tight bounds for hierarchical frustum culling
+		void	BuildQuadtree ( Image* img );
+		int		getNodeNdx ( int lev, int x, int y )	{ return m_qtoff[lev] + y * (1 << lev) + x; }
+		int		getNumNodes ()							{ return (int) m_qthgt.size(); }
+		void	SelectNodes ( Camera3D* cam, Matrix4F& objxform );		// visible nodes into m_qtvis
+		uint	getMorphClr ();											// geomorph params, instance clr
+
+		// Bake (raytracing)
+		// - height/normal map sampled once per lattice point, shared by all cells
+		// - bake mesh sized once and filled by cell in parallel
+		void	BuildHeightNormalMap ( Image* img, int gx, int gy, std::vector<Vec4F>& map );
+		void	BakeMesh ( Image* img, Mesh* src, Mesh* bakem, Vec3I cell_cnt );
+
+		// Height access (navigation)
+		// - height image spans the local unit square, world height = h * depth (local)
+		Image*	getHeightImage ();
+		float	getDepth ()			{ return m_depth; }
+
+		static int SelfTest ();
+	
 	private:		
 
 		Vec3I	m_res;		// cache image res		
+		Vec8S	m_mtl;		// terrain material
+		float	m_depth;	// vertical scale
+
+		int					m_qtlevels;		// quadtree levels
+		int					m_qtgrid;		// grid quads per node (power of 2)
+		std::vector<int>	m_qtoff;		// first node of each level
+		std::vector<Vec2F>	m_qthgt;		// node min/max height [0,1]
+		std::vector<float>	m_qtrange;		// lod range per level, world units
+		std::vector<Vec3I>	m_qtvis;		// visible nodes this frame (x, y, level)
 	};
 
 #endif
\ No newline at end of file
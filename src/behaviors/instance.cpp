@@ -49,6 +49,7 @@ void Instance::Generate(int x, int y)
 	if (pnts==0x0) return;
 
 	CreateOutput('Ashp');
+	getOutShapes()->SetLayout ( SHAPES_SOA );		// hot/cold streams for sort & upload
 	
 	SetOutputXform();
 
@@ -71,10 +72,14 @@ void Instance::Generate(int x, int y)
 	Vec3F scaling = getParamV3(I_SCALE);
 
 	// create instances at points
+	int first;
+	s = AddShapes ( num_pnts, first );
+	if ( s == 0x0 ) return;
+
 	for (int n=0; n < num_pnts; n++ ) {
 	
-		// add shape		
-		s = AddShape();
+		// fill shape		
+		s->Clear();
 		s->ids = getIDS(0, 0, 0);
 		s->type = S_MESH;
 		s->matids = mat;
@@ -84,10 +89,13 @@ void Instance::Generate(int x, int y)
 		s->scale = Vec3F(*prad, *prad, *prad) * scaling;
 		s->pivot = Vec3F(0, 0, 0);
 
+		s++;
 		ppos++;
 		pclr++;
 		prad++;
 	}
+	getOutShapes()->PackStreams ( first );
+
 	MarkDirty();
 }
 
@@ -19,6 +19,9 @@
 #include "mesh.h"
 #include "quaternion.h"
 #include "scene.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "selftest.h"
 
 #include <stack>
 #include <vector>
@@ -30,6 +33,7 @@
 #define L_NAME		4
 #define L_OFFSET	5
 #define L_SCALE		6
+#define L_MERGED	7
 
 #define PI		(3.141592)
 
@@ -37,6 +41,9 @@ Loft::Loft() : Object()
 {
 	m_Section = 0x0;
 	m_SectionNorm = 0x0;	
+	m_merged = 0x0;
+	m_mergedRes.Set(0, 0, 0);
+	m_topoKey = 0;
 }
 
 void Loft::Define (int x, int y)
@@ -54,6 +61,7 @@ void Loft::Define (int x, int y)
 	AddParam(L_NAME,	"name",	 "s");	SetParamStr (L_NAME, 0, "Vsingle" );
 	AddParam(L_OFFSET,  "offset", "3");	SetParamV3(L_OFFSET, 0, Vec3F(0,0,0) );
 	AddParam(L_SCALE,	"scale", "3");	SetParamV3(L_SCALE, 0, Vec3F(1, 1, 1));
+	AddParam(L_MERGED,	"merged", "i");	SetParamI(L_MERGED, 0, 0);			// 1 = all lofts in one mesh, one draw
 
 	mTimeRange.Set(0,10000,0);
 }
@@ -79,6 +87,38 @@ void Loft::ConstructSection (int ures, Vec3F norm)
 		m_SectionNorm[u] = Vec3F(0.0f, cos(u * 2.0f * PI / (ures-1) ), sin(u * 2.0f * PI / (ures-1) ));	
 		m_SectionNorm[u] *= q;															
 	}
+
+	// SoA copy of section & normals for ring transforms
+	m_SecSoA.resize ( 6 * ures );
+	for (int u = 0; u < ures; u++) {
+		m_SecSoA[u] = m_Section[u].x;				m_SecSoA[ures + u] = m_Section[u].y;		m_SecSoA[2*ures + u] = m_Section[u].z;
+		m_SecSoA[3*ures + u] = m_SectionNorm[u].x;	m_SecSoA[4*ures + u] = m_SectionNorm[u].y;	m_SecSoA[5*ures + u] = m_SectionNorm[u].z;
+	}
+}
+
+// Transform one ring of the section
+// - affine xform reduced to origin & basis vectors once per ring, then
+//   a branch-free multiply-add over the SoA section (vectorizes across ures)
+// - normals by the ring rotation only, section normals are unit so no normalize
+//
+void Loft::TransformRing ( int ures, Vec3F o, Vec3F ex, Vec3F ey, Vec3F ez, Vec3F nx, Vec3F ny, Vec3F nz, Vec3F* vpos, Vec3F* vnorm )
+{
+	const float* sx = &m_SecSoA[0];
+	const float* sy = sx + ures;
+	const float* sz = sy + ures;
+	const float* snx = sz + ures;
+	const float* sny = snx + ures;
+	const float* snz = sny + ures;
+	float* pf = &vpos->x;
+	float* nf = &vnorm->x;
+	for (int u = 0; u < ures; u++) {
+		pf[3*u]   = o.x + ex.x * sx[u] + ey.x * sy[u] + ez.x * sz[u];
+		pf[3*u+1] = o.y + ex.y * sx[u] + ey.y * sy[u] + ez.y * sz[u];
+		pf[3*u+2] = o.z + ex.z * sx[u] + ey.z * sy[u] + ez.z * sz[u];
+		nf[3*u]   = nx.x * snx[u] + ny.x * sny[u] + nz.x * snz[u];
+		nf[3*u+1] = nx.y * snx[u] + ny.y * sny[u] + nz.y * snz[u];
+		nf[3*u+2] = nx.z * snx[u] + ny.z * sny[u] + nz.z * snz[u];
+	}
 }
 
 void Loft::ConstructMeshes (Vec3I res, std::string srcname, std::string vname )
@@ -106,42 +146,10 @@ void Loft::ConstructMeshes (Vec3I res, std::string srcname, std::string vname )
 		}
 
 		mesh->MeshX::Clear ();
-	
-		// SetInput( "mesh", mesh_name );			// connect mesh to this object
 
-		// build loft mesh topology
-		int ures = res.x; int vres = res.y;	int wres = 1;		//res.z;
 		Shape* xfm = mesh->getLocalXform();
 		xfm->pos.Set(0, 0, 0);
-		// vertices
-		//for (int w = 0; w < wres; w++) {
-			for (int v = 0; v < vres; v++) {
-				for (int u = 0; u < ures; u++) {
-					mesh->AddVert(0, 0, 0);
-					mesh->AddVertNorm(Vec3F(0, 1, 0));
-					//mesh->AddVertClr ( Vec3F(float(u)/ures, 0, float(v)/vres) );		// debugging - color vertices by u,v
-					mesh->AddVertClr(Vec3F(1, 1, 1));
-					mesh->AddVertTex(Vec2F(float(u) / (ures - 1), float(v) / (vres - 1)));
-				}
-			}
-		//}
-		// faces - total faces per shape: ures * (vres-1)
-		int faces;
-		int p = 0;
-		//for (int w = 0; w < wres; w++) {
-		//	p = w * ures * vres;							// vertex index.. this is *not* the face index.		
-			for (int v = 0; v < vres - 1; v++) {			// there is one less row of faces than there are vertices along v
-				for (int u = 0; u < ures - 1; u++) {
-					mesh->AddFaceFast3FV(p, p + 1 , p + ures );
-					mesh->AddFaceFast3FV(p + ures, p + 1, p + ures + 1 );
-					p++;
-				}
-				mesh->AddFaceFast3FV(p, p - ures + 1, p + ures  );		// wrap around.
-				mesh->AddFaceFast3FV(p + ures, p - ures + 1, p + 1 );
-				p++;
-			}
-			faces = mesh->GetNumFace3();
-		//}
+		AddLoftTopology ( mesh, res );
 
 		//mesh->setElemCount ( ures * vres);
 		mesh->MarkDirty();		// geometry changed for rendering
@@ -149,6 +157,73 @@ void Loft::ConstructMeshes (Vec3I res, std::string srcname, std::string vname )
 }
 
 
+// Add vertices & faces for one loft to mesh
+// - ures * vres vertices, 2 * ures * (vres-1) faces, indices offset by the current vertex count
+//
+void Loft::AddLoftTopology ( Mesh* mesh, Vec3I res )
+{
+	int ures = res.x; int vres = res.y;
+	int p = mesh->GetNumVert();					// vertex index.. this is *not* the face index.
+	
+	// vertices
+	for (int v = 0; v < vres; v++) {
+		for (int u = 0; u < ures; u++) {
+			mesh->AddVert(0, 0, 0);
+			mesh->AddVertNorm(Vec3F(0, 1, 0));
+			//mesh->AddVertClr ( Vec3F(float(u)/ures, 0, float(v)/vres) );		// debugging - color vertices by u,v
+			mesh->AddVertClr(Vec3F(1, 1, 1));
+			mesh->AddVertTex(Vec2F(float(u) / (ures - 1), float(v) / (vres - 1)));
+		}
+	}
+	// faces - total faces per shape: ures * (vres-1)
+	for (int v = 0; v < vres - 1; v++) {			// there is one less row of faces than there are vertices along v
+		for (int u = 0; u < ures - 1; u++) {
+			mesh->AddFaceFast3FV(p, p + 1 , p + ures );
+			mesh->AddFaceFast3FV(p + ures, p + 1, p + ures + 1 );
+			p++;
+		}
+		mesh->AddFaceFast3FV(p, p - ures + 1, p + ures  );		// wrap around.
+		mesh->AddFaceFast3FV(p + ures, p - ures + 1, p + 1 );
+		p++;
+	}
+}
+
+// Merged mesh, all lofts in one vertex & index buffer
+// - loft w owns vertices [w*uvres, (w+1)*uvres) and faces from w * 2*ures*(vres-1)
+//
+void Loft::ConstructMergedMesh ( Vec3I res, int wmax )
+{
+	m_merged->MeshX::Clear ();
+	Shape* xfm = m_merged->getLocalXform();
+	xfm->pos.Set(0, 0, 0);
+	for (int w = 0; w < wmax; w++)
+		AddLoftTopology ( m_merged, res );
+
+	m_mergedRes = res;
+	m_chainHash.assign ( wmax, 0 );
+	m_merged->MarkDirtyTopology ();		// full upload
+}
+
+// Hash of the inputs of loft w, to find changed lofts
+uint64_t Loft::getChainHash ( int w )
+{
+	std::vector<int>& links = m_lofts[w].links;
+	uint64_t h = hashValue ( 0, (int) links.size() );
+	h = hashValue ( h, m_lofts[w].parent );
+	h = hashValue ( h, m_lofts[w].variant );
+	Shape* s;
+	for (int i = 0; i < links.size(); i++) {
+		h = hashValue ( h, links[i] );
+		s = m_shapes->getShape ( links[i] );
+		h = hashValue ( h, s->pos );
+		h = hashValue ( h, s->rot );
+		h = hashValue ( h, s->scale );
+		h = hashValue ( h, s->pivot );
+		h = hashValue ( h, s->clr );
+	}
+	return h;
+}
+
 void Loft::Generate (int x, int y)
 {
 	CreateOutput ( 'Ashp' );
@@ -161,7 +236,18 @@ void Loft::Generate (int x, int y)
 	m_shapes = getInputShapes("shapes");			// input shapes
 	if ( m_shapes != 0x0 ) {
 		
-		ConstructMeshes ( res, m_shapes->getName(), name );		// build meshes
+		if ( getParamI(L_MERGED) > 0 ) {
+			// merged mesh, topology built in Run once the number of lofts is known
+			std::string mesh_name = "Loft_" + m_shapes->getName() + name + "All";
+			m_merged = (Mesh*) gAssets.getObj ( mesh_name );
+			if ( m_merged == 0x0 ) {
+				m_merged = (Mesh*) gAssets.AddObject ( 'Amsh', mesh_name );
+				m_merged->CreateFV ();
+			}
+			m_mergedRes.Set ( 0, 0, 0 );
+		} else {
+			ConstructMeshes ( res, m_shapes->getName(), name );		// build meshes
+		}
 
 	} else {
 		return;		// no input shapes
@@ -169,6 +255,7 @@ void Loft::Generate (int x, int y)
 	
 	// section profile 
 	ConstructSection ( res.x, Vec3F(1,0,0) );
+	m_topoKey = 0;					// rebuild chains on next run
 
 	ClearShapes ();
 
@@ -217,42 +304,41 @@ void Loft::GenerateIndividual ()
 	mesh->MarkDirty();					// geometry changed for rendering
 }
 
+// Find the chains & their links
+// - walks the hierarchy channels. called only when the input topology key changes (see Run)
+// - loft groups & link vectors are reused in place, keeping their capacity
+//
 void Loft::CountChainsAndLengths()
 {
-	Vec3I res = getMeshRes();
-	LoftGroup g;
-
 	// count chains & chain lengths			
-	Shape *s, *sc;
-	uchar* slev = (uchar*)		m_shapes->getData (BLEV);			// hierarchy data
-	uxlong* schild = (uxlong*)	m_shapes->getData (BCHILD);
+	Shape *s;
+	uxlong* schild = (uxlong*)	m_shapes->getData (BCHILD);			// hierarchy data
 	uxlong* snext = (uxlong*)	m_shapes->getData (BNEXT);
 	Vec3I* svari = (Vec3I*)m_shapes->getData (BVARI);		// OPTIONAL
 
-	m_lofts.clear ();
-
+	int cnt = 0;
 	for (int si = 0; si < m_shapes->getNumShapes(); si++) {
 		s = m_shapes->getShape(si);
 		
 		if ( !s->isSegment() ) {	
-			// new LoftGroup
-			g.parent = si;			
 			int id = schild[si];								// POINT child is head of segment chain	
-			g.links.clear ();			
 			if ( id != S_NULL ) {
-				
+				// new LoftGroup
+				if ( cnt >= m_lofts.size() ) m_lofts.push_back ( LoftGroup() );
+				LoftGroup& g = m_lofts[cnt++];
+				g.parent = si;
+				g.links.clear ();
 				for (; id != S_NULL; ) { 
-					sc = m_shapes->getShape(id);			// debugging - check first child pos = parent pos	
 					g.links.push_back ( id );					// record each link in chain
 					id = snext[id];
 				}
 				if (svari != 0x0 ) g.variant = svari[si];
-				m_lofts.push_back ( g );			
 
-				// dbgprintf ( "loft: %d, si: %d, cnt: %d\n", m_lofts.size()-1, si, g.links.size() );		// debugging
+				// dbgprintf ( "loft: %d, si: %d, cnt: %d\n", cnt-1, si, g.links.size() );		// debugging
 			}			
 		}
 	}
+	m_lofts.resize ( cnt );
 }
 
 
@@ -401,41 +487,29 @@ Vec3F Loft::getStats()
 	return Vec3F( wmax, wmax, wmax * faces );
 }
 
-int Loft::GenerateComplete (int w)
+// Generate a final segmented profile for loft w
+// - writes uvres vertices of mesh starting at first_v
+// - thread-safe for distinct w: writes only its own vertices, reads shared inputs
+//
+int Loft::GenerateComplete (int w, Mesh* mesh, int first_v)
 {
-	Shape* s;
 	Matrix4F xform;
 	Quaternion xrot;
-	Vec3F start_pos, p, scale, ctr;
 	Vec3F uvz (0,0,0);
 	Vec3F offset = getParamV3(L_OFFSET);
 	Vec3F gscale = getParamV3(L_SCALE);
+	Vec3F o, ex, ey, ez, nx, ny, nz;
 	uint clr;
 	float du, sz;
 	int vmax;
 
-	Mesh* mesh = m_meshes[w];
-
-	Object* tex = getInputResult("tex");					// set surface texture of mesh
-	if (tex != 0x0) mesh->SetTexture(tex->getID());
-
-	Vec3F* vpos = (Vec3F*) mesh->GetBufData(BVERTPOS);
-	Vec3F* vnorm = (Vec3F*) mesh->GetBufData(BVERTNORM);
-	Vec2F* vtex = (Vec2F*) mesh->GetBufData(BVERTTEX);
-	uint* vclr = (uint*) mesh->GetBufData(BVERTCLR);	
+	Vec3F* vpos = (Vec3F*) mesh->GetBufData(BVERTPOS) + first_v;
+	Vec3F* vnorm = (Vec3F*) mesh->GetBufData(BVERTNORM) + first_v;
+	Vec2F* vtex = (Vec2F*) mesh->GetBufData(BVERTTEX) + first_v;
+	uint* vclr = (uint*) mesh->GetBufData(BVERTCLR) + first_v;	
 	Vec3I res = getMeshRes();
-	int uvres = res.x * res.y;
-	float noise = getParamF(L_NOISE);
-	int seed = getParamI(L_SEED);
-	
-	// Clear mesh buffer data
-	memset ( vpos, 0, sizeof(Vec3F) * uvres );
 
 	// Loft each chain
-
-	// get mesh shape
-	s = getShape(w);
-
 	vmax = std::max( res.y-1, 2 );
 	//vmax = max(min( res.y-1, m_lofts[w].links.size() ), 2);
 		
@@ -447,28 +521,33 @@ int Loft::GenerateComplete (int w)
 	//uvz.y = (m_lofts[w].links.size() / texscale_v) * (1.0f / res.y);
 	uvz.y = (m_lofts[w].links.size() / texscale_v) * (1.0f / res.y);				
 	 
-	m_rand.seed(w);
+	Mersenne rnd;							// per-loft random stream, same for any thread count
+	rnd.seed(w);
 
 	du = 0;
 
-	sz = 1.0;
-
-	//dbgprintf ( "%d %d\n", m_lofts.size(), wmax, res.x, res.y, res.z );		// debugging
-
 	for (int vi=0; vi < res.y; vi++) {
 
 		sz = (vi==0 || vi >= vmax-1 ) ? 0 : 1.0;		
 
 		getLoftSection ( float(vi) * (m_lofts[w].links.size()-1) / vmax, w, xform, xrot, uvz.z, clr );		// sample loft group to get xform & size at this 'v' coordinate
 
+		// ring basis. point = ((section * sz) * xform) * gscale + offset
+		o = Vec3F(0,0,0) * xform;
+		ex = (Vec3F(1,0,0) * xform - o) * gscale * sz;
+		ey = (Vec3F(0,1,0) * xform - o) * gscale * sz;
+		ez = (Vec3F(0,0,1) * xform - o) * gscale * sz;
+		o = o * gscale + offset;
+		nx = Vec3F(1,0,0) * xrot;	nx.Normalize();				// xrot is lerped, not unit length
+		ny = Vec3F(0,1,0) * xrot;	ny.Normalize();
+		nz = Vec3F(0,0,1) * xrot;	nz.Normalize();
+		TransformRing ( res.x, o, ex, ey, ez, nx, ny, nz, vpos, vnorm );		// oriented points & normals on profile (cross-section)
+		vpos += res.x;
+		vnorm += res.x;
+
+		v = vi * uvz.y; 
 		for (int ui = 0; ui < res.x; ui++) {
-
-			p = (m_Section[ui] * sz) * xform;				// oriented point on profile (cross-section), translated to start
-					
-			*vpos++ = p * gscale + offset;				
-			*vnorm++ = (m_SectionNorm[ui] * xrot).Normalize();			// section normal transformed into loft orientation			
 			u = (ui+du) * uvz.x; 
-			v = vi * uvz.y; 
 			*vtex++ = Vec2F( u, v );		// transformed to shape space. ensure wrap around tex coord: tex(u=0) == tex(u=ures-1)
 			*vclr++ = clr;
 		}
@@ -477,7 +556,6 @@ int Loft::GenerateComplete (int w)
 	}
 
 	//m_mesh->ComputeNormals(w * uvres, (w + 1) * uvres - 1, false);			// ** This is quite slow. Avoid if possible. false = smooth normals
-	mesh->MarkDirty();					// geometry changed for rendering
 
 	return 2 * res.x * (vmax-1);		// final face count
 }
@@ -489,37 +567,55 @@ void Loft::Run ( float time )
 	
 	//if ( m_shapes->bHasSegments ) {			//--- need to fix
 
-	// find the chains and lengths
-	CountChainsAndLengths();
+	// find the chains and lengths, only when the input hierarchy changed
+	uint64_t topo = hashValue ( m_shapes->getTopologyKey(), m_shapes->getID() );
+	if ( topo != m_topoKey ) {
+		CountChainsAndLengths();
+		m_topoKey = topo;
+	}
 
 	// Output shapes
 	Vec3I res = getMeshRes();
 	int uvres = res.x * res.y;
-	int faces;	
 
 	int wmax = std::min( res.z, (int) m_lofts.size());		// total number of lofts
 
 	ClearShapes ();
 
-	for (int w=0; w < wmax; w++) {
-		
-		// Add shape
-		Shape* s = AddShape();
-		s->type = S_MESH;
-		s->pos = Vec3F(0,0,0);
-
-		faces = GenerateComplete ( w );		
-
-		s->meshids.x = m_meshes[w]->getID();
-		s->meshids.y = 0;
-		s->meshids.z = faces;
-		s->meshids.w = 0;
+	if ( m_merged != 0x0 && getParamI(L_MERGED) > 0 ) {
+		RunMerged ( wmax );
+		MarkClean();
+		MarkComplete();
+		return;
+	}
 
-		//dbgprintf ( "loft: %d %d %d\n", m_lofts.size(), lofts, lofts*faces_per_shape );	
+	// Add shapes, one per loft
+	int first;
+	Shape* shapes = AddShapes ( wmax, first );
+	if ( shapes == 0x0 ) return;
+	Object* tex = getInputResult("tex");
+
+	// Generate lofts in parallel. each loft fills its own mesh & shape
+	ParallelFor ( wmax, 4, [&](int start, int end, int chunk) {
+		for (int w = start; w < end; w++) {
+			Shape* s = shapes + w;
+			s->Clear ();
+			s->type = S_MESH;
+			s->pos = Vec3F(0,0,0);
+
+			if (tex != 0x0) m_meshes[w]->SetTexture(tex->getID());			// set surface texture of mesh
+			int faces = GenerateComplete ( w, m_meshes[w], 0 );
+			m_meshes[w]->MarkDirty();											// geometry changed for rendering
+
+			s->meshids.x = m_meshes[w]->getID();
+			s->meshids.y = 0;
+			s->meshids.z = faces;
+			s->meshids.w = 0;
 		
-		s->scale.Set(1,1,1);
-		s->pivot.Set(0,0,0);
-	}
+			s->scale.Set(1,1,1);
+			s->pivot.Set(0,0,0);
+		}
+	});
 	
 	/* --- old method, multiple shapes /w sub-faces
 	Shape* s;
@@ -543,6 +639,58 @@ void Loft::Run ( float time )
 	MarkComplete();		// NOTE: This is where we check if the input is complete, and mark self as complete. (not at top of func)
 }
 
+// Merged mode
+// - one mesh and one shape for all lofts, a single draw
+// - only lofts whose inputs changed are regenerated, and uploaded as vertex sub-ranges
+//
+void Loft::RunMerged ( int wmax )
+{
+	Vec3I res = getMeshRes();
+	int uvres = res.x * res.y;						// vertices per loft, loft w starts at w*uvres
+
+	// topology, rebuilt only when the number of lofts or resolution changes
+	bool topo = false;
+	if ( m_chainHash.size() != wmax || m_mergedRes.x != res.x || m_mergedRes.y != res.y ) {
+		ConstructMergedMesh ( res, wmax );
+		topo = true;
+	}
+	Object* tex = getInputResult("tex");
+	if (tex != 0x0) m_merged->SetTexture(tex->getID());
+
+	// changed lofts
+	std::vector<uint64_t> hash ( wmax );
+	ParallelFor ( wmax, 64, [&](int start, int end, int chunk) {
+		for (int w = start; w < end; w++)
+			hash[w] = getChainHash ( w );
+	});
+	std::vector<int> dirty;
+	for (int w = 0; w < wmax; w++)
+		if ( topo || hash[w] != m_chainHash[w] ) dirty.push_back ( w );
+	m_chainHash.swap ( hash );
+
+	// regenerate changed lofts in parallel
+	ParallelFor ( (int) dirty.size(), 4, [&](int start, int end, int chunk) {
+		for (int i = start; i < end; i++)
+			GenerateComplete ( dirty[i], m_merged, dirty[i] * uvres );
+	});
+
+	// partial upload, runs of adjacent changed lofts as one range
+	if ( !topo ) {
+		for (int i = 0, j; i < dirty.size(); i = j) {
+			for (j = i + 1; j < dirty.size() && dirty[j] == dirty[j-1] + 1; j++);
+			m_merged->MarkDirtyVerts ( dirty[i] * uvres, (j - i) * uvres );
+		}
+	}
+
+	// single shape for all lofts
+	Shape* s = AddShape();
+	s->type = S_MESH;
+	s->pos = Vec3F(0,0,0);
+	s->meshids.Set ( m_merged->getID(), 0, 0, 0 );		// faces = 0, draw entire mesh
+	s->scale.Set(1,1,1);
+	s->pivot.Set(0,0,0);
+}
+
 void Loft::Render ()
 {
 }
@@ -576,6 +724,49 @@ void Loft::Sketch (int w, int h, Camera3D* cam )
 
 }
 
-
-
-
+// Topology key & chain hash
+// - moving shapes keeps the topology key, variant or type changes invalidate it
+// - chain hash changes with link transforms, link ids and the variant
+int Loft::SelfTest ()
+{
+	int bad = 0;
+	Shapes shapes;
+	shapes.AddChannel ( BVARI, "vari", sizeof(Vec3I) );
+	int first;
+	Shape* s = shapes.AddSpan ( 4, first );
+	Vec3I* vari = (Vec3I*) shapes.getData ( BVARI );
+	for (int i = 0; i < 4; i++) {
+		s[i].Clear ();
+		s[i].type = S_NODE;
+		s[i].pos.Set ( 0, float(i), 0 );
+		vari[i].Set ( 0, 0, 0 );
+	}
+	uint64_t k0 = shapes.getTopologyKey ();
+	s[1].pos.x = 1;
+	bad += selfCheck ( k0 == shapes.getTopologyKey(), "loft", "topology key changed on move" );
+	vari[2].x = 1;
+	uint64_t k1 = shapes.getTopologyKey ();
+	bad += selfCheck ( k0 != k1, "loft", "variant not in topology key" );
+	s[3].type = S_INTERNODE;
+	bad += selfCheck ( k1 != shapes.getTopologyKey(), "loft", "type not in topology key" );
+
+	Loft loft;
+	loft.m_shapes = &shapes;
+	loft.m_lofts.resize ( 1 );
+	loft.m_lofts[0].links.push_back ( 0 );
+	loft.m_lofts[0].links.push_back ( 1 );
+	loft.m_lofts[0].links.push_back ( 2 );
+	loft.m_lofts[0].variant.Set ( 0, 0, 0 );
+	uint64_t h0 = loft.getChainHash ( 0 );
+	bad += selfCheck ( h0 == loft.getChainHash(0), "loft", "chain hash not repeatable" );
+	s[1].pos.z = 2;
+	uint64_t h1 = loft.getChainHash ( 0 );
+	bad += selfCheck ( h0 != h1, "loft", "link move not in chain hash" );
+	loft.m_lofts[0].variant.x = 1;
+	uint64_t h2 = loft.getChainHash ( 0 );
+	bad += selfCheck ( h1 != h2, "loft", "variant not in chain hash" );
+	s[3] = s[2];
+	loft.m_lofts[0].links[2] = 3;									// same transform, other shape
+	bad += selfCheck ( h2 != loft.getChainHash(0), "loft", "link ids not in chain hash" );
+	return selfReport ( "loft", bad );
+}
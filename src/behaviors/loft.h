@@ -45,12 +45,21 @@
 
 		void ConstructSection(int ures, Vec3F norm);
 		void ConstructMeshes (Vec3I res, std::string srcname, std::string name);
+		void AddLoftTopology (Mesh* mesh, Vec3I res);
+
+		// Merged mode, all lofts in one mesh with per-loft ranges
+		void ConstructMergedMesh (Vec3I res, int wmax);
+		void RunMerged (int wmax);
+		uint64_t getChainHash (int w);
 
 		void GenerateIndividual ();			// generate a loft profile for each individual shape
 		void GenerateGrowth (float time);	// generate a segmented profile that grows over time
-		int  GenerateComplete (int w);		// generate a final segmented profile (no animation)
+		int  GenerateComplete (int w, Mesh* mesh, int first_v);		// generate a final segmented profile (no animation)
+		void TransformRing (int ures, Vec3F o, Vec3F ex, Vec3F ey, Vec3F ez, Vec3F nx, Vec3F ny, Vec3F nz, Vec3F* vpos, Vec3F* vnorm);
 
 		void CountChainsAndLengths();
+
+		static int SelfTest ();
 		void getLoftSection(float v, int w, Matrix4F& xform, Quaternion& xrot, float& sz, uint& clr);
 		Vec3I getMeshRes();
 
@@ -59,10 +68,16 @@
 		bool			m_bSegments;
 		Vec3F*		m_Section;
 		Vec3F*		m_SectionNorm;
+		std::vector<float>		m_SecSoA;			// section x,y,z & normal x,y,z, ures each
 
 		std::vector<LoftGroup>	m_lofts;
 		std::vector<Mesh*>		m_meshes;			// performance pointer		
 
+		Mesh*					m_merged;			// merged mode mesh
+		Vec3I					m_mergedRes;		// resolution of merged topology
+		std::vector<uint64_t>	m_chainHash;		// per loft input hash, for partial updates
+		uint64_t				m_topoKey;			// input topology key of m_lofts
+
 		Shapes*			m_shapes;		
 
 		Mersenne		m_rand;
@@ -17,8 +17,15 @@
 #include "shapes.h"
 #include "scene.h"
 #include "imagex.h"
+#include "mesh.h"
+#include "image.h"
 #include "params.h"
+#include "loft.h"
 #include "timex.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "blob_cache.h"
+#include "selftest.h"
 
 #define M_NAME		0
 #define M_SEED		1
@@ -35,6 +42,9 @@
 #define M_VAR2MIN	10
 #define M_VAR2MAX	11
 #define M_VAR2DIV	12
+#define M_CACHE		13
+
+#define M_CACHE_VERSION	3
 
 // MODULE
 // --------
@@ -51,7 +61,8 @@
 
 Module::Module() : Object()
 {
-
+	m_params = 0x0;
+	for (int n=0; n < 4; n++) m_NumJobs[n] = 0;
 }
 
 void Module::Define (int x, int y)
@@ -85,6 +96,8 @@ void Module::Define (int x, int y)
 	AddParam(M_VAR2MAX,		"max2",		"3");	SetParamV3 (M_VAR2MAX, 0, Vec3F(1, 1, 1));
 	AddParam(M_VAR2DIV,		"div2",		"i");	SetParamI (M_VAR2DIV, 0, 0);
 
+	AddParam(M_CACHE,		"cache",	"i");	SetParamI (M_CACHE, 0, 1 );		// 0 = regenerate all, 1 = memory, 2 = memory & disk
+
 	mTimeRange.Set(0,10000,0);
 }
 
@@ -133,16 +146,15 @@ Shapes* Module::GenerateProxy(Vec3I v, std::string vname, int rnd, Vec3I numvari
 	return vari_shapes;
 }
 
-Shapes* Module::GenerateVariant (Vec3I v, std::string vname, int rnd, Vec3I numvari, std::vector<Object*>& objlist, Params* params)
+// Apply variant name, variant params & parameter space to objects in module
+void Module::ApplyVariant (Vec3I v, std::string vname, Vec3I numvari, std::vector<Object*>& objlist, Params* params)
 {
-	Shapes* vari_shapes;				// variant shapes
-	Vec3F pos, v1, v2, v3;
+	Vec3F v1, v2, v3;
 	int pid;
 	Vec3F v1min, v1max, v2min, v2max, v3min, v3max;
 	std::string key, val;
 	int v1div, v2div;
 	Object* obj;
-	Shapes* src_shapes;
 	
 	std::string v1param = getParamStr(M_VAR1PARAM);
 	std::string v2param = getParamStr(M_VAR2PARAM);
@@ -199,6 +211,15 @@ Shapes* Module::GenerateVariant (Vec3I v, std::string vname, int rnd, Vec3I numv
 			}
 		}
 	}
+}
+
+Shapes* Module::GenerateVariant (Vec3I v, std::string vname, int rnd, Vec3I numvari, std::vector<Object*>& objlist, Params* params)
+{
+	Shapes* vari_shapes;				// variant shapes
+	Shapes* src_shapes;
+	Object* obj;
+
+	ApplyVariant ( v, vname, numvari, objlist, params );
 
 	// create variant 
 	std::string name = getName() + "_" + vname;				// output = object + variant
@@ -304,13 +325,312 @@ void Module::RandomizeParams ()
 }
 
 
+// Variant cache
+// - key per variant from module params, seed, variant index, the params ApplyVariant will
+//   set, the other params of every object in the module, and everything upstream of
+//   the module: params of all inputs, transitively, and mesh & image content (see VariantKey)
+// - memory: the variant asset itself is the cached result. unchanged key = reuse as is
+// - disk (cache=2): blob per key (variant_{key}.bin in the BlobCache directory) with the variant shapes and the
+//   names of assets they reference. only valid while those assets exist with the same id
+//   & name, and were not created by variant generation (those change with the variant)
+//
+#define VJ_PROXY		0
+#define VJ_GENERATE		1
+#define VJ_REUSE		2
+#define VJ_LOAD			3
+
+struct VariantJob {
+	Vec3I		v;
+	int			rnd;
+	std::string	vname;
+	std::vector<std::string> params;		// randomized parameter space
+	uint64_t	key;
+	char		state;
+	bool		exists;						// variant asset from a previous rebuild
+	std::vector<Shape> shapes;				// loaded from disk
+	Shapes*		out;
+};
+
+// Assets referenced by shapes (mesh, shader, material)
+static void getVariantAssets ( Shape* s, int cnt, std::set<int>& ids )
+{
+	int num = gAssets.getNumObj();
+	for (int n=0; n < cnt; n++, s++) {
+		int mesh = (int) s->meshids.x, shdr = (int) s->meshids.y, mtl = s->matids.x;
+		if ( mesh >= 0 && mesh < num )	ids.insert ( mesh );
+		if ( shdr >= 0 && shdr < num )	ids.insert ( shdr );
+		if ( mtl != NULL_NDX && mtl >= 0 && mtl < num ) ids.insert ( mtl );
+	}
+}
+
+static uint64_t hashObjectParams ( uint64_t h, Object* obj, std::set<std::string>* skip = 0x0 )
+{
+	h = hashValue ( h, obj->getType() );
+	h = hashString ( h, obj->getName() );
+	for (int n=0; n < obj->getNumParam(); n++) {
+		if ( skip != 0x0 && skip->count ( obj->getParamName(n) ) != 0 ) continue;
+		h = hashString ( h, obj->getParamName(n) );
+		h = hashString ( h, obj->getParamValueAsStr(n) );
+	}
+	return h;
+}
+
+// Asset content, so an edited mesh or image with the same name changes the key
+static uint64_t hashObjectData ( uint64_t h, Object* obj )
+{
+	if ( obj->getType() == 'Amsh' ) {
+		Mesh* mesh = (Mesh*) obj;
+		int bufs[4] = { BVERTPOS, BVERTNORM, BVERTTEX, BFACEV3 };
+		for (int b = 0; b < 4; b++) {
+			if ( !mesh->isActive(bufs[b]) ) continue;
+			h = hashBytes ( h, mesh->GetStart(bufs[b]), size_t(mesh->GetNumElem(bufs[b])) * mesh->GetBufStride(bufs[b]) );
+		}
+	} else if ( obj->getType() == 'Aimg' ) {
+		Image* img = (Image*) obj;
+		h = hashValue ( h, img->GetWidth() );
+		h = hashValue ( h, img->GetHeight() );
+		h = hashValue ( h, (int) img->GetFormat() );
+		if ( img->GetData() != 0x0 )
+			h = hashBytes ( h, img->GetData(), size_t(img->GetWidth()) * img->GetHeight() * img->GetBytesPerPix() );
+	}
+	return h;
+}
+
+// Key of everything upstream of the module objects
+// - transitive input closure, in input order. same for all variants, computed once per rebuild
+// - module outputs & assets created by variant generation are skipped, they follow from the variant key
+uint64_t Module::InputsKey ( std::vector<Object*>& objlist )
+{
+	std::set<objID> visited;
+	std::vector<objID> stack;
+	Object* obj;
+	for (int n=0; n < objlist.size(); n++) {
+		visited.insert ( objlist[n]->getID() );
+		obj = objlist[n]->getOutput();							// regenerated per variant
+		if ( obj != 0x0 ) visited.insert ( obj->getID() );
+	}
+	for (int n=objlist.size()-1; n >= 0; n--)
+		for (int i=objlist[n]->getNumInputs()-1; i >= 0; i--)
+			stack.push_back ( objlist[n]->getInput(i) );
+
+	uint64_t h = 0;
+	while ( stack.size() > 0 ) {
+		objID id = stack.back();
+		stack.pop_back();
+		if ( visited.count ( id ) != 0 ) continue;
+		visited.insert ( id );
+		obj = gAssets.getObj ( id );
+		if ( obj == 0x0 || m_GenAssets.count ( id ) != 0 ) continue;
+		h = hashValue ( h, id );
+		h = hashObjectParams ( h, obj );
+		h = hashObjectData ( h, obj );
+		for (int i=obj->getNumInputs()-1; i >= 0; i--)
+			stack.push_back ( obj->getInput(i) );
+	}
+	return h;
+}
+
+// Variant key, without applying the variant
+// - params that ApplyVariant & RebuildSubgraph set are replaced by their inputs (name, seed, variant index, param space)
+// - the module's own cache param is left out, switching cache modes reuses results
+uint64_t Module::VariantKey ( Vec3I v, std::string vname, int rnd, Vec3I numvari, std::vector<std::string>& params, std::vector<Object*>& objlist, uint64_t inputs )
+{
+	std::set<std::string> own;
+	own.insert ( "cache" );									// how results are kept, not what they are
+	uint64_t h = hashValue ( 0, (int) M_CACHE_VERSION );
+	h = hashObjectParams ( h, this, &own );
+	h = hashValue ( h, rnd );
+	h = hashValue ( h, v );
+	h = hashValue ( h, numvari );
+	h = hashString ( h, vname );
+	for (int n=0; n < params.size(); n++)
+		h = hashString ( h, params[n] );
+	h = hashValue ( h, inputs );
+
+	std::set<std::string> skip;
+	skip.insert ( "name" );
+	skip.insert ( "seed" );									// set from rnd by RebuildSubgraph
+	skip.insert ( getParamStr(M_VAR1PARAM) );
+	skip.insert ( getParamStr(M_VAR2PARAM) );
+	if ( m_params != 0x0 )
+		for (int n=0; n < m_params->getNumParam(); n++)
+			skip.insert ( m_params->getParamName(n) );
+
+	// objects in module and their direct inputs
+	Object* obj;
+	for (int n=0; n < objlist.size(); n++) {
+		obj = objlist[n];
+		h = hashObjectParams ( h, obj, &skip );
+		h = hashValue ( h, (int) obj->isVisible() );
+		for (int i=0; i < obj->getNumInputs(); i++)
+			h = hashValue ( h, obj->getInput ( i ) );
+	}
+	return h;
+}
+
+// Blob count = shapes, assets
+bool Module::LoadVariant ( uint64_t key, std::vector<Shape>& shapes )
+{
+	BlobHeader hdr;
+	FILE* fp = BlobCache::OpenRead ( "variant", "VRNT", M_CACHE_VERSION, key, hdr );
+	if ( fp == 0x0 ) return false;
+	int num_shapes = hdr.count[0], num_assets = hdr.count[1];
+	bool ok = num_shapes >= 0 && num_assets >= 0;
+	if ( ok && num_shapes > 0 ) {
+		shapes.resize ( num_shapes );
+		ok = fread ( &shapes[0], sizeof(Shape), num_shapes, fp ) == num_shapes;
+	}
+	if ( !ok ) {
+		BlobCache::CloseRead ( fp, "variant", key, false );
+		return false;
+	}
+	// referenced assets, same id & name, not generated
+	// - a mismatch is not a bad blob, the assets may return. kept on disk
+	int id, len;
+	std::string name;
+	Object* obj;
+	for (int n=0; ok && n < num_assets; n++) {
+		ok = fread ( &id, sizeof(int), 1, fp ) == 1 && fread ( &len, sizeof(int), 1, fp ) == 1 && len > 0 && len < 4096;
+		if ( ok ) {
+			name.resize ( len );
+			ok = fread ( &name[0], 1, len, fp ) == len;
+		}
+		obj = (ok && id >= 0 && id < gAssets.getNumObj()) ? gAssets.getObj ( id ) : 0x0;
+		ok = obj != 0x0 && obj->getName() == name && m_GenAssets.count ( id ) == 0;
+	}
+	BlobCache::CloseRead ( fp, "variant", key, true );
+	return ok;
+}
+
+void Module::SaveVariant ( uint64_t key, Shapes* vari_shapes )
+{
+	int num = vari_shapes->getNumShapes();
+	std::set<int> ids;
+	if ( num > 0 ) getVariantAssets ( vari_shapes->getShape(0), num, ids );
+	for (std::set<int>::iterator it = ids.begin(); it != ids.end(); it++)
+		if ( m_GenAssets.count ( *it ) != 0 ) return;				// references generated assets, memory only
+
+	BlobHeader hdr;
+	hdr.Set ( "VRNT", M_CACHE_VERSION, key );
+	hdr.count[0] = num;
+	hdr.count[1] = (int) ids.size();
+	FILE* fp = BlobCache::OpenWrite ( "variant", hdr );
+	if ( fp == 0x0 ) return;
+	if ( num > 0 ) fwrite ( vari_shapes->getShape(0), sizeof(Shape), num, fp );
+	for (std::set<int>::iterator it = ids.begin(); it != ids.end(); it++) {
+		int id = *it;
+		std::string name = gAssets.getObj ( id )->getName();
+		int len = (int) name.size();
+		fwrite ( &id, sizeof(int), 1, fp );
+		fwrite ( &len, sizeof(int), 1, fp );
+		fwrite ( name.c_str(), 1, len, fp );
+	}
+	BlobCache::CloseWrite ( fp, "variant", key );
+}
+
+// Variant keys & disk blobs
+// - key is repeatable, and changes with variant, seed, name, param space, upstream key
+//   and the params of objects in the module
+// - params that ApplyVariant sets (name, param1/param2) are not in the key
+// - mesh & image content is hashed, not just names
+// - a saved blob loads back under its key only
+int Module::SelfTest ()
+{
+	int bad = 0;
+	Module mod, obj;
+	mod.Define ( 0, 0 );
+	obj.Define ( 0, 0 );
+	mod.SetParamStr ( M_VAR1PARAM, 0, "height" );
+	std::vector<Object*> objlist;
+	objlist.push_back ( &obj );
+	std::vector<std::string> params;
+	params.push_back ( "0.5" );
+	Vec3I v ( 1, 2, 0 ), numvari ( 4, 4, 1 );
+
+	uint64_t k0 = mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 );
+	bad += selfCheck ( k0 == mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "key not repeatable" );
+	bad += selfCheck ( k0 != mod.VariantKey ( Vec3I(2,1,0), "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "variant not in key" );
+	bad += selfCheck ( k0 != mod.VariantKey ( v, "vari_1_2", 8, numvari, params, objlist, 11 ), "variant_cache", "seed not in key" );
+	bad += selfCheck ( k0 != mod.VariantKey ( v, "vari_2_1", 7, numvari, params, objlist, 11 ), "variant_cache", "name not in key" );
+	bad += selfCheck ( k0 != mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 12 ), "variant_cache", "inputs not in key" );
+	params[0] = "0.6";
+	bad += selfCheck ( k0 != mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "param space not in key" );
+	params[0] = "0.5";
+
+	obj.SetParamF ( M_HGT, 0, 3 );										// set by ApplyVariant (param1)
+	obj.SetParamStr ( M_NAME, 0, "other" );
+	bad += selfCheck ( k0 == mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "variant params in key" );
+	obj.SetParamI ( M_SEED, 0, 99 );										// set by RebuildSubgraph
+	mod.SetParamI ( M_CACHE, 0, 2 );
+	bad += selfCheck ( k0 == mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "seed or cache mode in key" );
+	obj.SetParamV3 ( M_SPACING, 0, Vec3F(2,1,1) );
+	bad += selfCheck ( k0 != mod.VariantKey ( v, "vari_1_2", 7, numvari, params, objlist, 11 ), "variant_cache", "object params not in key" );
+
+	// asset content
+	Mesh mesh;
+	mesh.CreateFV ();
+	mesh.AddVert ( 0, 0, 0 );	mesh.AddVert ( 1, 0, 0 );	mesh.AddVert ( 0, 0, 1 );
+	mesh.AddFaceFast3FV ( 0, 1, 2 );
+	uint64_t h = hashObjectData ( 0, &mesh );
+	((Vec3F*) mesh.GetStart(BVERTPOS))[2].y = 1;
+	bad += selfCheck ( h != hashObjectData ( 0, &mesh ), "variant_cache", "mesh content not in key" );
+	Image img;
+	img.ResizeImage ( 4, 4, ImageOp::RGB24 );
+	memset ( img.GetData(), 0, 4 * 4 * img.GetBytesPerPix() );
+	h = hashObjectData ( 0, &img );
+	img.GetData()[7] = 50;
+	bad += selfCheck ( h != hashObjectData ( 0, &img ), "variant_cache", "image content not in key" );
+
+	// disk blob round-trip
+	Shapes vs;
+	int first;
+	Shape* s = vs.AddSpan ( 3, first );
+	for (int i = 0; i < 3; i++) {
+		s[i].Clear ();
+		s[i].pos.Set ( float(i), 1, 2 );
+	}
+	mod.SaveVariant ( k0, &vs );
+	std::vector<Shape> loaded;
+	bool ok = mod.LoadVariant ( k0, loaded );
+	bad += selfCheck ( ok && loaded.size() == 3 && loaded[2].pos.x == 2 && loaded[1].pos.z == 2, "variant_cache", "blob did not load back" );
+	loaded.clear ();
+	bad += selfCheck ( !mod.LoadVariant ( hashValue ( k0, 1 ), loaded ) && loaded.size() == 0, "variant_cache", "loaded a blob never saved" );
+	BlobCache::Remove ( "variant", k0 );
+
+	// rebuild twice, the second reuses every variant
+	// - subgraph is one merged loft over an empty shape set, complete after one run
+	if ( gScene != 0x0 ) {
+		gAssets.AddObject ( 'Ashp', "selftest_chain" );
+		Loft* loft = (Loft*) gAssets.AddObject ( 'loft', "selftest_loft" );
+		loft->Define ( 0, 0 );
+		loft->SetInput ( "shapes", "selftest_chain" );
+		loft->SetParamI ( loft->getParamByName("merged"), 0, 1 );
+		Module* rm = (Module*) gAssets.AddObject ( 'modl', "selftest_module" );
+		rm->Define ( 0, 0 );
+		rm->SetInput ( "object", "selftest_loft" );
+		rm->SetParamI3 ( M_RES, 0, Vec3I(3,2,1) );
+		rm->Generate ( 0, 0 );
+		bad += selfCheck ( rm->getNumJobs(VJ_GENERATE) == 6 && rm->getNumShapes() == 6, "variant_cache", "first rebuild did not generate all variants" );
+		rm->Rebuild ( true );
+		bad += selfCheck ( rm->getNumJobs(VJ_GENERATE) == 0 && rm->getNumJobs(VJ_REUSE) == 6, "variant_cache", "second rebuild regenerated variants" );
+		rm->SetParamI ( M_CACHE, 0, 2 );
+		rm->Rebuild ( true );
+		bad += selfCheck ( rm->getNumJobs(VJ_REUSE) == 6, "variant_cache", "cache mode change regenerated variants" );
+		rm->SetParamI ( M_CACHE, 0, 1 );
+		loft->SetParamF ( loft->getParamByName("noise"), 0, 0.01f );
+		rm->Rebuild ( true );
+		bad += selfCheck ( rm->getNumJobs(VJ_GENERATE) == 6, "variant_cache", "object param change not regenerated" );
+	}
+
+	return selfReport ( "variant_cache", bad );
+}
+
 void Module::Rebuild(bool bGenerate)
 {
 	Shape* s;	
 	Shapes* vari_shapes;		// variant shapes
 	Vec3F pos;
 	Quaternion rot;
-	int rnd;
 
 	std::vector<Object*> objlist;
 	int objs = getInputList("object", objlist);
@@ -326,56 +646,136 @@ void Module::Rebuild(bool bGenerate)
 
 	// Create LOD shapes
 	ClearShapes();
-	for (int n = 0; n < numvari.x * numvari.y * numvari.z; n++)
-		AddShape();
+	int first, numgrp = numvari.x * numvari.y * numvari.z;
+	Shape* grp = AddShapes ( numgrp, first );
+	for (int n = 0; n < numgrp; n++)
+		grp[n].Clear();
 	
 	Vec3F spacing = getParamV3(M_SPACING);
 
 	bool bParamSpace = CheckForParams();
 
-	// Generate variants
+	int cache = getParamI(M_CACHE);
+	m_VariantKeys.resize ( numgrp, 0 );
+
+	// Variant jobs
+	// - params randomized in variant order from the module seed, same sequence every rebuild
+	std::vector<VariantJob> jobs ( numgrp );
+	m_rand.seed ( getParamI(M_SEED) );
 	int i = 0;
 	for (v.z = 0; v.z < numvari.z; v.z++) {
 		for (v.y = 0; v.y < numvari.y; v.y++) {
 			for (v.x = 0; v.x < numvari.x; v.x++) {
-
-				// randomize for each Y/Z variant
-				rnd = getParamI(M_SEED) + i;
-
-				if ( bParamSpace ) 
-					RandomizeParams ();				
-
-				// get variant name
-				std::string vname = "V" + iToStr(v.x) + "x" + iToStr(v.y) + "x" + iToStr(v.z);
-
-				if ( v.x==numvari.x-1 && img != 0x0 ) { 					
-					vari_shapes = GenerateProxy (v, vname, rnd, numvari);						// last lod
-				} else {
-					vari_shapes = GenerateVariant (v, vname, rnd, numvari, objlist, m_params);	// module variant
+				VariantJob& job = jobs[i];
+				job.v = v;
+				job.rnd = getParamI(M_SEED) + i;			// randomize for each Y/Z variant
+				job.vname = "V" + iToStr(v.x) + "x" + iToStr(v.y) + "x" + iToStr(v.z);
+				job.key = 0;
+				job.out = 0x0;
+				job.exists = gAssets.FindObj ( getName() + "_" + job.vname ) != 0x0;
+
+				if ( bParamSpace ) {
+					RandomizeParams ();
+					for (int n=0; n < m_params->getNumParam(); n++)
+						job.params.push_back ( m_params->getParamValueAsStr(n) );
 				}
-				pos = Vec3F(v.x, v.z, v.y) * spacing;										// optional spatial layout					
-				vari_shapes->SetTransform(pos, Vec3F(1, 1, 1), rot);
-
-				// Add to master shape group (module output)
-				s = getShape(v.z * numvari.y * numvari.x + v.y * numvari.x + v.x);
-				s->type = S_SHAPEGRP;
-				s->meshids.x = vari_shapes->getID();			// shape group
-				s->meshids.y = OBJ_SHAPEGRP;					// this a *shape group*, not a mesh instance
-
-				//dbgprintf("VARIANT: %s, %d shapes\n", name.c_str(), vari_shapes->getNumShapes());				
 				i++;
 			}
 		}
 	}
 
+	// Variant keys, in parallel (read only)
+	// - unchanged key & existing variant asset = reuse
+	uint64_t inputs = (cache > 0) ? InputsKey ( objlist ) : 0;
+	ParallelFor ( numgrp, 1, [&](int start, int end, int chunk) {
+		for (int n = start; n < end; n++) {
+			VariantJob& job = jobs[n];
+			if ( job.v.x==numvari.x-1 && img != 0x0 ) {
+				job.state = VJ_PROXY;					// last lod
+			} else if ( cache > 0 ) {
+				job.key = VariantKey ( job.v, job.vname, job.rnd, numvari, job.params, objlist, inputs );
+				job.state = (job.key == m_VariantKeys[n] && job.exists) ? VJ_REUSE : (cache > 1 ? VJ_LOAD : VJ_GENERATE);
+			} else {
+				job.state = VJ_GENERATE;
+			}
+		}
+	});
+
+	// Load changed variants from disk, in parallel
+	if ( cache > 1 ) {
+		ParallelFor ( numgrp, 1, [&](int start, int end, int chunk) {
+			for (int n = start; n < end; n++)
+				if ( jobs[n].state == VJ_LOAD && !LoadVariant ( jobs[n].key, jobs[n].shapes ) )
+					jobs[n].state = VJ_GENERATE;
+		});
+	}
+
+	// Generate variants
+	// - serial, variants share the objects of the module subgraph (ApplyVariant writes their params).
+	//   objects parallelize their own work, e.g. lofts in Loft::Run
+	std::vector<int> save_list;
+	std::set<int> ids;
+	for (int n=0; n < 4; n++) m_NumJobs[n] = 0;
+	for (i = 0; i < numgrp; i++) {
+		VariantJob& job = jobs[i];
+		std::string name = getName() + "_" + job.vname;
+
+		switch ( job.state ) {
+		case VJ_PROXY:
+			vari_shapes = GenerateProxy (job.v, job.vname, job.rnd, numvari);
+			break;
+		case VJ_REUSE:
+			vari_shapes = (Shapes*) gAssets.FindObj(name);
+			break;
+		case VJ_LOAD:
+			vari_shapes = (Shapes*) gAssets.FindObj(name);
+			if (vari_shapes == 0x0) vari_shapes = (Shapes*) gAssets.AddObject('Ashp', name);
+			vari_shapes->Clear();
+			s = vari_shapes->AddSpan ( (int) job.shapes.size(), first );
+			if ( s != 0x0 && !job.shapes.empty() ) memcpy ( s, &job.shapes[0], job.shapes.size() * sizeof(Shape) );
+			break;
+		default: {
+			for (int n=0; n < job.params.size(); n++)
+				m_params->SetParam ( n, job.params[n] );		// randomized params of this variant
+
+			int num_assets = gAssets.getNumObj();
+			vari_shapes = GenerateVariant (job.v, job.vname, job.rnd, numvari, objlist, m_params);	// module variant
+
+			// assets created by generation
+			ids.clear();
+			if ( vari_shapes->getNumShapes() > 0 ) getVariantAssets ( vari_shapes->getShape(0), vari_shapes->getNumShapes(), ids );
+			for (std::set<int>::iterator it = ids.begin(); it != ids.end(); it++)
+				if ( *it >= num_assets ) m_GenAssets.insert ( *it );
+
+			if ( cache > 1 ) save_list.push_back ( i );
+			} break;
+		}
+		job.out = vari_shapes;
+		m_VariantKeys[i] = job.key;
+		m_NumJobs[ job.state ]++;
+
+		pos = Vec3F(job.v.x, job.v.z, job.v.y) * spacing;							// optional spatial layout
+		vari_shapes->SetTransform(pos, Vec3F(1, 1, 1), rot);
+
+		// Add to master shape group (module output)
+		s = getShape(i);
+		s->type = S_SHAPEGRP;
+		s->meshids.x = vari_shapes->getID();			// shape group
+		s->meshids.y = OBJ_SHAPEGRP;					// this a *shape group*, not a mesh instance
+	}
+
+	// Save generated variants to disk, in parallel
+	ParallelFor ( (int) save_list.size(), 1, [&](int start, int end, int chunk) {
+		for (int n = start; n < end; n++)
+			SaveVariant ( jobs[ save_list[n] ].key, jobs[ save_list[n] ].out );
+	});
+
 	MarkClean();
 }
 
 void Module::Generate (int x, int y)
 {
 	CreateOutput ( 'Ashp' );	
-	
-	m_rand.seed( getParamI(M_SEED) );
 
 	Rebuild(true);
 }
@@ -396,7 +796,7 @@ Shape Module::SelectVariant(Vec3F vari, Vec3F& sz)
 	vari *= num_vari;										// vari range <0,0,0> <nx,ny,nz>
 	int variant = int(vari.z) * num_vari.y * num_vari.x + int(vari.y) * num_vari.x + int(vari.x);	// specific variant
 
-	Shape* s = getShape( variant );							// shape group
+	Shape* s = readShape( variant );						// shape group
 	Shapes* sh = (Shapes*) gAssets.getObj ( s->meshids.x );	// shapes
 	s = sh->getShape(0);									// first shape
 	
@@ -405,7 +805,7 @@ Shape Module::SelectVariant(Vec3F vari, Vec3F& sz)
 
 Shape Module::SelectVariant(int vari, Vec3F& sz)
 {
-	Shape* s = getShape(vari);								// shape group
+	Shape* s = readShape(vari);								// shape group
 	Shapes* sh = (Shapes*)gAssets.getObj(s->meshids.x);		// shapes
 	s = sh->getShape(0);									// first shape
 	
@@ -17,7 +17,9 @@
 
 	#include "object.h"	
 	#include "mersenne.h"
+	#include <stdint.h>
 	#include <vector>
+	#include <set>
 
 	class Params;
 
@@ -34,6 +36,7 @@
 
 		void Rebuild (bool bRun);
 
+		void	ApplyVariant	(Vec3I v, std::string vname, Vec3I numvari, std::vector<Object*>& objlist, Params* params);
 		Shapes* GenerateVariant (Vec3I v, std::string vname, int rnd, Vec3I numvari, std::vector<Object*>& objlist, Params* params);
 		Shapes* GenerateProxy   (Vec3I v, std::string vname, int rnd, Vec3I numvari );
 
@@ -44,11 +47,24 @@
 		void RandomizeParams ();
 		std::string RandomizeValueTypeless ( std::string vmin, std::string vmax, uchar typ );
 
+		// Variant cache (content-addressed, memory & optional disk)
+		uint64_t InputsKey   (std::vector<Object*>& objlist);
+		uint64_t VariantKey  (Vec3I v, std::string vname, int rnd, Vec3I numvari, std::vector<std::string>& params, std::vector<Object*>& objlist, uint64_t inputs);
+		bool	 LoadVariant (uint64_t key, std::vector<Shape>& shapes);
+		void	 SaveVariant (uint64_t key, Shapes* vari_shapes);
+		int		 getNumJobs  (int state)	{ return m_NumJobs[state]; }		// variants of the last rebuild, by VJ_ state
+
+		static int SelfTest ();
+
 	private:		
 
 		Mersenne	m_rand;
 
 		Params*		m_params;
+
+		std::vector<uint64_t>	m_VariantKeys;		// key of the current result, per variant (0 = none)
+		std::set<objID>			m_GenAssets;		// assets created by variant generation, never valid in disk blobs
+		int						m_NumJobs[4];		// proxy, generated, reused, loaded
 	};
 
 #endif
\ No newline at end of file
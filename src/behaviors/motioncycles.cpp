@@ -17,9 +17,14 @@
 #include "camera.h"
 #include "main.h"
 #include "imagex.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "crowd.h"
+#include "selftest.h"
 
 #include <stack>
 #include <vector>
+#include <algorithm>
 
 #define BVH_START		0
 #define BVH_HIER		1
@@ -32,9 +37,15 @@
 
 #define JUNDEF		0xFFFF
 
+#define QBITS		20						// bits per smallest-three component
+#define QMASK		((1ULL << QBITS)-1)
+#define QSIGN		(1ULL << 62)			// sign of largest component
+
 MotionCycles::MotionCycles () : Object()
 {
 	m_TPose = 0x0;
+	m_KeyError = 0;
+	m_Version = 0;
 }
 
 MotionCycles::~MotionCycles()
@@ -47,6 +58,7 @@ bool MotionCycles::RunCommand(std::string cmd, vecStrs args)
 	if (cmd.compare("tpose")==0)	{ LoadTPose ( args[0] );	return true; }
 	if (cmd.compare("load") == 0)	{ LoadBVH ( args[0] );		return true; }
 	if (cmd.compare("cycle")==0)	{ SplitCycle ( args[0], (int) m_Cycles.size() - 1, strToI(args[1]), strToI(args[2]) );	return true; }
+	if (cmd.compare("keyerror")==0)	{ SetKeyError ( strToF(args[0]) );	return true; }
 	
 	if (cmd.compare("finish")==0)	{ 
 		RemoveAllBVH(); 
@@ -81,6 +93,7 @@ void MotionCycles::Clear()
 		if (cy->orient_table != 0x0)	{ free(cy->orient_table); cy->orient_table = 0x0; }
 	}
 	m_Cycles.clear();
+	m_Version++;
 }
 
 bool sort_func ( Vec3F a, Vec3F b )
@@ -90,11 +103,8 @@ bool sort_func ( Vec3F a, Vec3F b )
 
 int MotionCycles::AddCycle ( std::string name, int nframes, int njoints, int fskip )
 {
-	// *NOTE*:
-	// There are ways to improve memory in future:
-	// 1. only store cycle data for output channels, not all joints
-	// 2. only store orientation table, not ang & orient
-	// 3. compact pos & orient in single table. then index using channel ID
+	// Raw pos & orient tables only. 
+	// Euler angles are allocated by LoadBVH, split cycles are compressed (see CompressCycle)
 
 	Cycle cy;
 	
@@ -104,19 +114,19 @@ int MotionCycles::AddCycle ( std::string name, int nframes, int njoints, int fsk
 	cy.joints = njoints;
 	cy.frameskip = fskip;
 	cy.pos_table = (Vec3F*) malloc ( nframes * njoints * sizeof(Vec3F) );
-	cy.ang_table = (Vec3F*) malloc ( nframes * njoints * sizeof(Vec3F) );
+	cy.ang_table = 0x0;
 	cy.orient_table = (Quaternion*)  malloc ( nframes * njoints * sizeof(Quaternion) );	
 
 	// clear to identity as some channels may not be used
 	memset(cy.pos_table, 0, nframes * njoints * sizeof(Vec3F) );
-	memset(cy.ang_table, 0, nframes * njoints * sizeof(Vec3F) );
 	
+	cy.packed = false;
+	cy.pos_tracks = 0;
+	cy.raw_bytes = (uint64_t) cy.frames * njoints * (sizeof(Vec3F)*2 + sizeof(Quaternion));	// pos, ang & orient
 	cy.vis = 0x0;
 
-	float memuse = nframes * njoints * (sizeof(Vec3F)*2 + sizeof(Matrix4F)) / (1024.f*1024.f);		// NOT CORRECT
-	//logf ( "MotionCycle mem used: %fMB\n", memuse );
-
 	m_Cycles.push_back ( cy );
+	m_Version++;
 	return (int) m_Cycles.size()-1;
 }
 
@@ -142,9 +152,13 @@ int MotionCycles::SplitCycle ( std::string name, int src, int fin, int fout )
 	Cycle* csrc = getCycle(src);
 
 	// extract sub-matrix from source cycle
-	memcpy ( cdest->pos_table, &csrc->pos_table[fin*njoints], nframes*njoints*sizeof(Vec3F) );
-	memcpy ( cdest->ang_table, &csrc->ang_table[fin*njoints], nframes*njoints*sizeof(Vec3F) );
-	memcpy ( cdest->orient_table, &csrc->orient_table[fin*njoints], nframes*njoints*sizeof(Quaternion) );
+	for (int f=0; f < nframes; f++) {
+		for (int j=0; j < njoints; j++) {
+			cdest->pos_table[f*njoints + j] = getCyclePos ( csrc, j, fin+f );
+			cdest->orient_table[f*njoints + j] = getCycleRot ( csrc, j, fin+f );
+		}
+	}
+	CompressCycle ( cyid );
 
 	// generation visualization
 	GenerateVis ( cyid );
@@ -190,6 +204,7 @@ void MotionCycles::DeleteCycle ( int i )
 	free ( m_Cycles[i].ang_table );
 	free ( m_Cycles[i].orient_table );	
 	m_Cycles.erase ( m_Cycles.begin() + i );
+	m_Version++;
 }
 void MotionCycles::RemoveAllBVH ()
 {
@@ -207,9 +222,16 @@ void MotionCycles::RemoveAllBVH ()
 
 void MotionCycles::ListCycles ()
 {
+	uint64_t raw = 0, packed = 0, bytes;
+	Cycle* cy;
 	for (int n=0; n < m_Cycles.size(); n++ ) {
-		dbgprintf ( "    MotionCycle %d: %s (%d)\n", n, m_Cycles[n].name, m_Cycles[n].frames  );
+		cy = &m_Cycles[n];
+		bytes = getPackedBytes ( cy );
+		dbgprintf ( "    MotionCycle %d: %s (%d), %d keys, %.1f KB -> %.1f KB\n", n, cy->name, cy->frames, (int) cy->rot_key.size(), cy->raw_bytes/1024.f, bytes/1024.f );
+		raw += cy->raw_bytes;
+		packed += bytes;
 	}
+	if ( packed > 0 ) dbgprintf ( "    MotionCycles: %.2f MB -> %.2f MB (%.1fx)\n", raw/(1024.f*1024.f), packed/(1024.f*1024.f), float(raw)/packed );
 }
 int MotionCycles::RandomCycleInGroup ( std::string name )
 {
@@ -232,23 +254,109 @@ int MotionCycles::RandomCycleInGroup ( std::string name )
 	return group_list[j];
 }
 
+// BVH motion parsing
+// - whole file is read once, frame lines are indexed in a single pass
+// - frames are parsed in parallel. ParseFloat is locale independent and does
+//   not allocate (sscanf and atof follow LC_NUMERIC and are slow per value)
+
+static bool ReadFileData ( const char* fname, std::vector<char>& data )
+{
+	FILE* fp = fopen ( fname, "rb" );
+	if ( fp == 0x0 ) return false;
+	fseek ( fp, 0, SEEK_END );
+	long sz = ftell ( fp );
+	fseek ( fp, 0, SEEK_SET );
+	data.resize ( sz + 1 );
+	size_t got = (sz > 0) ? fread ( &data[0], 1, sz, fp ) : 0;
+	fclose ( fp );
+	data.resize ( got + 1 );
+	data[got] = '\0';
+	return true;
+}
+
+static inline const char* NextLine ( const char* p, const char* end )
+{
+	const char* n = (const char*) memchr ( p, '\n', end - p );
+	return (n == 0x0) ? end : n + 1;
+}
+
+static inline const char* SkipSpace ( const char* p )
+{
+	while ( *p == ' ' || *p == '\t' ) p++;
+	return p;
+}
+
+static inline const char* ParseFloat ( const char* p, float& val )
+{
+	p = SkipSpace ( p );
+	bool neg = (*p == '-');
+	if ( *p == '-' || *p == '+' ) p++;
+	double v = 0, scale = 0.1;
+	while ( *p >= '0' && *p <= '9' ) v = v*10 + (*p++ - '0');
+	if ( *p == '.' ) {
+		p++;
+		for (; *p >= '0' && *p <= '9'; p++, scale *= 0.1 ) v += (*p - '0') * scale;
+	}
+	if ( *p == 'e' || *p == 'E' ) {
+		p++;
+		bool eneg = (*p == '-');
+		if ( *p == '-' || *p == '+' ) p++;
+		int e = 0;
+		while ( *p >= '0' && *p <= '9' ) e = e*10 + (*p++ - '0');
+		v *= pow ( 10.0, eneg ? -e : e );
+	}
+	val = float( neg ? -v : v );
+	return p;
+}
+
+// Index the frame lines of the MOTION section
+// - comments & blank lines skipped. returns number of frames, at most the lines found, or -1 if not a BVH motion
+static int IndexBVHFrames ( const char* buf, const char* buf_end, std::string fname, std::vector<const char*>& frame_line )
+{
+	frame_line.clear ();
+
+	// Find motion section
+	const char* line = buf;
+	const char* next;
+	for (; line < buf_end; line = next) {
+		next = NextLine ( line, buf_end );
+		if ( strncmp ( SkipSpace(line), "MOTION", 6 ) == 0 ) break;
+	}
+	if ( line >= buf_end ) {
+		dbgprintf ( "ERROR: BVH file does not contain MOTION section. %s\n", fname.c_str() );
+		return -1;
+	}
+	line = SkipSpace ( next );
+	if ( strncmp ( line, "Frames:", 7 ) != 0 ) {
+		dbgprintf ( "ERROR: BVH file does not contain Frames entry. %s\n", fname.c_str() );
+		return -1;
+	}
+	int nframes = std::max ( 0, atoi ( line + 7 ) );			// # of frames in cycle
+	line = SkipSpace ( NextLine ( line, buf_end ) );
+	if ( strncmp ( line, "Frame Time:", 11 ) != 0 ) {
+		dbgprintf ( "ERROR: BVH file does not contain Frame Time entry. %s\n", fname.c_str() );
+	}
+	line = NextLine ( line, buf_end );
+
+	// Index frame lines in one pass
+	frame_line.reserve ( nframes );
+	for (; line < buf_end && frame_line.size() < nframes; line = NextLine ( line, buf_end ) ) {
+		const char* c = SkipSpace ( line );
+		if ( *line == '#' || *c == '\n' || *c == '\r' || *c == '\0' ) continue;		// comments & blank lines
+		frame_line.push_back ( line );
+	}
+	if ( frame_line.size() < nframes ) {
+		dbgprintf ( "WARNING: BVH has %d of %d frames. %s\n", (int) frame_line.size(), nframes, fname.c_str() );
+		nframes = (int) frame_line.size();
+	}
+	return nframes;
+}
+
 int MotionCycles::LoadBVH ( std::string fname )
 {
-	FILE* fp;
-	char buf[16384];
 	char filepath[1024];
 
 	int frame_skip = 1;
-	float scaling = 0.25;
-
-	std::string word, word1, word2, word3, name;
-	int mode = BVH_MOTION;
-	std::stack<int> jtree;
-	int jnt = 0, jlev = 0, jparent = 0;
-	int bytes = 0, cnt = 0, num_chan = 0;
-	int frame = 0, used;
-	//char args[10][1024];
-	Vec3F vec;
 
 	if ( !getFileLocation ( fname.c_str(), filepath ) ) {
 		dbgprintf( "ERROR: Cannot find file. %s\n", fname );		
@@ -288,88 +396,49 @@ int MotionCycles::LoadBVH ( std::string fname )
 		m_ChannelMap.push_back( dst_chan );
 	}
 
-	// Open the BVH again to get motion data
-	fp = fopen ( filepath, "rt" );	
-
-	jnt = 0;
-	jparent = 0;
-	int cyid = OBJ_NULL;
-	Cycle* cy;
-	int njoints, nframes;
-	
-	while ( feof( fp ) == 0 ) {
-		fgets ( buf, 16384, fp );	
-
-		if ( buf[0] == '#' )				// Comments
-			continue;
-
-		switch ( mode ) {
-		case BVH_MOTION:
-			word = readword ( buf, ' ' );
-			if ( word.compare ( "MOTION" ) == 0 ) {	
-				// Start motion section
-				fgets ( buf, 1024, fp );						// Frames data
-				word = readword ( buf, ' ' );
-				if ( word.compare ( "Frames:" ) !=0 ) {
-					dbgprintf ( "ERROR: BVH file does not contain Frames entry\n", fname );
-				}
-				word = readword ( buf, ' ' );				
-				
-				nframes = strToI ( word );				// # of frames in cycle				
-							
-				fgets ( buf, 1024, fp );					// frame time data
-				word = readword ( buf, ' ' );
-				if ( word.compare ( "Frame" ) !=0 ) {
-					dbgprintf ( "ERROR: BVH file does not contain Frame Time entry\n", fname );
-				}
-				word = readword ( buf, ' ' );
-				word = readword ( buf, ' ' );
-				
-				njoints = m_TPose->getNumJoints(JNTS_A);	// number of joints in output character 
-				
-				float frametime = strToF ( word );			// frame time				
-								
-				// Create cycle
-				cyid = AddCycle ( fname, nframes, njoints, frame_skip );
-				cy = getCycle ( cyid );
-
-				mode = BVH_TIMEDATA;
-			}
-			break;
-		case BVH_TIMEDATA: {
-			bytes = 0;
-			//printf ( "  MOTION. Frame: %d of %d\n", frame, m_Cycle.frames );			
-						
-			if ( frame % frame_skip == 0 ) {
-
-				// loop over each channel modification (joint pos/ang) for single frame
-				int recframe = frame / frame_skip;
-				
-				assert( m_TmpChar->getNumChannels() == m_ChannelMap.size() );		// all channels must be accounted for
-				
-				for (int c=0; c < m_ChannelMap.size(); c++ ) {
-					src_chan = m_TmpChar->getChannel (c);							// source channel
-					dst_chan = m_ChannelMap[c];										// dest channel
-					switch (src_chan.y) {
-					case CHAN_XYZ_POS:
-						sscanf(buf + bytes, "%f %f %f%n", &vec.x, &vec.y, &vec.z, &used);		// always read frame data
-						if (dst_chan.x != -1) cy->pos_table[recframe * njoints + dst_chan.x] = vec;		
-						break;
-					case CHAN_ZYX_ROT:
-						sscanf(buf + bytes, "%f %f %f%n", &vec.z, &vec.y, &vec.x, &used);		// always read frame data
-						if (dst_chan.x != -1) cy->ang_table[recframe * njoints + dst_chan.x] = vec;
-						break;
-					} 
-					bytes += used;			// advance to next joint in same line
+	// Read the whole BVH into memory to get motion data
+	std::vector<char> data;
+	if ( !ReadFileData ( filepath, data ) ) {
+		dbgprintf ( "ERROR: Cannot read file. %s\n", fname.c_str() );
+		return OBJ_NULL;
+	}
+	const char* buf = &data[0];
+	const char* buf_end = buf + data.size() - 1;				// data is null terminated
+	std::vector<const char*> frame_line;
+	int nframes = IndexBVHFrames ( buf, buf_end, fname, frame_line );
+	if ( nframes < 0 ) return OBJ_NULL;
+
+	// Create cycle
+	int njoints = m_TPose->getNumJoints(JNTS_A);				// number of joints in output character 
+	int cyid = AddCycle ( fname, nframes, njoints, frame_skip );
+	Cycle* cy = getCycle ( cyid );
+	cy->ang_table = (Vec3F*) malloc ( nframes * njoints * sizeof(Vec3F) );
+	memset ( cy->ang_table, 0, nframes * njoints * sizeof(Vec3F) );
+
+	std::vector<Vec3I> src_chans;								// all channels must be accounted for
+	for (int c=0; c < m_TmpChar->getNumChannels(); c++)
+		src_chans.push_back ( m_TmpChar->getChannel(c) );
+
+	// Parse frames in parallel, one line per frame
+	ParallelFor ( cy->frames, 64, [&](int start, int end, int chunk) {
+		Vec3F vec;
+		for (int recframe = start; recframe < end; recframe++) {
+			const char* p = frame_line[ recframe * frame_skip ];
+			for (int c=0; c < src_chans.size(); c++ ) {
+				Vec3I dst_chan = m_ChannelMap[c];
+				switch ( src_chans[c].y ) {
+				case CHAN_XYZ_POS:
+					p = ParseFloat ( ParseFloat ( ParseFloat ( p, vec.x ), vec.y ), vec.z );		// always read frame data
+					if (dst_chan.x != -1) cy->pos_table[recframe * njoints + dst_chan.x] = vec;
+					break;
+				case CHAN_ZYX_ROT:
+					p = ParseFloat ( ParseFloat ( ParseFloat ( p, vec.z ), vec.y ), vec.x );
+					if (dst_chan.x != -1) cy->ang_table[recframe * njoints + dst_chan.x] = vec;
+					break;
 				}
 			}
-			frame++;
-			if ( frame >= cy->frames*frame_skip ) mode = BVH_END;
-			} break;
-		case BVH_END:
-			break;
-		}; 
-	}
+		}
+	} );
 	
 	// Refactor the BVH format into desired Ri' orientations		
 	//   See the paper: Meredit & Maddock, Motion Capture File Formats Explained 
@@ -379,9 +448,14 @@ int MotionCycles::LoadBVH ( std::string fname )
 	Quaternion parent;
 	parent.Identity();
 	
-	for (int f=0; f < cy->frames; f++) {									// Process all frames
-		RefactorBVH ( m_TPose->getJoints(JNTS_A), cy, 0, f, parent );		// TPose gives us the bone pivots to be refactored
-	}
+	JointSet& tpose = m_TPose->getJoints(JNTS_A);						// TPose gives us the bone pivots to be refactored
+	ParallelFor ( cy->frames, 64, [&](int start, int end, int chunk) {
+		for (int f=start; f < end; f++)										// frames are independent
+			RefactorBVH ( tpose, cy, 0, f, parent );
+	} );
+	free ( cy->ang_table );													// Euler angles no longer needed
+	cy->ang_table = 0x0;
+	m_Version++;
 
 	return cyid;
 }
@@ -440,12 +514,12 @@ void MotionCycles::getInterpolatedJoint ( float f, Cycle* cy, Vec3F& p, Quaterni
 	float u = f - int(f);
 
 	// root joint only
-	p1 = cy->pos_table[ int(f) * cy->joints ];	
-	q1 = cy->orient_table[ int(f) * cy->joints ];	
+	p1 = getCyclePos ( cy, 0, int(f) );
+	q1 = getCycleRot ( cy, 0, int(f) );
 	
 	if ( u==0.0 ) { p = p1; q = q1;	return; }
-	p2 = cy->pos_table[ (int(f)+1) * cy->joints ];	
-	q2 = cy->orient_table[ (int(f)+1) * cy->joints ];
+	p2 = getCyclePos ( cy, 0, int(f)+1 );
+	q2 = getCycleRot ( cy, 0, int(f)+1 );
 
 	q.slerp ( q1, q2, u );		// interpolate rotation
 	p = p1 + (p2-p1)*u;			// interpolate pos
@@ -469,15 +543,12 @@ void MotionCycles::AssignCycleToJoints ( int cyid, JointSet& joints, float t )
 	// locate animation data for the selected frame
 	Cycle* cy = getCycle(cyid);
 	int frame = int(t);
-	Vec3F* cpos = &cy->pos_table[ frame*cy->joints ];		
-	Vec3F* cang = &cy->ang_table[ frame*cy->joints ];			
-	Quaternion* corient = &cy->orient_table[ frame*cy->joints ];			
 
 	// write all joints
 	for (int j=0; j < cy->joints; j++ ) {
-		joints[j].pos = *cpos++;
-		joints[j].angs = *cang++;		
-		joints[j].orient = *corient++;
+		joints[j].pos = getCyclePos ( cy, j, frame );
+		joints[j].orient = getCycleRot ( cy, j, frame );
+		if ( cy->ang_table != 0x0 ) joints[j].angs = cy->ang_table[ frame*cy->joints + j ];
 	}
 }
 
@@ -500,16 +571,389 @@ void MotionCycles::SetGroup ( std::string name )
 Quaternion MotionCycles::getCycleFrameOrientation ( int cid, int f )
 {
 	Cycle* cy = getCycle(cid);
-	return cy->orient_table[ f*cy->joints ];		// return orientation of base joint 0
+	return getCycleRot ( cy, 0, f );				// return orientation of base joint 0
 }
 
 Vec3F MotionCycles::getCycleFramePos ( int cid, int f )
 {
 	Cycle* cy = getCycle(cid);
-	return cy->pos_table[ f*cy->joints ];			// return pos of base joint 0
+	return getCyclePos ( cy, 0, f );				// return pos of base joint 0
+}
+
+
+
+//---------------- Cycle compression
+//
+// Rotations: smallest-three. the largest quaternion component is dropped and
+//   rebuilt from unit length, the other three are quantized to 20 bits in
+//   [-1/sqrt2, 1/sqrt2]. 64 bits = index(2) + 3x20 + sign of largest.
+// Keyframes: optional, per joint. a key is dropped when interpolating its
+//   neighbors stays within m_KeyError degrees of every frame in between.
+// Positions: only joints that move get a track, others keep a single value.
+
+static uint64_t PackQuat ( Quaternion& q )
+{
+	float c[4] = { (float) q.X, (float) q.Y, (float) q.Z, (float) q.W };
+	float len = sqrt ( c[0]*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3] );
+	if ( len == 0 ) { c[3] = len = 1; }					// identity
+	int big = 0;
+	for (int i=1; i < 4; i++)
+		if ( fabs(c[i]) > fabs(c[big]) ) big = i;
+	float s = (c[big] < 0) ? -1.0f : 1.0f;
+	uint64_t v = (uint64_t) big | ((s < 0) ? QSIGN : 0);
+	int k = 0;
+	for (int i=0; i < 4; i++) {
+		if ( i == big ) continue;
+		float u = ( c[i]*s/len * 0.70710678f + 0.5f );		// [-1/sqrt2, 1/sqrt2] -> [0,1]
+		u = (u < 0) ? 0 : (u > 1) ? 1 : u;
+		v |= ((uint64_t) (u * QMASK + 0.5f)) << (2 + QBITS*k);
+		k++;
+	}
+	return v;
+}
+
+static Quaternion UnpackQuat ( uint64_t v )
+{
+	float c[4];
+	int big = int(v & 3);
+	float sum = 0;
+	int k = 0;
+	for (int i=0; i < 4; i++) {
+		if ( i == big ) continue;
+		c[i] = ( float((v >> (2 + QBITS*k)) & QMASK) / QMASK - 0.5f ) * 1.41421356f;
+		sum += c[i]*c[i];
+		k++;
+	}
+	c[big] = sqrt ( (sum < 1) ? 1 - sum : 0 );
+	if ( v & QSIGN ) { c[0] = -c[0]; c[1] = -c[1]; c[2] = -c[2]; c[3] = -c[3]; }
+	Quaternion q;
+	q.set ( c[0], c[1], c[2], c[3] );
+	return q;
+}
+
+static float QuatDot ( Quaternion& a, Quaternion& b )
+{
+	return float( a.X*b.X + a.Y*b.Y + a.Z*b.Z + a.W*b.W );
+}
+
+// normalized lerp, shortest path. used both to fit and to play back keys
+static Quaternion QuatNlerp ( Quaternion& a, Quaternion& b, float u )
+{
+	float s = (QuatDot(a, b) < 0) ? -u : u;
+	float c[4] = { float(a.X*(1-u) + b.X*s), float(a.Y*(1-u) + b.Y*s), float(a.Z*(1-u) + b.Z*s), float(a.W*(1-u) + b.W*s) };
+	float len = sqrt ( c[0]*c[0] + c[1]*c[1] + c[2]*c[2] + c[3]*c[3] );
+	Quaternion q;
+	q.set ( c[0]/len, c[1]/len, c[2]/len, c[3]/len );
+	return q;
+}
+
+Quaternion MotionCycles::getCycleRot ( Cycle* cy, int j, int f )
+{
+	if ( f < 0 ) f = 0;
+	if ( f >= cy->frames ) f = cy->frames-1;
+	if ( !cy->packed ) return cy->orient_table[ f*cy->joints + j ];
+
+	int k0 = cy->rot_start[j];
+	if ( cy->rot_frame.size() == 0 ) return UnpackQuat ( cy->rot_key[ k0 + f ] );
+
+	// last key at or before f
+	uint16_t* fr = &cy->rot_frame[0];
+	int k1 = cy->rot_start[j+1];
+	int k = int( std::upper_bound ( fr + k0, fr + k1, (uint16_t) f ) - fr ) - 1;
+	if ( k < k0 ) k = k0;
+	if ( fr[k] == f || k >= k1-1 ) return UnpackQuat ( cy->rot_key[k] );
+
+	Quaternion a = UnpackQuat ( cy->rot_key[k] );
+	Quaternion b = UnpackQuat ( cy->rot_key[k+1] );
+	return QuatNlerp ( a, b, float(f - fr[k]) / float(fr[k+1] - fr[k]) );
+}
+
+Vec3F MotionCycles::getCyclePos ( Cycle* cy, int j, int f )
+{
+	if ( f < 0 ) f = 0;
+	if ( f >= cy->frames ) f = cy->frames-1;
+	if ( !cy->packed ) return cy->pos_table[ f*cy->joints + j ];
+
+	int t = cy->pos_track[j];
+	return (t < 0) ? cy->pos_const[j] : cy->pos_key[ f*cy->pos_tracks + t ];
+}
+
+void MotionCycles::CompressCycle ( int cyid )
+{
+	Cycle* cy = getCycle(cyid);
+	if ( cy == 0x0 || cy->packed ) return;
+
+	int nf = cy->frames;
+	int nj = cy->joints;
+	bool reduce = ( m_KeyError > 0 && nf <= 65535 );
+	float cos_err = cos ( m_KeyError * 0.5f * DEGtoRAD );		// |dot| bound for the angle between quaternions
+	std::vector<uint64_t> keys ( nf );
+	std::vector<Quaternion> q ( nf );
+
+	// Rotations
+	cy->rot_start.clear();
+	cy->rot_frame.clear();
+	cy->rot_key.clear();
+	for (int j=0; j < nj; j++) {
+		cy->rot_start.push_back ( (int) cy->rot_key.size() );
+		for (int f=0; f < nf; f++) {
+			keys[f] = PackQuat ( cy->orient_table[ f*nj + j ] );
+			q[f] = UnpackQuat ( keys[f] );					// fit against the quantized values
+		}
+		if ( !reduce ) {
+			cy->rot_key.insert ( cy->rot_key.end(), keys.begin(), keys.end() );
+			continue;
+		}
+		int a = 0;
+		cy->rot_frame.push_back ( a );
+		cy->rot_key.push_back ( keys[a] );
+		while ( a < nf-1 ) {
+			int b = a+1;
+			while ( b+1 < nf ) {
+				bool fits = true;							// can key a span to b+1?
+				for (int i=a+1; i <= b && fits; i++) {
+					Quaternion r = QuatNlerp ( q[a], q[b+1], float(i-a) / float(b+1-a) );
+					fits = ( fabs(QuatDot(r, q[i])) >= cos_err );
+				}
+				if ( !fits ) break;
+				b++;
+			}
+			cy->rot_frame.push_back ( b );
+			cy->rot_key.push_back ( keys[b] );
+			a = b;
+		}
+	}
+	cy->rot_start.push_back ( (int) cy->rot_key.size() );
+
+	// Positions
+	cy->pos_track.assign ( nj, -1 );
+	cy->pos_const.resize ( nj );
+	cy->pos_tracks = 0;
+	for (int j=0; j < nj; j++) {
+		Vec3F p0 = cy->pos_table[ j ];
+		cy->pos_const[j] = p0;
+		for (int f=1; f < nf; f++) {
+			Vec3F d = cy->pos_table[ f*nj + j ] - p0;
+			if ( fabs(d.x) > 1e-6f || fabs(d.y) > 1e-6f || fabs(d.z) > 1e-6f ) { cy->pos_track[j] = cy->pos_tracks++; break; }
+		}
+	}
+	cy->pos_key.resize ( nf * cy->pos_tracks );
+	for (int f=0; f < nf; f++)
+		for (int j=0; j < nj; j++)
+			if ( cy->pos_track[j] >= 0 ) cy->pos_key[ f*cy->pos_tracks + cy->pos_track[j] ] = cy->pos_table[ f*nj + j ];
+
+	// Release raw tables
+	free ( cy->pos_table );		cy->pos_table = 0x0;
+	free ( cy->orient_table );	cy->orient_table = 0x0;
+	if ( cy->ang_table != 0x0 ) { free ( cy->ang_table ); cy->ang_table = 0x0; }
+	cy->packed = true;
+	m_Version++;
+}
+
+uint64_t MotionCycles::getPoseKey ( int cyc, int frame )
+{
+	Cycle* cy = getCycle(cyc);
+	if ( cy == 0x0 ) return 0;
+	frame = std::max ( 0, std::min ( frame, cy->frames-1 ) );		// same clamp as getCycleRot
+	int ids[4] = { getID(), m_Version, cyc, frame };
+	return hashValue ( 0, ids );
+}
+
+uint64_t MotionCycles::getCycleSetKey ()
+{
+	uint64_t h = hashValue ( 0, (int) m_Cycles.size() );
+	if ( m_TPose != 0x0 ) h = hashValue ( h, Crowd::getSkeletonKey ( m_TPose->getJoints(JNTS_A) ) );
+	for (int n=0; n < m_Cycles.size(); n++) {
+		Cycle* cy = &m_Cycles[n];
+		int sz = cy->frames * cy->joints;
+		h = hashBytes ( h, cy->name, strlen(cy->name) );
+		h = hashValue ( h, cy->frames );
+		h = hashValue ( h, cy->joints );
+		if ( cy->packed ) {
+			if ( cy->rot_key.size() > 0 )	h = hashBytes ( h, &cy->rot_key[0], cy->rot_key.size()*sizeof(uint64_t) );
+			if ( cy->rot_frame.size() > 0 )	h = hashBytes ( h, &cy->rot_frame[0], cy->rot_frame.size()*sizeof(uint16_t) );
+		} else if ( sz > 0 ) {
+			h = hashBytes ( h, cy->orient_table, sz * sizeof(Quaternion) );
+		}
+	}
+	return h;
+}
+
+uint64_t MotionCycles::getPackedBytes ( Cycle* cy )
+{
+	if ( !cy->packed ) return cy->raw_bytes;
+	return cy->rot_start.size()*sizeof(int) + cy->rot_frame.size()*sizeof(uint16_t) + cy->rot_key.size()*sizeof(uint64_t)
+		 + cy->pos_track.size()*sizeof(int) + cy->pos_const.size()*sizeof(Vec3F) + cy->pos_key.size()*sizeof(Vec3F);
+}
+
+
+// Transition from cycle ci at frame to the start of cj
+// - precomputed transition list when present, otherwise indexed pose search
+Vec3I MotionCycles::FindTransition ( int ci, int cj, int frame )
+{
+	Cycle* cyclei = getCycle(ci);						// input cycle
+	TransitionList& tlist = cyclei->transitions;
+
+	if ( tlist.size()==0 ) 								// no transition list, use pose search
+		return getPoseDB()->FindTransition ( ci, frame, cj );
+
+	int best = -1;
+	int bestf = 100000;
+	for (int n=0; n < tlist.size(); n++) {
+		if ( tlist[n].x == cj && tlist[n].y >= frame && tlist[n].y < bestf ) {	// find best candidate transition
+			best = n;
+			bestf = tlist[n].y;
+		}
+	}
+	if ( best == -1 ) return Vec3I(-1,-1,-1);		// no candidate found
+	return tlist[ best ];
+}
+
+
+// angle between rotations, radians
+static float QuatAngle ( Quaternion& a, Quaternion& b )
+{
+	float d = fabs ( QuatDot ( a, b ) );
+	return 2.0f * acos ( (d > 1) ? 1 : d );
+}
+
+static Quaternion RandomQuat ( uint64_t seed, int i )
+{
+	float c[4], len = 0;
+	for (int k=0; k < 4; k++) { c[k] = hashRandF ( seed, i*4+k ) * 2 - 1; len += c[k]*c[k]; }
+	len = (len > 1e-6f) ? sqrt(len) : 1;
+	Quaternion q;
+	q.set ( c[0]/len, c[1]/len, c[2]/len, c[3]/len );
+	return q;
 }
 
+// Compressed storage round-trips
+// - smallest-three packing within quantization error, sign & largest index kept
+// - lossless keys reproduce every frame, reduced keys stay within the key error
+int MotionCycles::SelfTest ()
+{
+	int bad = 0;
+	float qerr = 0.1f * DEGtoRAD;						// 20-bit quantization is far below
+
+	// pack / unpack
+	Quaternion q, r;
+	float worst = 0;
+	for (int i=0; i < 10000; i++) {
+		q = RandomQuat ( 3, i );
+		if ( i == 0 ) q.set ( 0, 0, 0, 1 );
+		if ( i == 1 ) q.set ( 0, 0, 0, -1 );
+		if ( i == 2 ) q.set ( 0.5f, -0.5f, 0.5f, -0.5f );		// equal magnitudes
+		r = UnpackQuat ( PackQuat ( q ) );
+		worst = std::max ( worst, QuatAngle ( q, r ) );
+	}
+	bad += selfCheck ( worst < qerr, "motioncycles", "quaternion packing error too large" );
+
+	// cycle compression, smooth random motion
+	int nf = 120, nj = 5;
+	for (int pass=0; pass < 2; pass++) {
+		MotionCycles mc;
+		mc.SetKeyError ( pass==0 ? 0 : 2.0f );
+		int c = mc.AddCycle ( "test", nf, nj, 1 );
+		Cycle* cy = mc.getCycle ( c );
+		std::vector<Quaternion> orient ( nf*nj );
+		std::vector<Vec3F> pos ( nf*nj );
+		for (int j=0; j < nj; j++) {
+			Quaternion a = RandomQuat ( 5, j*2 ), b = RandomQuat ( 5, j*2+1 );
+			for (int f=0; f < nf; f++) {
+				orient[f*nj+j] = QuatNlerp ( a, b, float(f) / (nf-1) );
+				pos[f*nj+j] = (j % 2) ? Vec3F(0, float(j), 0) : Vec3F(float(f), 0, float(j));	// constant & moving joints
+			}
+		}
+		memcpy ( cy->orient_table, &orient[0], nf*nj*sizeof(Quaternion) );
+		memcpy ( cy->pos_table, &pos[0], nf*nj*sizeof(Vec3F) );
+		mc.CompressCycle ( c );
+		cy = mc.getCycle ( c );
+
+		float limit = (pass==0) ? qerr : 2.0f * DEGtoRAD + qerr;
+		worst = 0;
+		int pos_bad = 0;
+		for (int f=0; f < nf; f++) {
+			for (int j=0; j < nj; j++) {
+				r = mc.getCycleRot ( cy, j, f );
+				worst = std::max ( worst, QuatAngle ( orient[f*nj+j], r ) );
+				Vec3F p = mc.getCyclePos ( cy, j, f );
+				if ( p.x != pos[f*nj+j].x || p.y != pos[f*nj+j].y || p.z != pos[f*nj+j].z ) pos_bad++;
+			}
+		}
+		bad += selfCheck ( cy->packed, "motioncycles", "cycle not packed" );
+		bad += selfCheck ( worst < limit, "motioncycles", pass==0 ? "lossless keys changed rotations" : "reduced keys exceed key error" );
+		bad += selfCheck ( pos_bad == 0, "motioncycles", "positions changed" );
+		if ( pass == 1 ) bad += selfCheck ( cy->rot_key.size() < nf*nj, "motioncycles", "no keys dropped on smooth motion" );
+
+		// shared pose keys follow the cycle set
+		uint64_t k = mc.getPoseKey ( c, 10 );
+		bad += selfCheck ( k == mc.getPoseKey ( c, 10 ) && k != mc.getPoseKey ( c, 11 ), "motioncycles", "pose key not per frame" );
+		bad += selfCheck ( mc.getPoseKey ( c, nf+5 ) == mc.getPoseKey ( c, nf-1 ), "motioncycles", "pose key not clamped like getCycleRot" );
+		mc.AddCycle ( "other", nf, nj, 1 );
+		bad += selfCheck ( k != mc.getPoseKey ( c, 10 ), "motioncycles", "pose key kept after cycle set changed" );
+	}
 
+	// BVH motion, in memory: CRLF, comments, blank lines, tabs, signs & exponents
+	int nv = 9;
+	std::vector<float> gen ( nf*nv );
+	std::string bvh = "HIERARCHY\r\nROOT Hips\r\n{\r\n}\r\nMOTION\r\nFrames: 40\r\nFrame Time: 0.0333333\r\n";
+	char val[64];
+	for (int f=0; f < 40; f++) {
+		if ( f == 10 ) bvh += "# comment line\r\n\r\n";
+		if ( f == 25 ) bvh += " \t\r\n";
+		if ( f % 3 == 1 ) bvh += "\t ";
+		for (int c=0; c < nv; c++) {
+			gen[f*nv+c] = (hashRandF ( 7, f*nv+c ) * 400 - 200) * ((c == 8) ? 0.001f : 1.0f);
+			switch ( (f + c) % 3 ) {
+			case 0: snprintf ( val, 64, "%.4f", gen[f*nv+c] );	break;
+			case 1: snprintf ( val, 64, "%+e", gen[f*nv+c] );	break;
+			case 2: snprintf ( val, 64, "%g", gen[f*nv+c] );	break;
+			}
+			bvh += val;
+			bvh += (c % 2) ? "\t" : " ";
+		}
+		bvh += "\r\n";
+	}
+	std::vector<const char*> lines;
+	const char* bvh_end = bvh.c_str() + bvh.length();
+	int frames = IndexBVHFrames ( bvh.c_str(), bvh_end, "selftest", lines );
+	bad += selfCheck ( frames == 40 && lines.size() == 40, "motioncycles", "BVH frame count wrong" );
+
+	// values match strtod and the written values
+	int val_bad = 0;
+	std::vector<float> ser ( 40*nv, 0 ), par ( 40*nv, 0 );
+	for (int f=0; f < lines.size(); f++) {
+		const char* p = lines[f];
+		char* q = (char*) lines[f];
+		for (int c=0; c < nv; c++) {
+			p = ParseFloat ( p, ser[f*nv+c] );
+			double ref = strtod ( q, &q );
+			if ( p != q || fabs ( ser[f*nv+c] - ref ) > 1e-6 * std::max ( 1.0, fabs(ref) ) ) val_bad++;
+			if ( fabs ( ser[f*nv+c] - gen[f*nv+c] ) > 1e-3f ) val_bad++;
+		}
+	}
+	bad += selfCheck ( val_bad == 0, "motioncycles", "BVH values differ from written values" );
+
+	// parallel parse matches serial
+	ParallelFor ( (int) lines.size(), 4, [&](int start, int end, int chunk) {
+		for (int f=start; f < end; f++) {
+			const char* p = lines[f];
+			for (int c=0; c < nv; c++) p = ParseFloat ( p, par[f*nv+c] );
+		}
+	} );
+	bad += selfCheck ( par == ser, "motioncycles", "parallel BVH parse differs from serial" );
+
+	// short file keeps the frames found, no motion fails
+	std::string shrt = bvh;
+	shrt.replace ( shrt.find ( "Frames: 40" ), 10, "Frames: 50" );
+	frames = IndexBVHFrames ( shrt.c_str(), shrt.c_str() + shrt.length(), "selftest short", lines );
+	bad += selfCheck ( frames == 40 && lines.size() == 40, "motioncycles", "short BVH not reduced to lines found" );
+	std::string none = "HIERARCHY\r\nROOT Hips\r\n";
+	frames = IndexBVHFrames ( none.c_str(), none.c_str() + none.length(), "selftest none", lines );
+	bad += selfCheck ( frames == -1, "motioncycles", "BVH without MOTION accepted" );
+
+	return selfReport ( "motioncycles", bad );
+}
 
 //---------------- Advanced character funcs
 
@@ -724,23 +1168,4 @@ void MotionCycles::IdentifyTransitions ( int ci, int cj, ImageX& img )
 	free ( cost_smooth );
 }
 
-Vec3I MotionCycles::FindTransition ( int ci, int cj, int frame )
-{
-	Cycle* cyclei = getCycle(ci);						// input cycle
-	TransitionList& tlist = cyclei->transitions;
-
-	if ( tlist.size()==0 ) return Vec3I(-1,-1,-1);	// no transition list
-
-	int best = -1;
-	int bestf = 100000;
-	for (int n=0; n < tlist.size(); n++) {
-		if ( tlist[n].x == cj && tlist[n].y >= frame && tlist[n].y < bestf ) {	// find best candidate transition
-			best = n;
-			bestf = tlist[n].y;
-		}
-	}
-	if ( best == -1 ) return Vec3I(-1,-1,-1);		// no candidate found
-	return tlist[ best ];
-}
-
 */
\ No newline at end of file
@@ -17,8 +17,10 @@
 
 	#include "object.h"
 	#include "character.h"			
+	#include "pose_search.h"
 	#include "vec.h"
 	#include <vector>
+	#include <stdint.h>
 
 	class ImageX;
 	
@@ -36,6 +38,17 @@
 		Vec3F*	ang_table;		// joint angles, BVH format (deleted after loading)		
 		Quaternion*	orient_table;	// joint orientation, Ri'
 
+		// compressed tables (see CompressCycle). raw tables are freed once packed
+		bool					packed;
+		std::vector<int>		rot_start;		// per joint, first key in rot_key (joints+1)
+		std::vector<uint16_t>	rot_frame;		// frame of each key, empty = every frame is a key
+		std::vector<uint64_t>	rot_key;		// smallest-three quaternions
+		int						pos_tracks;		// number of moving joints
+		std::vector<int>		pos_track;		// per joint, track or -1 if constant
+		std::vector<Vec3F>		pos_const;		// per joint, pos when constant
+		std::vector<Vec3F>		pos_key;		// [frame * pos_tracks + track]
+		uint64_t				raw_bytes;		// size of uncompressed tables
+
 		Vec3F*	vis;
 
 		TransitionList	transitions;
@@ -67,7 +80,20 @@
 		void getInterpolatedJoint ( float t, Cycle* cy, Vec3F& p, Quaternion& q );
 		void AssignCycleToJoints ( int cyc, JointSet& joints, float t );
 		void AssignCycleToJoints ( int cyc, JointSet& joints, float t, float dt,Vec3F& cp, Vec3F& cpl, Quaternion& cov, Quaternion& covl );
+		Quaternion getCycleRot ( Cycle* cy, int j, int f );		// decompress
+		Vec3F getCyclePos ( Cycle* cy, int j, int f );
+
+		// Compression
+		void CompressCycle ( int cyid );
+		void SetKeyError ( float deg )		{ m_KeyError = deg; }		// keyframe reduction bound, 0 = keep all frames
+		uint64_t getPackedBytes ( Cycle* cy );
+		static int SelfTest ();
 		Vec3I FindTransition(int ci, int cj, int frame);
+		PoseDB* getPoseDB ()		{ m_PoseDB.Update ( this ); return &m_PoseDB; }
+		uint64_t getCycleSetKey ();								// content key of all cycles & T-pose
+		int getVersion ()			{ return m_Version; }		// changes whenever cycles are added, removed or packed
+		uint64_t getPoseKey ( int cyc, int frame );				// identifies a cycle frame pose, for sharing
+		Character* getTPose ()		{ return m_TPose; }
 
 		Quaternion ComputeOrientFromBoneVec(Vec3F v);
 		
@@ -95,6 +121,9 @@
 
 		std::vector<Cycle>		m_Cycles;
 		std::string				m_CurrGroup;
+		float					m_KeyError;			// degrees
+		int						m_Version;
+		PoseDB					m_PoseDB;			// pose search for transitions
 
 		Character*				m_TPose;
 
@@ -57,6 +57,7 @@ void Muscles::Generate (int x, int y)
 	if ( mOutput != OBJ_NULL ) return;
 	
 	CreateOutput ( 'Ashp' );	
+	CreateShapeData ( BMUSCLE, (char*) "muscle", sizeof(Vec3F) );		// shape muscle data (angle, curve)
 	//SetShapeShaderFromInput("shader");		//--- obsolete
 	//SetShapeMeshFromInput("mesh");			//--- obsolete
 	//SetShapeTex(G_TEX_UNI, "tex", "");		//--- obsolete
@@ -160,8 +161,10 @@ int Muscles::AddMuscle(Vec3F p1, Vec3F p2, Vec3I b1, Vec3I b2, Vec3F norm)
 	mPartList.push_back(m);
 
 	// add shape
-	int n = getNumShapes();
-	Shape* s = AddShape();
+	int n;
+	Shape* s = AddShapes ( 1, n );					// span keeps muscle channel sized with shapes
+	if ( s == 0x0 ) return (int) mPartList.size() - 1;
+	s->Clear();
 	s->ids = getIDS( n, 0, 0 );
 	s->type = S_MESH;
 	s->clr = COLORA(1.0, 0.7, 0.7, 1.0);
@@ -224,13 +227,13 @@ void Muscles::Sketch ( int w, int h, Camera3D* cam )
 	Shape* s;
 	
 	for (int n = 0; n < getNumShapes(); n++) {
-		s = getShape(n);
+		s = readShape(n);
 		p1 = s->pos;
 		p2 = Vec3F(0, s->scale.y, 0); p2 *= s->rot; p2 += p1;
 		drawLine3D(p1, p2, Vec4F(1, 0, 0, 1));
 	}
 	if (mSel.x != -1) {
-		s = getShape(mSel.x);
+		s = readShape(mSel.x);
 		Matrix4F xform = s->getXform();
 		drawBox3D (Vec3F(-0.5, -0.5, -0.5), Vec3F(.5, .5, .5), Vec4F(1,1,1,1), xform);
 	}
@@ -0,0 +1,818 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#include "navigation.h"
+#include "heightfield.h"
+#include "character.h"
+#include "shapes.h"
+#include "image.h"
+#include "object_list.h"
+#include "scene.h"
+#include "timex.h"
+#include "parallel.h"
+#include "selftest.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <vector>
+
+#define NV_BOUNDS		0
+#define NV_CELL			1
+#define NV_CLUSTER		2
+#define NV_SLOPE		3
+#define NV_RADIUS		4
+
+#define NV_WIDE_RUN		6				// entrance runs this wide get a node at each end
+#define NV_INF			1.0e30f
+#define NV_DIAG			1.41421356f
+
+typedef std::pair<float, int>	NavItem;	// (cost, index) in a min-heap
+
+struct NavLocal {
+	std::vector<float>		ldist;			// local search, per cell of the cluster
+	std::vector<int>		lpar;
+	int						lx, lz, lw, lh;	// local search rect
+};
+
+struct NavScratch {
+	NavLocal				ls, lg;			// start & goal side local searches
+	std::vector<float>		g, tail;		// cluster graph search, per node. reset after each query
+	std::vector<int>		pnode, pedge;
+	std::vector<int>		touched;		// nodes given a cost by the current query
+	std::vector<NavItem>	heap;
+	std::vector<int>		cells, seg;
+};
+
+static inline void heapPush ( std::vector<NavItem>& h, float cost, int i )
+{
+	h.push_back ( NavItem(cost, i) );
+	std::push_heap ( h.begin(), h.end(), std::greater<NavItem>() );
+}
+static inline NavItem heapPop ( std::vector<NavItem>& h )
+{
+	std::pop_heap ( h.begin(), h.end(), std::greater<NavItem>() );
+	NavItem it = h.back();
+	h.pop_back ();
+	return it;
+}
+
+Navigation::Navigation () : Object()
+{
+	m_res = Vec3I(0, 0, 0);
+	m_cres = Vec3I(0, 0, 0);
+	m_cell = 1;
+	m_csize = 16;
+	m_InputsKey = 0;
+}
+
+void Navigation::Define (int x, int y)
+{
+	AddInput ( "time",		'Atim' );		// time must come first. checked every frame, rebuilt when inputs change
+	AddInput ( "terrain",	'hgtf' );		// heightfield, walkable below max slope
+	AddInput ( "obstacles",	'Ashp' );		// obstacle shapes
+
+	AddParam ( NV_BOUNDS,	"bounds",	"4");	SetParamV4 ( NV_BOUNDS, 0, Vec4F(-50, -50, 50, 50) );	// xz min & max, when there is no terrain
+	AddParam ( NV_CELL,		"cell",		"f");	SetParamF ( NV_CELL, 0, 0.5 );			// grid cell size
+	AddParam ( NV_CLUSTER,	"cluster",	"i");	SetParamI ( NV_CLUSTER, 0, 16 );		// cluster size, in cells
+	AddParam ( NV_SLOPE,	"slope",	"f");	SetParamF ( NV_SLOPE, 0, 35 );			// max walkable slope (degrees)
+	AddParam ( NV_RADIUS,	"radius",	"f");	SetParamF ( NV_RADIUS, 0, 0.4 );		// agent radius
+
+	mTimeRange.Set(0, 10000, 0);
+}
+
+bool Navigation::RunCommand (std::string cmd, vecStrs args)
+{
+	if (cmd.compare("finish") == 0) { return true; }
+
+	return false;
+}
+
+void Navigation::Generate (int x, int y)
+{
+	Build ();
+	MarkClean ();
+}
+
+void Navigation::Run ( float time )
+{
+	if ( InputsKey() != m_InputsKey ) Build ();		// obstacles moved, terrain or params edited
+	MarkClean ();
+}
+
+// Key of everything the grid is built from
+// - own params, terrain params, obstacle count, positions & sizes. cheap enough for every frame
+uint64_t Navigation::InputsKey ()
+{
+	uint64_t h = 0;
+	for (int n = 0; n < getNumParam(); n++)
+		h = hashString ( h, getParamValueAsStr(n) );
+	Object* hf = getInput ( "terrain" );
+	if ( hf != 0x0 ) {
+		h = hashValue ( h, hf->getID() );
+		for (int n = 0; n < hf->getNumParam(); n++)
+			h = hashString ( h, hf->getParamValueAsStr(n) );
+	}
+	Shapes* obs = getInputShapes ( "obstacles" );
+	if ( obs != 0x0 ) {
+		Shape* s;
+		h = hashValue ( h, obs->getNumShapes() );
+		for (int n = 0; n < obs->getNumShapes(); n++) {
+			s = obs->getShape(n);
+			h = hashValue ( h, s->pos );
+			h = hashValue ( h, s->scale );
+		}
+	}
+	return h;
+}
+
+int Navigation::getCell ( Vec3F p )
+{
+	int x = int( floor( (p.x - m_min.x) / m_cell ) );
+	int z = int( floor( (p.z - m_min.z) / m_cell ) );
+	if ( x < 0 || z < 0 || x >= m_res.x || z >= m_res.y ) return -1;
+	return z * m_res.x + x;
+}
+
+Vec3F Navigation::getCellPos ( int c )
+{
+	int x = c % m_res.x, z = c / m_res.x;
+	return Vec3F ( m_min.x + (x + 0.5f) * m_cell, m_hgt[c], m_min.z + (z + 0.5f) * m_cell );
+}
+
+int Navigation::FindWalkable ( Vec3F p )
+{
+	int c = getCell ( p );
+	if ( c < 0 ) return -1;
+	if ( m_walk[c] ) return c;
+
+	// nearest walkable cell in a small neighborhood (e.g. goal inside an obstacle's margin)
+	int x = c % m_res.x, z = c / m_res.x;
+	int best = -1, d, bestd = 1 << 30;
+	for (int r = 1; r <= 4 && best < 0; r++) {
+		for (int j = z - r; j <= z + r; j++) {
+			for (int i = x - r; i <= x + r; i++) {
+				if ( i < 0 || j < 0 || i >= m_res.x || j >= m_res.y ) continue;
+				if ( !m_walk[ j * m_res.x + i ] ) continue;
+				d = (i - x)*(i - x) + (j - z)*(j - z);
+				if ( d < bestd ) { bestd = d; best = j * m_res.x + i; }
+			}
+		}
+	}
+	return best;
+}
+
+int Navigation::AddNode ( int cell, std::map<int, int>& cell_node, std::vector< std::vector<NavEdge> >& adj )
+{
+	std::map<int, int>::iterator it = cell_node.find ( cell );
+	if ( it != cell_node.end() ) return it->second;
+
+	NavNode n;
+	n.cell = cell;
+	n.cluster = getCluster ( cell );
+	n.edge_first = 0;
+	n.edge_cnt = 0;
+	m_Nodes.push_back ( n );
+	adj.push_back ( std::vector<NavEdge>() );
+	cell_node[ cell ] = (int) m_Nodes.size() - 1;
+	return (int) m_Nodes.size() - 1;
+}
+
+// Entrances along one cluster border
+// - border cells (x0,z0) + i*(dx,dz), i < len, on side A. side B is the next cell across the border
+// - each walkable run gives a node pair in the middle, or at both ends when wide
+void Navigation::AddEntrances ( int x0, int z0, int dx, int dz, int len, std::map<int, int>& cell_node, std::vector< std::vector<NavEdge> >& adj )
+{
+	auto cellA = [&](int i) { return (z0 + i*dz) * m_res.x + (x0 + i*dx); };
+	auto cellB = [&](int i) { return (z0 + i*dz + dx) * m_res.x + (x0 + i*dx + dz); };
+	auto link = [&](int i) {
+		int na = AddNode ( cellA(i), cell_node, adj );
+		int nb = AddNode ( cellB(i), cell_node, adj );
+		NavEdge e;
+		e.cost = m_cell;
+		e.seg_len = 1;
+		e.to = nb; e.seg = (int) m_Segs.size(); m_Segs.push_back ( cellB(i) );	adj[na].push_back ( e );
+		e.to = na; e.seg = (int) m_Segs.size(); m_Segs.push_back ( cellA(i) );	adj[nb].push_back ( e );
+	};
+
+	int run = -1;
+	bool open;
+	for (int i = 0; i <= len; i++) {
+		open = (i < len) && m_walk[ cellA(i) ] && m_walk[ cellB(i) ];
+		if ( open && run < 0 ) run = i;
+		if ( !open && run >= 0 ) {
+			if ( i - run >= NV_WIDE_RUN ) {
+				link ( run );
+				link ( i - 1 );
+			} else {
+				link ( (run + i - 1) / 2 );
+			}
+			run = -1;
+		}
+	}
+}
+
+// Build navigation grid & cluster graph
+void Navigation::Build ()
+{
+	PERF_PUSH ( "Navigation::Build" );
+	m_InputsKey = InputsKey ();
+
+	Vec4F bounds = getParamV4 ( NV_BOUNDS );
+	m_cell = std::max( getParamF ( NV_CELL ), 0.01f );
+	m_csize = std::max( getParamI ( NV_CLUSTER ), 2 );
+	float rise = tan( getParamF ( NV_SLOPE ) * DEGtoRAD ) * m_cell;		// max height step between neighbors
+	float radius = getParamF ( NV_RADIUS );
+
+	// Terrain extents
+	Heightfield* hf = dynamic_cast<Heightfield*> ( getInput ( "terrain" ) );
+	Image* img = (hf != 0x0) ? hf->getHeightImage() : 0x0;
+	Matrix4F hfxform;
+	Vec3F ta, tb;
+	if ( img != 0x0 ) {
+		hfxform = hf->getXform();
+		ta = Vec3F(0, 0, 0) * hfxform;				// heightfield spans the unit square (local)
+		tb = Vec3F(1, 0, 1) * hfxform;
+		bounds = Vec4F ( std::min(ta.x, tb.x), std::min(ta.z, tb.z), std::max(ta.x, tb.x), std::max(ta.z, tb.z) );
+	}
+	m_min.Set ( bounds.x, 0, bounds.y );
+	m_res.x = std::min( std::max( int(ceil( (bounds.z - bounds.x) / m_cell )), 1), NV_MAX_RES );
+	m_res.y = std::min( std::max( int(ceil( (bounds.w - bounds.y) / m_cell )), 1), NV_MAX_RES );
+	int nx = m_res.x, nz = m_res.y;
+
+	m_hgt.assign ( nx * nz, 0.f );
+	m_walk.assign ( nx * nz, 1 );
+
+	// Heights & slope
+	if ( img != 0x0 ) {
+		bool bw16 = (img->GetFormat() == ImageOp::BW16);
+		float depth = hf->getDepth();
+		ParallelFor ( nz, 16, [&](int start, int end, int chunk) {
+			Vec3F p;
+			float u, v, h;
+			for (int z = start; z < end; z++) {
+				for (int x = 0; x < nx; x++) {
+					p = getCellPos ( z * nx + x );
+					u = (p.x - ta.x) / (tb.x - ta.x);
+					v = (p.z - ta.z) / (tb.z - ta.z);
+					h = bw16 ? img->GetPixelUV16(u, v) : img->GetPixelUV(u, v).x;
+					m_hgt[ z * nx + x ] = (Vec3F(u, h * depth, v) * hfxform).y;
+				}
+			}
+		} );
+		ParallelFor ( nz, 16, [&](int start, int end, int chunk) {
+			int c;
+			float h;
+			for (int z = start; z < end; z++) {
+				for (int x = 0; x < nx; x++) {
+					c = z * nx + x;
+					h = m_hgt[c];
+					if ( (x > 0 && fabs(m_hgt[c - 1] - h) > rise) || (x < nx - 1 && fabs(m_hgt[c + 1] - h) > rise) ||
+						 (z > 0 && fabs(m_hgt[c - nx] - h) > rise) || (z < nz - 1 && fabs(m_hgt[c + nx] - h) > rise) )
+						m_walk[c] = 0;
+				}
+			}
+		} );
+	}
+
+	// Obstacles (circles in xz, inflated by agent radius)
+	Shapes* obs = getInputShapes ( "obstacles" );
+	if ( obs != 0x0 ) {
+		Shape* s;
+		float r, dx, dz;
+		int x0, x1, z0, z1;
+		for (int n = 0; n < obs->getNumShapes(); n++) {
+			s = obs->getShape(n);
+			r = 0.5f * std::max( s->scale.x, s->scale.z ) + radius;
+			x0 = std::max( int(floor( (s->pos.x - r - m_min.x) / m_cell )), 0 );
+			x1 = std::min( int(floor( (s->pos.x + r - m_min.x) / m_cell )), nx - 1 );
+			z0 = std::max( int(floor( (s->pos.z - r - m_min.z) / m_cell )), 0 );
+			z1 = std::min( int(floor( (s->pos.z + r - m_min.z) / m_cell )), nz - 1 );
+			for (int z = z0; z <= z1; z++) {
+				for (int x = x0; x <= x1; x++) {
+					dx = m_min.x + (x + 0.5f) * m_cell - s->pos.x;
+					dz = m_min.z + (z + 0.5f) * m_cell - s->pos.z;
+					if ( dx*dx + dz*dz <= r*r ) m_walk[ z * nx + x ] = 0;
+				}
+			}
+		}
+	}
+
+	BuildGraph ();
+
+	PERF_POP ();
+}
+
+// Cluster graph from the walkability grid
+void Navigation::BuildGraph ()
+{
+	static const int nbr[8][2] = { {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1} };
+	int nx = m_res.x, nz = m_res.y;
+
+	// Connected regions, same moves as LocalSearch. queries across regions fail at once
+	m_Region.assign ( nx * nz, -1 );
+	std::vector<int> stk;
+	int nreg = 0, c, x, z, i, j;
+	for (int c0 = 0; c0 < nx * nz; c0++) {
+		if ( !m_walk[c0] || m_Region[c0] >= 0 ) continue;
+		m_Region[c0] = nreg;
+		stk.push_back ( c0 );
+		while ( stk.size() > 0 ) {
+			c = stk.back(); stk.pop_back();
+			x = c % nx; z = c / nx;
+			for (int k = 0; k < 8; k++) {
+				i = x + nbr[k][0];
+				j = z + nbr[k][1];
+				if ( i < 0 || j < 0 || i >= nx || j >= nz ) continue;
+				if ( !m_walk[ j * nx + i ] || m_Region[ j * nx + i ] >= 0 ) continue;
+				if ( k >= 4 && ( !m_walk[ z * nx + i ] || !m_walk[ j * nx + x ] ) ) continue;		// no corner cutting
+				m_Region[ j * nx + i ] = nreg;
+				stk.push_back ( j * nx + i );
+			}
+		}
+		nreg++;
+	}
+
+	// Clusters & entrances
+	m_cres.x = (nx + m_csize - 1) / m_csize;
+	m_cres.y = (nz + m_csize - 1) / m_csize;
+	int nk = m_cres.x * m_cres.y;
+
+	m_Nodes.clear();
+	m_Edges.clear();
+	m_Segs.clear();
+	std::map<int, int> cell_node;
+	std::vector< std::vector<NavEdge> > adj;
+	int x0, z0, w, h;
+
+	for (int kz = 0; kz < m_cres.y; kz++) {
+		for (int kx = 0; kx < m_cres.x; kx++) {
+			x0 = kx * m_csize;	w = std::min( m_csize, nx - x0 );
+			z0 = kz * m_csize;	h = std::min( m_csize, nz - z0 );
+			if ( kx + 1 < m_cres.x ) AddEntrances ( x0 + w - 1, z0, 0, 1, h, cell_node, adj );		// border with +x cluster
+			if ( kz + 1 < m_cres.y ) AddEntrances ( x0, z0 + h - 1, 1, 0, w, cell_node, adj );		// border with +z cluster
+		}
+	}
+
+	// Nodes per cluster
+	m_ClusterFirst.assign ( nk + 1, 0 );
+	for (int n = 0; n < m_Nodes.size(); n++)
+		m_ClusterFirst[ m_Nodes[n].cluster + 1 ]++;
+	for (int k = 0; k < nk; k++)
+		m_ClusterFirst[k + 1] += m_ClusterFirst[k];
+	m_ClusterNodes.resize ( m_Nodes.size() );
+	std::vector<int> fill ( m_ClusterFirst.begin(), m_ClusterFirst.end() - 1 );
+	for (int n = 0; n < m_Nodes.size(); n++)
+		m_ClusterNodes[ fill[ m_Nodes[n].cluster ]++ ] = n;
+
+	// Edges inside each cluster, with cached cell paths. clusters in parallel
+	std::vector< std::vector<NavEdge> > intra ( nk );
+	std::vector< std::vector<int> > intra_from ( nk ), intra_segs ( nk );
+
+	ParallelFor ( nk, 4, [&](int start, int end, int chunk) {
+		NavScratch s;
+		NavEdge e;
+		int a, b;
+		for (int k = start; k < end; k++) {
+			for (int i = m_ClusterFirst[k]; i < m_ClusterFirst[k + 1]; i++) {
+				a = m_ClusterNodes[i];
+				LocalSearch ( k, m_Nodes[a].cell, s.ls, s );
+				for (int j = m_ClusterFirst[k]; j < m_ClusterFirst[k + 1]; j++) {
+					b = m_ClusterNodes[j];
+					if ( b == a ) continue;
+					e.cost = getLocalCost ( m_Nodes[b].cell, s.ls );
+					if ( e.cost >= NV_INF ) continue;
+					s.seg.clear();
+					getLocalPath ( m_Nodes[b].cell, s.ls, s.seg );				// cells after b, back to a = edge b -> a
+					e.to = a;
+					e.seg = (int) intra_segs[k].size();
+					e.seg_len = (int) s.seg.size();
+					intra_segs[k].insert ( intra_segs[k].end(), s.seg.begin(), s.seg.end() );
+					intra[k].push_back ( e );
+					intra_from[k].push_back ( b );
+				}
+			}
+		}
+	} );
+
+	int base;
+	for (int k = 0; k < nk; k++) {
+		base = (int) m_Segs.size();
+		m_Segs.insert ( m_Segs.end(), intra_segs[k].begin(), intra_segs[k].end() );
+		for (int i = 0; i < intra[k].size(); i++) {
+			intra[k][i].seg += base;
+			adj[ intra_from[k][i] ].push_back ( intra[k][i] );
+		}
+	}
+
+	// Flatten edges
+	for (int n = 0; n < m_Nodes.size(); n++) {
+		m_Nodes[n].edge_first = (int) m_Edges.size();
+		m_Nodes[n].edge_cnt = (int) adj[n].size();
+		m_Edges.insert ( m_Edges.end(), adj[n].begin(), adj[n].end() );
+	}
+
+	dbgprintf ( "  Navigation: grid %dx%d, %d clusters, %d nodes, %d edges, %d cached cells\n", nx, nz, nk, (int) m_Nodes.size(), (int) m_Edges.size(), (int) m_Segs.size() );
+}
+
+// Dijkstra over the cells of one cluster, from src
+void Navigation::LocalSearch ( int cluster, int src, NavLocal& ls, NavScratch& s )
+{
+	static const int nbr[8][2] = { {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1} };
+
+	ls.lx = (cluster % m_cres.x) * m_csize;
+	ls.lz = (cluster / m_cres.x) * m_csize;
+	ls.lw = std::min( m_csize, m_res.x - ls.lx );
+	ls.lh = std::min( m_csize, m_res.y - ls.lz );
+	ls.ldist.assign ( ls.lw * ls.lh, NV_INF );
+	ls.lpar.assign ( ls.lw * ls.lh, -1 );
+	s.heap.clear ();
+
+	int l = (src / m_res.x - ls.lz) * ls.lw + (src % m_res.x - ls.lx);
+	ls.ldist[l] = 0;
+	heapPush ( s.heap, 0, l );
+
+	NavItem it;
+	int x, z, i, j, nl;
+	float nd;
+	while ( !s.heap.empty() ) {
+		it = heapPop ( s.heap );
+		l = it.second;
+		if ( it.first > ls.ldist[l] ) continue;				// stale
+		x = l % ls.lw;
+		z = l / ls.lw;
+		for (int k = 0; k < 8; k++) {
+			i = x + nbr[k][0];
+			j = z + nbr[k][1];
+			if ( i < 0 || j < 0 || i >= ls.lw || j >= ls.lh ) continue;
+			if ( !m_walk[ (ls.lz + j) * m_res.x + ls.lx + i ] ) continue;
+			if ( k >= 4 ) {										// diagonal, no corner cutting
+				if ( !m_walk[ (ls.lz + z) * m_res.x + ls.lx + i ] || !m_walk[ (ls.lz + j) * m_res.x + ls.lx + x ] ) continue;
+				nd = it.first + m_cell * NV_DIAG;
+			} else {
+				nd = it.first + m_cell;
+			}
+			nl = j * ls.lw + i;
+			if ( nd < ls.ldist[nl] ) {
+				ls.ldist[nl] = nd;
+				ls.lpar[nl] = l;
+				heapPush ( s.heap, nd, nl );
+			}
+		}
+	}
+}
+
+float Navigation::getLocalCost ( int c, NavLocal& ls )
+{
+	return ls.ldist[ (c / m_res.x - ls.lz) * ls.lw + (c % m_res.x - ls.lx) ];
+}
+
+void Navigation::getLocalPath ( int c, NavLocal& ls, std::vector<int>& out )
+{
+	int l = (c / m_res.x - ls.lz) * ls.lw + (c % m_res.x - ls.lx);
+	while ( ls.lpar[l] != -1 ) {
+		l = ls.lpar[l];
+		out.push_back ( (ls.lz + l / ls.lw) * m_res.x + ls.lx + l % ls.lw );
+	}
+}
+
+bool Navigation::LineOfSight ( int a, int b )
+{
+	Vec3F pa = getCellPos ( a );
+	Vec3F pb = getCellPos ( b );
+	float dx = pb.x - pa.x, dz = pb.z - pa.z;
+	int steps = int( 4.0f * std::max( fabs(dx), fabs(dz) ) / m_cell ) + 1;		// quarter-cell samples
+	int c;
+	for (int i = 1; i < steps; i++) {
+		c = getCell ( Vec3F( pa.x + dx * i / steps, 0, pa.z + dz * i / steps ) );
+		if ( c < 0 || !m_walk[c] ) return false;
+	}
+	return true;
+}
+
+bool Navigation::FindPath ( Vec3F start, Vec3F goal, std::vector<Vec3F>& path )
+{
+	NavScratch s;
+	return FindPath ( start, goal, path, s );
+}
+
+bool Navigation::FindPath ( Vec3F start, Vec3F goal, std::vector<Vec3F>& path, NavScratch& s )
+{
+	path.clear();
+	if ( m_walk.size() == 0 ) return false;
+
+	int cs = FindWalkable ( start );
+	int cg = FindWalkable ( goal );
+	if ( cs < 0 || cg < 0 || m_Region[cs] != m_Region[cg] ) return false;
+	int ks = getCluster ( cs );
+	int kg = getCluster ( cg );
+	std::vector<int>& cells = s.cells;
+	cells.clear();
+	cells.push_back ( cs );
+
+	// Goal side. same cluster & reachable inside it: local path only
+	LocalSearch ( kg, cg, s.lg, s );
+	if ( ks == kg && getLocalCost ( cs, s.lg ) < NV_INF ) {
+		getLocalPath ( cs, s.lg, cells );
+	} else {
+		int N = (int) m_Nodes.size();
+		if ( s.g.size() != N ) {									// first query with this scratch
+			s.g.assign ( N, NV_INF );
+			s.tail.assign ( N, NV_INF );
+			s.pnode.assign ( N, -1 );
+			s.pedge.assign ( N, -1 );
+		}
+		s.touched.clear();
+		for (int i = m_ClusterFirst[kg]; i < m_ClusterFirst[kg + 1]; i++)
+			s.tail[ m_ClusterNodes[i] ] = getLocalCost ( m_Nodes[ m_ClusterNodes[i] ].cell, s.lg );
+
+		// octile distance to goal
+		int gx = cg % m_res.x, gz = cg / m_res.x;
+		auto heur = [&](int n) {
+			int dx = abs( m_Nodes[n].cell % m_res.x - gx );
+			int dz = abs( m_Nodes[n].cell / m_res.x - gz );
+			return m_cell * ( std::max(dx, dz) + (NV_DIAG - 1.0f) * std::min(dx, dz) );
+		};
+
+		// Start side, then A* on the cluster graph
+		LocalSearch ( ks, cs, s.ls, s );
+		s.heap.clear();
+		int n;
+		float c;
+		for (int i = m_ClusterFirst[ks]; i < m_ClusterFirst[ks + 1]; i++) {
+			n = m_ClusterNodes[i];
+			c = getLocalCost ( m_Nodes[n].cell, s.ls );
+			if ( c >= NV_INF ) continue;
+			s.g[n] = c;
+			s.touched.push_back ( n );
+			heapPush ( s.heap, c + heur(n), n );
+		}
+		float best = NV_INF;
+		int last = -1;
+		NavItem it;
+		while ( !s.heap.empty() ) {
+			it = heapPop ( s.heap );
+			if ( it.first >= best ) break;						// heuristic is admissible
+			n = it.second;
+			if ( it.first > s.g[n] + heur(n) + 1e-4f ) continue;	// stale
+			if ( s.g[n] + s.tail[n] < best ) {
+				best = s.g[n] + s.tail[n];
+				last = n;
+			}
+			for (int e = m_Nodes[n].edge_first; e < m_Nodes[n].edge_first + m_Nodes[n].edge_cnt; e++) {
+				NavEdge& ed = m_Edges[e];
+				c = s.g[n] + ed.cost;
+				if ( c < s.g[ed.to] ) {
+					if ( s.g[ed.to] >= NV_INF ) s.touched.push_back ( ed.to );
+					s.g[ed.to] = c;
+					s.pnode[ed.to] = n;
+					s.pedge[ed.to] = e;
+					heapPush ( s.heap, c + heur(ed.to), ed.to );
+				}
+			}
+		}
+
+		// Splice cells: start -> first node, cached segments, last node -> goal
+		if ( last >= 0 ) {
+			std::vector<int> chain;
+			for (n = last; n != -1; n = s.pnode[n])
+				chain.push_back ( n );
+			std::reverse ( chain.begin(), chain.end() );
+
+			s.seg.clear();
+			getLocalPath ( m_Nodes[chain[0]].cell, s.ls, s.seg );		// ends with cs
+			for (int i = (int) s.seg.size() - 2; i >= 0; i--)
+				cells.push_back ( s.seg[i] );
+			if ( m_Nodes[chain[0]].cell != cs )
+				cells.push_back ( m_Nodes[chain[0]].cell );
+
+			for (int i = 1; i < chain.size(); i++) {
+				NavEdge& ed = m_Edges[ s.pedge[ chain[i] ] ];
+				cells.insert ( cells.end(), m_Segs.begin() + ed.seg, m_Segs.begin() + ed.seg + ed.seg_len );
+			}
+			getLocalPath ( m_Nodes[last].cell, s.lg, cells );			// goal search kept from the start
+		}
+
+		// Reset only what this query touched
+		for (int i = 0; i < s.touched.size(); i++) {
+			n = s.touched[i];
+			s.g[n] = NV_INF;
+			s.pnode[n] = -1;
+			s.pedge[n] = -1;
+		}
+		for (int i = m_ClusterFirst[kg]; i < m_ClusterFirst[kg + 1]; i++)
+			s.tail[ m_ClusterNodes[i] ] = NV_INF;
+		if ( last < 0 ) return false;
+	}
+
+	// Straighten by line of sight, tested at turns of the cell path only
+	// - cells between two turns are a straight run, in sight of each other
+	std::vector<int>& turns = s.seg;
+	turns.clear();
+	for (int i = 1; i + 1 < cells.size(); i++)
+		if ( cells[i] - cells[i-1] != cells[i+1] - cells[i] ) turns.push_back ( i );
+	turns.push_back ( (int) cells.size() - 1 );
+	int a = 0, prev = 0;
+	for (int k = 0; k < turns.size(); k++) {
+		if ( prev != a && !LineOfSight ( cells[a], cells[ turns[k] ] ) ) {
+			a = prev;
+			path.push_back ( getCellPos ( cells[a] ) );
+		}
+		prev = turns[k];
+	}
+	Vec3F end = getCellPos ( cells.back() );
+	if ( cg == getCell ( goal ) ) {
+		end.x = goal.x;
+		end.z = goal.z;
+	}
+	path.push_back ( end );
+	return true;
+}
+
+void Navigation::Request ( objID id, Vec3F start, Vec3F goal )
+{
+	NavRequest r;
+	r.id = id;
+	r.start = start;
+	r.goal = goal;
+
+	std::map<objID, int>::iterator it = m_RequestMap.find ( id );
+	if ( it != m_RequestMap.end() ) {
+		m_Requests[ it->second ] = r;
+		return;
+	}
+	m_RequestMap[ id ] = (int) m_Requests.size();
+	m_Requests.push_back ( r );
+}
+
+// Solve all queued requests
+// - requests are independent, solved in parallel with per-chunk scratch
+// - paths are handed back in request order
+void Navigation::SolveRequests ()
+{
+	if ( m_Requests.size() == 0 || m_walk.size() == 0 ) return;
+
+	int num = (int) m_Requests.size();
+	std::vector< std::vector<Vec3F> > paths ( num );
+	std::vector<uint8_t> found ( num, 0 );
+
+	ParallelFor ( num, 16, [&](int start, int end, int chunk) {
+		NavScratch s;
+		for (int i = start; i < end; i++)
+			found[i] = FindPath ( m_Requests[i].start, m_Requests[i].goal, paths[i], s ) ? 1 : 0;
+	} );
+
+	Character* ch;
+	for (int i = 0; i < num; i++) {
+		ch = dynamic_cast<Character*> ( gAssets.getObj ( m_Requests[i].id ) );
+		if ( ch != 0x0 )
+			ch->SetPath ( paths[i], found[i] != 0 );
+	}
+	m_Requests.clear();
+	m_RequestMap.clear();
+}
+
+// Random maze for tests & benchmarks: scattered blocks, two walls with one gap each
+static void BuildMaze ( int nx, int nz, std::vector<uint8_t>& walk )
+{
+	walk.assign ( nx * nz, 1 );
+	for (int c = 0; c < nx * nz; c++)
+		if ( hashRandF ( 31, c ) < 0.25f ) walk[c] = 0;
+	for (int z = 0; z < nz - 6; z++) walk[ z * nx + nx * 5 / 16 ] = 0;
+	for (int z = 6; z < nz; z++) walk[ z * nx + nx * 41 / 64 ] = 0;
+}
+
+// Benchmark path queries
+// - num agents with random start & goal on a 256x256 grid of obstacle discs and walls,
+//   solved like SolveRequests: in parallel, scratch reused per chunk
+void Navigation::BenchmarkPaths ( int num )
+{
+	if ( num <= 0 ) return;
+	Navigation nav;
+	int nx = 256, nz = 256;
+	nav.m_res = Vec3I ( nx, nz, 0 );
+	nav.m_min.Set ( -64, 0, -64 );
+	nav.m_cell = 0.5f;
+	nav.m_csize = 16;
+	nav.m_hgt.assign ( nx * nz, 0.f );
+	nav.m_walk.assign ( nx * nz, 1 );
+	int x0, z0, r;											// obstacle discs (~15% blocked) & two walls with one gap each
+	for (int n = 0; n < 600; n++) {
+		x0 = int( hashRandF ( 34, n*3 ) * nx );
+		z0 = int( hashRandF ( 34, n*3+1 ) * nz );
+		r = 1 + int( hashRandF ( 34, n*3+2 ) * 5 );
+		for (int z = std::max(z0 - r, 0); z <= std::min(z0 + r, nz - 1); z++)
+			for (int x = std::max(x0 - r, 0); x <= std::min(x0 + r, nx - 1); x++)
+				if ( (x - x0)*(x - x0) + (z - z0)*(z - z0) <= r*r ) nav.m_walk[ z * nx + x ] = 0;
+	}
+	for (int z = 0; z < nz - 8; z++) nav.m_walk[ z * nx + nx / 3 ] = 0;
+	for (int z = 8; z < nz; z++) nav.m_walk[ z * nx + 2 * nx / 3 ] = 0;
+
+	TimeX t1, t2, t3;
+	t1.SetTimeNSec ();
+	nav.BuildGraph ();
+	t2.SetTimeNSec ();
+
+	std::vector< std::vector<Vec3F> > paths ( num );
+	std::vector<uint8_t> found ( num, 0 );
+	ParallelFor ( num, 16, [&](int start, int end, int chunk) {
+		NavScratch s;
+		int cs, cg;
+		for (int i = start; i < end; i++) {
+			cs = int( hashRandF ( 33, i*2 ) * nx * nz );
+			cg = int( hashRandF ( 33, i*2+1 ) * nx * nz );
+			found[i] = nav.FindPath ( nav.getCellPos(cs), nav.getCellPos(cg), paths[i], s ) ? 1 : 0;
+		}
+	} );
+	t3.SetTimeNSec ();
+
+	int cnt = 0;
+	for (int i = 0; i < num; i++) cnt += found[i];
+	float ms = t3.GetElapsedMSec(t2);
+	dbgprintf ( "Benchmark: navigation, grid %dx%d, build %6.2f ms, %d paths %6.2f ms (%5.1f us/path), %d found\n",
+		nx, nz, t2.GetElapsedMSec(t1), num, ms, 1000.0f * ms / num, cnt );
+}
+
+// Paths on a random maze against a full-grid search
+// - a path is found exactly when the goal is reachable
+// - every path corner is walkable and each leg has line of sight (quarter-cell samples)
+// - path ends in the goal cell, and is no longer than 1.5x the grid shortest path
+int Navigation::SelfTest ()
+{
+	static const int nbr[8][2] = { {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1} };
+	int bad = 0;
+	Navigation nav;
+	int nx = 64, nz = 48;
+	nav.m_res = Vec3I ( nx, nz, 0 );
+	nav.m_min.Set ( -16, 0, -12 );
+	nav.m_cell = 0.5f;
+	nav.m_csize = 8;
+	nav.m_hgt.assign ( nx * nz, 0.f );
+	BuildMaze ( nx, nz, nav.m_walk );
+	nav.BuildGraph ();
+
+	int num = 300, wrong_found = 0, invalid = 0, too_long = 0;
+	std::vector<float> dist;
+	std::vector<NavItem> heap;
+	std::vector<Vec3F> path;
+	for (int n = 0; n < num; n++) {
+		int cs = int( hashRandF ( 32, n*2 ) * nx * nz ), cg = int( hashRandF ( 32, n*2+1 ) * nx * nz );
+		if ( !nav.m_walk[cs] || !nav.m_walk[cg] ) continue;
+
+		// reference, Dijkstra over the whole grid with the same moves
+		dist.assign ( nx * nz, NV_INF );
+		dist[cs] = 0;
+		heap.clear ();
+		heapPush ( heap, 0, cs );
+		while ( !heap.empty() ) {
+			NavItem it = heapPop ( heap );
+			if ( it.first > dist[it.second] ) continue;
+			int x = it.second % nx, z = it.second / nx;
+			for (int k = 0; k < 8; k++) {
+				int i = x + nbr[k][0], j = z + nbr[k][1];
+				if ( i < 0 || j < 0 || i >= nx || j >= nz || !nav.m_walk[ j * nx + i ] ) continue;
+				if ( k >= 4 && ( !nav.m_walk[ z * nx + i ] || !nav.m_walk[ j * nx + x ] ) ) continue;
+				float nd = it.first + nav.m_cell * ( (k >= 4) ? NV_DIAG : 1.0f );
+				if ( nd < dist[ j * nx + i ] ) { dist[ j * nx + i ] = nd; heapPush ( heap, nd, j * nx + i ); }
+			}
+		}
+
+		Vec3F start = nav.getCellPos ( cs ), goal = nav.getCellPos ( cg );
+		bool found = nav.FindPath ( start, goal, path );
+		if ( found != (dist[cg] < NV_INF) ) { wrong_found++; continue; }
+		if ( !found ) continue;
+
+		float len = 0;
+		int a = cs, b;
+		bool ok = path.size() > 0;
+		for (int i = 0; i < path.size() && ok; i++) {
+			b = nav.getCell ( path[i] );
+			ok = ( b >= 0 && nav.m_walk[b] );
+			Vec3F pa = nav.getCellPos ( a ), pb = ok ? nav.getCellPos ( b ) : pa;
+			float dx = pb.x - pa.x, dz = pb.z - pa.z;
+			int steps = int( 4.0f * std::max( fabs(dx), fabs(dz) ) / nav.m_cell ) + 1;
+			for (int k = 1; k < steps && ok; k++) {
+				int c = nav.getCell ( Vec3F( pa.x + dx * k / steps, 0, pa.z + dz * k / steps ) );
+				ok = ( c >= 0 && nav.m_walk[c] );
+			}
+			len += sqrt ( dx*dx + dz*dz );
+			a = b;
+		}
+		if ( !ok || a != cg ) { invalid++; continue; }
+		if ( len > 1.5f * dist[cg] + nav.m_cell ) too_long++;
+	}
+	bad += selfCheck ( wrong_found == 0, "navigation", "path found differs from reachability" );
+	bad += selfCheck ( invalid == 0, "navigation", "path blocked or not ending at goal" );
+	bad += selfCheck ( too_long == 0, "navigation", "path much longer than shortest" );
+	return selfReport ( "navigation", bad );
+}
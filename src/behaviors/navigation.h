@@ -0,0 +1,114 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_NAVIGATION
+	#define DEF_NAVIGATION
+
+	#include "object.h"
+	#include <stdint.h>
+	#include <vector>
+	#include <map>
+
+	// Navigation (hierarchical A*)
+	// - Walkability grid over the xz plane, from a heightfield (max slope) and/or
+	//   obstacle shapes (circles, inflated by the agent radius).
+	// - Grid is split into square clusters. Walkable runs along each cluster border
+	//   give entrance nodes; nodes in the same cluster are linked by edges whose
+	//   cell paths are found once at build time and cached (path segments).
+	// - A query connects start & goal to the nodes of their clusters with a local
+	//   search, runs A* on the cluster graph, then splices the cached segments
+	//   and straightens the result by line of sight.
+	// - Characters queue requests (Request); SolveRequests runs the whole queue in
+	//   parallel once per frame and hands the paths back (Character::SetPath).
+
+	#define NV_MAX_RES		2048			// max grid cells per side
+
+	struct NavNode {
+		int			cell;					// grid cell
+		int			cluster;
+		int			edge_first, edge_cnt;
+	};
+	struct NavEdge {
+		int			to;
+		float		cost;
+		int			seg, seg_len;			// cached cells after 'from', up to and including 'to'
+	};
+	struct NavRequest {
+		objID		id;						// requesting character
+		Vec3F		start, goal;
+	};
+	struct NavLocal;
+	struct NavScratch;
+
+	class Navigation : public Object {
+	public:
+		Navigation ();
+
+		virtual objType getType()	{ return 'navg'; }
+		virtual void Define (int x, int y);
+		virtual bool RunCommand (std::string cmd, vecStrs args);
+		virtual void Generate (int x, int y);
+		virtual void Run ( float time );
+
+		void	Build ();
+		void	BuildGraph ();
+		bool	FindPath ( Vec3F start, Vec3F goal, std::vector<Vec3F>& path );	// single query, path excludes start
+
+		// Request queue
+		void	Request ( objID id, Vec3F start, Vec3F goal );		// replaces a pending request of the same id
+		void	SolveRequests ();
+		int		getNumRequests ()		{ return (int) m_Requests.size(); }
+
+		bool	isWalkable ( Vec3F p )	{ int c = getCell(p); return c >= 0 && m_walk[c] != 0; }
+		float	getHeight ( Vec3F p )	{ int c = getCell(p); return c >= 0 ? m_hgt[c] : 0.f; }
+		int		getNumNodes ()			{ return (int) m_Nodes.size(); }
+
+		static void BenchmarkPaths ( int num );
+		static int SelfTest ();
+
+	private:
+		int		getCell ( Vec3F p );
+		Vec3F	getCellPos ( int c );
+		int		getCluster ( int c )	{ return ((c / m_res.x) / m_csize) * m_cres.x + (c % m_res.x) / m_csize; }
+		int		FindWalkable ( Vec3F p );
+		void	AddEntrances ( int x0, int z0, int dx, int dz, int len, std::map<int, int>& cell_node, std::vector< std::vector<NavEdge> >& adj );
+		int		AddNode ( int cell, std::map<int, int>& cell_node, std::vector< std::vector<NavEdge> >& adj );
+		void	LocalSearch ( int cluster, int src, NavLocal& ls, NavScratch& s );
+		float	getLocalCost ( int c, NavLocal& ls );
+		void	getLocalPath ( int c, NavLocal& ls, std::vector<int>& out );		// cells after c, back to the search source
+		bool	LineOfSight ( int a, int b );
+		bool	FindPath ( Vec3F start, Vec3F goal, std::vector<Vec3F>& path, NavScratch& s );
+		uint64_t InputsKey ();
+
+		Vec3I					m_res;				// grid cells (x, z)
+		Vec3F					m_min;				// grid corner (world xz)
+		float					m_cell;				// cell size
+		int						m_csize;			// cluster size, in cells
+		Vec3I					m_cres;				// clusters (x, z)
+		std::vector<uint8_t>	m_walk;				// walkable per cell
+		std::vector<float>		m_hgt;				// ground height per cell
+		std::vector<int>		m_Region;			// connected region per walkable cell, -1 blocked
+		uint64_t				m_InputsKey;		// inputs the grid was built from
+
+		std::vector<NavNode>	m_Nodes;
+		std::vector<NavEdge>	m_Edges;
+		std::vector<int>		m_Segs;				// cached path segments (cells)
+		std::vector<int>		m_ClusterFirst;		// nodes of cluster k: m_ClusterNodes[ first[k], first[k+1] )
+		std::vector<int>		m_ClusterNodes;
+
+		std::vector<NavRequest>	m_Requests;
+		std::map<objID, int>	m_RequestMap;
+	};
+
+#endif
@@ -84,7 +84,7 @@ void Parts::Save ( std::string fname )
 	FILE* fp = fopen ( buf, "wt" );
 
 	for (int n = 0; n < mPartList.size(); n++) {
-		s = getShape(n);
+		s = readShape(n);
 		obj = gAssets.getObj( mPartList[n].asset_id );
 		mesh_name = mPartList[n].asset_name;
 		append = mPartList[n].append;
@@ -228,12 +228,12 @@ void Parts::Sketch ( int w, int h, Camera3D* cam )
 	setTextSz ( txtsz, 1 );
 
 	for (int n=0; n < getNumShapes(); n++ ) {
-		s = getShape(n);
+		s = readShape(n);
 		name = mPartList[n].asset_name;
 		//drawText3D ( cam, s->pos.x + txtsz, s->pos.y + txtsz, s->pos.z, (char*) name.c_str(), 1, 1,0, 1); 		
 	}
 	if (mSel.x != -1) {
-		s = getShape(mSel.x);
+		s = readShape(mSel.x);
 		Matrix4F xform = s->getXform();
 		drawBox3D (Vec3F(0, 0, 0), Vec3F(1, 1, 1), Vec4F(1,1,1,1), xform);
 	}
@@ -254,7 +254,7 @@ bool Parts::Raytrace ( Vec3F pos, Vec3F dir, Vec3I& sel, Vec3F& hit, Vec3F& norm
 	
 	for (int n=0; n < getNumShapes(); n++ ) {
 
-		s = getShape(n);										// shape - orientation of mesh
+		s = readShape(n);										// shape - orientation of mesh
 
 		obj = (Mesh*) gAssets.getObj ( mPartList[n].asset_id );			// mesh geometry
 
@@ -0,0 +1,323 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#include "pose_search.h"
+#include "motioncycles.h"
+#include "crowd.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "blob_cache.h"
+#include "main.h"
+#include "selftest.h"
+
+#include <algorithm>
+#include <float.h>
+
+PoseDB::PoseDB ()
+{
+	m_Key = 0;
+	m_Version = -1;
+	m_Dim = 0;
+}
+
+void PoseDB::Clear ()
+{
+	m_Key = 0;
+	m_Dim = 0;
+	m_Features.clear();
+	m_Trees.clear();
+}
+
+bool PoseDB::Update ( MotionCycles* mc )
+{
+	if ( mc->getVersion() == m_Version ) return false;		// no change since last check
+	m_Version = mc->getVersion();
+
+	uint64_t key = hashValue ( mc->getCycleSetKey(), (int) PDB_VERSION );
+	if ( key == m_Key ) return false;						// same content
+
+	if ( !Load ( key ) ) {
+		Build ( mc );
+		m_Key = key;
+		if ( m_Features.size() > 0 ) Save ();
+	}
+	return true;
+}
+
+void PoseDB::Build ( MotionCycles* mc )
+{
+	Clear ();
+	Character* tpose = mc->getTPose();
+	if ( tpose == 0x0 || tpose->getNumJoints(JNTS_A) == 0 ) return;
+
+	// Flatten T-pose skeleton
+	SkelLayout lay;
+	Crowd::BuildLayout ( tpose->getJoints(JNTS_A), lay );
+	int nj = (int) lay.order.size();
+
+	// Feature joints: leaves farthest from the root (feet, hands, head)
+	std::vector<float> reach ( nj, 0 );
+	std::vector<bool> leaf ( nj, true );
+	for (int j=1; j < nj; j++) {
+		reach[j] = reach[ lay.parent[j] ] + lay.length[ lay.parent[j] ];
+		leaf[ lay.parent[j] ] = false;
+	}
+	std::vector<int> feat;
+	for (int j=1; j < nj; j++)
+		if ( leaf[j] ) feat.push_back ( j );
+	std::sort ( feat.begin(), feat.end(), [&](int a, int b) { return reach[a] > reach[b]; } );
+	if ( feat.size() > PDB_MAX_JOINTS ) feat.resize ( PDB_MAX_JOINTS );
+	m_Dim = (int) feat.size() * 6;
+	if ( m_Dim == 0 ) return;
+
+	// Per-cycle feature ranges, cycles without the full skeleton get no rows
+	int total = 0;
+	m_Trees.resize ( mc->getNumCycles() );
+	for (int c=0; c < mc->getNumCycles(); c++) {
+		Cycle* cy = mc->getCycle(c);
+		m_Trees[c].first = total;
+		m_Trees[c].count = ( cy->joints < nj ) ? 0 : cy->frames;
+		total += m_Trees[c].count;
+	}
+	m_Features.resize ( (size_t) total * m_Dim );
+
+	// Evaluate every frame of a cycle as one instance, root at identity
+	Quaternion ident;
+	ident.Identity();
+	for (int c=0; c < mc->getNumCycles(); c++) {
+		Cycle* cy = mc->getCycle(c);
+		int nf = m_Trees[c].count;
+		if ( nf == 0 ) continue;
+		CrowdGroup g;
+		g.root_orient.assign ( nf, ident );
+		g.root_pos.assign ( nf, Vec3F(0,0,0) );
+		for (int k=0; k < 4; k++) { g.lq[k].resize ( nf*nj ); g.wq[k].resize ( nf*nj ); }
+		for (int k=0; k < 3; k++) g.wp[k].resize ( nf*nj );
+
+		ParallelFor ( nf, 64, [&](int start, int end, int chunk) {
+			for (int f=start; f < end; f++) {
+				for (int j=0; j < nj; j++) {
+					Quaternion q = mc->getCycleRot ( cy, lay.order[j], f );
+					g.lq[0][j*nf+f] = (float) q.X;	g.lq[1][j*nf+f] = (float) q.Y;
+					g.lq[2][j*nf+f] = (float) q.Z;	g.lq[3][j*nf+f] = (float) q.W;
+				}
+			}
+			Crowd::EvaluateSoA ( lay, g, start, end );
+		} );
+
+		// positions & velocities of feature joints
+		float* out = &m_Features[ (size_t) m_Trees[c].first * m_Dim ];
+		for (int f=0; f < nf; f++) {
+			int fp = (f > 0) ? f-1 : 0;
+			int fn = (f > 0 || nf == 1) ? f : 1;
+			for (int k=0; k < feat.size(); k++) {
+				int i = feat[k] * nf;
+				for (int a=0; a < 3; a++) {
+					*out++ = g.wp[a][i + f];
+					*out++ = g.wp[a][i + fn] - g.wp[a][i + fp];
+				}
+			}
+		}
+	}
+
+	// Unit variance per dimension
+	if ( total > 1 ) {
+		for (int d=0; d < m_Dim; d++) {
+			double sum = 0, sum2 = 0;
+			for (int i=0; i < total; i++) { sum += m_Features[i*m_Dim+d]; sum2 += m_Features[i*m_Dim+d]*m_Features[i*m_Dim+d]; }
+			double var = sum2/total - (sum/total)*(sum/total);
+			float s = (var > 1e-12) ? float(1.0 / sqrt(var)) : 1.0f;
+			for (int i=0; i < total; i++) m_Features[i*m_Dim+d] *= s;
+		}
+	}
+
+	// Trees
+	ParallelFor ( (int) m_Trees.size(), 1, [&](int start, int end, int chunk) {
+		for (int c=start; c < end; c++) {
+			PoseTree& t = m_Trees[c];
+			t.idx.resize ( t.count );
+			t.dim.resize ( t.count );
+			for (int i=0; i < t.count; i++) t.idx[i] = t.first + i;
+			BuildTree ( t, 0, t.count );
+		}
+	} );
+	dbgprintf ( "  PoseDB: %d cycles, %d frames, %d dims.\n", (int) m_Trees.size(), total, m_Dim );
+}
+
+// split each range at the median of its widest dimension
+void PoseDB::BuildTree ( PoseTree& t, int lo, int hi )
+{
+	if ( hi - lo <= 0 ) return;
+	int mid = (lo + hi) / 2;
+	int best = 0;
+	float best_spread = -1;
+	for (int d=0; d < m_Dim; d++) {
+		float vmin = FLT_MAX, vmax = -FLT_MAX;
+		for (int i=lo; i < hi; i++) {
+			float v = m_Features[ t.idx[i]*m_Dim + d ];
+			vmin = std::min(vmin, v); vmax = std::max(vmax, v);
+		}
+		if ( vmax - vmin > best_spread ) { best_spread = vmax - vmin; best = d; }
+	}
+	const float* F = &m_Features[0];
+	int D = m_Dim;
+	std::nth_element ( t.idx.begin() + lo, t.idx.begin() + mid, t.idx.begin() + hi, [&](int a, int b) { return F[a*D+best] < F[b*D+best]; } );
+	t.dim[mid] = (uint8_t) best;
+	BuildTree ( t, lo, mid );
+	BuildTree ( t, mid+1, hi );
+}
+
+void PoseDB::SearchTree ( PoseTree& t, int lo, int hi, const float* q, int min_frame, int& best, float& best_d )
+{
+	if ( hi - lo <= 0 ) return;
+	int mid = (lo + hi) / 2;
+	int p = t.idx[mid];
+	const float* f = &m_Features[ p*m_Dim ];
+
+	if ( p - t.first >= min_frame ) {
+		float d2 = 0;
+		for (int d=0; d < m_Dim && d2 < best_d; d++) d2 += (q[d]-f[d]) * (q[d]-f[d]);
+		if ( d2 < best_d ) { best_d = d2; best = p; }
+	}
+	float diff = q[ t.dim[mid] ] - f[ t.dim[mid] ];
+	if ( diff < 0 ) {
+		SearchTree ( t, lo, mid, q, min_frame, best, best_d );
+		if ( diff*diff < best_d ) SearchTree ( t, mid+1, hi, q, min_frame, best, best_d );
+	} else {
+		SearchTree ( t, mid+1, hi, q, min_frame, best, best_d );
+		if ( diff*diff < best_d ) SearchTree ( t, lo, mid, q, min_frame, best, best_d );
+	}
+}
+
+int PoseDB::FindFrame ( int cyc, const float* query, int min_frame, float& cost )
+{
+	cost = FLT_MAX;
+	if ( cyc < 0 || cyc >= m_Trees.size() || m_Dim == 0 ) return -1;
+	PoseTree& t = m_Trees[cyc];
+	int best = -1;
+	float best_d = FLT_MAX;
+	SearchTree ( t, 0, t.count, query, min_frame, best, best_d );
+	if ( best < 0 ) return -1;
+	cost = sqrt ( best_d / m_Dim );
+	return best - t.first;
+}
+
+Vec3I PoseDB::FindTransition ( int ci, int frame, int cj )
+{
+	if ( cj < 0 || cj >= m_Trees.size() || m_Trees[cj].count == 0 ) return Vec3I(-1,-1,-1);
+	float cost;
+	int k = FindFrame ( ci, getFeature(cj, 0), frame, cost );			// frame in ci closest to the start of cj
+	if ( k < 0 || cost > PDB_MAX_COST ) return Vec3I(-1,-1,-1);
+	return Vec3I ( cj, k, int(cost * 1000) );
+}
+
+// Blob count = dim, cycles, features
+bool PoseDB::Load ( uint64_t key )
+{
+	BlobHeader hdr;
+	FILE* fp = BlobCache::OpenRead ( "posedb", "PSDB", PDB_VERSION, key, hdr );
+	if ( fp == 0x0 ) return false;
+	int num_cycles = hdr.count[1], num_features = hdr.count[2];
+	bool ok = hdr.count[0] >= 0 && num_cycles >= 0 && num_features >= 0;
+	if ( ok ) {
+		Clear ();
+		m_Dim = hdr.count[0];
+		m_Features.resize ( (size_t) num_features * m_Dim );
+		m_Trees.resize ( num_cycles );
+		ok = m_Features.size() == 0 || fread ( &m_Features[0], sizeof(float), m_Features.size(), fp ) == m_Features.size();
+		for (int c=0; c < num_cycles && ok; c++) {
+			PoseTree& t = m_Trees[c];
+			ok = fread ( &t.first, sizeof(int), 1, fp ) == 1 && fread ( &t.count, sizeof(int), 1, fp ) == 1 && t.count >= 0;
+			if ( !ok || t.count == 0 ) continue;
+			t.idx.resize ( t.count );
+			t.dim.resize ( t.count );
+			ok = fread ( &t.idx[0], sizeof(int), t.count, fp ) == t.count && fread ( &t.dim[0], sizeof(uint8_t), t.count, fp ) == t.count;
+		}
+		if ( !ok ) Clear ();
+	}
+	BlobCache::CloseRead ( fp, "posedb", key, ok );
+	if ( ok ) m_Key = key;
+	return ok;
+}
+
+void PoseDB::Save ()
+{
+	BlobHeader hdr;
+	hdr.Set ( "PSDB", PDB_VERSION, m_Key );
+	hdr.count[0] = m_Dim;
+	hdr.count[1] = (int) m_Trees.size();
+	hdr.count[2] = (m_Dim == 0) ? 0 : (int) (m_Features.size() / m_Dim);
+	FILE* fp = BlobCache::OpenWrite ( "posedb", hdr );
+	if ( fp == 0x0 ) return;
+	if ( m_Features.size() > 0 ) fwrite ( &m_Features[0], sizeof(float), m_Features.size(), fp );
+	for (int c=0; c < m_Trees.size(); c++) {
+		PoseTree& t = m_Trees[c];
+		fwrite ( &t.first, sizeof(int), 1, fp );
+		fwrite ( &t.count, sizeof(int), 1, fp );
+		if ( t.count == 0 ) continue;
+		fwrite ( &t.idx[0], sizeof(int), t.count, fp );
+		fwrite ( &t.dim[0], sizeof(uint8_t), t.count, fp );
+	}
+	BlobCache::CloseWrite ( fp, "posedb", m_Key );
+}
+
+// Tree search matches a brute force scan
+// - random features, cycles of many, one and no frames, queries with a minimum frame
+int PoseDB::SelfTest ()
+{
+	int bad = 0;
+	PoseDB db;
+	int counts[3] = { 500, 1, 0 };
+	db.m_Dim = 12;
+	db.m_Trees.resize ( 3 );
+	int total = 0;
+	for (int c=0; c < 3; c++) {
+		db.m_Trees[c].first = total;
+		db.m_Trees[c].count = counts[c];
+		total += counts[c];
+	}
+	db.m_Features.resize ( total * db.m_Dim );
+	for (int i=0; i < db.m_Features.size(); i++)
+		db.m_Features[i] = hashRandF ( 11, i ) * 2 - 1;
+	for (int c=0; c < 3; c++) {
+		PoseTree& t = db.m_Trees[c];
+		t.idx.resize ( t.count );
+		t.dim.resize ( t.count );
+		for (int i=0; i < t.count; i++) t.idx[i] = t.first + i;
+		db.BuildTree ( t, 0, t.count );
+	}
+
+	std::vector<float> q ( db.m_Dim );
+	int mismatch = 0;
+	float cost;
+	for (int n=0; n < 2000; n++) {
+		int c = n % 2;
+		int min_frame = (n % 3 == 0) ? 0 : int( hashRandF ( 12, n ) * counts[c] );
+		for (int d=0; d < db.m_Dim; d++) q[d] = hashRandF ( 13, n*db.m_Dim + d ) * 2 - 1;
+
+		float best_d = FLT_MAX;
+		for (int f=min_frame; f < counts[c]; f++) {
+			const float* x = db.getFeature ( c, f );
+			float d2 = 0;
+			for (int d=0; d < db.m_Dim; d++) d2 += (q[d]-x[d]) * (q[d]-x[d]);
+			best_d = std::min ( best_d, d2 );
+		}
+		int k = db.FindFrame ( c, &q[0], min_frame, cost );
+		if ( k < min_frame || k >= counts[c] || fabs ( cost - sqrt(best_d / db.m_Dim) ) > 1e-5f ) mismatch++;
+	}
+	bad += selfCheck ( mismatch == 0, "pose_search", "tree search differs from brute force" );
+	bad += selfCheck ( db.FindFrame ( 2, &q[0], 0, cost ) == -1, "pose_search", "empty cycle returned a frame" );
+	bad += selfCheck ( db.FindFrame ( 0, &q[0], counts[0], cost ) == -1, "pose_search", "frame before min_frame returned" );
+	return selfReport ( "pose_search", bad );
+}
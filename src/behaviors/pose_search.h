@@ -0,0 +1,74 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_POSE_SEARCH
+	#define DEF_POSE_SEARCH
+
+	#include "vec.h"
+	#include <stdint.h>
+	#include <string>
+	#include <vector>
+
+	class MotionCycles;
+
+	// Pose search database
+	// - One feature vector per cycle frame: positions & velocities of the end joints
+	//   (feet, hands, head..) in the root frame, each dimension scaled to unit variance.
+	// - One KD-tree per cycle, so a query only searches the requested motion.
+	// - Built from the T-pose skeleton with the crowd SoA evaluator, in parallel.
+	// - Persisted as posedb_{key}.bin in the BlobCache directory. The key covers the cycle set & skeleton,
+	//   so the database is rebuilt only when the cycles change.
+
+	#define PDB_VERSION			3
+	#define PDB_MAX_JOINTS		8			// feature joints
+	#define PDB_MAX_COST		0.5f		// rms distance, in std devs, for an acceptable transition
+
+	struct PoseTree {
+		int						first, count;		// features [first, first+count) = frames of one cycle
+		std::vector<int>		idx;				// implicit tree, node at the middle of each range
+		std::vector<uint8_t>	dim;				// split dimension per node
+	};
+
+	class PoseDB {
+	public:
+		PoseDB ();
+
+		bool	Update ( MotionCycles* mc );							// load or rebuild if the cycle set changed
+		void	Clear ();
+
+		int		FindFrame ( int cyc, const float* query, int min_frame, float& cost );	// nearest frame in a cycle
+		Vec3I	FindTransition ( int ci, int frame, int cj );			// frame in ci to leave for the start of cj
+
+		const float* getFeature ( int cyc, int frame )	{ return &m_Features[ (m_Trees[cyc].first + frame) * m_Dim ]; }
+		int		getNumCycles ()		{ return (int) m_Trees.size(); }
+		int		getDim ()			{ return m_Dim; }
+		uint64_t getKey ()			{ return m_Key; }
+
+		static int SelfTest ();
+
+	private:
+		void	Build ( MotionCycles* mc );
+		void	BuildTree ( PoseTree& t, int lo, int hi );
+		void	SearchTree ( PoseTree& t, int lo, int hi, const float* q, int min_frame, int& best, float& best_d );
+		bool	Load ( uint64_t key );
+		void	Save ();
+
+		uint64_t				m_Key;
+		int						m_Version;			// cycle set version last checked
+		int						m_Dim;
+		std::vector<float>		m_Features;			// [feature * m_Dim + d], cycles contiguous
+		std::vector<PoseTree>	m_Trees;			// per cycle
+	};
+
+#endif
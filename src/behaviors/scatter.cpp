@@ -17,6 +17,9 @@
 #include "scene.h"
 #include "shapes.h"
 #include "mesh.h"
+#include "image.h"
+#include "parallel.h"
+#include "selftest.h"
 
 #include "gxlib.h"
 using namespace glib;
@@ -26,11 +29,23 @@ using namespace glib;
 #define S_DIST		2
 #define S_ZOOM		3
 #define S_SIZE		4
+#define S_MODE		5
+#define S_SPACING	6
+
+#define SCATTER_RANDOM	0		// modes
+#define SCATTER_POISSON	1
+
+#define PD_CANDIDATES	4		// poisson-disk candidates per requested instance
+
+#define S_SEED		1623		// scatter seed (counter-based, see hashRand64)
 
 Scatter::Scatter() : Object()
 {
 	m_numlod = 0;
 	m_numvari = 0;
+	m_numsrc = 0;
+	m_frame = 0;
+	m_rebuild = true;
 }
 
 void Scatter::Define(int x, int y)
@@ -52,6 +67,8 @@ void Scatter::Define(int x, int y)
 	AddParam(S_DIST,	"distance", "3");	SetParamV3(S_DIST,	0, Vec3F(0, 300, 400));
 	AddParam(S_ZOOM,	"zoom",		"f");	SetParamF(S_ZOOM, 0, 1.0);
 	AddParam(S_SIZE,	"size",		"3");	SetParamV3(S_SIZE, 0, Vec3F(0.1,0.1,0.1) );
+	AddParam(S_MODE,	"mode",		"i");	SetParamI(S_MODE, 0, SCATTER_RANDOM );		// 0=random, 1=poisson-disk
+	AddParam(S_SPACING,	"spacing",	"f");	SetParamF(S_SPACING, 0, 1.0 );				// poisson-disk spacing, x source diameter
 
 	mTimeRange.Set(0, 10000, 0 );
 
@@ -75,6 +92,10 @@ void Scatter::Generate(int x, int y)
 	
 	// Output shapes
 	CreateOutput('Ashp');	
+	getOutShapes()->SetLayout ( SHAPES_SOA );		// hot/cold streams for sort & upload
+
+	m_tiles.clear ();					// inputs may have changed, flush tile cache
+	m_rebuild = true;
 
 	ImageX* hgt = (ImageX*) getInput("height");
 	if (hgt != 0x0) {
@@ -106,47 +127,7 @@ void Scatter::Generate(int x, int y)
 
 		// Scatter over another object -- NO height field
 		//
-		Vec8S mat_id = getInputMat("material");		
-		Vec3F sz = getParamV3(S_SIZE);
-		int cnt = getParamI(S_COUNT);
-
-		// source mesh - object to scatter
-		int src_mesh = getInputID("source", 'Amsh');
-
-		// target behavior - object(s) to scatter over
-		Shapes* target = getInputShapes("target");
-		Shape* tshp = target->getShape(0);					// single shape
-		Mesh* target_mesh = dynamic_cast<Mesh*> ( gAssets.getObj( tshp->meshids.x ) );		// mesh on that shape
-		Matrix4F xform = getInput("target")->getXform();					// transform of behavior (applies to all shapes)
-		
-		int numf = target_mesh->GetNumFace3();
-		int f;
-		float u,v;
-		Vec3F v1, v2, v3, n1, n2, n3;
-
-		for (int n=0; n < cnt; n++) {
-			Shape *s = AddShape();
-			s->type = S_MESH;			
-			s->matids = mat_id;					
-			// set source mesh 
-			s->meshids.Set ( src_mesh, 0, 0, 0);		
-
-			// choose random point inside a random face on target
-			f = m_rand.randI(0, numf);
-      AttrV3 fv = *target_mesh->GetFace3(f);
-			v1 = *target_mesh->GetVertPos(fv.v1); v1 *= xform; n1 = *target_mesh->GetVertNorm(fv.v1);
-			v2 = *target_mesh->GetVertPos(fv.v2); v2 *= xform; n2 = *target_mesh->GetVertNorm(fv.v2);
-			v3 = *target_mesh->GetVertPos(fv.v3); v3 *= xform; n3 = *target_mesh->GetVertNorm(fv.v3);
-		
-			u = m_rand.randF(0,1);
-			v = m_rand.randF(0,1);
-			if (u+v > 1.0f) { u = 1.0f-u; v = 1.0f-v; }
-			s->pos = v1 + (v2-v1)*u + (v3-v1)*v;
-			s->rot.fromDirectionAndUp ( (n1+n2+n3)/3.0f, Vec3F(0,1,0) );
-			s->rot.normalize();
-			s->scale = sz;
-			//s->clr = VECCLR(pal[m_distlod[int(pt.z * 1024 / (dst.z * dst.z))]]);
-		} 
+		ScatterOverShapes ();
 	}
 	
 	m_rand.seed ( 6124 );
@@ -154,17 +135,364 @@ void Scatter::Generate(int x, int y)
 	MarkDirty();
 }
 
-// Scatter Objects over Heightfield 
-// using wang tiles, given 3D camera, zoom factor, and tone scale
+// Build area-weighted face sampler
+// - candidate faces from all shapes of the target, in world space
+// - weight = triangle area, optionally scaled by density image at face center
+// - Vose alias table for O(1) sampling
 //
-void Scatter::ScatterOverHeightfield()
+int Scatter::BuildFaceSampler ( Shapes* target, Matrix4F xform, Image* density )
+{
+	ClearSampler ();
+	if ( target == 0x0 ) return 0;
+
+	// enumerate faces of every mesh shape
+	Shape* s;
+	Mesh* mesh;
+	for (int i=0; i < target->getNumShapes(); i++) {
+		s = target->getShape(i);
+		if ( s->meshids.x < 0 || s->meshids.x >= MESH_NULL ) continue;
+		mesh = dynamic_cast<Mesh*> ( gAssets.getObj( s->meshids.x ) );
+		if ( mesh == 0x0 ) continue;
+
+		Matrix4F m = xform;
+		m *= s->getXform ();						// behavior xform * shape xform
+		int f0 = (int) s->meshids.z;
+		int fn = (s->meshids.w > 0) ? (int) s->meshids.w : mesh->GetNumFace3() - f0;
+		AddSamplerMesh ( mesh, m, f0, fn );
+	}
+	return BuildAliasTable ( density );
+}
+
+void Scatter::ClearSampler ()
+{
+	m_sfaces.clear ();
+	m_smesh.clear ();
+	m_sxform.clear ();
+	m_snxform.clear ();
+	m_sprob.clear ();
+	m_salias.clear ();
+}
+
+// Add faces f0..f0+fn-1 of a mesh, placed by world xform m
+void Scatter::AddSamplerMesh ( Mesh* mesh, Matrix4F m, int f0, int fn )
+{
+	ScatterFace sf;
+	sf.shape = (int) m_smesh.size();
+	m_smesh.push_back ( mesh );
+	m_sxform.push_back ( m );
+
+	// normal transform = cofactor matrix of the linear part (inverse transpose * det),
+	// sign of det kept so mirrored shapes keep outward normals
+	Vec3F o(0,0,0), c0(1,0,0), c1(0,1,0), c2(0,0,1);
+	o *= m;	c0 *= m; c1 *= m; c2 *= m;
+	c0 -= o; c1 -= o; c2 -= o;
+	Vec3F n0 = c1; n0.Cross ( c2 );
+	Vec3F n1 = c2; n1.Cross ( c0 );
+	Vec3F n2 = c0; n2.Cross ( c1 );
+	float det = (float) c0.Dot ( n0 );
+	if ( det < 0 ) { n0 *= -1.0f; n1 *= -1.0f; n2 *= -1.0f; }
+	m_snxform.push_back ( n0 );
+	m_snxform.push_back ( n1 );
+	m_snxform.push_back ( n2 );
+
+	for (int f = f0; f < f0 + fn; f++) {
+		sf.face = f;
+		m_sfaces.push_back ( sf );
+	}
+}
+
+// Face weights & alias table over the faces added
+int Scatter::BuildAliasTable ( Image* density )
+{
+	m_sprob.clear ();
+	m_salias.clear ();
+	int numf = (int) m_sfaces.size();
+	if ( numf == 0 ) return 0;
+
+	// face weights
+	std::vector<double> wgt ( numf );
+	ParallelFor ( numf, 8192, [&](int start, int end, int chunk) {
+		Vec3F v1, v2, v3, e1, e2;
+		for (int n = start; n < end; n++) {
+			ScatterFace& f = m_sfaces[n];
+			Mesh* mesh = m_smesh[ f.shape ];
+			AttrV3 fv = *mesh->GetFace3( f.face );
+			v1 = *mesh->GetVertPos(fv.v1); v1 *= m_sxform[f.shape];
+			v2 = *mesh->GetVertPos(fv.v2); v2 *= m_sxform[f.shape];
+			v3 = *mesh->GetVertPos(fv.v3); v3 *= m_sxform[f.shape];
+			e1 = v2 - v1;
+			e2 = v3 - v1;
+			e1.Cross ( e2 );
+			wgt[n] = 0.5 * e1.Length();
+			if ( density != 0x0 ) {
+				Vec2F t1 = *mesh->GetVertTex(fv.v1), t2 = *mesh->GetVertTex(fv.v2), t3 = *mesh->GetVertTex(fv.v3);
+				wgt[n] *= density->GetPixelUV ( (t1.x+t2.x+t3.x)/3.0f, (t1.y+t2.y+t3.y)/3.0f ).x;
+			}
+		}
+	});
+	double sum = 0;
+	for (int n=0; n < numf; n++) sum += wgt[n];
+	if ( sum <= 0 ) { m_sfaces.clear(); return 0; }
+
+	// alias table
+	std::vector<int> small, large;
+	m_sprob.resize ( numf );
+	m_salias.resize ( numf );
+	for (int n=0; n < numf; n++) {
+		wgt[n] *= numf / sum;						// mean of 1
+		if ( wgt[n] < 1.0 ) small.push_back(n); else large.push_back(n);
+	}
+	int sm, lg;
+	while ( !small.empty() && !large.empty() ) {
+		sm = small.back(); small.pop_back();
+		lg = large.back();
+		m_sprob[sm] = (float) wgt[sm];
+		m_salias[sm] = lg;
+		wgt[lg] = (wgt[lg] + wgt[sm]) - 1.0;
+		if ( wgt[lg] < 1.0 ) { large.pop_back(); small.push_back(lg); }
+	}
+	for (int n=0; n < large.size(); n++) { m_sprob[ large[n] ] = 1.0f; m_salias[ large[n] ] = large[n]; }
+	for (int n=0; n < small.size(); n++) { m_sprob[ small[n] ] = 1.0f; m_salias[ small[n] ] = small[n]; }		// round-off
+
+	return numf;
+}
+
+// Sample a point on the target surface
+// - sample n uses random counters 4n..4n+3, so results do not depend on thread count
+//
+void Scatter::SampleSurface ( uint64_t n, Vec3F& pos, Vec3F& norm )
+{
+	uint64_t c = n * 4;
+	int numf = (int) m_sfaces.size();
+
+	// choose face from alias table
+	int f = std::min( int(hashRandF( S_SEED, c ) * numf), numf-1 );
+	if ( hashRandF( S_SEED, c+1 ) >= m_sprob[f] ) f = m_salias[f];
+
+	ScatterFace& sf = m_sfaces[f];
+	Mesh* mesh = m_smesh[ sf.shape ];
+	Matrix4F& m = m_sxform[ sf.shape ];
+	AttrV3 fv = *mesh->GetFace3( sf.face );
+	Vec3F v1 = *mesh->GetVertPos(fv.v1); v1 *= m;
+	Vec3F v2 = *mesh->GetVertPos(fv.v2); v2 *= m;
+	Vec3F v3 = *mesh->GetVertPos(fv.v3); v3 *= m;
+
+	// choose random point inside face
+	float u = hashRandF( S_SEED, c+2 );
+	float v = hashRandF( S_SEED, c+3 );
+	if (u+v > 1.0f) { u = 1.0f-u; v = 1.0f-v; }
+
+	pos = v1 + (v2-v1)*u + (v3-v1)*v;
+
+	// normal, same barycentric weights as position, then to world space
+	Vec3F vn = *mesh->GetVertNorm(fv.v1) * (1.0f-u-v) + *mesh->GetVertNorm(fv.v2) * u + *mesh->GetVertNorm(fv.v3) * v;
+	Vec3F* nx = &m_snxform[ sf.shape * 3 ];
+	norm = nx[0] * vn.x + nx[1] * vn.y + nx[2] * vn.z;
+	if ( norm.Length() > 0 ) norm.Normalize();
+	else norm.Set(0,1,0);
+}
+
+// Radius of source mesh footprint, from its bounds in the local XZ plane
+float Scatter::getSourceRadius ( int src_mesh, Vec3F sz )
+{
+	Mesh* mesh = dynamic_cast<Mesh*> ( gAssets.getObj( src_mesh ) );
+	if ( mesh == 0x0 || mesh->GetNumVert() == 0 ) return 0.5f * std::max(sz.x, sz.z);
+
+	Vec3F bmin = *mesh->GetVertPos(0), bmax = bmin, p;
+	for (int n=1; n < mesh->GetNumVert(); n++) {
+		p = *mesh->GetVertPos(n);
+		bmin.x = std::min(bmin.x, p.x); bmax.x = std::max(bmax.x, p.x);
+		bmin.z = std::min(bmin.z, p.z); bmax.z = std::max(bmax.z, p.z);
+	}
+	float dx = (bmax.x - bmin.x) * sz.x;
+	float dz = (bmax.z - bmin.z) * sz.z;
+	return 0.5f * sqrt( dx*dx + dz*dz );
+}
+
+// Poisson-disk selection over surface samples
+// - candidates are surface samples 0..num_cand-1, tested in index order (dart throwing)
+// - background hash grid with cell size = min distance, so conflicts are in adjacent cells
+// - cells are grouped in tiles of PD_TILE^3 cells, processed in 8 parity phases.
+//   Tiles in the same phase are 2+ tiles apart and never conflict, so they run in parallel,
+//   and the result is identical to a serial run for any thread count.
+//
+#define PD_TILE		4
+
+int Scatter::PoissonSelect ( int num_cand, float mindist, int max_out, std::vector<int>& out )
+{
+	out.clear ();
+	if ( num_cand <= 0 || mindist <= 0 ) return 0;
+
+	// candidate positions & cells
+	std::vector<Vec3F> cpos ( num_cand );
+	std::vector<Vec3I> ccell ( num_cand );
+	float inv = 1.0f / mindist;
+	ParallelFor ( num_cand, 8192, [&](int start, int end, int chunk) {
+		Vec3F nrm;
+		for (int n = start; n < end; n++) {
+			SampleSurface ( n, cpos[n], nrm );
+			ccell[n] = Vec3I( (int) floor(cpos[n].x * inv), (int) floor(cpos[n].y * inv), (int) floor(cpos[n].z * inv) );
+		}
+	});
+
+	// hash grid (counting sort of candidates into buckets)
+	int nb = 1;
+	while ( nb < num_cand * 2 ) nb <<= 1;
+	auto cellHash = [nb](int x, int y, int z) -> int {
+		return (int) ( ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u) ^ ((uint32_t) z * 83492791u) ) & (nb - 1);
+	};
+	std::vector<int> bstart ( nb + 1, 0 );
+	std::vector<int> bcand ( num_cand );
+	for (int n=0; n < num_cand; n++) bstart[ cellHash(ccell[n].x, ccell[n].y, ccell[n].z) + 1 ]++;
+	for (int b=0; b < nb; b++) bstart[b+1] += bstart[b];
+	{
+		std::vector<int> bfill ( bstart.begin(), bstart.end()-1 );
+		for (int n=0; n < num_cand; n++) bcand[ bfill[ cellHash(ccell[n].x, ccell[n].y, ccell[n].z) ]++ ] = n;
+	}
+
+	// group candidates by (phase, tile), index order within each tile
+	auto tileOf = [](int c) -> int { return (c >= 0) ? c / PD_TILE : -((-c + PD_TILE - 1) / PD_TILE); };
+	std::vector<int> order ( num_cand );
+	for (int n=0; n < num_cand; n++) order[n] = n;
+	std::sort ( order.begin(), order.end(), [&](int a, int b) {
+		Vec3I ta ( tileOf(ccell[a].x), tileOf(ccell[a].y), tileOf(ccell[a].z) );
+		Vec3I tb ( tileOf(ccell[b].x), tileOf(ccell[b].y), tileOf(ccell[b].z) );
+		int pa = (ta.x & 1) | ((ta.y & 1) << 1) | ((ta.z & 1) << 2);
+		int pb = (tb.x & 1) | ((tb.y & 1) << 1) | ((tb.z & 1) << 2);
+		if ( pa != pb ) return pa < pb;
+		if ( ta.x != tb.x ) return ta.x < tb.x;
+		if ( ta.y != tb.y ) return ta.y < tb.y;
+		if ( ta.z != tb.z ) return ta.z < tb.z;
+		return a < b;
+	});
+	// tile ranges [start,end) in order, and phase ranges over tiles
+	std::vector<int> tstart;
+	std::vector<int> pstart ( 9, 0 );
+	Vec3I tprev, t;
+	for (int i=0; i < num_cand; i++) {
+		int n = order[i];
+		t = Vec3I( tileOf(ccell[n].x), tileOf(ccell[n].y), tileOf(ccell[n].z) );
+		if ( i == 0 || t.x != tprev.x || t.y != tprev.y || t.z != tprev.z ) {
+			tstart.push_back ( i );
+			pstart[ ((t.x & 1) | ((t.y & 1) << 1) | ((t.z & 1) << 2)) + 1 ]++;
+		}
+		tprev = t;
+	}
+	int num_tiles = (int) tstart.size();
+	tstart.push_back ( num_cand );
+	for (int p=0; p < 8; p++) pstart[p+1] += pstart[p];
+
+	// dart throwing, phase by phase
+	std::vector<char> accept ( num_cand, 0 );
+	float d2 = mindist * mindist;
+	for (int p=0; p < 8; p++) {
+		int t0 = pstart[p];
+		ParallelFor ( pstart[p+1] - t0, 1, [&](int start, int end, int chunk) {
+			for (int ti = t0 + start; ti < t0 + end; ti++) {
+				for (int i = tstart[ti]; i < tstart[ti+1]; i++) {
+					int n = order[i];
+					Vec3I& c = ccell[n];
+					bool ok = true;
+					for (int z = c.z-1; z <= c.z+1 && ok; z++)
+					for (int y = c.y-1; y <= c.y+1 && ok; y++)
+					for (int x = c.x-1; x <= c.x+1 && ok; x++) {
+						int b = cellHash ( x, y, z );
+						for (int j = bstart[b]; j < bstart[b+1]; j++) {
+							int k = bcand[j];
+							if ( k == n || ccell[k].x != x || ccell[k].y != y || ccell[k].z != z ) continue;		// hash collision
+							Vec3F d = cpos[k] - cpos[n];
+							if ( d.x*d.x + d.y*d.y + d.z*d.z < d2 && accept[k] ) { ok = false; break; }
+						}
+					}
+					accept[n] = ok ? 1 : 0;
+				}
+			}
+		});
+	}
+
+	// accepted samples in index order
+	for (int n=0; n < num_cand && out.size() < max_out; n++)
+		if ( accept[n] ) out.push_back ( n );
+
+	return (int) out.size();
+}
+
+// Scatter Objects over all shapes of another object
+// - faces are area-weighted (optionally density weighted)
+// - mode 0: white noise, 'count' instances
+// - mode 1: Poisson-disk (blue noise), up to 'count' instances spaced by source radius
+//
+void Scatter::ScatterOverShapes()
+{
+	Vec8S mat_id = getInputMat("material");		
+	Vec3F sz = getParamV3(S_SIZE);
+	int cnt = getParamI(S_COUNT);
+
+	// source mesh - object to scatter
+	int src_mesh = getInputID("source", 'Amsh');
+
+	// target behavior - object(s) to scatter over
+	Shapes* target = getInputShapes("target");
+	Object* target_obj = getInput("target");
+	if ( target == 0x0 || target_obj == 0x0 ) return;
+	Matrix4F xform = target_obj->getXform();				// transform of behavior (applies to all shapes)
+
+	int numf = BuildFaceSampler ( target, xform, (Image*) getInput("density") );
+	if ( numf == 0 || cnt <= 0 ) return;
+
+	// poisson-disk selects a subset of candidate samples
+	std::vector<int> samples;
+	if ( getParamI(S_MODE) == SCATTER_POISSON ) {
+		float mindist = 2.0f * getSourceRadius ( src_mesh, sz ) * getParamF(S_SPACING);
+		cnt = PoissonSelect ( cnt * PD_CANDIDATES, mindist, cnt, samples );
+	}
+
+	// allocate all shapes up front
+	int base;
+	Shape* dst = AddShapes ( cnt, base );
+	if ( dst == 0x0 ) return;
+
+	ParallelFor ( cnt, 4096, [&](int start, int end, int chunk) {
+		Vec3F pos, norm;
+		for (int n = start; n < end; n++) {
+			SampleSurface ( samples.empty() ? n : samples[n], pos, norm );
+
+			Shape* s = dst + n;
+			s->Clear ();
+			s->type = S_MESH;
+			s->matids = mat_id;
+			s->meshids.Set ( src_mesh, 0, 0, 0);			// set source mesh
+			s->pos = pos;
+			s->rot.fromDirectionAndUp ( norm, Vec3F(0,1,0) );
+			s->rot.normalize();
+			s->scale = sz;
+		}
+	});
+	getOutShapes()->PackStreams ( base );
+}
+
+// Select LOD band of tile, from distance of tile center to camera
+//
+int Scatter::getTileBand ( WangTileKey& k, Camera3D* cam, Vec3F dst )
 {
-	Vec3F pt, a, b, c;
+	if ( m_numlod == 0 ) return 0;
+	Vec3F sz = m_wt.getSize();
+	float dx = (k.x + k.size * 0.5f) * sz.x - cam->from_pos.x;
+	float dz = (k.y + k.size * 0.5f) * sz.z - cam->from_pos.z;
+	int i = int( (dx*dx + dz*dz) * 1024 / (dst.z * dst.z) );
+	return m_distlod[ std::min( std::max(i, 0), 1023 ) ];
+}
+
+// Generate points & shapes of a single tile
+// - touches only the tile, safe to call concurrently for different tiles
+//
+void Scatter::GenerateTile ( ScatterTile& t, Image* hgt, Shapes* target, int src_mesh, Vec3F size )
+{
+	Vec3F pt, a, c;
 	c.Set(1, 40, 1);
-	Shape* s, * q;
-	Quaternion r;
-	float sz;
-	int lod, vari, id;
+	Shape* q;
+	float sz, h = 0;
+	int id, ndx;
 
 	Vec4F pal[5];
 	pal[0].Set(1, 0, 0, 1);
@@ -173,97 +501,190 @@ void Scatter::ScatterOverHeightfield()
 	pal[3].Set(0, 0, 1, 1);
 	pal[4].Set(0, 1, 1, 1);
 
-	ImageX* hgt = (ImageX*)getInput("height");
+	m_wt.GenerateTilePoints ( t.key, t.pnts );
+	t.shapes.clear ();
+
+	if ( target == 0x0 || m_numlod == 0 || m_numvari == 0 ) {
+		// No shapes. Just use boxes.
+		Shape s;
+		for (int n = 0; n < t.pnts.size(); n++) {
+			pt = t.pnts[n];
+			s.Clear ();
+			s.type = S_MESH;
+			s.pos.Set ( pt.x, 0, pt.y );
+			s.scale = c;
+			s.clr = VECCLR(pal[ std::min(t.band, 4) ]);
+			s.meshids.Set( src_mesh, 0, 0, 0);
+			t.shapes.push_back ( s );
+		}
+		return;
+	}
+
+	// Scatter shapes
+	uint64_t seed = hashRand64 ( S_SEED, t.key.key );
+	uint64_t r;
+	for (int n = 0; n < t.pnts.size(); n++) {
+		pt = t.pnts[n];
+		if (hgt != 0x0) {
+			h = size.y * ((ImageX*) hgt)->GetPixelUV(pt.x / size.x, pt.y / size.z).x;		// get height from terrain image
+		}
+		a.Set(pt.x, h, pt.y);
+
+		r = hashRand64 ( seed, n );								// per point, seeded by tile coordinate
+		id = int(r % m_numvari) * m_numlod + t.band;			// variant & lod
+		if ( id >= m_numsrc ) continue;
+		sz = 1.0 + ((r >> 16) % 71) / 71.0f;
+		ndx = int((r >> 32) % 100);
+
+		for (int j = 0; j < m_srcgrp[id]->getNumShapes(); j++) {
+			q = m_srcgrp[id]->getShape(j);
+			t.shapes.push_back ( *q );
+			Shape& s = t.shapes.back();
+			s.pos = q->pos * sz + a;
+			s.scale *= sz;
+			s.clr = VECCLR(Vec4F(1 - float(ndx) * 0.3 / 100.0, 1, 1 - float(ndx) * 0.3 / 100.0, 1));
+		}
+	}
+}
+
+// Scatter Objects over Heightfield 
+// using wang tiles, given 3D camera, zoom factor, and tone scale
+// - temporally coherent: points & shapes are cached per tile (level, ix, iy).
+//   Each frame only tiles which entered the view or changed LOD band are generated (in parallel),
+//   tiles which left the view are evicted.
+// - each tile owns a span of the output. Changed tiles are written in place or appended,
+//   evicted tiles are hidden. The output is compacted once hidden shapes outnumber live ones.
+//
+void Scatter::ScatterOverHeightfield()
+{
+	Image* hgt = (Image*) getInput("height");
 	int src_mesh = getInputID("source", 'Amsh');
 
 	Vec3F size = getParamV3(S_SIZE);
-
 	float dens = getParamF(S_DENSITY);
 	float zm = getParamF(S_ZOOM);
 	Vec3F dst = getParamV3(S_DIST);
 
 	Camera3D* cam = gScene->getCamera3D();
-	int pnts = m_wt.Recurse3D(cam, zm, dens, dst.z);
-
-	ClearShapes();
-
-	Shapes* src = getInputShapes("target");
-
-	if (src == 0x0) {
-		// No shapes. Just use boxes.
-		for (int n = 0; n < pnts; n++) {
-			pt = m_wt.getPnt(n);
-			a.Set(pt.x, 0, pt.y);
-			b = a + c;
-			if (cam->boxInFrustum(a, b)) {
-				s = AddShape();
-				s->type = S_MESH;
-				s->pos = a;
-				s->scale = c;
-				s->clr = VECCLR(pal[m_distlod[int(pt.z * 1024 / (dst.z * dst.z))]]);
-				s->meshids.Set( src_mesh, 0, 0, 0);
-			}
+	Shapes* target = getInputShapes("target");
+	Shapes* out = getOutShapes();
+
+	// Visible tiles
+	m_wt.CollectTiles3D ( cam, zm, dens, dst.z, m_visible );
+	m_frame++;
+
+	// Find new tiles & tiles with changed lod
+	std::vector<ScatterTile*> added;
+	std::map<uint64_t, ScatterTile>::iterator it;
+	int band;
+	for (int n = 0; n < m_visible.size(); n++) {
+		WangTileKey& k = m_visible[n];
+		band = getTileBand ( k, cam, dst );
+		it = m_tiles.find ( k.key );
+		if ( it == m_tiles.end() ) {
+			ScatterTile& t = m_tiles[ k.key ];
+			t.key = k;
+			t.band = band;
+			t.first = -1;
+			t.cap = 0;
+			added.push_back ( &t );
+		} else if ( it->second.band != band ) {
+			it->second.band = band;
+			added.push_back ( &it->second );
 		}
+		m_tiles[ k.key ].frame = m_frame;
 	}
-	else {
-		// Setup source LODS on Modules
-		float h = 0;
-		int ndx;
-
-		// Scatter shapes
-		for (int n = 0; n < pnts; n++) {
-
-			pt = m_wt.getPnt(n);
-			if (hgt != 0x0) {
-				h = size.y * hgt->GetPixelUV(pt.x / size.x, pt.y / size.z).x;			// get height from terrain image
-			}
-			a.Set(pt.x, h, pt.y);
-			b = a + c;					// c should be bounding box of src
-
-			if (cam->boxInFrustum(a, b)) {
 
-				ndx = int(pt.x * pt.y);
-
-				// select lod
-				lod = m_distlod[int(pt.z * 1024 / (dst.z * dst.z))];	// lookup table
-				vari = ndx % m_numvari;
-				id = vari * m_numlod + lod;
-
-				//ang = int(pt.x * pt.y * 39761) % 360;
-				//r.fromAngleAxis ( ang*DEGtoRAD, Vec3F(0,1,0) );/				
-				sz = 1.0 + (ndx % 71) / 71.0f;
-				ndx = (ndx % 100);
-
-				for (int j = 0; j < m_srcgrp[id]->getNumShapes(); j++) {
-					q = m_srcgrp[id]->getShape(j);
-					s = AddShapeByCopy(q);
-					s->pos = q->pos * sz + a;
-					s->scale *= sz;
-					s->clr = VECCLR(Vec4F(1 - float(ndx) * 0.3 / 100.0, 1, 1 - float(ndx) * 0.3 / 100.0, 1));
-					//s->rot *= r;
-
-				}
+	// Evict tiles no longer visible
+	int lo = out->getNumShapes();						// first output shape changed
+	for (it = m_tiles.begin(); it != m_tiles.end(); ) {
+		if ( it->second.frame != m_frame ) {
+			if ( !m_rebuild && it->second.first >= 0 ) {
+				lo = std::min ( lo, it->second.first );
+				HideTile ( it->second );
 			}
+			it = m_tiles.erase ( it );
+		} else {
+			it++;
 		}
 	}
 
-	/*for (int n = 0; n < pnts; n++) {
-
-		pt = wt.getPnt(n);											// get generated point
-
-		a = Vec3F(pt.x, 0, pt.y);								// get 3D position
-		o = int(pt.y * imgres.x) + int(pt.x);						// offset into density func
-		b = a + Vec3F(.1, m_density[o] * 5.0, .1);				// get 3D box dimensions. height = density
+	// Generate new tiles (parallel)
+	ParallelFor ( (int) added.size(), 1, [&](int start, int end, int chunk) {
+		for (int i = start; i < end; i++)
+			GenerateTile ( *added[i], hgt, target, src_mesh, size );
+	});
+
+	// Compact once hidden shapes outnumber live ones
+	int live = 0;
+	for (it = m_tiles.begin(); it != m_tiles.end(); it++)
+		live += (int) it->second.shapes.size();
+	if ( m_rebuild || out->getNumShapes() - live > live ) {
+		RebuildTiles ();
+		return;
+	}
 
-		if (m_cam->boxInFrustum(a, b)) {							// cull box if outside camera frustum
-			d = 100.0 / (m_cam->getPos() - a).LengthFast();				// use distance as alpha falloff
-			pix = img.GetPixelUV(pt.x / imgres.x, pt.y / imgres.y);		// get point color (sample original image)
-			drawCube3D(a, b, pix.x, pix.y, pix.z, d);				// draw box
+	// Write changed tiles. in place if they fit, otherwise appended
+	int first, cnt;
+	Shape* s;
+	for (int i = 0; i < added.size(); i++) {
+		ScatterTile& t = *added[i];
+		cnt = (int) t.shapes.size();
+		if ( t.first >= 0 && cnt > t.cap ) HideTile ( t );
+		if ( t.first < 0 ) {
+			if ( cnt == 0 ) continue;
+			s = out->AddSpan ( cnt, first );
+			t.first = first;
+			t.cap = cnt;
+		} else {
+			s = out->getShape ( t.first );
+			for (int j = cnt; j < t.cap; j++)				// unused tail of the span
+				s[j].invisible = 1;
 		}
+		if ( cnt > 0 ) memcpy ( s, &t.shapes[0], cnt * sizeof(Shape) );
+		lo = std::min ( lo, t.first );
 	}
-	*/
+	out->InvalidateStreams ( lo );
+	out->PackStreams ( lo );
 }
 
+// Hide the output span of a tile, until the next compaction
+void Scatter::HideTile ( ScatterTile& t )
+{
+	Shape* s = getOutShapes()->getShape ( t.first );
+	for (int j = 0; j < t.cap; j++)
+		s[j].invisible = 1;
+	t.first = -1;
+	t.cap = 0;
+}
+
+// Rebuild output from all cached tiles, without holes
+void Scatter::RebuildTiles ()
+{
+	std::map<uint64_t, ScatterTile>::iterator it;
+	int total = 0;
+	for (it = m_tiles.begin(); it != m_tiles.end(); it++)
+		total += (int) it->second.shapes.size();
+
+	Shapes* out = getOutShapes();
+	out->Clear ();
+	m_rebuild = false;
+	for (it = m_tiles.begin(); it != m_tiles.end(); it++) { it->second.first = -1; it->second.cap = 0; }
+	if ( total == 0 ) return;
+
+	int first;
+	Shape* s = out->AddSpan ( total, first );
+	for (it = m_tiles.begin(); it != m_tiles.end(); it++) {
+		std::vector<Shape>& sv = it->second.shapes;
+		if ( sv.size() == 0 ) continue;
+		memcpy ( s, &sv[0], sv.size() * sizeof(Shape) );
+		it->second.first = first;
+		it->second.cap = (int) sv.size();
+		first += (int) sv.size();
+		s += sv.size();
+	}
+	out->PackStreams ();
+}
 
 void Scatter::Run(float time)
 {
@@ -311,14 +732,16 @@ void Scatter::Sketch(int w, int h, Camera3D* cam)
 	Vec4F pix ( 1,1,1,1 );
 	
 	c.Set(1, 40, 1);
-	for (int n = 0; n < m_wt.numPnts(); n ++) {			// skip every other pnt (faster)
-		pt = m_wt.getPnt(n);
-		a.Set(pt.x, 0, pt.y);
-		b = a + c;					// c should be bounding box of src
-		if (cam->boxInFrustum(a, b)) {
-			pix = pal [ m_distlod[ int(pt.z * 1024/(dst.z*dst.z)) ] ] ;
-			drawCircle ( Vec2F(a.x/sc, a.z/sc), 3.0, pix );
-			//drawPnt(a.x / sc, a.y / sc, pix);
+	std::map<uint64_t, ScatterTile>::iterator it;
+	for (it = m_tiles.begin(); it != m_tiles.end(); it++) {		// cached tile points
+		pix = pal [ std::min(it->second.band, 4) ];
+		for (int n = 0; n < it->second.pnts.size(); n++) {
+			pt = it->second.pnts[n];
+			a.Set(pt.x, 0, pt.y);
+			b = a + c;					// c should be bounding box of src
+			if (cam->boxInFrustum(a, b)) {
+				drawCircle ( Vec2F(a.x/sc, a.z/sc), 3.0, pix );
+			}
 		}
 	}
 	end2D();
@@ -326,8 +749,133 @@ void Scatter::Sketch(int w, int h, Camera3D* cam)
 	start3D(cam);
 }
 
+// Sample n lies on world triangle a,b,c
+static bool TestOnFace ( Vec3F p, Vec3F a, Vec3F b, Vec3F c )
+{
+	Vec3F ac = c - a;
+	Vec3F fn = b - a;	fn.Cross ( ac );
+	float len = fn.Length();
+	Vec3F e[3] = { b - a, c - b, a - c };
+	Vec3F q[3] = { p - a, p - b, p - c };
+	for (int i=0; i < 3; i++) {
+		e[i].Cross ( q[i] );
+		if ( e[i].Dot ( fn ) < -1e-4f * len ) return false;
+	}
+	return fabs( q[0].Dot ( fn ) ) < 1e-4f * len;
+}
 
-
-
-
-
+// Faces are picked in proportion to world area (and density), samples lie on the face,
+// normals are unit and follow a non-uniform xform, samples repeat by index.
+// Poisson-disk keeps the min distance, rejects only near accepted samples, any thread count
+int Scatter::SelfTest ()
+{
+	int bad = 0;
+	Scatter scat;
+
+	// two faces in one plane, areas 0.5 & 1.5. normals up, uv at the face centers
+	Mesh mesh;
+	mesh.CreateFV ();
+	Vec3F v[6] = { Vec3F(0,0,0), Vec3F(0,0,1), Vec3F(1,0,0), Vec3F(2,0,0), Vec3F(2,0,3), Vec3F(3,0,0) };
+	for (int i=0; i < 6; i++) {
+		mesh.AddVert ( v[i].x, v[i].y, v[i].z );
+		mesh.AddVertNorm ( Vec3F(0,1,0) );
+		mesh.AddVertTex ( Vec2F( (i < 3) ? 0.25f : 0.75f, 0.5f ) );
+	}
+	mesh.AddFaceFast3FV ( 0, 1, 2 );
+	mesh.AddFaceFast3FV ( 3, 4, 5 );
+
+	// sheared & scaled, det > 0. coplanar areas keep their 1:3 ratio
+	Matrix4F m;
+	m.SRT ( Vec3F(2,0,0.5f), Vec3F(0,1,0.3f), Vec3F(0.4f,0,1.5f), Vec3F(1,2,3), 1.0f );
+	Vec3F w[6];
+	for (int i=0; i < 6; i++) { w[i] = v[i]; w[i] *= m; }
+	Vec3F wn = w[1] - w[0], w2 = w[2] - w[0];
+	wn.Cross ( w2 );	wn.Normalize();
+
+	scat.ClearSampler ();
+	scat.AddSamplerMesh ( &mesh, m, 0, 2 );
+	bad += selfCheck ( scat.BuildAliasTable ( 0x0 ) == 2, "scatter", "faces not added" );
+
+	int num = 40000, cnt[2] = {0, 0}, off = 0, nbad = 0;
+	Vec3F pos, norm, pos2, norm2;
+	for (int n=0; n < num; n++) {
+		scat.SampleSurface ( n, pos, norm );
+		if ( TestOnFace ( pos, w[0], w[1], w[2] ) ) cnt[0]++;
+		else if ( TestOnFace ( pos, w[3], w[4], w[5] ) ) cnt[1]++;
+		else off++;
+		if ( fabs(norm.Length() - 1.0f) > 1e-4f || norm.Dot ( wn ) < 0.9999f ) nbad++;
+	}
+	bad += selfCheck ( off == 0, "scatter", "sample off the faces" );
+	bad += selfCheck ( fabs( cnt[1] / float(num) - 0.75f ) < 0.015f, "scatter", "faces not area weighted" );
+	bad += selfCheck ( nbad == 0, "scatter", "normal not unit or not transformed" );
+	scat.SampleSurface ( 123, pos, norm );
+	scat.SampleSurface ( 123, pos2, norm2 );
+	bad += selfCheck ( pos.x == pos2.x && pos.y == pos2.y && pos.z == pos2.z, "scatter", "sample not repeatable" );
+
+	// density 3:1 evens out the 1:3 areas. left half of the image is 3x brighter
+	Image img;
+	img.ResizeImage ( 8, 2, ImageOp::RGB24 );
+	uchar* pix = (uchar*) img.GetData();
+	int bpp = img.GetBytesPerPix();
+	for (int i=0; i < 16; i++)
+		for (int b=0; b < bpp; b++) pix[i*bpp + b] = (i % 8 < 4) ? 240 : 80;
+	scat.BuildAliasTable ( &img );
+	cnt[0] = cnt[1] = 0;
+	for (int n=0; n < num; n++) {
+		scat.SampleSurface ( n, pos, norm );
+		cnt[ TestOnFace ( pos, w[0], w[1], w[2] ) ? 0 : 1 ]++;
+	}
+	bad += selfCheck ( fabs( cnt[0] / float(num) - 0.5f ) < 0.015f, "scatter", "faces not density weighted" );
+
+	// poisson-disk over a 20x20 square across the origin, so cells & tiles go negative
+	Mesh quad;
+	quad.CreateFV ();
+	for (int i=0; i < 4; i++) {
+		quad.AddVert ( (i & 1) ? 10.0f : -10.0f, 0, (i & 2) ? 10.0f : -10.0f );
+		quad.AddVertNorm ( Vec3F(0,1,0) );
+		quad.AddVertTex ( Vec2F(0,0) );
+	}
+	quad.AddFaceFast3FV ( 0, 2, 1 );
+	quad.AddFaceFast3FV ( 1, 2, 3 );
+	m.SRT ( Vec3F(1,0,0), Vec3F(0,1,0), Vec3F(0,0,1), Vec3F(0,0,0), 1.0f );
+	scat.ClearSampler ();
+	scat.AddSamplerMesh ( &quad, m, 0, 2 );
+	scat.BuildAliasTable ( 0x0 );
+
+	int num_cand = 8000;
+	float mindist = 0.5f;
+	std::vector<int> sel, sel2, ser;
+	int cnt_sel = scat.PoissonSelect ( num_cand, mindist, num_cand, sel );
+	bad += selfCheck ( cnt_sel > 200 && cnt_sel == sel.size(), "scatter", "too few poisson samples" );
+
+	std::vector<Vec3F> cpos ( num_cand );
+	std::vector<char> acc ( num_cand, 0 );
+	for (int n=0; n < num_cand; n++) scat.SampleSurface ( n, cpos[n], norm );
+	for (int i=0; i < sel.size(); i++) acc[ sel[i] ] = 1;
+	int close = 0, uncovered = 0;
+	Vec3F d;
+	for (int n=0; n < num_cand; n++) {
+		bool near = false;
+		for (int i=0; i < sel.size(); i++) {
+			if ( sel[i] == n ) continue;
+			d = cpos[ sel[i] ] - cpos[n];
+			if ( d.Dot ( d ) < mindist * mindist ) { near = true; break; }
+		}
+		if ( acc[n] && near ) close++;					// accepted samples keep the min distance
+		if ( !acc[n] && !near ) uncovered++;			// rejected only next to an accepted sample
+	}
+	bad += selfCheck ( close == 0, "scatter", "poisson samples closer than min distance" );
+	bad += selfCheck ( uncovered == 0, "scatter", "poisson sample rejected with no neighbor" );
+
+	// repeatable, same on one thread, max_out keeps the index order prefix
+	scat.PoissonSelect ( num_cand, mindist, num_cand, sel2 );
+	bad += selfCheck ( sel2 == sel, "scatter", "poisson not repeatable" );
+	ParallelFor ( 2, 1, [&](int start, int end, int chunk) {
+		if ( chunk == 0 ) scat.PoissonSelect ( num_cand, mindist, num_cand, ser );		// nested in a pool job, runs serial
+	});
+	bad += selfCheck ( ser == sel, "scatter", "poisson depends on thread count" );
+	scat.PoissonSelect ( num_cand, mindist, 50, sel2 );
+	bad += selfCheck ( sel2.size() == 50 && std::equal ( sel2.begin(), sel2.end(), sel.begin() ), "scatter", "max_out not a prefix" );
+
+	return selfReport ( "scatter", bad );
+}
@@ -18,6 +18,26 @@
 	#include "mersenne.h"
 	#include "wang_tiles.h"
 	#include <vector>
+	#include <map>
+	#include <stdint.h>
+
+	class Mesh;
+	class Image;
+
+	struct ScatterFace {
+		int			shape;				// index into sampler meshes/xforms
+		int			face;				// face on that mesh
+	};
+
+	// Cached tile of heightfield scatter
+	struct ScatterTile {
+		WangTileKey			key;
+		int					band;			// lod band at generation
+		int					frame;			// last frame tile was visible
+		std::vector<Vec3F>	pnts;			// tile points (x, z, level)
+		std::vector<Shape>	shapes;			// expanded shapes
+		int					first, cap;		// span in output shapes, -1 if not placed
+	};
 
 	class Scatter : public Object {
 	public:
@@ -31,6 +51,21 @@
 		virtual void Sketch(int w, int h, Camera3D* cam);
 
 		void ScatterOverHeightfield();
+		void ScatterOverShapes();
+		void GenerateTile ( ScatterTile& t, Image* hgt, Shapes* target, int src_mesh, Vec3F size );
+		int  getTileBand ( WangTileKey& k, Camera3D* cam, Vec3F dst );
+		void HideTile ( ScatterTile& t );
+		void RebuildTiles ();
+
+		int  BuildFaceSampler ( Shapes* target, Matrix4F xform, Image* density );
+		void ClearSampler ();
+		void AddSamplerMesh ( Mesh* mesh, Matrix4F m, int f0, int fn );
+		int  BuildAliasTable ( Image* density );
+		void SampleSurface ( uint64_t n, Vec3F& pos, Vec3F& norm );
+		int  PoissonSelect ( int num_cand, float mindist, int max_out, std::vector<int>& out );
+		float getSourceRadius ( int src_mesh, Vec3F sz );
+
+		static int SelfTest ();
 
 	private:
 
@@ -42,6 +77,20 @@
 		Shapes*		m_srcgrp[100];
 
 		uchar		m_distlod[1024];
+
+		// heightfield tile cache, keyed by (level, ix, iy)
+		std::map<uint64_t, ScatterTile>	m_tiles;
+		std::vector<WangTileKey>	m_visible;
+		int			m_frame;
+		bool		m_rebuild;				// output rebuilt from all tiles on next update
+
+		// area-weighted face sampler (alias table)
+		std::vector<ScatterFace>	m_sfaces;
+		std::vector<float>		m_sprob;
+		std::vector<int>		m_salias;
+		std::vector<Mesh*>		m_smesh;
+		std::vector<Matrix4F>	m_sxform;
+		std::vector<Vec3F>		m_snxform;		// normal transform per shape, 3 columns (cofactors of xform)
 	};
 
 #endif
\ No newline at end of file
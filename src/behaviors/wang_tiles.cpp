@@ -17,9 +17,12 @@
 #include "wang_tiles.h"
 #include "image.h"
 #include "camera3d.h"
+#include "parallel.h"
+#include "selftest.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 
 /*
 	Copyright 2006 Johannes Kopf (kopf@inf.uni-konstanz.de)
@@ -294,3 +297,225 @@ void WangTiles::Recurse3D(WangTile& t, float x, float y, int level)
 				Recurse3D (mTiles[t.subdivs[0][ty * numSubtiles + tx]], x + tx * tileSize / numSubtiles, y + ty * tileSize / numSubtiles, level + 1);
 	}
 }
+
+
+// Collect visible tiles
+// - same traversal & recursion criteria as Recurse3D, but culled per tile rather than per point
+// - tiles entirely beyond distance 'dst' from the camera are skipped
+// - subtrees of the top-level subtiles are collected in parallel, output in serial order
+//
+int WangTiles::CollectTiles3D ( Camera3D* cam, float zm, float ts, float dst, std::vector<WangTileKey>& out )
+{
+	Vec3F ca, cb;
+	mCam = cam;
+	mCam->getBounds ( Vec2F(0,0.5), Vec2F(1,0.5), dst, ca, cb );
+	mClipMin = Vec3F(ca.x, ca.z, 0);
+	mClipMax = Vec3F(cb.x, cb.z, 0);
+
+	mZoom = zm;
+	mDist = dst;
+	mDSQ2 = mDist * mDist * 0.25 * 0.25;		// fractional distance (25%) for full density
+	toneScale = ts * 256.0;
+
+	out.clear ();
+	if ( !CollectTile ( 0, 0, 0, 0, out ) ) return (int) out.size();
+
+	int num = numSubtiles * numSubtiles;
+	std::vector< std::vector<WangTileKey> > sub ( num );
+	WangTile& t = mTiles[0];
+	ParallelFor ( num, 1, [&](int start, int end, int chunk) {
+		for (int i = start; i < end; i++)
+			CollectTiles3D ( t.subdivs[0][i], i % numSubtiles, i / numSubtiles, 1, sub[i] );
+	});
+	for (int i = 0; i < num; i++)
+		out.insert ( out.end(), sub[i].begin(), sub[i].end() );
+
+	return (int) out.size();
+}
+
+void WangTiles::CollectTiles3D ( int tile, int ix, int iy, int level, std::vector<WangTileKey>& out )
+{
+	if ( !CollectTile ( tile, ix, iy, level, out ) ) return;
+
+	// recursion
+	WangTile& t = mTiles[tile];
+	for (int ty = 0; ty < numSubtiles; ty++)
+		for (int tx = 0; tx < numSubtiles; tx++)
+			CollectTiles3D ( t.subdivs[0][ty * numSubtiles + tx], ix * numSubtiles + tx, iy * numSubtiles + ty, level + 1, out );
+}
+
+// Cull a single tile, output its key if it emits points
+// - returns true if its subtiles should be visited
+//
+bool WangTiles::CollectTile ( int tile, int ix, int iy, int level, std::vector<WangTileKey>& out )
+{
+	WangTile& t = mTiles[tile];
+	float tileSize = 1.f / powf(float(numSubtiles), float(level));
+	float x = ix * tileSize;
+	float y = iy * tileSize;
+
+	// transform tile to world space
+	Vec3F a(x * mSize.x, 0, y * mSize.z);
+	Vec3F b = a + Vec3F(tileSize * mSize.x, 1000, tileSize * mSize.z);
+
+	// check if tile is outside the camera bounding box
+	if ((b.x < mClipMin.x) || (a.x > mClipMax.x) || (b.z < mClipMin.y) || (a.z > mClipMax.y))
+		return false;
+
+	// check if tile is beyond max distance (nearest point on tile)
+	float dx = std::max( std::max(a.x - mCam->from_pos.x, mCam->from_pos.x - b.x), 0.f );
+	float dz = std::max( std::max(a.z - mCam->from_pos.z, mCam->from_pos.z - b.z), 0.f );
+	if ( dx*dx + dz*dz >= mDist*mDist )
+		return false;
+
+	// check if tile is outside the camera frustum
+	if (!mCam->boxInFrustum(a, b))
+		return false;
+
+	float factor = toneScale * tileSize * tileSize / mZoom;
+	int tilePnts = imin(t.numSubPoints, int(factor - t.numPoints));
+
+	if ( tilePnts > 0 ) {
+		WangTileKey k;
+		k.key = (uint64_t(level) << 56) | (uint64_t(ix) << 28) | uint64_t(iy);
+		k.tile = tile;
+		k.level = level;
+		k.ix = ix; k.iy = iy;
+		k.x = x; k.y = y; k.size = tileSize;
+		out.push_back ( k );
+	}
+	return (factor - t.numPoints > t.numSubPoints);
+}
+
+// Generate points of a single tile
+// - same density test as Recurse3D. Points depend only on the tile (level, ix, iy),
+//   zoom & tone scale, never on the camera, so cached tiles stay valid as the view moves.
+//   Distance is handled per tile: CollectTiles3D culls by 'dst', lod bands pick detail.
+//   (the Recurse3D distfactor recurrence stays below 1 + 2/mDSQ2, so density is the same)
+// - uses only read-only state set by CollectTiles3D, safe to call concurrently
+//
+int WangTiles::GenerateTilePoints ( WangTileKey& k, std::vector<Vec3F>& out )
+{
+	WangTile& t = mTiles[k.tile];
+	float factor = toneScale * k.size * k.size / mZoom;
+	int tilePnts = imin(t.numSubPoints, int(factor - t.numPoints));
+	float px, py, v;
+
+	out.clear ();
+	for (int i = 0; i < tilePnts; i++)
+	{
+		px = (k.x + t.subPoints[i].x * k.size) * mSize.x;
+		py = (k.y + t.subPoints[i].y * k.size) * mSize.z;
+
+		// evaluate density function
+		v = * (mDensityFunc + (int(py * (mRes.y/mSize.z)) * int(mRes.x) + int(px * (mRes.x / mSize.x))) * mStride) / 255.0f;
+		if (v * v <= i / factor)
+			continue;
+
+		out.push_back ( Vec3F(px, py, k.level) );
+	}
+	return (int) out.size();
+}
+
+// Parallel collection gives the serial tile order, tiles are culled by distance,
+// tile points stay inside the tile, follow the density and do not depend on the camera
+// - synthetic set of two tiles with 2x2 subtiles, no tileset file needed
+int WangTiles::SelfTest ()
+{
+	int bad = 0;
+	WangTiles wt;
+	wt.numTiles = 2;
+	wt.numSubtiles = 2;
+	wt.numSubdivs = 1;
+	wt.mTiles = new WangTile[2];
+	for (int i=0; i < 2; i++) {
+		WangTile& t = wt.mTiles[i];
+		t.subdivs = new int* [1];
+		t.subdivs[0] = new int[4];
+		for (int k=0; k < 4; k++) t.subdivs[0][k] = (k == 0 || k == 3) ? 1-i : i;
+		t.numPoints = 4;
+		t.points = new Vec2F[4];
+		t.numSubPoints = 16;
+		t.subPoints = new Vec2F[16];
+		for (int k=0; k < 20; k++) {
+			Vec2F p ( hashRandF(i, k*2), hashRandF(i, k*2+1) );
+			if ( k < 4 ) t.points[k] = p; else t.subPoints[k-4] = p;
+		}
+	}
+	// density: partial on the left half (thins the larger tiles), none on the right
+	uchar dens[64*64];
+	for (int n=0; n < 64*64; n++) dens[n] = (n % 64 < 32) ? 180 : 0;
+	Vec3F sz ( 100, 1, 100 );
+	wt.SetDensityFunc ( dens, 64, 64, sz );
+
+	Camera3D cam, cam2;
+	cam.setFov ( 60.0f );	cam.setAspect ( 1.0f );	cam.setNearFar ( 0.1f, 5000.0f );
+	cam.setOrbit ( Vec3F(0, 89, 0), Vec3F(50, 0, 50), 100, 1 );
+	cam2 = cam;
+	cam2.setOrbit ( Vec3F(30, 40, 0), Vec3F(30, 0, 60), 60, 1 );
+	float zm = 0.01f, ts = 1.0f, dst = 60.0f;
+
+	// parallel top level matches the serial recursion
+	std::vector<WangTileKey> keys, ser, keys2;
+	wt.CollectTiles3D ( &cam, zm, ts, dst, keys );
+	wt.CollectTiles3D ( 0, 0, 0, 0, ser );
+	bool same = keys.size() == ser.size() && keys.size() > 16;
+	for (int i=0; same && i < keys.size(); i++) same = keys[i].key == ser[i].key && keys[i].tile == ser[i].tile;
+	bad += selfCheck ( same, "wang_tiles", "parallel collection differs from serial" );
+
+	// distance cull, nearest point of each tile within dst
+	int far = 0;
+	for (int i=0; i < keys.size(); i++) {
+		float x0 = keys[i].x * sz.x, x1 = x0 + keys[i].size * sz.x;
+		float z0 = keys[i].y * sz.z, z1 = z0 + keys[i].size * sz.z;
+		float dx = std::max( std::max(x0 - cam.from_pos.x, cam.from_pos.x - x1), 0.f );
+		float dz = std::max( std::max(z0 - cam.from_pos.z, cam.from_pos.z - z1), 0.f );
+		if ( dx*dx + dz*dz >= dst*dst ) far++;
+	}
+	bad += selfCheck ( far == 0, "wang_tiles", "tile beyond max distance" );
+
+	// points inside the tile & on the dense half
+	std::vector< std::vector<Vec3F> > kpnts ( keys.size() );
+	std::vector<Vec3F> pnts;
+	int outside = 0, total = 0;
+	for (int i=0; i < keys.size(); i++) {
+		WangTileKey& k = keys[i];
+		total += wt.GenerateTilePoints ( k, kpnts[i] );
+		for (int j=0; j < kpnts[i].size(); j++) {
+			Vec3F& p = kpnts[i][j];
+			if ( p.x < k.x*sz.x || p.x > (k.x+k.size)*sz.x || p.y < k.y*sz.z || p.y > (k.y+k.size)*sz.z ) outside++;
+			if ( p.x >= 50.0f || p.z != k.level ) outside++;
+		}
+	}
+	bad += selfCheck ( total > 0, "wang_tiles", "no tile points" );
+	bad += selfCheck ( outside == 0, "wang_tiles", "point outside its tile or density" );
+
+	// same tile from another camera gives the same points
+	wt.CollectTiles3D ( &cam2, zm, ts, dst, keys2 );
+	int common = 0, diff = 0;
+	for (int i=0; i < keys.size(); i++) {
+		for (int j=0; j < keys2.size(); j++) {
+			if ( keys2[j].key != keys[i].key ) continue;
+			common++;
+			wt.GenerateTilePoints ( keys2[j], pnts );
+			std::vector<Vec3F>& p1 = kpnts[i];
+			if ( p1.size() != pnts.size() ) { diff++; break; }
+			for (int n=0; n < pnts.size(); n++)
+				if ( p1[n].x != pnts[n].x || p1[n].y != pnts[n].y ) { diff++; break; }
+			break;
+		}
+	}
+	bad += selfCheck ( common > 0 && diff == 0, "wang_tiles", "tile points depend on the camera" );
+
+	for (int i=0; i < 2; i++) {
+		delete [] wt.mTiles[i].subdivs[0];
+		delete [] wt.mTiles[i].subdivs;
+		delete [] wt.mTiles[i].points;
+		delete [] wt.mTiles[i].subPoints;
+	}
+	delete [] wt.mTiles;
+	delete [] wt.mPoints;
+	wt.mTiles = 0x0;
+	wt.mPoints = 0x0;
+	return selfReport ( "wang_tiles", bad );
+}
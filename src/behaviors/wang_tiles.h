@@ -16,6 +16,8 @@
 	#define DEF_WANGTILES
 
 	#include "vec.h"
+	#include <stdint.h>
+	#include <vector>
 
 	struct WangTile
 	{
@@ -26,6 +28,16 @@
 		Vec2F *subPoints;
 	};
 	
+	// Tile instance in the recursive tiling, uniquely identified by (level, ix, iy)
+	struct WangTileKey
+	{
+		uint64_t	key;
+		int			tile;				// index into tile set
+		int			level;
+		int			ix, iy;				// tile coordinates at level
+		float		x, y, size;			// tile origin & size, in [0,1]
+	};
+	
 	class Camera3D;
 	class Image;
 
@@ -46,9 +58,21 @@
 		void	Recurse3D ( WangTile& t, float x, float y, int level);
 		//void	Recurse3D ( Camera3D* cam, float ts );
 
+		// Tile-level traversal for caching
+		// - CollectTiles3D lists visible tiles which emit points
+		// - GenerateTilePoints returns the points of one tile (thread-safe). Points depend
+		//   only on the tile coordinate, not the camera, so a cached tile stays valid
+		int		CollectTiles3D ( Camera3D* cam, float zm, float ts, float dst, std::vector<WangTileKey>& out );
+		void	CollectTiles3D ( int tile, int ix, int iy, int level, std::vector<WangTileKey>& out );
+		bool	CollectTile ( int tile, int ix, int iy, int level, std::vector<WangTileKey>& out );
+		int		GenerateTilePoints ( WangTileKey& k, std::vector<Vec3F>& out );
+		Vec3F	getSize()			{ return mSize; }
+
 		int numPnts ()				{ return mNumPnts; }
 		Vec3F getPnt ( int n )	{ return mPoints[n]; }
 
+		static int SelfTest ();
+
 	private:
 		
 		float		mZoom, mDist, mDSQ2;
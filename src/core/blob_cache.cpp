@@ -0,0 +1,287 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#include "blob_cache.h"
+#include "content_hash.h"
+#include "main.h"				// for dbgprintf
+#include "selftest.h"
+
+#include <string.h>
+#include <vector>
+#include <mutex>
+#ifdef _WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+struct BlobEntry {
+	std::string		name;
+	uint64_t		bytes;
+};
+
+// Index of blobs on disk, least recently used first
+// - loaded on first use, guarded since variants & displace may write from workers
+static std::string				gBlobDir = "cache/";
+static uint64_t					gBlobBudget = BLOB_CACHE_BUDGET;
+static std::vector<BlobEntry>	gBlobIndex;
+static uint64_t					gBlobBytes = 0;
+static bool						gBlobLoaded = false;
+static std::mutex				gBlobMutex;
+
+void BlobHeader::Set ( const char* m, int ver, uint64_t k )
+{
+	memcpy ( magic, m, 4 );
+	version = ver;
+	key = k;
+	for (int i=0; i < 4; i++) count[i] = 0;
+}
+
+static std::string getBlobName ( const char* prefix, uint64_t key )
+{
+	return std::string(prefix) + "_" + hashToStr(key) + ".bin";
+}
+
+static void MakeBlobDir ()
+{
+	#ifdef _WIN32
+		_mkdir ( gBlobDir.c_str() );
+	#else
+		mkdir ( gBlobDir.c_str(), 0755 );
+	#endif
+}
+
+// Index helpers, caller holds gBlobMutex
+static void LoadIndex ()
+{
+	if ( gBlobLoaded ) return;
+	gBlobLoaded = true;
+	gBlobIndex.clear ();
+	gBlobBytes = 0;
+	FILE* fp = fopen ( (gBlobDir + BLOB_INDEX_FILE).c_str(), "rt" );
+	if ( fp == 0x0 ) return;
+	char name[256];
+	unsigned long long bytes;
+	BlobEntry e;
+	while ( fscanf ( fp, "%255s %llu", name, &bytes ) == 2 ) {
+		e.name = name;
+		e.bytes = bytes;
+		gBlobIndex.push_back ( e );
+		gBlobBytes += e.bytes;
+	}
+	fclose ( fp );
+}
+
+static void SaveIndex ()
+{
+	FILE* fp = fopen ( (gBlobDir + BLOB_INDEX_FILE).c_str(), "wt" );
+	if ( fp == 0x0 ) return;
+	for (int n=0; n < gBlobIndex.size(); n++)
+		fprintf ( fp, "%s %llu\n", gBlobIndex[n].name.c_str(), (unsigned long long) gBlobIndex[n].bytes );
+	fclose ( fp );
+}
+
+static int FindEntry ( std::string& name )
+{
+	for (int n = (int) gBlobIndex.size()-1; n >= 0; n--)		// recent at the back
+		if ( gBlobIndex[n].name == name ) return n;
+	return -1;
+}
+
+static void EraseEntry ( int n, bool del )
+{
+	if ( del ) remove ( (gBlobDir + gBlobIndex[n].name).c_str() );
+	gBlobBytes -= gBlobIndex[n].bytes;
+	gBlobIndex.erase ( gBlobIndex.begin() + n );
+}
+
+void BlobCache::SetDir ( std::string dir )
+{
+	if ( dir.empty() ) dir = ".";
+	char c = dir.at ( dir.length()-1 );
+	if ( c != '/' && c != '\\' ) dir += "/";
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	gBlobDir = dir;
+	gBlobLoaded = false;						// index of the new directory
+}
+
+void BlobCache::SetBudget ( uint64_t bytes )
+{
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	gBlobBudget = bytes;
+}
+
+std::string BlobCache::getDir ()
+{
+	return gBlobDir;
+}
+
+uint64_t BlobCache::getBytes ()
+{
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	LoadIndex ();
+	return gBlobBytes;
+}
+
+std::string BlobCache::getPath ( const char* prefix, uint64_t key )
+{
+	return gBlobDir + getBlobName ( prefix, key );
+}
+
+FILE* BlobCache::OpenRead ( const char* prefix, const char* magic, int version, uint64_t key, BlobHeader& hdr )
+{
+	std::string path = getPath ( prefix, key );
+	FILE* fp = fopen ( path.c_str(), "rb" );
+	if ( fp == 0x0 ) return 0x0;
+	bool ok = fread ( &hdr, sizeof(hdr), 1, fp ) == 1 && strncmp ( hdr.magic, magic, 4 ) == 0 && hdr.version == version && hdr.key == key;
+	if ( !ok ) {
+		CloseRead ( fp, prefix, key, false );
+		return 0x0;
+	}
+	// most recently used
+	std::string name = getBlobName ( prefix, key );
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	LoadIndex ();
+	int n = FindEntry ( name );
+	if ( n >= 0 && n != gBlobIndex.size()-1 ) {
+		BlobEntry e = gBlobIndex[n];
+		gBlobIndex.erase ( gBlobIndex.begin() + n );
+		gBlobIndex.push_back ( e );
+	}
+	return fp;
+}
+
+void BlobCache::CloseRead ( FILE* fp, const char* prefix, uint64_t key, bool ok )
+{
+	fclose ( fp );
+	if ( ok ) return;
+	dbgprintf ( "WARNING: Cache %s is stale or invalid. Regenerating.\n", getPath(prefix, key).c_str() );
+	Remove ( prefix, key );
+}
+
+FILE* BlobCache::OpenWrite ( const char* prefix, BlobHeader& hdr )
+{
+	std::string path = getPath ( prefix, hdr.key );
+	FILE* fp = fopen ( path.c_str(), "wb" );
+	if ( fp == 0x0 ) {
+		MakeBlobDir ();
+		fp = fopen ( path.c_str(), "wb" );
+	}
+	if ( fp == 0x0 ) {
+		dbgprintf ( "WARNING: Unable to write cache %s\n", path.c_str() );
+		return 0x0;
+	}
+	fwrite ( &hdr, sizeof(hdr), 1, fp );
+	return fp;
+}
+
+void BlobCache::CloseWrite ( FILE* fp, const char* prefix, uint64_t key )
+{
+	bool ok = ferror ( fp ) == 0;
+	long bytes = ftell ( fp );
+	fclose ( fp );
+	std::string name = getBlobName ( prefix, key );
+	if ( !ok || bytes <= 0 ) {
+		dbgprintf ( "WARNING: Unable to write cache %s\n", getPath(prefix, key).c_str() );
+		Remove ( prefix, key );
+		return;
+	}
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	LoadIndex ();
+	int n = FindEntry ( name );
+	if ( n >= 0 ) EraseEntry ( n, false );		// rewritten
+	BlobEntry e;
+	e.name = name;
+	e.bytes = (uint64_t) bytes;
+	gBlobIndex.push_back ( e );
+	gBlobBytes += e.bytes;
+
+	// drop least recently used over budget, never the new blob
+	while ( gBlobBytes > gBlobBudget && gBlobIndex.size() > 1 )
+		EraseEntry ( 0, true );
+	SaveIndex ();
+}
+
+void BlobCache::Remove ( const char* prefix, uint64_t key )
+{
+	std::string name = getBlobName ( prefix, key );
+	std::lock_guard<std::mutex> lock ( gBlobMutex );
+	LoadIndex ();
+	remove ( (gBlobDir + name).c_str() );
+	int n = FindEntry ( name );
+	if ( n >= 0 ) {
+		EraseEntry ( n, false );
+		SaveIndex ();
+	}
+}
+
+// Blobs round-trip, stale blobs are removed, budget drops the least recently used
+int BlobCache::SelfTest ()
+{
+	int bad = 0;
+	const char* pre = "blobtest";
+	int payload[16];
+	BlobHeader hdr;
+	FILE* fp;
+	uint64_t keys[4];
+	for (int k=0; k < 4; k++) keys[k] = hashValue ( 0x5eed, k );
+	uint64_t blob = sizeof(BlobHeader) + sizeof(payload);
+	uint64_t base = getBytes ();
+	SetBudget ( base + blob*2 + blob/2 );				// room for two test blobs
+
+	// write 0,1. read 0 so 1 is least recent. write 2 drops 1
+	for (int k=0; k < 3; k++) {
+		if ( k == 2 ) {
+			fp = OpenRead ( pre, "BTST", 1, keys[0], hdr );
+			bad += selfCheck ( fp != 0x0, "blob_cache", "blob did not read back" );
+			if ( fp ) CloseRead ( fp, pre, keys[0], true );
+		}
+		hdr.Set ( "BTST", 1, keys[k] );
+		hdr.count[0] = 16;
+		for (int i=0; i < 16; i++) payload[i] = k*100 + i;
+		fp = OpenWrite ( pre, hdr );
+		bad += selfCheck ( fp != 0x0, "blob_cache", "unable to write blob" );
+		if ( fp == 0x0 ) break;
+		fwrite ( payload, sizeof(int), 16, fp );
+		CloseWrite ( fp, pre, keys[k] );
+	}
+	fp = OpenRead ( pre, "BTST", 1, keys[1], hdr );
+	bad += selfCheck ( fp == 0x0, "blob_cache", "least recent blob kept over budget" );
+	if ( fp ) fclose ( fp );
+
+	for (int k=0; k < 3; k += 2) {
+		fp = OpenRead ( pre, "BTST", 1, keys[k], hdr );
+		bool ok = fp != 0x0 && hdr.count[0] == 16 && fread ( payload, sizeof(int), 16, fp ) == 16 && payload[15] == k*100 + 15;
+		bad += selfCheck ( ok, "blob_cache", "blob payload mismatch" );
+		if ( fp ) CloseRead ( fp, pre, keys[k], ok );
+	}
+	bad += selfCheck ( getBytes() == base + blob*2, "blob_cache", "index size mismatch" );
+
+	// stale version & missing key
+	fp = OpenRead ( pre, "BTST", 2, keys[0], hdr );
+	bad += selfCheck ( fp == 0x0, "blob_cache", "accepted a blob of another version" );
+	if ( fp ) fclose ( fp );
+	fp = OpenRead ( pre, "BTST", 1, keys[0], hdr );
+	bad += selfCheck ( fp == 0x0, "blob_cache", "stale blob not removed" );
+	if ( fp ) fclose ( fp );
+	fp = OpenRead ( pre, "BTST", 1, keys[3], hdr );
+	bad += selfCheck ( fp == 0x0, "blob_cache", "read a blob never written" );
+	if ( fp ) fclose ( fp );
+
+	for (int k=0; k < 4; k++) Remove ( pre, keys[k] );
+	bad += selfCheck ( getBytes() == base, "blob_cache", "index not restored" );
+	SetBudget ( BLOB_CACHE_BUDGET );
+
+	return selfReport ( "blob_cache", bad );
+}
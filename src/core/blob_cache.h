@@ -0,0 +1,61 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_BLOB_CACHE
+	#define DEF_BLOB_CACHE
+
+	#include <stdint.h>
+	#include <stdio.h>
+	#include <string>
+
+	#define BLOB_CACHE_BUDGET	(uint64_t(2) << 30)		// bytes on disk, all blobs
+	#define BLOB_INDEX_FILE		"blob_index.txt"
+
+	// Disk blob cache
+	// - generated results persisted per content key: displace meshes, pose databases, module variants
+	// - one directory for all blobs, set with -cache {dir}. default {ASSET_PATH}/cache, made on first write
+	// - blob file is {prefix}_{key}.bin, a BlobHeader then the caller's payload
+	// - index file lists blobs & sizes, least recently used first. over budget the oldest are removed.
+	//   reads reorder the index in memory, saved with the next write
+	//
+	struct BlobHeader {
+		void		Set ( const char* m, int ver, uint64_t k );
+		char		magic[4];
+		int			version;
+		uint64_t	key;
+		int			count[4];				// payload sizes, meaning set by the caller
+	};
+
+	class BlobCache {
+	public:
+		static void		SetDir ( std::string dir );
+		static void		SetBudget ( uint64_t bytes );
+		static std::string getDir ();
+		static uint64_t	getBytes ();				// total size of indexed blobs
+		static std::string getPath ( const char* prefix, uint64_t key );
+
+		// read: header is checked against magic, version & key. stale blobs are removed
+		static FILE*	OpenRead ( const char* prefix, const char* magic, int version, uint64_t key, BlobHeader& hdr );
+		static void		CloseRead ( FILE* fp, const char* prefix, uint64_t key, bool ok );		// ok=false removes the blob
+
+		// write: hdr is written first. close records the blob & trims the cache
+		static FILE*	OpenWrite ( const char* prefix, BlobHeader& hdr );
+		static void		CloseWrite ( FILE* fp, const char* prefix, uint64_t key );
+
+		static void		Remove ( const char* prefix, uint64_t key );
+
+		static int		SelfTest ();
+	};
+
+#endif
@@ -0,0 +1,70 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_CONTENT_HASH
+	#define DEF_CONTENT_HASH
+
+	#include <stdint.h>
+	#include <stdio.h>
+	#include <string.h>
+	#include <string>
+
+	// Content hashing
+	// - 64-bit hash of raw bytes, for content-addressed caches of generated results
+	// - 8 bytes per step, tail bytes folded into a last word. splitmix64 finalizer
+	// - not cryptographic. keys also carry sizes, so equal prefixes don't collide trivially
+
+	inline uint64_t hashMix64 ( uint64_t z )
+	{
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	inline uint64_t hashBytes ( uint64_t h, const void* data, size_t len )
+	{
+		const unsigned char* p = (const unsigned char*) data;
+		uint64_t w;
+		h ^= len * 0x9E3779B97F4A7C15ULL;
+		for (; len >= 8; len -= 8, p += 8) {
+			memcpy ( &w, p, 8 );
+			h = (h ^ w) * 0x100000001B3ULL;
+			h ^= h >> 29;
+		}
+		if ( len > 0 ) {
+			w = 0;
+			memcpy ( &w, p, len );
+			h = (h ^ w) * 0x100000001B3ULL;
+		}
+		return hashMix64 ( h );
+	}
+
+	template<class T> inline uint64_t hashValue ( uint64_t h, const T& val )
+	{
+		return hashBytes ( h, &val, sizeof(T) );
+	}
+
+	inline uint64_t hashString ( uint64_t h, const std::string& str )
+	{
+		return hashBytes ( h, str.c_str(), str.size() );
+	}
+
+	inline std::string hashToStr ( uint64_t h )
+	{
+		char buf[20];
+		snprintf ( buf, 20, "%016llx", (unsigned long long) h );
+		return buf;
+	}
+
+#endif
@@ -370,11 +370,14 @@ Shapes* Object::getOutShapes()			{ return dynamic_cast<Shapes*> (gAssets.getObj(
 Shape* Object::AddShape()				{ int i;	return getOutShapes()->Add(i); }
 void Object::ClearShapes()				{ Shapes* shapes = getOutShapes(); if (shapes!=0x0) shapes->Clear(); }
 void Object::DeleteShape(int i)			{ Shapes* shapes = getOutShapes(); if (shapes != 0x0) shapes->Delete(i); }
-Shape* Object::AddShape(int& i)			{ Shapes* shapes = getOutShapes(); return (shapes=0x0) ? 0 : getOutShapes()->Add(i); }
+Shape* Object::AddShape(int& i)			{ Shapes* shapes = getOutShapes(); return (shapes==0x0) ? 0 : shapes->Add(i); }
 Shape* Object::AddShapeByCopy(Shape* src) { return getOutShapes()->AddShapeByCopy (src); }
+Shape* Object::AddShapes(int cnt, int& first) { Shapes* shapes = getOutShapes(); first = 0; return (shapes==0x0) ? 0 : shapes->AddSpan(cnt, first); }
 int Object::getNumShapes()				{ Shapes* shapes = getOutShapes(); return (shapes==0x0) ? 0 : shapes->getNumShapes(); }
-Shape* Object::getShape(int n)			{ Shapes* shapes = getOutShapes(); return (shapes==0x0) ? 0 : shapes->getShape (n); }
-char* Object::getShapeData(int b, int i) { Shapes* shapes = getOutShapes(); return (shapes == 0x0) ? 0 : shapes->getElem (b, i); }
+Shape* Object::getShape(int n)			{ Shapes* shapes = getOutShapes(); if (shapes==0x0) return 0; shapes->InvalidateStreams (n); return shapes->getShape (n); }		// writable, streams repacked from n
+char* Object::getShapeData(int b, int i) { Shapes* shapes = getOutShapes(); if (shapes==0x0) return 0; if (b==BSHAPE) shapes->InvalidateStreams (i); return shapes->getElem (b, i); }
+Shape* Object::readShape(int n)			{ Shapes* shapes = getOutShapes(); return (shapes==0x0) ? 0 : shapes->getShape (n); }		// read only, streams kept
+char* Object::readShapeData(int b, int i) { Shapes* shapes = getOutShapes(); return (shapes==0x0) ? 0 : shapes->getElem (b, i); }
 
 // copy all input shapes to output
 bool Object::CopyShapesFromInput(std::string input_name )
@@ -382,8 +385,10 @@ bool Object::CopyShapesFromInput(std::string input_name )
 	Shapes* shapes = getInputShapes(input_name);
 	if ( shapes == 0x0 ) return false;
 	
-	for (int n=0; n < shapes->getNumShapes(); n++) 
-		AddShapeByCopy ( shapes->getShape(n) );
+	int first, cnt = shapes->getNumShapes();
+	Shape* dest = AddShapes ( cnt, first );
+	if ( dest != 0x0 ) 
+		memcpy ( dest, shapes->getShape(0), cnt * sizeof(Shape) );
 
 	return true;
 }
@@ -391,10 +396,11 @@ bool Object::CopyShapesFromInput(std::string input_name )
 void Object::PlaceShapesEndToEnd()
 {
 	Quaternion rot;
-	Shape* s;
 	Vec3F dir;
-	for (int n = 0; n < getNumShapes() - 1; n++) {
-		s = getShape(n);
+	int num = getNumShapes();
+	if ( num == 0 ) return;
+	Shape* s = getShape(0);								// streams repacked once, for all shapes
+	for (int n = 0; n < num - 1; n++, s++) {
 		dir = (s + 1)->pos - s->pos;
 		s->scale.x = dir.Length() * 0.5;									// segment length
 		dir.Normalize();
@@ -402,7 +408,6 @@ void Object::PlaceShapesEndToEnd()
 		s->rot = rot;
 		s->pivot.Set ( 1, 0, 0);		
 	}
-	s = getShape( getNumShapes()-1 );
 	s->scale.x = dir.Length() * 0.5;
 	s->rot = rot;
 	s->pivot.Set(1, 0, 0);
@@ -417,7 +422,7 @@ void Object::SetShapeData(int buf, int i, void* src, int sz)
 void Object::CreateShapeData(int buf, char* name, int stride )
 {
 	Shapes* shapes = getOutShapes();
-	shapes->AddBuffer(buf, name, stride, 1 );
+	shapes->AddChannel(buf, name, stride );
 }
 
 
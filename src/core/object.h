@@ -176,21 +176,24 @@
 		Shape*		AddShape();				
 		Shape*		AddShape(int& i);
 		Shape*		AddShapeByCopy (Shape* src);
+		Shape*		AddShapes (int cnt, int& first);		// bulk. contiguous span of new shapes (see Shapes::AddSpan)
 		bool		CopyShapesFromInput( std::string name );
 		void		PlaceShapesEndToEnd();
 		void		CreateShapeData(int buf, char* name, int stride);
 		void		SetShapeData( int buf, int i, void* dat, int sz );		
 		char*		getShapeData( int b, int i=0 );
-		uxlong		getShapeDataUXLONG ( int b, int i )		{ return * (uxlong*)	getShapeData(b,i); }
-		ushort		getShapeDataUSHORT ( int b, int i )		{ return * (ushort*)	getShapeData(b,i); }
-		uchar		getShapeDataUCHAR (int b, int i)		{ return * (uchar*)		getShapeData(b,i); }
-		int			getShapeDataI (int b, int i)			{ return * (int*)		getShapeData(b,i); }
-		Vec3F	getShapeDataV3 (int b, int i)			{ return * (Vec3F*) getShapeData(b,i); }
-		Vec4F	getShapeDataV4 (int b, int i)			{ return * (Vec4F*)getShapeData(b, i); }
+		char*		readShapeData( int b, int i=0 );
+		uxlong		getShapeDataUXLONG ( int b, int i )		{ return * (uxlong*)	readShapeData(b,i); }
+		ushort		getShapeDataUSHORT ( int b, int i )		{ return * (ushort*)	readShapeData(b,i); }
+		uchar		getShapeDataUCHAR (int b, int i)		{ return * (uchar*)		readShapeData(b,i); }
+		int			getShapeDataI (int b, int i)			{ return * (int*)		readShapeData(b,i); }
+		Vec3F	getShapeDataV3 (int b, int i)			{ return * (Vec3F*) readShapeData(b,i); }
+		Vec4F	getShapeDataV4 (int b, int i)			{ return * (Vec4F*)readShapeData(b, i); }
 		
 		void		DeleteShape(int i);
 		void		CopyShape (Shape* s, Shapes* src, int i);
-		Shape*		getShape(int n); 		
+		Shape*		getShape(int n); 						// writable, SoA streams repacked from n
+		Shape*		readShape(int n);						// read only, SoA streams stay valid
 		int			getNumShapes();		
 
 		// Output particles
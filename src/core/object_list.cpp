@@ -46,6 +46,7 @@
 #include "character.h"
 #include "motioncycles.h"
 #include "muscles.h"
+#include "navigation.h"
 
 // rigid objects
 #include "transform.h"
@@ -162,6 +163,7 @@ void ObjectList::RegisterTypes ()
 	mTypeMap["MUSCLES"] = 'musl';
 	mTypeMap["MOTION"] = 'mcyc';
 	mTypeMap["CHARACTER"] = 'char';
+	mTypeMap["NAVIGATION"] = 'navg';
 	
 	// geography	
 	mTypeMap["TILEGRID"] = 'grid';
@@ -223,7 +225,8 @@ Object* ObjectList::AddObject ( objType otype, std::string name )
 	// characters
 	case 'char':	obj = new Character;	break;		
 	case 'musl':	obj = new Muscles;		break;	
-	case 'mcyc':	obj = new MotionCycles;	break;	
+	case 'mcyc':	obj = new MotionCycles;	break;
+	case 'navg':	obj = new Navigation;	break;	
 	
 
 	default:
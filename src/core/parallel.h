@@ -0,0 +1,145 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_PARALLEL
+	#define DEF_PARALLEL
+
+	#include <stdint.h>
+	#include <thread>
+	#include <atomic>
+	#include <vector>
+	#include <functional>
+	#include <algorithm>
+	#include <mutex>
+	#include <condition_variable>
+
+	// Parallel helpers
+	// - ParallelFor splits [0,cnt) into fixed chunks of 'grain' items. Chunk boundaries
+	//   depend only on cnt & grain, never on the number of threads, so any work keyed
+	//   by chunk (or by item) gives identical results for any thread count.
+	// - Chunks are claimed dynamically from an atomic counter (simple load balancing).
+	// - fn(start, end, chunk) is called once per chunk, possibly concurrently.
+	// - Threads come from a persistent pool. A call made while the pool is busy, or from
+	//   inside a pool thread, runs its chunks on the calling thread (same results).
+
+	inline int getNumThreads ()
+	{
+		unsigned int n = std::thread::hardware_concurrency();
+		return (n == 0) ? 1 : (int) n;
+	}
+
+	// Persistent worker pool
+	// - threads are created on first use and sleep between jobs, so per-object loops
+	//   (each character, each frame) don't pay for thread creation
+	// - one job at a time. the pool is never destroyed, threads end with the process
+	class WorkerPool {
+	public:
+		static WorkerPool& get ()		{ static WorkerPool* pool = new WorkerPool; return *pool; }
+		static bool& isWorker ()		{ static thread_local bool worker = false; return worker; }
+
+		// run job on num_workers pool threads and the calling thread, returns false if busy
+		bool Run ( int num_workers, const std::function<void()>& job )
+		{
+			if ( isWorker() ) return false;
+			bool idle = false;
+			if ( !m_Busy.compare_exchange_strong ( idle, true ) ) return false;		// busy, or nested from the caller's share
+			{
+				std::lock_guard<std::mutex> lk ( m_Mutex );
+				while ( m_Threads.size() < num_workers )
+					m_Threads.push_back ( std::thread ( &WorkerPool::Loop, this, (int) m_Threads.size(), m_Gen ) );
+				m_Job = &job;
+				m_Active = num_workers;
+				m_Pending = num_workers;
+				m_Gen++;
+			}
+			m_Wake.notify_all ();
+			job ();
+			std::unique_lock<std::mutex> lk ( m_Mutex );
+			m_Done.wait ( lk, [&]() { return m_Pending == 0; } );
+			m_Job = 0x0;
+			m_Busy = false;
+			return true;
+		}
+
+	private:
+		WorkerPool () : m_Busy(false), m_Job(0x0), m_Active(0), m_Pending(0), m_Gen(0) {}
+
+		void Loop ( int id, uint64_t seen )
+		{
+			isWorker() = true;
+			const std::function<void()>* job;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lk ( m_Mutex );
+					m_Wake.wait ( lk, [&]() { return m_Gen != seen; } );
+					seen = m_Gen;
+					if ( id >= m_Active ) continue;			// not needed for this job
+					job = m_Job;
+				}
+				(*job) ();
+				std::lock_guard<std::mutex> lk ( m_Mutex );
+				if ( --m_Pending == 0 ) m_Done.notify_one ();
+			}
+		}
+
+		std::atomic<bool>			m_Busy;			// set by the caller for a whole job
+		std::mutex					m_Mutex;
+		std::condition_variable		m_Wake, m_Done;
+		std::vector<std::thread>	m_Threads;
+		const std::function<void()>* m_Job;
+		int							m_Active, m_Pending;
+		uint64_t					m_Gen;			// job counter
+	};
+
+	inline void ParallelFor ( int cnt, int grain, const std::function<void(int, int, int)>& fn, int max_threads = 0 )
+	{
+		if ( cnt <= 0 ) return;
+		if ( grain < 1 ) grain = 1;
+		int num_chunks = (cnt + grain - 1) / grain;
+		int num_threads = (max_threads > 0) ? max_threads : getNumThreads();
+		if ( num_threads > num_chunks ) num_threads = num_chunks;
+
+		if ( num_threads <= 1 ) {
+			for (int c = 0; c < num_chunks; c++)					// serial, same chunking
+				fn ( c * grain, std::min(cnt, (c + 1) * grain), c );
+			return;
+		}
+		std::atomic<int> next ( 0 );
+		auto worker = [&]() {
+			int c;
+			while ( (c = next.fetch_add(1)) < num_chunks )
+				fn ( c * grain, std::min(cnt, (c + 1) * grain), c );
+		};
+		std::function<void()> job = worker;
+		if ( !WorkerPool::get().Run ( num_threads - 1, job ) )		// calling thread does work too
+			worker ();												// pool busy or nested, all chunks here
+	}
+
+	// Counter-based random numbers
+	// - Stateless: the value depends only on (seed, counter), so item n of a parallel
+	//   loop draws the same numbers regardless of which thread processes it.
+	// - splitmix64 finalizer.
+	inline uint64_t hashRand64 ( uint64_t seed, uint64_t ctr )
+	{
+		uint64_t z = seed * 0x9E3779B97F4A7C15ULL + ctr + 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+	inline float hashRandF ( uint64_t seed, uint64_t ctr )			// [0,1)
+	{
+		return float( hashRand64(seed, ctr) >> 40 ) * (1.0f / 16777216.0f);
+	}
+
+#endif
@@ -0,0 +1,45 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_QUAT_CONV
+	#define DEF_QUAT_CONV
+
+	// Quaternion conventions of the math library (libmin Quaternion, Irrlicht-derived)
+	// - a * b is the Hamilton product b a, so in p *= (a * b) the left operand turns p first
+	// - p *= q, q.getMatrix and fromAngleAxis rotate by q, right-hand rule
+	// - plain float paths (Crowd::EvaluateSoA, Deform::RunOps) are written for these.
+	//   Crowd::SelfTest and Deform::SelfTest check them against the library
+
+	// r = a * b, as the library computes it
+	inline void quatMulLib ( float ax, float ay, float az, float aw, float bx, float by, float bz, float bw,
+							 float& rx, float& ry, float& rz, float& rw )
+	{
+		rx = bw*ax + bx*aw + by*az - bz*ay;
+		ry = bw*ay + by*aw + bz*ax - bx*az;
+		rz = bw*az + bz*aw + bx*ay - by*ax;
+		rw = bw*aw - bx*ax - by*ay - bz*az;
+	}
+
+	// v rotated by q: v + w t + q x t, t = 2 q x v
+	inline void quatRotate ( float qx, float qy, float qz, float qw, const float* v, float* out )
+	{
+		float tx = 2.0f * (qy*v[2] - qz*v[1]);
+		float ty = 2.0f * (qz*v[0] - qx*v[2]);
+		float tz = 2.0f * (qx*v[1] - qy*v[0]);
+		out[0] = v[0] + qw*tx + (qy*tz - qz*ty);
+		out[1] = v[1] + qw*ty + (qz*tx - qx*tz);
+		out[2] = v[2] + qw*tz + (qx*ty - qy*tx);
+	}
+
+#endif
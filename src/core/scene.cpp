@@ -24,6 +24,8 @@
 
 
 #include "mesh.h"			// for mesh marking
+#include "crowd.h"			// for batched characters
+#include "scene_gen.h"		// for generated scenes
 
 Scene* gScene = 0x0;
 
@@ -35,6 +37,13 @@ Scene::Scene()
 	m_rand.seed(678);
 	
 	m_seed = 1;
+	m_Crowd = 0x0;
+}
+
+Scene::~Scene()
+{
+	if ( m_Crowd != 0x0 ) delete m_Crowd;
+	m_Crowd = 0x0;
 }
 
 bool Scene::Validate ()
@@ -254,30 +263,46 @@ void Scene::Execute (bool bRun, float time, float dt, bool dbg_eval )
 		}
 	}
 
+	// Neighbor grid of all characters, shared by every crowd batch of the frame
+	std::vector<Character*> chars;
+	for (int n = 0; n < mSceneList.size(); n++) {
+		obj = gAssets.getObj(mSceneList[n]);
+		if (obj != 0x0 && !obj->isAsset() && obj->getType() == 'char')
+			chars.push_back ( (Character*) obj );
+	}
+	if ( chars.size() > 0 ) {
+		if ( m_Crowd == 0x0 ) m_Crowd = new Crowd;
+		m_Crowd->BuildNeighbors ( chars );
+	}
+
 	// Execute
 	// run nodes until all are no longer dirty, or..
 	// the number of dirty nodes is not reducing further.
 	int num_dirtylast = -1;
 	int num_dirty =  1000000;
-	char msg[256];
 	while (num_dirty > 0 && num_dirty != num_dirtylast) {
 		num_dirtylast = num_dirty;
 		num_dirty = 0;
 		for (int n = 0; n < mSceneList.size(); n++) {
 			obj = gAssets.getObj(mSceneList[n]);
 			if (obj != 0x0 && !obj->isAsset() && obj->isDirty()) {
-				if (dbg_eval) {
-					sprintf ( msg, "Exec:%s", obj->getName().c_str() );
-					dbgprintf("    %s\n", msg );
-					PERF_PUSH ( msg );
-				}
-				obj->Run (time);
+				bool fed = isFedByCrowd ( obj );
 				num_dirty++;
-				if (dbg_eval) {
-					PERF_POP();
+				if ( obj->getType() == 'char' ) {
+					if ( fed ) RunCrowd ( time, dbg_eval );			// reads a pending node, finish the batch first
+					m_CrowdList.push_back ( (Character*) obj );		// all characters of the pass run together
+					BlockOnCrowd ( obj );
+					continue;
 				}
+				if ( fed ) {
+					m_CrowdDeferred.push_back ( obj );				// runs after the crowd batch
+					BlockOnCrowd ( obj );
+					continue;
+				}
+				RunNode ( obj, time, dbg_eval );
 			}
 		}
+		RunCrowd ( time, dbg_eval );
 	}
 	
 	// elapsed time
@@ -288,6 +313,61 @@ void Scene::Execute (bool bRun, float time, float dt, bool dbg_eval )
 		dbgprintf( "    %f msec\n", t);
 	}
 }
+
+void Scene::RunNode (Object* obj, float time, bool dbg_eval )
+{
+	char msg[256];
+	if (dbg_eval) {
+		sprintf ( msg, "Exec:%s", obj->getName().c_str() );
+		dbgprintf("    %s\n", msg );
+		PERF_PUSH ( msg );
+	}
+	obj->Run (time);
+	if (dbg_eval) {
+		PERF_POP();
+	}
+}
+
+// Nodes fed by a pending character wait for the crowd batch
+// - blocked: pending characters, deferred nodes, and their outputs
+bool Scene::isFedByCrowd ( Object* obj )
+{
+	if ( m_CrowdBlocked.size() == 0 ) return false;
+	for (int i = 0; i < obj->getNumInputs(); i++)
+		if ( m_CrowdBlocked.count ( obj->getInput(i) ) != 0 ) return true;
+	return false;
+}
+
+void Scene::BlockOnCrowd ( Object* obj )
+{
+	m_CrowdBlocked.insert ( obj->getID() );
+	Object* out = obj->getOutput();
+	if ( out != 0x0 ) m_CrowdBlocked.insert ( out->getID() );
+}
+
+// Run pending characters as one crowd batch
+// - all dirty characters of a pass, then the nodes deferred because they read one,
+//   in scene order
+void Scene::RunCrowd (float time, bool dbg_eval )
+{
+	if ( m_CrowdList.size() > 0 ) {
+		if ( m_Crowd == 0x0 ) m_Crowd = new Crowd;
+		if (dbg_eval) {
+			dbgprintf("    Exec:crowd (%d)\n", (int) m_CrowdList.size() );
+			PERF_PUSH ( "Exec:crowd" );
+		}
+		m_Crowd->Run ( m_CrowdList, time );
+		m_CrowdList.clear();
+		if (dbg_eval) {
+			PERF_POP();
+		}
+	}
+	for (int n = 0; n < m_CrowdDeferred.size(); n++)
+		RunNode ( m_CrowdDeferred[n], time, dbg_eval );
+	m_CrowdDeferred.clear();
+	m_CrowdBlocked.clear();
+}
+
 void Scene::SetVisible(std::string name, bool v)
 {
 	Object* obj = gAssets.getObj(name);
@@ -1043,6 +1123,26 @@ bool Scene::LoadScene ( std::string fname, int w, int h )
 }
 
 
+bool Scene::LoadGen ( SceneGen* gen, int w, int h )
+{
+	Object* obj = gAssets.FindOrLoadObject( "color_white" );
+	if (obj == 0x0) {
+		dbgprintf("**** ERROR: Default object color_white is required.\n" );
+		return false;
+	}
+	ShowAssets();
+
+	setRes(w, h);
+
+	gen->Build ( this );			// same objects as the generated scene file, without parsing it
+
+	if ( FindByType ( 'glbs' ) == 0x0) {
+		dbgprintf ( "ERROR: No globals.\n" );
+		exit(-5);
+	}
+	return true;
+}
+
 bool Scene::Load(std::string fname, int w, int h)
 {
   // Initialize Scene
@@ -20,22 +20,30 @@
 	#include "globals.h"
 	#include "mersenne.h"
 	#include <vector>
+	#include <set>
 
 	class Camera;
+	class Crowd;
+	class Character;
+	class SceneGen;
 	
 	class Scene : public Object {
 	public:
 		Scene();
+		~Scene();
 
 		virtual objType getType()	{ return 'scen'; }
 		virtual void Generate (int x, int y);		
 		virtual bool Validate ();
 
 		void	Execute (bool bRun, float time, float dt, bool dbg_eval );
+		void	RunCrowd (float time, bool dbg_eval );
+		void	RunNode (Object* obj, float time, bool dbg_eval );
 		
 		bool  Load  (std::string fname, int w, int h);
 		bool	LoadScene (std::string fname, int w, int h);
 		bool	LoadGLTF (std::string fname, int w, int h);
+		bool	LoadGen (SceneGen* gen, int w, int h);			// generated stress scene, in-memory
 		void	CreateSceneDefaults();
 		void	SaveScene ( std::string fname );		
 		void	CreateScene (int w, int h);		// test scene		
@@ -97,6 +105,14 @@
 		Globals*				mGlobals;
 		Mersenne				m_rand;
 		int						m_seed;
+
+		bool	isFedByCrowd ( Object* obj );
+		void	BlockOnCrowd ( Object* obj );
+
+		Crowd*					m_Crowd;			// batched character evaluation
+		std::vector<Character*>	m_CrowdList;		// pending characters of this pass
+		std::vector<Object*>	m_CrowdDeferred;	// nodes that read them, run after the batch
+		std::set<objID>			m_CrowdBlocked;
 	};
 
 	extern Scene* gScene;
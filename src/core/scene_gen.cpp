@@ -0,0 +1,320 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#include "scene_gen.h"
+#include "scene.h"
+#include "object_list.h"
+#include "string_helper.h"
+#include "main.h"				// for dbgprintf
+#include "selftest.h"
+
+#include <math.h>
+#include <algorithm>
+
+SceneGenParams::SceneGenParams()
+{
+	seed = 1;
+	instances = 100000;
+	objects = 1000;
+	meshes = 3;
+	materials = 100;
+	depth = 2;
+	fanout = 4;
+	particles = 0;
+	psys = 1;
+}
+
+SceneGen::SceneGen ()
+{
+	m_Extent = 100;
+}
+
+bool SceneGen::ParseSpec ( std::string spec )
+{
+	// spec is a list of key=value pairs, separated by commas
+	// e.g. "seed=7,inst=1000000,obj=10000,mesh=3,mtl=10000,depth=4,fanout=8,pnts=100000,psys=4"
+	std::string item, key, val;
+	SceneGenParams& p = m_Params;
+
+	while ( !spec.empty() ) {
+		item = strSplitLeft ( spec, "," );
+		if ( !strSplitLeft ( item, "=", key, val ) ) {
+			dbgprintf ( "ERROR: SceneGen spec not in form key=value. %s\n", item.c_str() );
+			return false;
+		}
+		key = strTrim(key);
+		val = strTrim(val);
+		if		( key.compare("seed")==0 )		p.seed = strToI(val);
+		else if ( key.compare("inst")==0 )		p.instances = strToI(val);
+		else if ( key.compare("obj")==0 )		p.objects = strToI(val);
+		else if ( key.compare("mesh")==0 )		p.meshes = strToI(val);
+		else if ( key.compare("mtl")==0 )		p.materials = strToI(val);
+		else if ( key.compare("depth")==0 )		p.depth = strToI(val);
+		else if ( key.compare("fanout")==0 )	p.fanout = strToI(val);
+		else if ( key.compare("pnts")==0 )		p.particles = strToI(val);
+		else if ( key.compare("psys")==0 )		p.psys = strToI(val);
+		else {
+			dbgprintf ( "ERROR: SceneGen unknown key '%s'\n", key.c_str() );
+			return false;
+		}
+	}
+	return true;
+}
+
+GenObj& SceneGen::AddObj ( std::string type, std::string name )
+{
+	GenObj g;
+	g.type = type;
+	g.name = name;
+	g.visible = true;
+	g.xform = false;
+	g.pos.Set(0,0,0);
+	g.scale.Set(1,1,1);
+	m_Objs.push_back ( g );
+	return m_Objs[ m_Objs.size()-1 ];
+}
+
+std::string SceneGen::Vec3Str ( Vec3F v )
+{
+	char buf[128];
+	snprintf ( buf, 128, "<%.4f,%.4f,%.4f>", v.x, v.y, v.z );
+	return buf;
+}
+
+// draws are sequenced explicitly so the result does not depend on argument evaluation order
+Vec3F SceneGen::RandomVec ( Vec3F vmin, Vec3F vmax )
+{
+	Vec3F v;
+	v.x = m_rand.randF( vmin.x, vmax.x );
+	v.y = m_rand.randF( vmin.y, vmax.y );
+	v.z = m_rand.randF( vmin.z, vmax.z );
+	return v;
+}
+
+std::string SceneGen::RandomMtl ()
+{
+	return "Mtl" + iToStr( m_rand.randI( m_Params.materials ) );
+}
+
+void SceneGen::Generate ()
+{
+	SceneGenParams& p = m_Params;
+	char name[256];
+
+	m_Objs.clear ();
+	m_rand.seed ( p.seed );							// all random draws below are in fixed order
+
+	if ( m_MeshKeys.size()==0 ) {
+		AddMeshKey ( "model_cube" );
+		AddMeshKey ( "model_sphere" );
+		AddMeshKey ( "model_square" );
+	}
+	int num_mesh = std::min( std::max(p.meshes, 1), (int) m_MeshKeys.size() );
+	if ( p.meshes > num_mesh )
+		dbgprintf ( "WARNING: SceneGen has %d mesh assets, requested %d distinct meshes.\n", num_mesh, p.meshes );
+	if ( p.materials < 1 ) p.materials = 1;
+	if ( p.objects > p.instances ) p.objects = p.instances;
+
+	// layout extent grows with instance count, ~1 unit spacing per object
+	m_Extent = 10.0f + sqrt( (float) std::max(p.instances, 1) ) * 0.5f;
+
+	//--- globals, camera, lights
+	GenObj* g = &AddObj ( "GLOBALS", "Globals" );
+	g->params.push_back ( "fps, 30" );
+	g->params.push_back ( "rate, 1.0" );
+	g->params.push_back ( "frames, <0, 100, 10>" );
+	g->params.push_back ( "envclr, <1,1,1,1>" );
+	g->params.push_back ( "backclr, <.1, .1, .15, 0>" );
+	g->params.push_back ( "record, 0" );
+	g->inputs.push_back ( std::make_pair("envmap", "env_sky") );
+
+	g = &AddObj ( "CAMERA", "Camera" );
+	g->params.push_back ( "fov, 40" );
+	g->params.push_back ( "nearfar, <.1," + fToStr(m_Extent*20.f) + ",0>" );
+	g->params.push_back ( "from, " + Vec3Str( Vec3F(m_Extent, m_Extent*0.8f, m_Extent*1.2f) ) );
+	g->params.push_back ( "to, <0, 0, 0>" );
+
+	g = &AddObj ( "LIGHTS", "Lightset" );
+	g->params.push_back ( "light, <300, 600, -200>, <0,0,0>, <0.01,0.01,0.01>, <1.7,1.7,1.7>, <0,0,0>" );
+
+	//--- materials (distinct material keys)
+	for (int n=0; n < p.materials; n++) {
+		g = &AddObj ( "MATERIAL", "Mtl" + iToStr(n) );
+		g->inputs.push_back ( std::make_pair("texture", "color_white") );
+		g->inputs.push_back ( std::make_pair("shader", "shade_mesh") );
+		g->params.push_back ( "diff_color, " + Vec3Str( RandomVec( Vec3F(0.1f,0.1f,0.1f), Vec3F(0.9f,0.9f,0.9f) ) ) );
+		g->params.push_back ( "spec_color, <0.2, 0.2, 0.2>" );
+		g->params.push_back ( "env_color, <0.3, 0.3, 0.3>" );
+	}
+
+	//--- ground
+	g = &AddObj ( "MESH", "Ground" );
+	g->inputs.push_back ( std::make_pair("mesh", "model_square") );
+	g->inputs.push_back ( std::make_pair("material", "Mtl0") );
+	g->xform = true;
+	g->pos.Set ( 0, 0, 0 );
+	g->scale.Set ( m_Extent*2.f, 1, m_Extent*2.f );
+
+	//--- individual mesh objects (exercise asset lookup & scheduler)
+	for (int n=0; n < p.objects; n++) {
+		g = &AddObj ( "MESH", "Obj" + iToStr(n) );
+		g->inputs.push_back ( std::make_pair("mesh", m_MeshKeys[ m_rand.randI(num_mesh) ] ) );
+		g->inputs.push_back ( std::make_pair("material", RandomMtl() ) );
+		g->xform = true;
+		g->pos = RandomVec( Vec3F(-m_Extent, 0.5f, -m_Extent), Vec3F(m_Extent, 0.5f, m_Extent) );
+		float s = m_rand.randF(0.2f, 1.0f);
+		g->scale.Set ( s, s, s );
+	}
+
+	//--- behavior chains: target -> scatter -> deform x depth
+	int scattered = p.instances - p.objects;
+	if ( p.fanout > 0 && scattered > 0 ) {
+		for (int c=0; c < p.fanout; c++) {
+			int count = scattered / p.fanout + ((c < scattered % p.fanout) ? 1 : 0);
+			std::string tgt = "Target" + iToStr(c);
+			std::string prev;
+
+			g = &AddObj ( "MESH", tgt );
+			g->inputs.push_back ( std::make_pair("mesh", "model_sphere") );
+			g->inputs.push_back ( std::make_pair("material", RandomMtl() ) );
+			g->xform = true;
+			g->pos = RandomVec( Vec3F(-m_Extent*0.8f, m_Extent*0.1f, -m_Extent*0.8f), Vec3F(m_Extent*0.8f, m_Extent*0.1f, m_Extent*0.8f) );
+			g->scale = Vec3F(1,1,1) * (m_Extent * 0.1f);
+
+			prev = "Scatter" + iToStr(c);
+			g = &AddObj ( "SCATTER", prev );
+			g->inputs.push_back ( std::make_pair("source", m_MeshKeys[ m_rand.randI(num_mesh) ] ) );
+			g->inputs.push_back ( std::make_pair("target", tgt ) );
+			g->inputs.push_back ( std::make_pair("material", RandomMtl() ) );
+			g->params.push_back ( "count, " + iToStr(count) );
+			g->params.push_back ( "size, <0.2,0.2,0.2>" );
+			g->visible = (p.depth == 0);						// only the end of each chain is rendered
+
+			for (int d=0; d < p.depth; d++) {
+				snprintf ( name, 256, "Deform%d_%d", c, d );
+				g = &AddObj ( "DEFORM", name );
+				g->inputs.push_back ( std::make_pair("shapes", prev ) );
+				g->params.push_back ( "bend_amt, " + Vec3Str( RandomVec( Vec3F(-0.1f,0,-0.1f), Vec3F(0.1f,0,0.1f) ) ) );
+				g->params.push_back ( "twist_max, " + Vec3Str( RandomVec( Vec3F(-0.1f,0,-0.1f), Vec3F(0.1f,0,0.1f) ) ) );
+				g->visible = (d == p.depth-1);
+				prev = name;
+			}
+		}
+	}
+
+	//--- particle systems
+	if ( p.particles > 0 && p.psys > 0 ) {
+		for (int n=0; n < p.psys; n++) {
+			int count = p.particles / p.psys + ((n < p.particles % p.psys) ? 1 : 0);
+			Vec3F vmin = RandomVec( Vec3F(-m_Extent, 10.f, -m_Extent), Vec3F(m_Extent, 10.f, m_Extent) );
+			g = &AddObj ( "POINTSYS", "Particles" + iToStr(n) );
+			g->params.push_back ( "max_particles, " + iToStr(count) );
+			g->params.push_back ( "vol_min, " + Vec3Str(vmin) );
+			g->params.push_back ( "vol_max, " + Vec3Str(vmin + Vec3F(10,10,10)) );
+			g->xform = true;
+		}
+	}
+
+	dbgprintf ( "SceneGen: seed %d, %d objects, %d inst, %d mtls, %d chains x %d deep, %d particles\n",
+		p.seed, (int) m_Objs.size(), p.instances, p.materials, p.fanout, p.depth, p.particles );
+}
+
+bool SceneGen::Save ( std::string fname )
+{
+	FILE* fp = fopen ( fname.c_str(), "wt" );
+	if ( fp == 0x0 ) {
+		dbgprintf ( "ERROR: Unable to write scene %s\n", fname.c_str() );
+		return false;
+	}
+	SceneGenParams& p = m_Params;
+	fprintf ( fp, "# Generated stress scene: seed=%d,inst=%d,obj=%d,mesh=%d,mtl=%d,depth=%d,fanout=%d,pnts=%d,psys=%d\n\n",
+		p.seed, p.instances, p.objects, p.meshes, p.materials, p.depth, p.fanout, p.particles, p.psys );
+
+	for (int n=0; n < m_Objs.size(); n++) {
+		GenObj& g = m_Objs[n];
+		fprintf ( fp, "[%s] %s\n", g.type.c_str(), g.name.c_str() );
+		if ( !g.visible ) fprintf ( fp, "  visible: false\n" );
+		for (int i=0; i < g.inputs.size(); i++)
+			fprintf ( fp, "  input: %s = %s\n", g.inputs[i].first.c_str(), g.inputs[i].second.c_str() );
+		for (int i=0; i < g.params.size(); i++)
+			fprintf ( fp, "  param: %s\n", g.params[i].c_str() );
+		if ( g.xform )
+			fprintf ( fp, "  xform: %s, %s\n", Vec3Str(g.pos).c_str(), Vec3Str(g.scale).c_str() );
+		fprintf ( fp, "\n" );
+	}
+	fclose ( fp );
+
+	dbgprintf ( "SceneGen: Saved %s\n", fname.c_str() );
+	return true;
+}
+
+void SceneGen::Build ( Scene* scene )
+{
+	Object* obj;
+	objType ot;
+	vecStrs args;
+
+	// same sequence of commands as Scene::LoadScene
+	for (int n=0; n < m_Objs.size(); n++) {
+		GenObj& g = m_Objs[n];
+		ot = gAssets.getObjTypeFromName ( g.type );
+		if ( ot == 'null' ) {
+			dbgprintf ( "WARNING: SceneGen object type not found, %s\n", g.type.c_str() );
+			continue;
+		}
+		obj = scene->CreateObject ( ot, g.name );
+		obj->SetVisible ( g.visible );
+		for (int i=0; i < g.inputs.size(); i++)
+			obj->SetInput ( g.inputs[i].first, g.inputs[i].second );
+		for (int i=0; i < g.params.size(); i++)
+			obj->FindOrCreateParams ( g.params[i], ';' );
+		if ( g.xform )
+			obj->SetTransform ( g.pos, g.scale );
+
+		args.clear();
+		obj->RunCommand ( "finish", args );
+	}
+}
+
+bool SceneGen::isSame ( SceneGen& b )
+{
+	if ( m_Objs.size() != b.m_Objs.size() ) return false;
+	for (int n=0; n < m_Objs.size(); n++) {
+		GenObj& x = m_Objs[n];
+		GenObj& y = b.m_Objs[n];
+		if ( x.type != y.type || x.name != y.name || x.visible != y.visible || x.xform != y.xform ) return false;
+		if ( x.inputs != y.inputs || x.params != y.params ) return false;
+		if ( x.xform && (x.pos.x != y.pos.x || x.pos.y != y.pos.y || x.pos.z != y.pos.z ||
+						 x.scale.x != y.scale.x || x.scale.y != y.scale.y || x.scale.z != y.scale.z) ) return false;
+	}
+	return true;
+}
+
+// Same spec gives the same scene, another seed a different one
+int SceneGen::SelfTest ()
+{
+	int bad = 0;
+	SceneGen a, b, c;
+	std::string spec = "seed=7,inst=5000,obj=50,mtl=20,depth=2,fanout=3,pnts=1000";
+	a.ParseSpec ( spec );	a.Generate ();
+	b.ParseSpec ( spec );	b.Generate ();
+	c.ParseSpec ( "seed=8,inst=5000,obj=50,mtl=20,depth=2,fanout=3,pnts=1000" );	c.Generate ();
+
+	bad += selfCheck ( a.getNumObj() > 0, "scene_gen", "no objects generated" );
+	bad += selfCheck ( a.isSame ( b ), "scene_gen", "same seed gave a different scene" );
+	bad += selfCheck ( !a.isSame ( c ), "scene_gen", "different seed gave the same scene" );
+	a.Generate ();
+	bad += selfCheck ( a.isSame ( b ), "scene_gen", "regenerate is not repeatable" );
+	return selfReport ( "scene_gen", bad );
+}
@@ -0,0 +1,84 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_SCENE_GEN
+	#define DEF_SCENE_GEN
+
+	#include "vec.h"
+	#include "mersenne.h"
+	#include <string>
+	#include <vector>
+
+	class Scene;
+
+	// Synthetic stress-scene generator
+	// - Produces large, reproducible scenes for scaling tests of the
+	//   state sort, the scheduler and asset lookup.
+	// - Same seed & params always produce the same scene.
+	// - Output as a scene file (LoadScene format) or built in-memory.
+	//
+	struct SceneGenParams {
+		SceneGenParams();
+		int		seed;
+		int		instances;			// total mesh instances (objects + scattered)
+		int		objects;			// number of instances that are individual MESH objects
+		int		meshes;				// distinct mesh keys
+		int		materials;			// distinct material keys
+		int		depth;				// behavior chain depth (deformers after each scatter)
+		int		fanout;				// number of parallel behavior chains
+		int		particles;			// total particles
+		int		psys;				// number of particle systems
+	};
+
+	struct GenObj {
+		std::string		type, name;
+		std::vector< std::pair<std::string, std::string> >	inputs;
+		std::vector< std::string >	params;						// "name, value" as in scene files
+		bool			visible;
+		bool			xform;
+		Vec3F			pos, scale;
+	};
+
+	class SceneGen {
+	public:
+		SceneGen();
+
+		void	SetParams ( SceneGenParams& p )		{ m_Params = p; }
+		bool	ParseSpec ( std::string spec );					// "seed=1,inst=1000000,mtl=10000,depth=4,fanout=8"
+		void	AddMeshKey ( std::string name )		{ m_MeshKeys.push_back ( name ); }
+
+		void	Generate ();									// build object records from params
+		bool	Save ( std::string fname );						// write scene file
+		void	Build ( Scene* scene );							// create objects in scene
+
+		int		getNumObj ()						{ return (int) m_Objs.size(); }
+		bool	isSame ( SceneGen& b );							// same object records
+
+		static int SelfTest ();
+		SceneGenParams& getParams()					{ return m_Params; }
+
+	private:
+		GenObj&	AddObj ( std::string type, std::string name );
+		std::string	Vec3Str ( Vec3F v );
+		std::string	RandomMtl ();
+		Vec3F	RandomVec ( Vec3F vmin, Vec3F vmax );
+
+		SceneGenParams				m_Params;
+		std::vector<std::string>	m_MeshKeys;		// mesh assets available for instancing
+		std::vector<GenObj>			m_Objs;
+		Mersenne					m_rand;
+		float						m_Extent;		// half-width of generated layout
+	};
+
+#endif
@@ -0,0 +1,37 @@
+//-------------------------
+// Copyright 2020-2025 (c) Quanta Sciences, Rama Hoetzlein
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//     http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//--------------------------
+
+#ifndef DEF_SELFTEST
+	#define DEF_SELFTEST
+
+	#include "main.h"			// for dbgprintf
+
+	// Self tests
+	// - behaviors provide static SelfTest() checks against a brute force or
+	//   round-trip reference, run with: shapes -selftest
+	// - each returns the number of failed checks
+
+	inline int selfCheck ( bool ok, const char* test, const char* what )
+	{
+		if ( !ok ) dbgprintf ( "  FAILED %s: %s\n", test, what );
+		return ok ? 0 : 1;
+	}
+
+	inline int selfReport ( const char* test, int bad )
+	{
+		dbgprintf ( "Selftest: %-20s %s\n", test, (bad == 0) ? "ok" : "FAILED" );
+		return bad;
+	}
+
+#endif
@@ -27,6 +27,7 @@
 		Mesh () : MeshX() { 
 			AddParam(0,"tex","i"); 
 			SetTexture(-1); 
+			mDirtyTopo = false;
 		}
 			
 		virtual objType getType()							{ return 'Amsh'; }		
@@ -36,7 +37,19 @@
 		virtual bool Load(std::string fname)	{ return MeshX::Load(fname); }
 
 		void SetTexture(int id)  { SetParamI(0, 0, id); }
-	
+
+		// Partial updates
+		// - vertex ranges changed since the last upload, topology unchanged. the renderer
+		//   may upload only these. use MarkDirtyTopology when anything else changed
+		void MarkDirtyVerts ( int first, int cnt )	{ mDirtyVerts.push_back ( std::pair<int,int>(first, cnt) ); MarkDirty(); }
+		void MarkDirtyTopology ()					{ mDirtyVerts.clear(); mDirtyTopo = true; MarkDirty(); }
+		void ClearDirtyVerts ()						{ mDirtyVerts.clear(); mDirtyTopo = false; }
+		bool hasDirtyVerts ()						{ return !mDirtyTopo && mDirtyVerts.size() > 0; }
+		std::vector< std::pair<int,int> >& getDirtyVerts ()	{ return mDirtyVerts; }
+
+	private:
+		std::vector< std::pair<int,int> >	mDirtyVerts;		// first, count
+		bool					mDirtyTopo;
 	};
 
 
@@ -13,10 +13,17 @@
 //--------------------------
 
 #include "shapes.h"
+#include "parallel.h"
+#include "content_hash.h"
+#include "selftest.h"
+#include <algorithm>
 
 Shapes::Shapes()
 {
 	AddBuffer ( BSHAPE, "shape", sizeof(Shape), 1 );
+	mChannels.push_back ( BSHAPE );
+	mLayout = SHAPES_AOS;
+	mPacked = 0;
 }
 
 /*void Shapes::AddPhysics()
@@ -30,39 +37,94 @@ Shapes::Shapes()
 void Shapes::Clear ()
 {
 	EmptyAllBuffers();
+	mPacked = 0;
 }
 
 void Shapes::CopyFrom (Shapes* src)
 {
 	src->CopyBuffer ( 0, 0, this, DT_CPU );
+	mPacked = 0;
 }
 void Shapes::AddFrom (int buf, Shapes* srclist, int lod, int max_lod )
 {
 	Shape* src = srclist->getShape(0);					// start of source list
-	int i;
+	int first, cnt = 0, num = srclist->getNumShapes();
 
-	for (int n=0; n  < srclist->getNumShapes(); n++) {	
-		if ( (max_lod - src->lod) <= (max_lod - lod)) {		 // accept if shape lod <= target lod
-			i = AddElem(buf);
-			memcpy ( getShape(i), src, sizeof(Shape) );				
-		}
-		src++;
+	for (int n=0; n < num; n++)
+		if ( (max_lod - src[n].lod) <= (max_lod - lod) ) cnt++;		 // accept if shape lod <= target lod
+
+	Shape* dest = AddSpan ( cnt, first );				// all channels grow with the shapes
+	if ( dest == 0x0 ) return;
+	for (int n=0; n < num; n++, src++) {
+		if ( (max_lod - src->lod) <= (max_lod - lod) )
+			memcpy ( dest++, src, sizeof(Shape) );
 	}
 }
 
 
 Shape* Shapes::AddShapeByCopy ( Shape* s )
 {
-	int i = AddElem( 0 );
-	Shape* dest = getShape(i);
+	int i;
+	Shape* dest = AddSpan ( 1, i );
 	memcpy ( dest, s, sizeof(Shape) );
 	return dest;
 }
 
+// Extra per-shape channel
+// - allocated to the current shape capacity, so spans on it match BSHAPE
+void Shapes::AddChannel (int b, std::string name, int stride)
+{
+	for (int c=0; c < mChannels.size(); c++)
+		if ( mChannels[c] == b ) return;
+
+	AddBuffer ( b, name, stride, std::max( GetMaxElem(BSHAPE), 1) );
+	mChannels.push_back ( b );
+	SetNum ( getNumShapes() );
+}
+
+// Reserve capacity for cnt more shapes on all channels
+void Shapes::Reserve (int cnt)
+{
+	int num = getNumShapes();
+	int need = num + cnt;
+	if ( need <= GetMaxElem(BSHAPE) ) return;
+
+	for (int c=0; c < mChannels.size(); c++)
+		ResizeBuffer ( mChannels[c], need, true );			// safe, keeps first num
+	SetNum ( num );
+}
+
+// Append cnt shapes, returns first new shape
+// - capacity grows geometrically, so repeated spans amortize
+Shape* Shapes::AddSpan (int cnt, int& first)
+{
+	first = getNumShapes();
+	if ( cnt <= 0 ) return 0x0;
+	InvalidateStreams ( first );
+	if ( first + cnt > GetMaxElem(BSHAPE) )
+		Reserve ( std::max( cnt, GetMaxElem(BSHAPE) ) );
+	SetNum ( first + cnt );
+	return getShape ( first );
+}
+
+uint64_t Shapes::getTopologyKey ()
+{
+	int num = getNumShapes();
+	uint64_t h = hashValue ( 0, num );
+	int bufs[4] = { BLEV, BCHILD, BNEXT, BVARI };
+	for (int b = 0; b < 4; b++) {
+		if ( isActive(bufs[b]) && GetNumElem(bufs[b]) >= num )
+			h = hashBytes ( h, GetStart(bufs[b]), size_t(num) * GetBufStride(bufs[b]) );
+	}
+	uint64_t t = 0;
+	for (int i = 0; i < num; i++)
+		t = t * 0x100000001B3ULL + (uint8_t) getShape(i)->type;
+	return hashValue ( h, t );
+}
+
 Shape* Shapes::Add (int& i)
 {
-	i = AddElem ();
-	return getShape(i)->Clear();
+	return AddSpan ( 1, i )->Clear();
 }
 
 void Shapes::Delete(int i)
@@ -71,3 +133,165 @@ void Shapes::Delete(int i)
 }
 
 
+
+// Shape layout
+void Shapes::SetLayout (int l)
+{
+	mLayout = l;
+	if ( mLayout == SHAPES_SOA ) {
+		AddChannel ( BS_XFORM,	"xform",	sizeof(ShapeXform) );
+		AddChannel ( BS_KEY,	"key",		sizeof(ShapeKey) );
+		AddChannel ( BS_CLR,	"clr",		sizeof(uint) );
+		AddChannel ( BS_FLAGS,	"flags",	sizeof(ShapeFlags) );
+	}
+	mPacked = 0;
+}
+
+// Split shape records into streams, from first to end
+// - starts no later than the first unpacked shape, so all shapes are packed on return
+void Shapes::PackStreams (int first)
+{
+	if ( mLayout != SHAPES_SOA ) return;
+	first = std::max ( std::min ( first, mPacked ), 0 );
+
+	ParallelFor ( getNumShapes() - first, 16384, [&](int start, int end, int chunk) {
+		Shape* s = getShape ( first + start );
+		ShapeXform* x = getXformS ( first + start );
+		ShapeKey* k = getKeyS ( first + start );
+		uint* c = getClrS ( first + start );
+		ShapeFlags* f = getFlagsS ( first + start );
+		for (int i = start; i < end; i++) {
+			x->pos = s->pos;	x->rot = s->rot;	x->scale = s->scale;	x->pivot = s->pivot;
+			k->mesh = (int) s->meshids.x;		k->shader = (int) s->meshids.y;
+			k->face_start = (int) s->meshids.z;	k->face_cnt = (int) s->meshids.w;
+			k->matids = s->matids;
+			*c = s->clr;
+			f->type = s->type;	f->invisible = s->invisible;	f->lod = s->lod;	f->pad = 0;
+			s++; x++; k++; c++; f++;
+		}
+	});
+	mPacked = getNumShapes();
+}
+
+// Write streams back to shape records
+void Shapes::UnpackStreams ()
+{
+	if ( mLayout != SHAPES_SOA ) return;
+
+	ParallelFor ( mPacked, 16384, [&](int start, int end, int chunk) {
+		for (int i = start; i < end; i++) {
+			Shape* s = getShape(i);
+			ShapeXform* x = getXformS(i);
+			ShapeKey* k = getKeyS(i);
+			ShapeFlags* f = getFlagsS(i);
+			s->pos = x->pos;	s->rot = x->rot;	s->scale = x->scale;	s->pivot = x->pivot;
+			s->meshids.Set ( k->mesh, k->shader, k->face_start, k->face_cnt );
+			s->matids = k->matids;
+			s->clr = *getClrS(i);
+			s->type = f->type;	s->invisible = f->invisible;	s->lod = f->lod;
+		}
+	});
+}
+
+// Shapes [a,b) whose streams differ from their records
+static int CompareStreams ( Shapes& sh, int a, int b )
+{
+	int diff = 0;
+	for (int i = a; i < b; i++) {
+		Shape* s = sh.getShape(i);
+		ShapeXform* x = sh.getXformS(i);
+		ShapeKey* k = sh.getKeyS(i);
+		ShapeFlags* f = sh.getFlagsS(i);
+		bool ok = x->pos.x == s->pos.x && x->pos.y == s->pos.y && x->pos.z == s->pos.z && x->scale.x == s->scale.x
+			&& k->mesh == (int) s->meshids.x && k->shader == (int) s->meshids.y && k->face_start == (int) s->meshids.z && k->face_cnt == (int) s->meshids.w
+			&& *sh.getClrS(i) == s->clr && f->type == s->type && f->invisible == s->invisible && f->lod == s->lod;
+		if ( !ok ) diff++;
+	}
+	return diff;
+}
+
+// Extra channels stay sized with the shapes through Add, AddShapeByCopy, AddSpan & AddFrom,
+// spans are contiguous, and growth keeps earlier shapes & channel data.
+// SoA streams match the records after PackStreams, repack from the first invalid shape, unpack back
+int Shapes::SelfTest ()
+{
+	int bad = 0;
+	Shapes sh, src;
+	int first, i, num = 0, unsized = 0, lost = 0, gaps = 0;
+	sh.AddChannel ( BVEL, "vel", sizeof(Vec3F) );
+	Shape ref;
+	ref.pos.Set ( 1, 2, 3 );
+	Shape* s = src.AddSpan ( 5, first );
+	for (int n=0; n < 5; n++) s[n].Clear ();
+
+	for (int r=0; r < 40; r++) {
+		switch ( r % 4 ) {
+		case 0:	s = sh.Add ( i );				first = i;	break;
+		case 1:	s = sh.AddShapeByCopy ( &ref );	first = num;	break;
+		case 2:	s = sh.AddSpan ( r * 3, first );			break;
+		case 3:	sh.AddFrom ( 0, &src );	s = sh.getShape ( num );	first = num;	break;
+		}
+		if ( first != num || s != sh.getShape(num) ) gaps++;
+		for (int n = num; n < sh.getNumShapes(); n++) {			// tag new shapes
+			sh.getShape(n)->clr = n;
+			((Vec3F*) sh.getElem(BVEL, n))->Set ( float(n), 0, 0 );
+		}
+		num = sh.getNumShapes();
+		if ( sh.GetNumElem(BVEL) != num ) unsized++;
+		for (int n=0; n < num; n++)
+			if ( sh.getShape(n)->clr != n || ((Vec3F*) sh.getElem(BVEL, n))->x != float(n) ) { lost++; break; }
+	}
+	bad += selfCheck ( num == 10 + 10 + 600 + 10*5, "shapes", "shape count" );		// Add, AddShapeByCopy, spans of 3r, AddFrom
+	bad += selfCheck ( gaps == 0, "shapes", "new shapes not contiguous" );
+	bad += selfCheck ( unsized == 0, "shapes", "extra channel not sized with shapes" );
+	bad += selfCheck ( lost == 0, "shapes", "growth lost shapes or channel data" );
+
+	// late channel, reserve & commit
+	sh.AddChannel ( BVARI, "vari", sizeof(Vec3I) );
+	bad += selfCheck ( sh.GetNumElem(BVARI) == num, "shapes", "late channel not sized with shapes" );
+	sh.Reserve ( 1000 );
+	bad += selfCheck ( sh.getNumShapes() == num && sh.GetMaxElem(BVEL) >= num + 1000 && sh.GetMaxElem(BVARI) >= num + 1000, "shapes", "reserve" );
+	sh.Commit ( num - 5 );
+	bad += selfCheck ( sh.getNumShapes() == num - 5 && sh.GetNumElem(BVEL) == num - 5, "shapes", "commit" );
+
+	// SoA streams follow the records from the first unpacked shape on
+	Shapes so;
+	so.SetLayout ( SHAPES_SOA );
+	for (int r=0; r < 2; r++) {
+		s = so.AddSpan ( 100, first );
+		for (int n=0; n < 100; n++) {
+			s[n].Clear ();
+			s[n].pos.Set ( float(first+n), 1, 2 );
+			s[n].scale.Set ( 1 + n % 3, 1, 1 );
+			s[n].meshids.Set ( n % 3, 1, first+n, 4 );
+			s[n].clr = (first+n) * 7;
+			s[n].type = n % 5;	s[n].invisible = n % 2;	s[n].lod = n % 4;
+		}
+		bad += selfCheck ( !so.isSoA(), "shapes", "streams valid over added shapes" );
+		so.PackStreams ( first );
+	}
+	bad += selfCheck ( so.isSoA() && CompareStreams ( so, 0, 200 ) == 0, "shapes", "packed streams differ from records" );
+
+	so.getShape(5)->clr = 999;							// record written without invalidating
+	so.PackStreams ( 50 );
+	bad += selfCheck ( *so.getClrS(5) != 999, "shapes", "repacked a shape before first" );
+	so.InvalidateStreams ( 5 );
+	bad += selfCheck ( !so.isSoA(), "shapes", "streams valid after invalidate" );
+	so.PackStreams ( 50 );								// starts at the first unpacked shape
+	bad += selfCheck ( so.isSoA() && CompareStreams ( so, 0, 200 ) == 0, "shapes", "repack skipped an invalidated shape" );
+
+	so.getXformS(7)->pos.Set ( -1, -2, -3 );
+	*so.getClrS(8) = 42;
+	so.getFlagsS(9)->lod = 3;
+	so.UnpackStreams ();
+	bad += selfCheck ( so.getShape(7)->pos.y == -2 && so.getShape(8)->clr == 42 && so.getShape(9)->lod == 3 && CompareStreams ( so, 0, 200 ) == 0, "shapes", "unpack" );
+	so.Commit ( 150 );
+	bad += selfCheck ( so.isSoA() && so.GetNumElem(BS_XFORM) == 150, "shapes", "commit streams" );
+
+	Shapes aos;
+	aos.AddSpan ( 10, first );
+	aos.PackStreams ();
+	bad += selfCheck ( !aos.isSoA() && !aos.isActive(BS_XFORM), "shapes", "streams on AoS layout" );
+
+	return selfReport ( "shapes", bad );
+}
@@ -19,7 +19,8 @@
 	#include "vec.h"
 	#include "quaternion.h"
 	#include "datax.h"
-	#include "object.h"		
+	#include "object.h"
+	#include <vector>		
 
 	// SHAPES
 	// Shapes are the definitive structure for the SHAPES rendering engine
@@ -45,6 +46,14 @@
 	#define BSIDE		8	
 	#define BGROW		9
 
+	#define BS_XFORM	12			// structure-of-arrays streams (SHAPES_SOA layout)
+	#define BS_KEY		13
+	#define BS_CLR		14
+	#define BS_FLAGS	15
+
+	#define SHAPES_AOS	0			// layouts
+	#define SHAPES_SOA	1
+
 	// Shape primary struct:
 	struct Shape {	
 	public:				
@@ -77,6 +86,42 @@
 		uchar		lod;				// lod
 	};
 
+	// Shape streams (SHAPES_SOA layout)
+	// - hot/cold split of the Shape record. Transform, material key, color and flags are
+	//   separate streams, so sort & cull touch only the bytes they need.
+	// - integer ids, rather than the float-encoded meshids of Shape.
+	// - Shape records remain authoritative for writers, see Shapes::PackStreams
+	struct ShapeXform {
+		Vec3F		pos;
+		Quaternion	rot;
+		Vec3F		scale;
+		Vec3F		pivot;
+	};
+	struct ShapeKey {
+		int			mesh, shader;		// asset ids
+		int			face_start, face_cnt;
+		Vec8S		matids;				// material
+	};
+	struct ShapeFlags {
+		char		type;
+		char		invisible;
+		uchar		lod;
+		uchar		pad;
+	};
+
+	// Shape render instance
+	// - only the fields read by renderers, packed into the state-sorted buffer and uploaded.
+	//   excludes picking ids, meshids & flags (sort state only).
+	struct ShapeInst {
+		Vec3F		pos;
+		Quaternion	rot;
+		Vec3F		scale;
+		Vec3F		pivot;
+		uint		clr;
+		Vec8S		matids;
+		Vec4F		texsub;
+	};
+
 	class Shapes : public DataX, public Object {
 	public:
 		Shapes();
@@ -89,16 +134,54 @@
 		Shape*		Add (int& i);				// new shape
 		Shape*		AddShapeByCopy (Shape* s);	// copy from another shape
 		void		Delete(int i);
+
+		// Bulk emission
+		// - Reserve grows all channels once, AddSpan commits cnt new shapes and returns them as a
+		//   contiguous range to fill (not cleared). Commit sets the final count (<= reserved).
+		// - Extra per-shape channels (BVEL, BMUSCLE, ..) are sized with the shapes, see getSpan.
+		void		AddChannel (int b, std::string name, int stride);
+		void		Reserve (int cnt);
+		Shape*		AddSpan (int cnt, int& first);
+		void		Commit (int num)			{ SetNum ( num ); InvalidateStreams ( num ); }
+		char*		getSpan (int b, int first)	{ return (char*) GetElem (b, first); }
+		Shape*		getSpan (int first)			{ return (Shape*) GetElem (BSHAPE, first); }
+
+		// Layout
+		// - SHAPES_SOA adds the hot/cold streams. PackStreams splits shape records into streams,
+		//   writers call it after filling. UnpackStreams writes streams back to records.
+		// - streams are valid for shapes [0, mPacked). Adding shapes or writing records through
+		//   Object::getShape invalidates from that shape on, until the next PackStreams. Object::readShape does not.
+		void		SetLayout (int l);
+		int			getLayout ()				{ return mLayout; }
+		bool		isSoA ()					{ return mLayout == SHAPES_SOA && mPacked == getNumShapes(); }
+		void		PackStreams (int first = 0);
+		void		UnpackStreams ();
+		void		InvalidateStreams (int first = 0)	{ if ( first < mPacked ) mPacked = first; }
+		ShapeXform*	getXformS (int i)			{ return (ShapeXform*) GetElem (BS_XFORM, i); }
+		ShapeKey*	getKeyS (int i)				{ return (ShapeKey*) GetElem (BS_KEY, i); }
+		uint*		getClrS (int i)				{ return (uint*) GetElem (BS_CLR, i); }
+		ShapeFlags*	getFlagsS (int i)			{ return (ShapeFlags*) GetElem (BS_FLAGS, i); }
+		// Topology key
+		// - hash of shape count, types, hierarchy & variant channels (BLEV, BCHILD, BNEXT, BVARI). unchanged when
+		//   shapes only move, so consumers can cache structure derived from the hierarchy
+		uint64_t	getTopologyKey ();
+
 		int			getNumShapes()				{ return GetNumElem(0); }		
 		int			getSize()					{ return GetBufSize(0); }
 		char*		getData(int b)				{ return (char*) GetStart( b ); }
 		char*		getElem (int b, int i)		{ return (char*) GetElem (b,i ); }
 		Shape*		getShape (int i)			{ return (Shape*) GetElem (BSHAPE, i); }		
+		static int	SelfTest ();
+
 		void		SetData (int buf, int i, char* src, int sz ) { 
 						char* dest = GetElem(buf, i);
 						assert ( sz == GetBufStride(buf) );			// should not need sz
 						memcpy ( dest, src, GetBufStride(buf) );
 					}
+	private:
+		std::vector<int>	mChannels;			// active channels, including BSHAPE
+		int					mLayout;
+		int					mPacked;			// shapes packed into streams
 	};
 
 #endif
\ No newline at end of file
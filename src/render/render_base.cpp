@@ -18,6 +18,10 @@
 #include "render.h"
 #include "scene.h"
 #include "material.h"
+#include "parallel.h"
+#include "selftest.h"
+
+#include <assert.h>
 
 void RenderBase::SetStateDebug ( int grp, int& x, int& y, uint64_t key )
 {
@@ -52,7 +56,7 @@ void RenderBase::InitializeStateSort ()
 	mSGMax = 512;	
 	mSG = (ShapeGroup*) malloc ( mSGMax * sizeof(ShapeGroup));
 
-	mSB.AddBuffer ( BSHAPES,	"shps",		sizeof(Shape), 512 );
+	mSB.AddBuffer ( BSHAPES,	"shps",		sizeof(ShapeInst), 512 );		// render instances (hot fields only)
 	mSB.AddBuffer ( BXFORMS,	"xforms",	16*sizeof(float), 512);
 	mSB.AddBuffer ( BBINS,		"bins",		sizeof(int), 512 );
 	mSB.AddBuffer ( BOFFSETS,	"offs",		sizeof(int), 512 );
@@ -229,44 +233,69 @@ void RenderBase::ResolveMaterial ( Vec8S* matids, int& shader )
 void RenderBase::InsertShapes ( Shapes* shapes, int& x, int& y )
 {
 	if (shapes==0x0 ) return;
+	mGroupCnt++;
 
 	uint64_t key;
 	Shape* s;
 	int shader = NULL_NDX;
 	int* bins, *offs;										// traversal order bins & offsets
 	int max = ExpandShapeBuffers( shapes->getNumShapes(), bins, offs );		// expand dynamically as needed
+
+	// SoA shapes read only key & flag streams
+	bool soa = shapes->isSoA();
+	ShapeKey* k;
+	ShapeFlags* f;
+	Vec8S* matids;
+	Vec4F meshids;
+	int mesh, type;
 	
 	for (int i = 0; i < shapes->getNumShapes(); i++) {
-		s = shapes->getShape(i);		
-		if ( s->isInvisible() || s->meshids.x==MESH_MARK) continue;
-		if (s->meshids.x < 0 || s->meshids.x >= MESH_NULL) {
-			dbgprintf("ERROR: Mesh id invalid. %d\n", s->meshids.x);
-			s->invisible = 1; continue;
+		if ( soa ) {
+			k = shapes->getKeyS(i);
+			f = shapes->getFlagsS(i);
+			if ( f->invisible || k->mesh==MESH_MARK) continue;
+			mesh = k->mesh;
+			type = f->type;
+			matids = &k->matids;
+			meshids.Set ( k->mesh, k->shader, k->face_start, k->face_cnt );
+		} else {
+			s = shapes->getShape(i);		
+			if ( s->isInvisible() || s->meshids.x==MESH_MARK) continue;
+			mesh = (int) s->meshids.x;
+			type = s->type;
+			matids = &s->matids;
+			meshids = s->meshids;
+		}
+		if (mesh < 0 || mesh >= MESH_NULL) {
+			dbgprintf("ERROR: Mesh id invalid. %d\n", mesh);
+			shapes->getShape(i)->invisible = 1; 
+			if ( soa ) f->invisible = 1;
+			continue;
 		}
 
-		if ( s->type == S_SHAPEGRP) {
+		if ( type == S_SHAPEGRP) {
 			// Shape group
-			InsertShapes ( (Shapes*) gAssets.getObj ( s->meshids.x ), x, y );
+			InsertShapes ( (Shapes*) gAssets.getObj ( mesh ), x, y );
 			continue;
 		}
 
 		// Resolve textures
 		// *NOTE* This happens in RenderBase because renderers get only the final SHAPE buffers 
 		// which are not stateful. The original shapes must be resolved to cache material id.		
-		ResolveMaterial( &s->matids, shader );
+		ResolveMaterial( matids, shader );
 
 		// State sorting		
-		key = getShapeKey (s->matids.x, shader, s->meshids.x, 0 );		// get key (group)
+		key = getShapeKey (matids->x, shader, mesh, 0 );		// get key (group)
 		
 		//-- debug instance groups (keys)
-		// dbgprintf ( "%d: k:%012lld, %d %d %d\n", i, key, (int) s->matids.x, shader, (int) s->meshids.x );
+		// dbgprintf ( "%d: k:%012lld, %d %d %d\n", i, key, (int) matids->x, shader, mesh );
 
 		// Insert shape into BST tree
 		if ( !FindNode ( key, mNode ) ) {		
 			
-			std::string name = gAssets.getObj ( s->meshids.x )->getName();
+			std::string name = gAssets.getObj ( mesh )->getName();
 
-			mNode = InsertNode ( key, s->meshids, shader, name, mNode );
+			mNode = InsertNode ( key, meshids, shader, name, mNode );
 		}		
 		// Assign shape a bin & index
 		if ( mID > max ) {
@@ -309,14 +338,62 @@ void RenderBase::SortShapes ( Shapes* shapes, Matrix4F& shapes_xform )
 	if (shapes==0x0 ) return;
 
 	int bin, ndx;
-	Shape *src, *dest;
-	Shape* out_shapebuf = (Shape*) mSB.GetStart ( BSHAPES );		// curret node for new insertions
+	Shape *src;
+	ShapeInst *dest;
+	ShapeInst* out_shapebuf = (ShapeInst*) mSB.GetStart ( BSHAPES );	// curret node for new insertions
 	Matrix4F* out_xforms = (Matrix4F*) mSB.GetStart ( BXFORMS );
 	int* bins = (int*) mSB.GetStart (BBINS);						// traversal order bins
 	int* offs = (int*) mSB.GetStart (BOFFSETS);						// traversal order offsets
 	Matrix4F* xform;
+	Matrix4F m;
+
+	// TRS mode. record parent xform once per shape group, no per-instance matrix
+	bool trs = isEnabled( OPT_TRS_XFORM );
+	int parent = (int) mParents.size();
+	if ( trs ) {
+		assert ( parent < TRS_MAX_PARENTS );			// checked per frame in InsertAndSortShapes
+		mParents.push_back ( shapes_xform );
+	}
+
+	// SoA shapes read transform, key & color streams. only texsub from the record.
+	bool soa = shapes->isSoA();
+	ShapeXform* xf;
+	ShapeKey* k;
 
 	for (int x = 0; x < shapes->getNumShapes(); x++) {
+		if ( soa ) {
+			ShapeFlags* f = shapes->getFlagsS(x);
+			k = shapes->getKeyS(x);
+			if (f->invisible || k->mesh == MESH_MARK) continue;
+			if (f->type == S_SHAPEGRP) {
+				Object* obj = (Shapes*) gAssets.getObj ( k->mesh ) ;
+				SortShapes( obj->getOutputShapes(), obj->getXform() );
+				continue;
+			}
+			xf = shapes->getXformS(x);
+			mChkSum = mChkSum + (uint64_t(k->mesh) + uint64_t(xf->pos.x*xf->pos.y*xf->pos.z) + uint64_t(xf->scale.x * 100.0));
+
+			// pack render instance from streams
+			bin = bins[mID];
+			ndx = offs[mID];
+			dest = out_shapebuf + (mSG[bin].offset + ndx);
+			memcpy ( dest, xf, sizeof(ShapeXform) );				// pos, rot, scale, pivot
+			dest->clr = *shapes->getClrS(x);
+			dest->matids = k->matids;
+			dest->texsub = shapes->getShape(x)->texsub;
+
+			if ( trs ) {
+				dest->matids.Set ( 7, parent );						// parent index (w2)
+			} else {
+				m.TRST ( xf->pos, xf->rot, xf->scale, xf->pivot );
+				xform = out_xforms + (mSG[bin].offset + ndx);
+				xform->Multiply (shapes_xform, m );					// shape transform * object transform
+			}
+
+			mID++;
+			continue;
+		}
+
 		src = shapes->getShape(x);
 		if (src->isInvisible() || src->meshids.x == MESH_MARK) continue;
 		if (src->type == S_SHAPEGRP) {
@@ -327,11 +404,23 @@ void RenderBase::SortShapes ( Shapes* shapes, Matrix4F& shapes_xform )
 		}
 		mChkSum = mChkSum + (uint64_t(src->meshids.x) + uint64_t(src->pos.x*src->pos.y*src->pos.z) + uint64_t(src->scale.x * 100.0));
 	
-		// deep copy shape into shape buffer
+		// pack render instance into shape buffer
 		bin = bins[mID];
 		ndx = offs[mID];
 		dest = out_shapebuf + (mSG[bin].offset + ndx);
-		memcpy ( dest, src, sizeof(Shape) );
+		dest->pos = src->pos;
+		dest->rot = src->rot;
+		dest->scale = src->scale;
+		dest->pivot = src->pivot;
+		dest->clr = src->clr;
+		dest->matids = src->matids;
+		dest->texsub = src->texsub;
+
+		if ( trs ) {
+			dest->matids.Set ( 7, parent );							// parent index (w2)
+			mID++;
+			continue;
+		}
 
 		// construct shape transform with object xform
 		// Matrix4F& xf = src->getXform();
@@ -358,6 +447,7 @@ void RenderBase::InsertAndSortShapes ()
 	int maxadd = 0;
 	ResetNodes ();		// clear BST	
 	mShapeCnt = 0;
+	mGroupCnt = 0;
 	mID = 0; 
 
 	// traverse scene graph	
@@ -375,9 +465,16 @@ void RenderBase::InsertAndSortShapes ()
 
 	// Step 3. Sort shapes into bins
 	PERF_PUSH("  Sort");
+	// parent index is 16-bit, more groups fall back to per-instance matrices
+	if ( isEnabled( OPT_TRS_XFORM ) && mGroupCnt > TRS_MAX_PARENTS ) {
+		dbgprintf ( "WARNING: %d shape groups exceed TRS parent limit %d. TRS mode disabled.\n", mGroupCnt, TRS_MAX_PARENTS );
+		SetOption ( OPT_TRS_XFORM, false );
+	}
+	bool trs = isEnabled( OPT_TRS_XFORM );
 	mSB.ResizeBuffer(BSHAPES, mShapeCnt );		// resize the shape buffer (destructively)
-	mSB.ResizeBuffer(BXFORMS, mShapeCnt );
+	if ( !trs ) mSB.ResizeBuffer(BXFORMS, mShapeCnt );
 	mSB.SetNum(mShapeCnt);
+	mParents.clear ();
 	mChkSumL = mChkSum;
 	mChkSum = 0;
 	mID = 0;
@@ -385,9 +482,154 @@ void RenderBase::InsertAndSortShapes ()
 		obj = scn->getSceneObj(n);				
 		SortShapes ( obj->getOutputShapes(), obj->getXform() );
 	}
+	if ( trs ) mChkSum += mParents.size();
+
+	// bytes per frame sent to renderer
+	mUploadBytes = uint64_t(mShapeCnt) * sizeof(ShapeInst);
+	mUploadBytes += trs ? mParents.size() * sizeof(Matrix4F) : uint64_t(mShapeCnt) * sizeof(Matrix4F);
 	PERF_POP();
 
 }
 
 
-		
\ No newline at end of file
+		
+
+// Benchmark state sort & pack
+// - CPU cost of insert, scan and sort for num synthetic instances over a number of mesh keys,
+//   with per-instance matrices and in TRS mode. Reports time and upload bytes per instance.
+// - runs on a scratch sorter, so the state of live renderers is untouched
+//
+void RenderBase::BenchmarkSortPack ( int num, int keys )
+{
+	RenderBase* rb = new RenderBase;
+	rb->InitializeStateSort ();
+	rb->RunBenchmarkSortPack ( num, keys );
+	free ( rb->mSG );
+	delete rb;
+}
+
+void RenderBase::RunBenchmarkSortPack ( int num, int keys )
+{
+	// mesh keys from loaded assets
+	std::vector<int> meshes;
+	for (int n = 0; n < gAssets.getNumObj() && meshes.size() < keys; n++) {
+		Object* obj = gAssets.getObj(n);
+		if ( obj != 0x0 && obj->getType() == 'Amsh' ) meshes.push_back ( n );
+	}
+	if ( meshes.size() == 0 ) {
+		dbgprintf ( "Benchmark: no meshes loaded.\n" );
+		return;
+	}
+
+	// synthetic instances
+	Shapes shapes;
+	int first;
+	Shape* s = shapes.AddSpan ( num, first );
+	for (int n = 0; n < num; n++, s++) {
+		s->Clear ();
+		s->type = S_MESH;
+		s->meshids.Set ( meshes[ (n / 64) % meshes.size() ], 0, 0, 0 );		// coherent runs of keys
+		s->pos.Set ( float(n % 1000), 0, float(n / 1000) );
+		s->scale.Set ( 1, 1, 1 );
+	}
+	Matrix4F xform;
+	xform.Identity ();
+
+	TimeX t1, t2;
+	for (int mode = 0; mode < 2; mode++) {
+		SetOption ( OPT_TRS_XFORM, mode );
+
+		t1.SetTimeNSec ();
+		int x = 0, y = 0;
+		ResetNodes ();
+		mShapeCnt = 0;
+		mGroupCnt = 0;
+		mID = 0;
+		InsertShapes ( &shapes, x, y );
+		mShapeCnt = PrefixScanShapes ();
+		mSB.ResizeBuffer ( BSHAPES, mShapeCnt );
+		if ( mode == 0 ) mSB.ResizeBuffer ( BXFORMS, mShapeCnt );
+		mSB.SetNum ( mShapeCnt );
+		mParents.clear ();
+		mID = 0;
+		SortShapes ( &shapes, xform );
+		t2.SetTimeNSec ();
+
+		uint64_t bytes = uint64_t(mShapeCnt) * sizeof(ShapeInst) + ((mode == 0) ? uint64_t(mShapeCnt) : mParents.size()) * sizeof(Matrix4F);
+		dbgprintf ( "Benchmark: %s, %d instances, %d keys, sort+pack %6.2f ms, upload %4.1f bytes/inst\n",
+			(mode == 0) ? "matrix" : "TRS   ", mShapeCnt, mSGCnt, t2.GetElapsedMSec(t1), double(bytes) / std::max(mShapeCnt, 1) );
+	}
+}
+
+// CPU port of getInstXform in shaders/inst_xform.glsl (trsMode 1)
+// - column-major, as uploaded: parent is 4 texels of parentXforms, one per column
+static void TRSInstXform ( ShapeInst* inst, float* parent, float* out )
+{
+	float x = inst->rot.X, y = inst->rot.Y, z = inst->rot.Z, w = inst->rot.W;
+	float m[9] = {	1 - 2*(y*y + z*z),	2*(x*y + z*w),		2*(x*z - y*w),
+					2*(x*y - z*w),		1 - 2*(x*x + z*z),	2*(y*z + x*w),
+					2*(x*z + y*w),		2*(y*z - x*w),		1 - 2*(x*x + y*y) };
+	float s[3] = { inst->scale.x, inst->scale.y, inst->scale.z };
+	float p[3] = { inst->pivot.x, inst->pivot.y, inst->pivot.z };
+	float t[3] = { inst->pos.x, inst->pos.y, inst->pos.z };
+	float trs[16];
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) trs[c*4 + r] = m[c*3 + r] * s[c];
+		trs[c*4 + 3] = 0;
+	}
+	for (int r = 0; r < 3; r++)
+		trs[12 + r] = trs[r] * p[0] + trs[4 + r] * p[1] + trs[8 + r] * p[2] + t[r];
+	trs[15] = 1;
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			out[c*4 + r] = parent[r] * trs[c*4] + parent[4 + r] * trs[c*4 + 1] + parent[8 + r] * trs[c*4 + 2] + parent[12 + r] * trs[c*4 + 3];
+}
+
+// Instance xform composed in the shader (TRS mode) equals the per-instance matrix of SortShapes,
+// parent index survives the 16-bit matid
+int RenderBase::SelfTest ()
+{
+	int bad = 0;
+	Shape s, ps;
+	ShapeInst inst;
+	Matrix4F parent, ref;
+	float out[16], err, maxerr = 0;
+	for (int n = 0; n < 200; n++) {
+		s.Clear ();
+		s.pos.Set ( hashRandF(33, n*16) * 20 - 10, hashRandF(33, n*16+1) * 20 - 10, hashRandF(33, n*16+2) * 20 - 10 );
+		s.rot.fromAngleAxis ( hashRandF(33, n*16+3) * 6.0f, Vec3F( hashRandF(33, n*16+4) - 0.5f, hashRandF(33, n*16+5) - 0.5f, hashRandF(33, n*16+6) - 0.5f ).Normalize() );
+		s.scale.Set ( 0.2f + hashRandF(33, n*16+7) * 3, 0.2f + hashRandF(33, n*16+8) * 3, 0.2f + hashRandF(33, n*16+9) * 3 );
+		s.pivot.Set ( hashRandF(33, n*16+10) - 0.5f, hashRandF(33, n*16+11) - 0.5f, hashRandF(33, n*16+12) - 0.5f );
+		ps.Clear ();
+		ps.pos.Set ( 5, -3, 2 );
+		ps.rot.fromAngleAxis ( hashRandF(33, n*16+13) * 6.0f, Vec3F( 0.3f, 1, -0.2f ).Normalize() );
+		ps.scale.Set ( 2, 0.5f, 1.5f );
+		parent = ps.getXform ();
+
+		// matrix mode, as in SortShapes
+		ref.Multiply ( parent, s.getXform() );
+
+		// TRS mode, render instance packed as in SortShapes
+		inst.pos = s.pos;	inst.rot = s.rot;	inst.scale = s.scale;	inst.pivot = s.pivot;
+		TRSInstXform ( &inst, parent.GetDataF(), out );
+		float* r = ref.GetDataF();
+		for (int i = 0; i < 16; i++) {
+			err = fabs( out[i] - r[i] ) / (1.0f + fabs(r[i]));
+			maxerr = std::max( maxerr, err );
+		}
+	}
+	bad += selfCheck ( maxerr < 1e-4f, "trs_xform", "shader TRS xform differs from instance matrix" );
+
+	// parent index in matids w2, up to the limit
+	Vec8S mat;
+	mat.Set ( NULL_NDX );
+	int wrong = 0;
+	int idx[3] = { 0, 1234, TRS_MAX_PARENTS - 1 };
+	for (int i = 0; i < 3; i++) {
+		mat.Set ( 7, idx[i] );
+		if ( mat.get(7) != idx[i] || mat.get(0) != NULL_NDX ) wrong++;
+	}
+	bad += selfCheck ( wrong == 0 && TRS_MAX_PARENTS < NULL_NDX, "trs_xform", "parent index does not fit the matid" );
+
+	return selfReport ( "trs_xform", bad );
+}
@@ -33,7 +33,10 @@
 	#define OPT_SKETCH_PICK		5
 	#define OPT_ENABLE			6
 	#define OPT_RECORD			7
-	#define OPT_MAX				8
+	#define OPT_TRS_XFORM		8		// instance transforms composed in shader from TRS + group parent (no BXFORMS)
+	#define OPT_MAX				9
+
+	#define TRS_MAX_PARENTS		65530		// parent index is a 16-bit matid (w2), below NULL_NDX
 
 	// State buffers
 	#define BSHAPES				0		// sorted shapes
@@ -65,7 +68,7 @@
 
 	class RenderBase {
 	public:
-		RenderBase () { mRenderMgr = 0x0; for (int n=0; n < OPT_MAX; n++) mbOpt[n]=false;  mOutTex=-1; }
+		RenderBase () { mRenderMgr = 0x0; for (int n=0; n < OPT_MAX; n++) mbOpt[n]=false;  mOutTex=-1; mUploadBytes=0; }
 		
 		virtual void Initialize ()		{};
 		virtual void PrepareAssets ()	 {};
@@ -102,6 +105,10 @@
 		int		PrefixScanShapes();
 		void	SortShapes(Shapes* shapes, Matrix4F& shapes_xform );
 		void	InsertAndSortShapes ();
+		uint64_t getUploadBytes ()		{ return mUploadBytes; }
+		static void BenchmarkSortPack ( int num, int keys );		// on a scratch sorter
+		void	RunBenchmarkSortPack ( int num, int keys );
+		static int SelfTest ();									// TRS shader xform matches per-instance matrices
 
 		bool	getMaterialObj ( Vec8S* matids, ::Material*& obj );
 
@@ -121,9 +128,12 @@
 		DataX					mSB;						// State-Sorted shape buffers
 		ShapeGroup*				mSG;						// Binary Search Tree on ShapeGroups
 		int						mShapeCnt;
+		int						mGroupCnt;					// shape groups inserted, parents in TRS mode
 		int						mSGRoot, mNode, mID;
 		int						mSGCnt, mSGMax;			
 		uint64_t				mChkSum, mChkSumL;			// Frame-to-frame change check
+		uint64_t				mUploadBytes;				// sorted instance data, bytes
+		std::vector<Matrix4F>	mParents;					// shape group parent xforms (OPT_TRS_XFORM)
 
 
 		// Debugging State
@@ -14,6 +14,7 @@
 //--------------------------
 
 #include "string_helper.h"
+#include <algorithm>
 
 #include <GL/glew.h>
 #ifdef _WIN32
@@ -58,14 +59,14 @@ int RenderGL::geomTex =		3;
 
 // mapping shapes to shader instances
 
-Shape IP;								// instance buffer offset (set to match Shape struct in object.h)
+ShapeInst IP;							// instance buffer offset (set to match ShapeInst struct in shapes.h)
 int RenderGL::IPOS		= (char*)&IP.pos -		 (char*) &IP;
 int RenderGL::IROTATE	= (char*)&IP.rot -		 (char*)&IP;
 int RenderGL::ISCALE	= (char*)&IP.scale -	 (char*)&IP;
 int RenderGL::IPIVOT	= (char*)&IP.pivot -	 (char*)&IP;
 
 int RenderGL::ICLR		= (char*)&IP.clr -		 (char*)&IP;
-int RenderGL::IDS		= (char*)&IP.ids -		 (char*)&IP;
+int RenderGL::IDS		= 0;									// picking ids not in render instances
 int RenderGL::IMATIDS	= (char*)&IP.matids.x2 - (char*)&IP;	// GL material IDs are x2,y2,z2,w2 of the Vec8S
 int RenderGL::ITEXSUB	= (char*)&IP.texsub -	 (char*)&IP;
 
@@ -159,6 +160,8 @@ void RenderGL::Initialize ()
 	// Create global shape instances
 	glGenBuffers(1, &mShapesVBO);					
 	glGenBuffers(1, &mShapesXformVBO);
+	glGenBuffers(1, &mParentsTBO);
+	glGenTextures(1, &mParentsTex);
 
 	// Load internal shaders
 	mSHPick = LoadInternalShader ( "shade_pick.frag.glsl" );
@@ -435,6 +438,15 @@ void RenderGL::TransmitShapesGL ()
 	glBindBuffer ( GL_ARRAY_BUFFER, mShapesVBO );
 	glBufferData ( GL_ARRAY_BUFFER, mSB.GetBufSize(BSHAPES), mSB.GetBufData(BSHAPES), GL_DYNAMIC_DRAW );
 
+	if ( isEnabled(OPT_TRS_XFORM) ) {
+		// parent xforms only, one per shape group
+		glBindBuffer ( GL_TEXTURE_BUFFER, mParentsTBO );
+		glBufferData ( GL_TEXTURE_BUFFER, std::max(mParents.size(), (size_t) 1) * sizeof(Matrix4F), mParents.size() ? &mParents[0] : 0x0, GL_DYNAMIC_DRAW );
+		glBindTexture ( GL_TEXTURE_BUFFER, mParentsTex );
+		glTexBuffer ( GL_TEXTURE_BUFFER, GL_RGBA32F, mParentsTBO );
+		glBindBuffer ( GL_TEXTURE_BUFFER, 0 );
+		return;
+	}
 	glBindBuffer ( GL_ARRAY_BUFFER, mShapesXformVBO);
 	glBufferData ( GL_ARRAY_BUFFER, mSB.GetBufSize(BXFORMS), mSB.GetBufData(BXFORMS), GL_DYNAMIC_DRAW );
 }
@@ -443,24 +455,35 @@ void RenderGL::BindShapesGL ()
 {
 	int indx = 0;		// all instances
 	glBindBuffer ( GL_ARRAY_BUFFER, mShapesVBO );
-	glVertexAttribPointer ( instPos, 3, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(IPOS + indx) );
+	glVertexAttribPointer ( instPos, 3, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(IPOS + indx) );
 	glVertexAttribDivisor ( instPos, 1 );
-	glVertexAttribPointer ( instRotate, 4, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(IROTATE + indx));
+	glVertexAttribPointer ( instRotate, 4, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(IROTATE + indx));
 	glVertexAttribDivisor ( instRotate, 1);
-	glVertexAttribPointer ( instScale, 3, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(ISCALE + indx));
+	glVertexAttribPointer ( instScale, 3, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(ISCALE + indx));
 	glVertexAttribDivisor ( instScale, 1);
-	glVertexAttribPointer ( instPivot, 3, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(IPIVOT + indx));
+	glVertexAttribPointer ( instPivot, 3, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(IPIVOT + indx));
 	glVertexAttribDivisor ( instPivot, 1);	
-	glVertexAttribPointer ( instClr, 1, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(ICLR + indx) );			// **NOTE**: GL_UNSIGNED_INT does not work
+	glVertexAttribPointer ( instClr, 1, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(ICLR + indx) );			// **NOTE**: GL_UNSIGNED_INT does not work
 	glVertexAttribDivisor ( instClr, 1 );
-	//glVertexAttribPointer ( instIDS, 4, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(IDS + indx) );
+	//glVertexAttribPointer ( instIDS, 4, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(IDS + indx) );
 	//glVertexAttribDivisor ( instIDS, 1 );
-	glVertexAttribPointer ( instMatIDS, 4, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Shape), PTR_OFFSET(IMATIDS + indx) );
+	glVertexAttribPointer ( instMatIDS, 4, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(IMATIDS + indx) );
 	glVertexAttribDivisor ( instMatIDS, 1 );	
-	glVertexAttribPointer ( instTexSub, 4, GL_FLOAT, GL_FALSE, sizeof(Shape), PTR_OFFSET(ITEXSUB + indx) );
+	glVertexAttribPointer ( instTexSub, 4, GL_FLOAT, GL_FALSE, sizeof(ShapeInst), PTR_OFFSET(ITEXSUB + indx) );
 	glVertexAttribDivisor ( instTexSub, 1 );
 	CHECK_GL ( "Bind shapes gl", mbDebug );
 
+	if ( isEnabled(OPT_TRS_XFORM) ) {
+		// no per-instance matrix stream
+		for (int i = 0; i < 4; i++) glDisableVertexAttribArray ( instXform + i );
+		glActiveTexture ( GL_TEXTURE2 );									// parent xforms on texture unit #2
+		glBindTexture ( GL_TEXTURE_BUFFER, mParentsTex );
+		glActiveTexture ( GL_TEXTURE0 );
+		CHECK_GL ( "Bind instances (trs)", mbDebug);
+		return;
+	}
+	for (int i = 0; i < 4; i++) glEnableVertexAttribArray ( instXform + i );
+
 	glBindBuffer(GL_ARRAY_BUFFER, mShapesXformVBO);
 	glVertexAttribPointer ( instXform + 0, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 16, (GLvoid*) 00 );
 	glVertexAttribDivisor ( instXform + 0, 1);
@@ -480,6 +503,7 @@ void RenderGL::RenderByGroup (bool shadow)
 	if (shadow) {
 		RShader* rshade = getInternalShader ( mSHMeshDepth );
 		glUseProgram ( rshade->programID );						// run depth pass
+		BindShaderXformVars ( rshade );
 		CSMShadowLightAsCamera( rshade );			// send light matrices for model/view/proj	
 		CHECK_GL("CSM::ShadowLightAsCamera", mbDebug);	
 	}	
@@ -504,6 +528,7 @@ void RenderGL::RenderByGroup (bool shadow)
 			// Bind Shader globals
 			BindShaderGlobals ( rshade );
 			BindShaderShadowMapVars ( rshade );
+			BindShaderXformVars ( rshade );
 			mShader = shader;
 			CHECK_GL("Bind global", mbDebug);
 		}
@@ -1021,6 +1046,7 @@ void RenderGL::RenderPicking ( int w, int h, int tex )
 	//BindAttribArrays ( 4, 1 );
 
 	/*OverrideShader ( mSHPick );												// enable the picking shader
+	BindShaderXformVars ( getInternalShader ( mSHPick ) );					// same instance transform mode as beauty pass
 
 	RenderByGroup ();				// *** ASSUMES ALREADY STATE-SORTED DURING PRIMARY RENDER *
 	
@@ -1406,6 +1432,12 @@ void RenderGL::BindShaderShadowMapVars ( RShader* rshade )
 	id = getParam(rshade, P_SSIZE);	if (id != P_NULL) glProgramUniform2f	(rshade->programID, id, (float)csm_depth_size, 1.0f / (float) csm_depth_size);	// shadow texture size 
 }
 
+// Instance transform mode
+void RenderGL::BindShaderXformVars ( RShader* rshade )
+{
+	int id = getParam(rshade, P_TRSMODE);	if (id != P_NULL) glProgramUniform1i (rshade->programID, id, isEnabled(OPT_TRS_XFORM) ? 1 : 0 );
+	id = getParam(rshade, P_PARENTS);		if (id != P_NULL) glProgramUniform1i (rshade->programID, id, 2);		// parent xforms texture unit (#2)
+}
 
 bool RenderGL::BindUniformBuffers ()
 {
@@ -1745,6 +1777,41 @@ char* RenderGL::ReadShaderSource ( std::string fname, long& fileSz )
 }
 
 
+// Handle shader #include (glsl does not)
+// - each #include "file" line is replaced by the file, found with getFileLocation. not nested
+// - takes and returns a malloc'd source
+char* RenderGL::IncludeShaderSource ( char* source )
+{
+	std::string src = source;
+	std::string inclfile, inclpath;
+	char* inclSource;
+	long fsz;
+	size_t posR;
+	size_t posL = src.find("#include");
+	if ( posL == std::string::npos ) return source;
+
+	while ( posL != std::string::npos ) {
+		posR = src.find("\n", posL);
+		if ( posR == std::string::npos ) posR = src.length();
+		inclfile = strParseOutDelim ( src.substr(posL, posR - posL), "\"", "\"" );
+		inclSource = 0x0;
+		if ( getFileLocation ( inclfile, inclpath ) ) inclSource = ReadShaderSource ( inclpath, fsz );
+		if ( inclSource == 0x0 ) {
+			dbgprintf ( "  OpenGL. ERROR: Unable to read include '%s'\n", inclfile.c_str() );
+			src.erase ( posL, posR - posL );
+			posL = src.find ( "#include", posL );
+			continue;
+		}
+		src.replace ( posL, posR - posL, inclSource );
+		free ( inclSource );
+		posL = src.find ( "#include", posL + fsz );
+	}
+	free ( source );
+	char* buf = (char*) malloc ( src.length() + 1 );
+	memcpy ( buf, src.c_str(), src.length() + 1 );
+	return buf;
+}
+
 bool RenderGL::AddParam ( int shader_id, int param_id, char* name )
 {
 	int prog = mShaders[shader_id].programID;
@@ -1847,6 +1914,8 @@ bool RenderGL::CreateShader ( Object* obj, std::string& msg)
 	AddParam(rid, P_SMTX,		  "shadowMtx");
 	AddParam(rid, P_STEX,		  "shadowTex");
 	AddParam(rid, P_SSIZE,		"shadowSize");
+	AddParam(rid, P_TRSMODE,	"trsMode");
+	AddParam(rid, P_PARENTS,	"parentXforms");
 
 	AddParamBlock(rid, P_TEXTURES,	"TEXTURE_BLOCK");
 	AddParamBlock(rid, P_MATERIALS, "MATERIAL_BLOCK");
@@ -1895,6 +1964,7 @@ bool RenderGL::LoadShader (std::string filename, GLuint& program )
 	// Read vertex program	
 	char *vertSource = ReadShaderSource(vertpath.c_str(), fsz);
 	if (!vertSource) { dbgprintf ("  OpenGL. ERROR: Unable to read source '%s'\n", vertfile.c_str());  return false; }
+	vertSource = IncludeShaderSource ( vertSource );
 	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(vShader, 1, (const GLchar**)&vertSource, NULL);
 	glCompileShader(vShader);
@@ -1917,34 +1987,7 @@ bool RenderGL::LoadShader (std::string filename, GLuint& program )
 		exit(-1);
 		return false;
 	}
-  // handle shader #include (glsl does not)
-  std::string src = fragSource;
-  size_t posL = src.find("#include");
-  if ( posL != std::string::npos) {
-  
-    // get include file
-    size_t posR = src.find("\n", posL+1);      
-    std::string inclfile = strParseOutDelim (src.substr(posL, posR - posL), "\"", "\"" );
-    std::string inclpath;
-    bool hasIncl = getFileLocation(inclfile, inclpath);
-
-    if (hasIncl) {
-      // read include file
-      free(fragSource);
-      char* inclSource = ReadShaderSource ( inclpath, fsz);
-      fragSource = (char*) malloc ( src.length() + fsz );
-
-      // append shader (before include)
-      posL--;
-      memcpy ( fragSource, src.c_str(), posL );
-      // append include
-      memcpy ( fragSource + posL, inclSource, fsz );
-      // append shader (after include)
-      memcpy ( fragSource + posL + fsz, src.substr(posR+1).c_str(), src.length()-posR );
-      
-    }    
-  }
-  
+	fragSource = IncludeShaderSource ( fragSource );
 
 	GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(fShader, 1, (const GLchar**) &fragSource, NULL);
@@ -1965,6 +2008,7 @@ bool RenderGL::LoadShader (std::string filename, GLuint& program )
 	if (hasGeom) {
 		geomSource = ReadShaderSource(geompath, fsz);
 		if (!geomSource) { dbgprintf("  OpenGL. ERROR: Unable to read source '%s'\n", geomfile.c_str()); return false; }
+		geomSource = IncludeShaderSource ( geomSource );
 		gShader = glCreateShader(GL_GEOMETRY_SHADER);
 		glShaderSource(gShader, 1, (const GLchar**)&geomSource, NULL);
 		glCompileShader(gShader);
@@ -2097,6 +2141,13 @@ int RenderGL::UpdateMesh (Mesh* mesh )
 	}
 	RMesh* m = &mMeshes[rid];
 
+	// partial update, only changed vertex ranges
+	if ( UpdateMeshVerts ( mesh ) ) return 1;
+
+	m->primcnt = mesh->GetNumElem ( BFACEV3 );
+	m->vertcnt = mesh->GetNumVert ();
+	mesh->ClearDirtyVerts ();
+
 	if ( mesh->isActive ( BVERTPOS ) ) {				
 		glBindBufferARB ( GL_ARRAY_BUFFER_ARB, m->meshVBO[ 0 ] );		
 		glBufferDataARB ( GL_ARRAY_BUFFER_ARB, mesh->GetBufSize(BVERTPOS), mesh->GetBufData(BVERTPOS), GL_DYNAMIC_DRAW);
@@ -2145,3 +2196,28 @@ int RenderGL::UpdateMesh (Mesh* mesh )
 	return 1;
 }
 
+// Upload only the dirty vertex ranges of a mesh
+// - requires same vertex count as on GPU, otherwise returns false for a full update
+//
+bool RenderGL::UpdateMeshVerts ( Mesh* mesh )
+{
+	int rid = mesh->getRIDs().x;
+	if ( rid == -1 || !mesh->hasDirtyVerts() ) return false;
+	RMesh* m = &mMeshes[rid];
+	if ( m->vertcnt != mesh->GetNumVert() ) return false;
+
+	int bufs[4] = { BVERTPOS, BVERTCLR, BVERTNORM, BVERTTEX };
+	std::vector< std::pair<int,int> >& ranges = mesh->getDirtyVerts();
+	for (int b = 0; b < 4; b++) {
+		if ( !mesh->isActive ( bufs[b] ) || m->meshVBO[b] == -1 ) continue;
+		int stride = mesh->GetBufStride ( bufs[b] );
+		char* data = (char*) mesh->GetBufData ( bufs[b] );
+		glBindBufferARB ( GL_ARRAY_BUFFER_ARB, m->meshVBO[ b ] );
+		for (int r = 0; r < ranges.size(); r++)
+			glBufferSubData ( GL_ARRAY_BUFFER_ARB, size_t(ranges[r].first) * stride, size_t(ranges[r].second) * stride, data + size_t(ranges[r].first) * stride );
+	}
+	CHECK_GL ( "Update mesh verts", mbDebug);
+	mesh->ClearDirtyVerts ();
+	return true;
+}
+
@@ -45,6 +45,8 @@
 	#define P_SMTX			20
 	#define P_STEX			21
 	#define P_SSIZE			22
+	#define P_TRSMODE		23
+	#define P_PARENTS		24
 
 	struct RTexture {
 		int				assetID;
@@ -63,10 +65,11 @@
 		RParamList		params;			// List of parameters (GL uniform indices)
 	};
 	struct RMesh {
-		RMesh() { meshVBO[0]=-1;meshVBO[1]=-1;meshVBO[2]=-1;meshVBO[3]=-1;meshVBO[4]=-1; }
+		RMesh() { meshVBO[0]=-1;meshVBO[1]=-1;meshVBO[2]=-1;meshVBO[3]=-1;meshVBO[4]=-1; vertcnt=0; }
 		int				assetID;		
 		int				primtype;		// Primitive type
 		int				primcnt;		// Primitive count
+		int				vertcnt;		// Vertex count on GPU (for partial updates)
 		int			  meshVBO[5];		// VBOs: 0=pos, 1=clr, 2=norm, 3=tex, 4=faces
 	};
 	struct RLight {
@@ -135,6 +138,7 @@
 		//	
 		bool	CreateMesh ( Object* ast, std::string& msg);					// Meshes
 		int		UpdateMesh ( Mesh* obj );
+		bool	UpdateMeshVerts ( Mesh* obj );
 		int		UpdatePnts ( Object* obj );
 
 		bool	CreateTexture ( Object* ast, std::string& msg );				// Textures		
@@ -148,6 +152,7 @@
 		bool	LoadShader( std::string fname, GLuint& program );
 		int		LoadInternalShader ( std::string fname );
 		char*	ReadShaderSource ( std::string fname, long& fsize );
+		char*	IncludeShaderSource ( char* source );			// expands #include lines
 		bool	AddParam ( int shader_id, int param_id, char* name );
 		bool	AddParamBlock ( int shader_id, int param_id, char* name );
 		int		getParam( RShader* sh, int param_id );
@@ -183,6 +188,7 @@
 		void	CSMShadowLightAsCamera(RShader* sh);
 		void	CSMRenderShadowMaps();
 		void	BindShaderShadowMapVars ( RShader* rshade );		// set on standard shaders during beauty pass to support shadows
+		void	BindShaderXformVars ( RShader* rshade );			// instance transform mode (OPT_TRS_XFORM)
 		int		getCSMTex()		{ return depth_tex_ar;}
 
 		// Sketching
@@ -215,6 +221,7 @@
 		int						mXres, mYres;
 		
 		GLuint					mShapesVBO, mShapesXformVBO;
+		GLuint					mParentsTBO, mParentsTex;			// shape group parent xforms (OPT_TRS_XFORM)
 		int						mShader;							// currently active shader ID
 
 		std::vector<RShader>	mShaders;							// shaders
@@ -506,7 +506,7 @@ void RenderOptiX::BuildRenderGraph ()
 {
 	int ig;
 
-	Shape IP;
+	ShapeInst IP;
 	int ITEXSUB	= (char*) &IP.texsub - (char*)&IP;
 
 	for (int g = 0; g < mSGCnt; g++) {			// state sorted shape groups
@@ -524,7 +524,7 @@ void RenderOptiX::BuildRenderGraph ()
 		// Get optix Material and Texture (for this group)	
 		// *Note* this is the shape within the SHAPE buffer, not the original shape
 		// so we cannot store render state in these shapes (eg. matids, texids).
-		Shape* shp = (Shape*) mSB.GetElem (BSHAPES, inst_offset);				// first shape in group
+		ShapeInst* shp = (ShapeInst*) mSB.GetElem (BSHAPES, inst_offset);				// first shape in group
 
 		int omat_id = getOptixMaterial ( &shp->matids );				// material optix id
 
@@ -544,7 +544,7 @@ void RenderOptiX::BuildRenderGraph ()
 		Matrix4F* xforms = (Matrix4F*) mSB.GetElem(BXFORMS, inst_offset);	// starting offset
 		char* inst_data = (char*) mSB.GetElem(BSHAPES, inst_offset );				
 			
-		optix->AddInstances ( ig, inst_count, xforms, inst_data, sizeof(Shape), ITEXSUB );
+		optix->AddInstances ( ig, inst_count, xforms, inst_data, sizeof(ShapeInst), ITEXSUB );
 
 		int vert = optix->getModel(rid)->info.num_vert;
 		